@@ -0,0 +1,194 @@
+// Latency benchmarks for the TinyLang toolchain.
+//
+//   tinylang-bench [--runs N] [--examples <dir>] [section...]
+//
+// With no section names every section runs. Results go to stdout, one line
+// per measurement, as the median over N runs.
+#include "lexer.hpp"
+#include "pipeline.hpp"
+#include "prelude.hpp"
+#include "process.hpp"
+#include "scan.hpp"
+#include "workdir.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace tinylang;
+
+#ifndef TINYLANG_EXAMPLES_DIR
+#define TINYLANG_EXAMPLES_DIR "examples"
+#endif
+
+static int runs = 5;
+static std::string examplesDir = TINYLANG_EXAMPLES_DIR;
+
+static std::string readExample(const std::string &name) {
+  std::ifstream f(examplesDir + "/" + name);
+  if (!f) {
+    std::cerr << "Cannot read " << examplesDir << "/" << name << std::endl;
+    std::exit(1);
+  }
+  std::stringstream ss;
+  ss << f.rdbuf();
+  return ss.str();
+}
+
+// Median wall time of `fn` in milliseconds.
+static double medianMs(const std::function<void()> &fn) {
+  std::vector<double> samples;
+  for (int i = 0; i < runs; ++i) {
+    auto start = std::chrono::steady_clock::now();
+    fn();
+    auto end = std::chrono::steady_clock::now();
+    samples.push_back(
+        std::chrono::duration<double, std::milli>(end - start).count());
+  }
+  std::sort(samples.begin(), samples.end());
+  return samples[samples.size() / 2];
+}
+
+static void report(const std::string &label, double ms) {
+  std::printf("  %-28s %10.2f ms\n", label.c_str(), ms);
+}
+
+// Front end + g++ for examples/fib.tl with the prelude pasted into the
+// program versus included from the precompiled header. The binary cache is
+// bypassed so every run really invokes g++.
+static void benchCompile() {
+  std::printf("compile latency: examples/fib.tl (median of %d)\n", runs);
+  RunRequest req;
+  req.source = readExample("fib.tl");
+  req.run = false;
+
+  auto compileOk = [&] {
+    RunResult r = runPipeline(req);
+    if (!r.success) {
+      std::cerr << "compile failed: " << r.error_msg << std::endl;
+      std::exit(1);
+    }
+  };
+
+  req.prelude = nullptr;
+  report("inline prelude", medianMs(compileOk));
+
+  PrecompiledPrelude prelude("", cxxCommand());
+  req.prelude = &prelude;
+  compileOk(); // build the .gch outside the measurement
+  report("precompiled prelude", medianMs(compileOk));
+}
+
+// Run time of the same program on each backend. For the compiled backend the
+// binary is built once and only its execution is timed; the in-process
+// backends are timed end to end (front end, lowering and execution).
+static void benchExecution(const std::string &example) {
+  std::printf("execution: examples/%s (median of %d)\n", example.c_str(),
+              runs);
+  RunRequest req;
+  req.source = readExample(example);
+
+  ScratchDir scratch;
+  req.run = false;
+  req.outputPath = scratch.file("prog");
+  RunResult built = runPipeline(req);
+  if (!built.success) {
+    std::cerr << "compile failed: " << built.error_msg << std::endl;
+    std::exit(1);
+  }
+  ProcessOptions exe;
+  exe.argv = {req.outputPath};
+  std::string expected = runProcess(exe).out;
+  report("compiled binary", medianMs([&] { runProcess(exe); }));
+
+  req.run = true;
+  for (auto [label, backend] :
+       {std::pair{"tiered (g++ not cached)", Backend::Tiered},
+        {"in-memory jit", Backend::Jit},
+        {"bytecode vm", Backend::Vm},
+        {"tree-walking interpreter", Backend::Interpret}}) {
+    req.backend = backend;
+    RunResult r = runPipeline(req);
+    if (!r.success || r.stdout_str != expected) {
+      std::cerr << label << " disagrees with the compiled binary"
+                << std::endl;
+      std::exit(1);
+    }
+    report(label, medianMs([&] { runPipeline(req); }));
+  }
+}
+
+// A synthetic program of about `bytes` bytes: indented functions with
+// comments, string literals and long identifiers, so every scan is exercised.
+static std::string syntheticSource(size_t bytes) {
+  std::string src;
+  for (int i = 0; src.size() < bytes; ++i) {
+    std::string n = std::to_string(i);
+    src += "// helper_function_number_" + n + " adds its arguments up\n"
+           "func helper_function_number_" + n +
+           "(first_argument, second_argument) {\n"
+           "    let accumulated_value = first_argument * " + n +
+           " + second_argument;\n"
+           "    if (accumulated_value > 1000) {\n"
+           "        println(\"accumulated value is getting large: \");\n"
+           "    }\n"
+           "    return accumulated_value;\n"
+           "}\n\n";
+  }
+  return src;
+}
+
+// Lexer throughput on a large generated program with each scan
+// implementation the CPU supports; "scalar" is a byte-at-a-time loop.
+static void benchLexer() {
+  std::string src = syntheticSource(size_t(16) << 20);
+  std::printf("lexer throughput: %zu MB generated program (median of %d)\n",
+              src.size() >> 20, runs);
+  ScanIsa best = detectScanIsa();
+  for (ScanIsa isa : {ScanIsa::Scalar, ScanIsa::Sse2, ScanIsa::Avx2}) {
+    if (isa > best)
+      break;
+    useScanIsa(isa);
+    double ms = medianMs([&] {
+      Lexer lexer(src);
+      std::vector<Token> tokens = lexer.tokenize();
+      lexer.locate(tokens.back()); // builds the line table
+    });
+    std::printf("  %-28s %10.2f ms %8.0f MB/s\n", scanIsaName(isa), ms,
+                src.size() / 1e3 / ms);
+  }
+  useScanIsa(best);
+}
+
+int main(int argc, char **argv) {
+  std::set<std::string> sections;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg == "--runs" && i + 1 < argc)
+      runs = std::max(1, std::atoi(argv[++i]));
+    else if (arg == "--examples" && i + 1 < argc)
+      examplesDir = argv[++i];
+    else
+      sections.insert(arg);
+  }
+  auto wanted = [&](const char *name) {
+    return sections.empty() || sections.count(name);
+  };
+
+  if (wanted("lexer"))
+    benchLexer();
+  if (wanted("compile"))
+    benchCompile();
+  if (wanted("execution")) {
+    benchExecution("fib_recursive.tl");
+    benchExecution("sieve.tl");
+  }
+  return 0;
+}
@@ -0,0 +1,272 @@
+// Implementation of the TinyLang runtime C ABI declared in tinylang_rt.h.
+// Generated programs link this statically; it depends only on libc.
+#include "tinylang_rt.h"
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <unistd.h>
+
+struct tlrt_string {
+  long refs;
+  long len;
+  char data[1]; // actually `len` bytes plus a terminating NUL
+};
+
+namespace {
+
+// ---- stdout -------------------------------------------------------------
+
+char outBuf[1 << 16];
+size_t outLen = 0;
+
+void flushOut() {
+  size_t off = 0;
+  while (off < outLen) {
+    ssize_t n = ::write(STDOUT_FILENO, outBuf + off, outLen - off);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      break;
+    off += (size_t)n;
+  }
+  outLen = 0;
+}
+
+void writeOut(const char *p, size_t n) {
+  if (n > sizeof(outBuf) - outLen) {
+    flushOut();
+    if (n >= sizeof(outBuf)) {
+      outLen = 0;
+      while (n > 0) {
+        ssize_t w = ::write(STDOUT_FILENO, p, n);
+        if (w < 0 && errno == EINTR)
+          continue;
+        if (w <= 0)
+          return;
+        p += w;
+        n -= (size_t)w;
+      }
+      return;
+    }
+  }
+  std::memcpy(outBuf + outLen, p, n);
+  outLen += n;
+}
+
+// Flush on normal exit (return from main or exit()).
+struct OutFlusher {
+  ~OutFlusher() { flushOut(); }
+} outFlusher;
+
+// ---- stdin --------------------------------------------------------------
+
+char inBuf[1 << 16];
+size_t inPos = 0;
+size_t inLen = 0;
+bool inEof = false;
+
+int readChar() {
+  if (inPos == inLen) {
+    if (inEof)
+      return -1;
+    ssize_t n;
+    do {
+      n = ::read(STDIN_FILENO, inBuf, sizeof(inBuf));
+    } while (n < 0 && errno == EINTR);
+    if (n <= 0) {
+      inEof = true;
+      return -1;
+    }
+    inPos = 0;
+    inLen = (size_t)n;
+  }
+  return (unsigned char)inBuf[inPos++];
+}
+
+bool isSpace(int c) {
+  return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' ||
+         c == '\f';
+}
+
+[[noreturn]] void runtimeError(const char *msg) {
+  flushOut();
+  char buf[256];
+  int n = std::snprintf(buf, sizeof(buf), "Runtime error: %s\n", msg);
+  if (n > 0) {
+    size_t len = (size_t)n < sizeof(buf) ? (size_t)n : sizeof(buf) - 1;
+    ssize_t ignored = ::write(STDERR_FILENO, buf, len);
+    (void)ignored;
+  }
+  std::_Exit(1);
+}
+
+tlrt_string *allocString(long len) {
+  tlrt_string *s = (tlrt_string *)std::malloc(sizeof(tlrt_string) + len);
+  if (!s)
+    runtimeError("out of memory");
+  s->refs = 1;
+  s->len = len;
+  s->data[len] = '\0';
+  return s;
+}
+
+// Array storage comes from operator new (tinylang_rt.h); running out of it is
+// reported like running out of string space instead of aborting the program.
+const bool newHandlerInstalled =
+    (std::set_new_handler([] { runtimeError("out of memory"); }), true);
+
+} // namespace
+
+extern "C" {
+
+tlrt_string *tlrt_str_new(const char *data, long len) {
+  if (len <= 0)
+    return nullptr;
+  tlrt_string *s = allocString(len);
+  std::memcpy(s->data, data, (size_t)len);
+  return s;
+}
+
+void tlrt_str_retain(tlrt_string *s) {
+  if (s)
+    s->refs++;
+}
+
+void tlrt_str_release(tlrt_string *s) {
+  if (s && --s->refs == 0)
+    std::free(s);
+}
+
+long tlrt_str_len(const tlrt_string *s) { return s ? s->len : 0; }
+
+const char *tlrt_str_data(const tlrt_string *s) { return s ? s->data : ""; }
+
+tlrt_string *tlrt_str_concat(const tlrt_string *a, const tlrt_string *b) {
+  long la = tlrt_str_len(a), lb = tlrt_str_len(b);
+  if (la + lb == 0)
+    return nullptr;
+  tlrt_string *s = allocString(la + lb);
+  if (la)
+    std::memcpy(s->data, a->data, (size_t)la);
+  if (lb)
+    std::memcpy(s->data + la, b->data, (size_t)lb);
+  return s;
+}
+
+int tlrt_str_compare(const tlrt_string *a, const tlrt_string *b) {
+  // Lengths are never negative; comparing them as size_t keeps g++ from
+  // assuming a negative length could reach memcmp as a huge bound.
+  size_t la = (size_t)tlrt_str_len(a), lb = (size_t)tlrt_str_len(b);
+  int c = std::memcmp(tlrt_str_data(a), tlrt_str_data(b), la < lb ? la : lb);
+  if (c != 0)
+    return c;
+  return la < lb ? -1 : (la > lb ? 1 : 0);
+}
+
+tlrt_string *tlrt_str_substr(const tlrt_string *s, int start, int len) {
+  long size = tlrt_str_len(s);
+  if (start < 0 || start > size) {
+    char msg[128];
+    std::snprintf(msg, sizeof(msg),
+                  "substr start %d out of range for string of length %ld",
+                  start, size);
+    runtimeError(msg);
+  }
+  long take = size - start;
+  if (len >= 0 && len < take)
+    take = len;
+  return tlrt_str_new(tlrt_str_data(s) + start, take);
+}
+
+int tlrt_str_to_int(const tlrt_string *s) {
+  const char *p = tlrt_str_data(s);
+  char *end = nullptr;
+  errno = 0;
+  long v = std::strtol(p, &end, 10);
+  if (end == p || errno == ERANGE || v < INT_MIN || v > INT_MAX)
+    return 0;
+  return (int)v;
+}
+
+double tlrt_str_to_float(const tlrt_string *s) {
+  const char *p = tlrt_str_data(s);
+  char *end = nullptr;
+  errno = 0;
+  double v = std::strtod(p, &end);
+  if (end == p || errno == ERANGE)
+    return 0.0;
+  return v;
+}
+
+tlrt_string *tlrt_input(void) {
+  // Prompts printed so far must be visible before we block on input.
+  flushOut();
+  int c = readChar();
+  while (c >= 0 && isSpace(c))
+    c = readChar();
+  char stackBuf[256];
+  char *buf = stackBuf;
+  long cap = sizeof(stackBuf), len = 0;
+  while (c >= 0 && !isSpace(c)) {
+    if (len == cap) {
+      char *bigger = (char *)std::malloc((size_t)cap * 2);
+      if (!bigger)
+        runtimeError("out of memory");
+      std::memcpy(bigger, buf, (size_t)len);
+      if (buf != stackBuf)
+        std::free(buf);
+      buf = bigger;
+      cap *= 2;
+    }
+    buf[len++] = (char)c;
+    c = readChar();
+  }
+  // The delimiter after the word is consumed, as with std::cin >> s.
+  tlrt_string *s = tlrt_str_new(buf, len);
+  if (buf != stackBuf)
+    std::free(buf);
+  return s;
+}
+
+void tlrt_print_int(int v) {
+  char buf[16];
+  int n = std::snprintf(buf, sizeof(buf), "%d", v);
+  writeOut(buf, (size_t)n);
+}
+
+void tlrt_print_float(double v) {
+  // Same formatting as std::cout's default (%g, precision 6).
+  char buf[64];
+  int n = std::snprintf(buf, sizeof(buf), "%g", v);
+  writeOut(buf, (size_t)n);
+}
+
+void tlrt_print_bool(int v) { writeOut(v ? "1" : "0", 1); }
+
+void tlrt_print_str(const tlrt_string *s) {
+  writeOut(tlrt_str_data(s), (size_t)tlrt_str_len(s));
+}
+
+void tlrt_println_end(void) {
+  writeOut("\n", 1);
+  flushOut();
+}
+
+void tlrt_index_error(long index, long size) {
+  char msg[128];
+  std::snprintf(msg, sizeof(msg),
+                "array index %ld out of bounds for array of size %ld", index,
+                size);
+  runtimeError(msg);
+}
+
+void tlrt_size_error(long size) {
+  char msg[64];
+  std::snprintf(msg, sizeof(msg), "invalid array size %ld", size);
+  runtimeError(msg);
+}
+
+} // extern "C"
@@ -0,0 +1,170 @@
+// TinyLang runtime: declarations included by every generated program.
+//
+// The runtime itself lives in libtinylang-runtime.a behind a small C ABI
+// (the tlrt_* functions). This header deliberately includes no system or STL
+// headers; the inline C++ wrappers below only give generated code value
+// semantics (`_tl_str`, `_tl_arr<T>`) and overloads (`_tl_print`, ...) on top
+// of that ABI, so a generated translation unit costs little more to compile
+// than the user's own code.
+#ifndef TINYLANG_RT_H
+#define TINYLANG_RT_H
+
+extern "C" {
+
+// Immutable, reference-counted string. A null pointer is the empty string.
+typedef struct tlrt_string tlrt_string;
+
+tlrt_string *tlrt_str_new(const char *data, long len);
+void tlrt_str_retain(tlrt_string *s);
+void tlrt_str_release(tlrt_string *s);
+long tlrt_str_len(const tlrt_string *s);
+const char *tlrt_str_data(const tlrt_string *s);
+tlrt_string *tlrt_str_concat(const tlrt_string *a, const tlrt_string *b);
+int tlrt_str_compare(const tlrt_string *a, const tlrt_string *b);
+tlrt_string *tlrt_str_substr(const tlrt_string *s, int start, int len);
+int tlrt_str_to_int(const tlrt_string *s);
+double tlrt_str_to_float(const tlrt_string *s);
+
+// Reads the next whitespace-delimited word from stdin ("" at end of input).
+tlrt_string *tlrt_input(void);
+
+// Buffered stdout. tlrt_println_end() writes '\n' and flushes.
+void tlrt_print_int(int v);
+void tlrt_print_float(double v);
+void tlrt_print_bool(int v);
+void tlrt_print_str(const tlrt_string *s);
+void tlrt_println_end(void);
+
+// Report a runtime error on stderr and exit with status 1.
+void tlrt_index_error(long index, long size) __attribute__((noreturn));
+void tlrt_size_error(long size) __attribute__((noreturn));
+}
+
+class _tl_str {
+public:
+  _tl_str() : rep(0) {}
+  template <long N> explicit _tl_str(const char (&lit)[N]) {
+    rep = tlrt_str_new(lit, N - 1);
+  }
+  _tl_str(const _tl_str &o) : rep(o.rep) { tlrt_str_retain(rep); }
+  _tl_str(_tl_str &&o) : rep(o.rep) { o.rep = 0; }
+  _tl_str &operator=(const _tl_str &o) {
+    tlrt_str_retain(o.rep);
+    tlrt_str_release(rep);
+    rep = o.rep;
+    return *this;
+  }
+  _tl_str &operator=(_tl_str &&o) {
+    if (this != &o) {
+      tlrt_str_release(rep);
+      rep = o.rep;
+      o.rep = 0;
+    }
+    return *this;
+  }
+  ~_tl_str() { tlrt_str_release(rep); }
+
+  static _tl_str adopt(tlrt_string *r) {
+    _tl_str s;
+    s.rep = r;
+    return s;
+  }
+  const tlrt_string *get() const { return rep; }
+
+private:
+  tlrt_string *rep;
+};
+
+inline _tl_str operator+(const _tl_str &a, const _tl_str &b) {
+  return _tl_str::adopt(tlrt_str_concat(a.get(), b.get()));
+}
+inline bool operator==(const _tl_str &a, const _tl_str &b) {
+  return tlrt_str_compare(a.get(), b.get()) == 0;
+}
+inline bool operator!=(const _tl_str &a, const _tl_str &b) {
+  return tlrt_str_compare(a.get(), b.get()) != 0;
+}
+inline bool operator<(const _tl_str &a, const _tl_str &b) {
+  return tlrt_str_compare(a.get(), b.get()) < 0;
+}
+inline bool operator<=(const _tl_str &a, const _tl_str &b) {
+  return tlrt_str_compare(a.get(), b.get()) <= 0;
+}
+inline bool operator>(const _tl_str &a, const _tl_str &b) {
+  return tlrt_str_compare(a.get(), b.get()) > 0;
+}
+inline bool operator>=(const _tl_str &a, const _tl_str &b) {
+  return tlrt_str_compare(a.get(), b.get()) >= 0;
+}
+
+// Bounds-checked array with value semantics (copies are deep).
+template <typename T> class _tl_arr {
+public:
+  _tl_arr() : data(0), n(0) {}
+  explicit _tl_arr(int size) : data(0), n(size) {
+    if (size < 0)
+      tlrt_size_error(size);
+    if (size > 0)
+      data = new T[size]();
+  }
+  _tl_arr(const _tl_arr &o) : data(0), n(o.n) {
+    if (n > 0) {
+      data = new T[n];
+      for (int i = 0; i < n; ++i)
+        data[i] = o.data[i];
+    }
+  }
+  _tl_arr &operator=(const _tl_arr &o) {
+    if (this != &o) {
+      _tl_arr tmp(o);
+      T *d = data;
+      data = tmp.data;
+      tmp.data = d;
+      int k = n;
+      n = tmp.n;
+      tmp.n = k;
+    }
+    return *this;
+  }
+  ~_tl_arr() { delete[] data; }
+
+  T &operator[](int i) {
+    if ((unsigned)i >= (unsigned)n)
+      tlrt_index_error(i, n);
+    return data[i];
+  }
+  const T &operator[](int i) const {
+    if ((unsigned)i >= (unsigned)n)
+      tlrt_index_error(i, n);
+    return data[i];
+  }
+
+private:
+  T *data;
+  int n;
+};
+
+inline _tl_str _tl_input() { return _tl_str::adopt(tlrt_input()); }
+inline int _tl_len(const _tl_str &s) { return (int)tlrt_str_len(s.get()); }
+inline _tl_str _tl_substr(const _tl_str &s, int start, int len) {
+  return _tl_str::adopt(tlrt_str_substr(s.get(), start, len));
+}
+inline int _tl_to_int(const _tl_str &s) { return tlrt_str_to_int(s.get()); }
+inline int _tl_to_int(int i) { return i; }
+inline int _tl_to_int(double d) { return (int)d; }
+inline double _tl_to_float(const _tl_str &s) {
+  return tlrt_str_to_float(s.get());
+}
+inline double _tl_to_float(int i) { return (double)i; }
+inline double _tl_to_float(double d) { return d; }
+
+inline void _tl_print(int v) { tlrt_print_int(v); }
+inline void _tl_print(bool v) { tlrt_print_bool(v); }
+inline void _tl_print(double v) { tlrt_print_float(v); }
+inline void _tl_print(const _tl_str &s) { tlrt_print_str(s.get()); }
+template <typename T> inline void _tl_println(const T &v) {
+  _tl_print(v);
+  tlrt_println_end();
+}
+
+#endif
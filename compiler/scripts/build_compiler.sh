@@ -17,7 +17,12 @@ if command -v cmake &> /dev/null; then
 else
     echo "CMake not found. Falling back to direct g++ compilation..."
     mkdir -p ../build
-    g++ -std=c++20 -O2 ../src/*.cpp -o tinylang-compiler
+    g++ -std=c++20 -O2 -c ../runtime/tinylang_rt.cpp -o tinylang_rt.o
+    ar rcs libtinylang-runtime.a tinylang_rt.o
+    g++ -std=c++20 -O2 -pthread \
+        -DTINYLANG_RUNTIME_INCLUDE_DIR="\"$(cd ../runtime && pwd)\"" \
+        -DTINYLANG_RUNTIME_LIBRARY="\"$(pwd)/libtinylang-runtime.a\"" \
+        ../src/*.cpp -o tinylang-compiler
 fi
 
 if [ -f "tinylang-compiler" ]; then
@@ -0,0 +1,117 @@
+// tinylang-spawn: runs a program as its own child and reports what the
+// program alone consumed (see tinylang_spawn.h). Plain C against libc only,
+// so its own resident set stays far below any program it runs.
+#define _GNU_SOURCE
+#include "tinylang_spawn.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/perf_event.h>
+#include <signal.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static void writeAll(const void *p, size_t n) {
+  const char *c = p;
+  while (n > 0) {
+    ssize_t w = write(TINYLANG_SPAWN_REPORT_FD, c, n);
+    if (w < 0 && errno == EINTR)
+      continue;
+    if (w <= 0)
+      return;
+    c += w;
+    n -= (size_t)w;
+  }
+}
+
+// Inherited by the program and switched on by its exec, so only the
+// program's own instructions are counted.
+static int openInstructionCounter(void) {
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+  attr.disabled = 1;
+  attr.enable_on_exec = 1;
+  attr.inherit = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1,
+                      PERF_FLAG_FD_CLOEXEC);
+}
+
+int main(int argc, char **argv) {
+  if (argc < 3)
+    return 127;
+  struct tinylang_spawn_report report;
+  memset(&report, 0, sizeof(report));
+  report.instructions = -1;
+  int counter = argv[1][0] == '1' ? openInstructionCounter() : -1;
+
+  int fail[2]; // carries the program's errno if exec fails
+  if (pipe2(fail, O_CLOEXEC) != 0) {
+    report.error = errno;
+    pid_t none = 0;
+    writeAll(&none, sizeof(none));
+    writeAll(&report, sizeof(report));
+    return 127;
+  }
+  pid_t self = getpid();
+  pid_t pid = fork();
+  if (pid == 0) {
+    // Killing the helper (e.g. for a time limit) takes the program along.
+    prctl(PR_SET_PDEATHSIG, SIGKILL);
+    if (getppid() != self)
+      _exit(127);
+    close(TINYLANG_SPAWN_REPORT_FD);
+    execvp(argv[2], argv + 2);
+    int err = errno;
+    ssize_t ignored = write(fail[1], &err, sizeof(err));
+    (void)ignored;
+    _exit(127);
+  }
+  close(fail[1]);
+  pid_t announced = pid > 0 ? pid : 0;
+  writeAll(&announced, sizeof(announced));
+  if (pid < 0) {
+    report.error = errno;
+    writeAll(&report, sizeof(report));
+    return 127;
+  }
+  // The program's output must reach EOF when the program exits, not when
+  // we do.
+  close(STDIN_FILENO);
+  close(STDOUT_FILENO);
+  close(STDERR_FILENO);
+
+  int err = 0;
+  ssize_t n;
+  while ((n = read(fail[0], &err, sizeof(err))) < 0 && errno == EINTR) {
+  }
+  if (n == (ssize_t)sizeof(err))
+    report.error = err;
+  while (wait4(pid, &report.status, 0, &report.usage) < 0 && errno == EINTR) {
+  }
+  uint64_t count;
+  if (counter >= 0 && read(counter, &count, sizeof(count)) == sizeof(count))
+    report.instructions = (long long)count;
+  writeAll(&report, sizeof(report));
+
+  if (report.error || !WIFSIGNALED(report.status))
+    return report.error ? 127 : WEXITSTATUS(report.status);
+  // Die the same way, without a core file of our own.
+  int sig = WTERMSIG(report.status);
+  struct rlimit noCore = {0, 0};
+  setrlimit(RLIMIT_CORE, &noCore);
+  signal(sig, SIG_DFL);
+  sigset_t only;
+  sigemptyset(&only);
+  sigaddset(&only, sig);
+  sigprocmask(SIG_UNBLOCK, &only, NULL);
+  kill(self, sig);
+  return 128 + sig;
+}
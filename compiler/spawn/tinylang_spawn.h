@@ -0,0 +1,33 @@
+// What tinylang-spawn reports to the process that started it.
+//
+// A child's rusage starts out with the peak resident set of the process it
+// was forked from (Linux carries the mark over at fork and at exec), so a
+// program spawned straight from a large driver or daemon can never report a
+// peak below the driver's. tinylang-spawn is small and forks the program
+// itself, so the figures it passes back belong to the program alone.
+//
+//   tinylang-spawn <0|1: count instructions> <program> [args...]
+//
+// The program inherits stdin, stdout and stderr. On TINYLANG_SPAWN_REPORT_FD
+// the helper writes the program's pid as soon as it has forked, then one
+// struct tinylang_spawn_report once it has reaped it, and finally exits the
+// way the program did.
+#ifndef TINYLANG_SPAWN_H
+#define TINYLANG_SPAWN_H
+
+#include <sys/resource.h>
+#include <sys/types.h>
+
+#define TINYLANG_SPAWN_REPORT_FD 3
+
+struct tinylang_spawn_report {
+  // errno of a failed fork or exec; the other members are then meaningless.
+  int error;
+  // wait status of the program.
+  int status;
+  // User-space instructions from exec on; -1 if not counted.
+  long long instructions;
+  struct rusage usage;
+};
+
+#endif
@@ -0,0 +1,30 @@
+#include "arena.hpp"
+
+namespace tinylang {
+
+// Blocks double up to this size; anything larger gets a block of its own.
+static constexpr size_t kMaxBlockBytes = 1 << 20;
+
+Arena::~Arena() {
+  while (blocks) {
+    Block *next = blocks->next;
+    ::operator delete(blocks);
+    blocks = next;
+  }
+}
+
+void *Arena::allocateSlow(size_t size, size_t align) {
+  size_t need = sizeof(Block) + size + align;
+  size_t bytes = need > nextSize ? need : nextSize;
+  if (nextSize < kMaxBlockBytes)
+    nextSize *= 2;
+  // Through operator new, so --phases counts the blocks.
+  auto *b = (Block *)::operator new(bytes);
+  b->next = blocks;
+  blocks = b;
+  cur = (char *)(b + 1);
+  limit = (char *)b + bytes;
+  return allocate(size, align);
+}
+
+} // namespace tinylang
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+namespace tinylang {
+
+// A fixed-size array whose storage belongs to an Arena.
+template <class T> class ArenaArray {
+public:
+  ArenaArray() = default;
+  ArenaArray(T *data, uint32_t size) : items(data), count(size) {}
+
+  T *begin() const { return items; }
+  T *end() const { return items + count; }
+  size_t size() const { return count; }
+  bool empty() const { return count == 0; }
+  T &operator[](size_t i) const { return items[i]; }
+
+private:
+  T *items = nullptr;
+  uint32_t count = 0;
+};
+
+// Bump allocator: objects are carved out of large blocks and all freed at
+// once when the arena is destroyed. Destructors never run, so only trivially
+// destructible types may live here.
+class Arena {
+public:
+  Arena() = default;
+  Arena(const Arena &) = delete;
+  Arena &operator=(const Arena &) = delete;
+  ~Arena();
+
+  void *allocate(size_t size, size_t align) {
+    uintptr_t p = ((uintptr_t)cur + align - 1) & ~(uintptr_t)(align - 1);
+    if (p + size > (uintptr_t)limit)
+      return allocateSlow(size, align);
+    cur = (char *)(p + size);
+    return (void *)p;
+  }
+
+  template <class T, class... Args> T *make(Args &&...args) {
+    static_assert(std::is_trivially_destructible_v<T>,
+                  "arena objects are never destroyed");
+    return new (allocate(sizeof(T), alignof(T)))
+        T(std::forward<Args>(args)...);
+  }
+
+  template <class T> ArenaArray<T> copy(const T *src, size_t n) {
+    static_assert(std::is_trivially_destructible_v<T>,
+                  "arena objects are never destroyed");
+    if (n == 0)
+      return {};
+    T *dst = (T *)allocate(n * sizeof(T), alignof(T));
+    for (size_t i = 0; i < n; ++i)
+      new (dst + i) T(src[i]);
+    return {dst, (uint32_t)n};
+  }
+
+  std::string_view copy(std::string_view s) {
+    if (s.empty())
+      return {};
+    char *dst = (char *)allocate(s.size(), 1);
+    s.copy(dst, s.size());
+    return {dst, s.size()};
+  }
+
+private:
+  struct Block {
+    Block *next;
+  };
+
+  void *allocateSlow(size_t size, size_t align);
+
+  char *cur = nullptr;
+  char *limit = nullptr;
+  Block *blocks = nullptr;
+  size_t nextSize = 16 << 10;
+};
+
+} // namespace tinylang
@@ -2,25 +2,16 @@
 
 namespace tinylang {
 
-void Variable::accept(ASTVisitor &v) { v.visit(*this); }
-void BinaryExpr::accept(ASTVisitor &v) { v.visit(*this); }
-void CallExpr::accept(ASTVisitor &v) { v.visit(*this); }
-void VarDecl::accept(ASTVisitor &v) { v.visit(*this); }
-void AssignStmt::accept(ASTVisitor &v) { v.visit(*this); }
-void PrintStmt::accept(ASTVisitor &v) { v.visit(*this); }
-void Block::accept(ASTVisitor &v) { v.visit(*this); }
-void IfStmt::accept(ASTVisitor &v) { v.visit(*this); }
-void ForStmt::accept(ASTVisitor &v) { v.visit(*this); }
-void FuncDecl::accept(ASTVisitor &v) { v.visit(*this); }
-void ReturnStmt::accept(ASTVisitor &v) { v.visit(*this); }
-void Program::accept(ASTVisitor &v) { v.visit(*this); }
-void UnaryExpr::accept(ASTVisitor &v) { v.visit(*this); }
-void ExprStmt::accept(ASTVisitor &v) { v.visit(*this); }
-void ArrayAccess::accept(ASTVisitor &v) { v.visit(*this); }
-void TypedVarDecl::accept(ASTVisitor &v) { v.visit(*this); }
+void Node::accept(ASTVisitor &v) {
+  dispatch(*this, [&](auto &node) { v.visit(node); });
+}
 
-void IntLiteral::accept(ASTVisitor &v) { v.visit(*this); }
-void FloatLiteral::accept(ASTVisitor &v) { v.visit(*this); }
-void StringLiteral::accept(ASTVisitor &v) { v.visit(*this); }
+const char *spelling(BinaryOp op) {
+  static const char *const names[] = {"+",  "-",  "*", "/",  "%", "==",
+                                      "!=", "<", "<=", ">", ">="};
+  return names[(int)op];
+}
+
+const char *spelling(UnaryOp op) { return op == UnaryOp::Not ? "!" : "-"; }
 
 } // namespace tinylang
@@ -1,116 +1,179 @@
 #pragma once
 
-#include <iostream>
-#include <memory>
-#include <string>
-#include <vector>
+#include "arena.hpp"
+#include "symbol.hpp"
+#include <cstdint>
+#include <string_view>
+#include <utility>
 
 namespace tinylang {
 
 // Forward declarations
 struct ASTVisitor;
 
+enum class NodeKind : uint8_t {
+  IntLiteral,
+  FloatLiteral,
+  StringLiteral,
+  Variable,
+  BinaryExpr,
+  UnaryExpr,
+  CallExpr,
+  ArrayAccess,
+  VarDecl,
+  TypedVarDecl,
+  AssignStmt,
+  PrintStmt,
+  ExprStmt,
+  Block,
+  IfStmt,
+  ForStmt,
+  ReturnStmt,
+  FuncDecl,
+  Program,
+};
+
+// Comparisons are contiguous, and the arithmetic operators come first in
+// this order; backends index tables with them.
+enum class BinaryOp : uint8_t {
+  Add,
+  Sub,
+  Mul,
+  Div,
+  Mod,
+  Eq,
+  Ne,
+  Lt,
+  Le,
+  Gt,
+  Ge
+};
+enum class UnaryOp : uint8_t { Neg, Not };
+
+inline bool isComparison(BinaryOp op) {
+  return op >= BinaryOp::Eq && op <= BinaryOp::Ge;
+}
+// The operator as written in TinyLang and C++.
+const char *spelling(BinaryOp op);
+const char *spelling(UnaryOp op);
+
+// Nodes live in their Program's arena and are never destroyed one by one, so
+// they hold only trivially destructible members: child pointers, arena
+// arrays, Symbols and views of arena-owned text. There are no virtual
+// functions; `kind` says which struct a node is, and passes switch on it.
 struct Node {
-  virtual ~Node() = default;
-  virtual void accept(ASTVisitor &visitor) = 0;
+  NodeKind kind;
   int line = 0;
   int col = 0;
+
+  // Calls the visitor's overload for this node's kind.
+  void accept(ASTVisitor &visitor);
+
+protected:
+  explicit Node(NodeKind k) : kind(k) {}
 };
 
-struct Expr : Node {};
+struct Expr : Node {
+protected:
+  using Node::Node;
+};
 
-struct Stmt : Node {};
+struct Stmt : Node {
+protected:
+  using Node::Node;
+};
+
+// The node as a T, or null if it is of another kind.
+template <class T> T *as(Node *node) {
+  return node && node->kind == T::kKind ? static_cast<T *>(node) : nullptr;
+}
 
 struct IntLiteral : Expr {
+  static constexpr NodeKind kKind = NodeKind::IntLiteral;
   int value;
-  IntLiteral(int v) : value(v) {}
-  void accept(ASTVisitor &v) override;
+  IntLiteral(int v) : Expr(kKind), value(v) {}
 };
 // Alias Number to IntLiteral for backward compat if needed or just replace
 // usage
 using Number = IntLiteral;
 
 struct FloatLiteral : Expr {
+  static constexpr NodeKind kKind = NodeKind::FloatLiteral;
   double value;
-  FloatLiteral(double v) : value(v) {}
-  void accept(ASTVisitor &v) override;
+  FloatLiteral(double v) : Expr(kKind), value(v) {}
 };
 
 struct StringLiteral : Expr {
-  std::string value;
-  StringLiteral(std::string v) : value(std::move(v)) {}
-  void accept(ASTVisitor &v) override;
+  static constexpr NodeKind kKind = NodeKind::StringLiteral;
+  std::string_view value;
+  StringLiteral(std::string_view v) : Expr(kKind), value(v) {}
 };
 
 struct Variable : Expr {
-  std::string name;
-  Variable(std::string n) : name(std::move(n)) {}
-  void accept(ASTVisitor &v) override;
+  static constexpr NodeKind kKind = NodeKind::Variable;
+  Symbol name;
+  Variable(Symbol n) : Expr(kKind), name(n) {}
 };
 
 struct BinaryExpr : Expr {
-  std::string op;
-  std::unique_ptr<Expr> left;
-  std::unique_ptr<Expr> right;
-  BinaryExpr(std::string o, std::unique_ptr<Expr> l, std::unique_ptr<Expr> r)
-      : op(std::move(o)), left(std::move(l)), right(std::move(r)) {}
-  void accept(ASTVisitor &v) override;
+  static constexpr NodeKind kKind = NodeKind::BinaryExpr;
+  BinaryOp op;
+  Expr *left;
+  Expr *right;
+  BinaryExpr(BinaryOp o, Expr *l, Expr *r)
+      : Expr(kKind), op(o), left(l), right(r) {}
 };
 
 struct CallExpr : Expr {
-  std::string callee;
-  std::vector<std::unique_ptr<Expr>> args;
-  CallExpr(std::string c, std::vector<std::unique_ptr<Expr>> a)
-      : callee(std::move(c)), args(std::move(a)) {}
-  void accept(ASTVisitor &v) override;
+  static constexpr NodeKind kKind = NodeKind::CallExpr;
+  Symbol callee;
+  ArenaArray<Expr *> args;
+  CallExpr(Symbol c, ArenaArray<Expr *> a)
+      : Expr(kKind), callee(c), args(a) {}
 };
 
 struct VarDecl : Stmt {
-  std::string name;
-  std::unique_ptr<Expr> initializer;
-  VarDecl(std::string n, std::unique_ptr<Expr> i)
-      : name(std::move(n)), initializer(std::move(i)) {}
-  void accept(ASTVisitor &v) override;
+  static constexpr NodeKind kKind = NodeKind::VarDecl;
+  Symbol name;
+  Expr *initializer;
+  VarDecl(Symbol n, Expr *i) : Stmt(kKind), name(n), initializer(i) {}
 };
 
 struct PrintStmt : Stmt {
-  std::unique_ptr<Expr> expr;
+  static constexpr NodeKind kKind = NodeKind::PrintStmt;
+  Expr *expr;
   bool newLine;
-  PrintStmt(std::unique_ptr<Expr> e, bool nl = true)
-      : expr(std::move(e)), newLine(nl) {}
-  void accept(ASTVisitor &v) override;
+  PrintStmt(Expr *e, bool nl = true) : Stmt(kKind), expr(e), newLine(nl) {}
 };
 
 struct Block : Stmt {
-  std::vector<std::unique_ptr<Stmt>> statements;
-  void accept(ASTVisitor &v) override;
+  static constexpr NodeKind kKind = NodeKind::Block;
+  ArenaArray<Stmt *> statements;
+  Block() : Stmt(kKind) {}
 };
 
 struct ForStmt : Stmt {
-  std::unique_ptr<Stmt> init; // usually AssignStmt or nullptr if we allowed
-                              // null (but grammar says assignment)
-  std::unique_ptr<Expr> condition;
-  std::unique_ptr<Stmt> update;
-  std::unique_ptr<Block> body;
-  ForStmt(std::unique_ptr<Stmt> i, std::unique_ptr<Expr> c,
-          std::unique_ptr<Stmt> u, std::unique_ptr<Block> b)
-      : init(std::move(i)), condition(std::move(c)), update(std::move(u)),
-        body(std::move(b)) {}
-  void accept(ASTVisitor &v) override;
+  static constexpr NodeKind kKind = NodeKind::ForStmt;
+  Stmt *init; // usually AssignStmt or nullptr if we allowed
+              // null (but grammar says assignment)
+  Expr *condition;
+  Stmt *update;
+  Block *body;
+  ForStmt(Stmt *i, Expr *c, Stmt *u, Block *b)
+      : Stmt(kKind), init(i), condition(c), update(u), body(b) {}
 };
 
 struct FuncDecl : Node {
-  std::string name;
+  static constexpr NodeKind kKind = NodeKind::FuncDecl;
+  Symbol name;
   // stored as {type, name}. if type is empty, it's inferred (auto)
-  std::vector<std::pair<std::string, std::string>> params;
-  std::string returnType; // e.g. "int", "void", or empty for auto
-  std::unique_ptr<Block> body;
+  ArenaArray<std::pair<Symbol, Symbol>> params;
+  Symbol returnType; // e.g. sym::Int, sym::Void, or empty for auto
+  Block *body;
 
-  FuncDecl(std::string n, std::vector<std::pair<std::string, std::string>> p,
-           std::string rt, std::unique_ptr<Block> b)
-      : name(std::move(n)), params(std::move(p)), returnType(std::move(rt)),
-        body(std::move(b)) {}
-  void accept(ASTVisitor &v) override;
+  FuncDecl(Symbol n, ArenaArray<std::pair<Symbol, Symbol>> p, Symbol rt,
+           Block *b)
+      : Node(kKind), name(n), params(p), returnType(rt), body(b) {}
 };
 
 // Replaces AssignStmt (sort of, or updates it)
@@ -119,72 +182,115 @@ struct FuncDecl : Node {
 // Existing: struct AssignStmt : Stmt { std::string name; std::unique_ptr<Expr>
 // value; ... } Let's modify AssignStmt to handle optional index.
 struct AssignStmt : Stmt {
-  std::string name;
-  std::unique_ptr<Expr> index; // Optional, for array assignment
-  std::unique_ptr<Expr> value;
-  AssignStmt(std::string n, std::unique_ptr<Expr> v,
-             std::unique_ptr<Expr> idx = nullptr)
-      : name(n), index(std::move(idx)), value(std::move(v)) {}
-  void accept(ASTVisitor &v) override;
+  static constexpr NodeKind kKind = NodeKind::AssignStmt;
+  Symbol name;
+  Expr *index; // Optional, for array assignment
+  Expr *value;
+  AssignStmt(Symbol n, Expr *v, Expr *idx = nullptr)
+      : Stmt(kKind), name(n), index(idx), value(v) {}
 };
 
 struct IfStmt : Stmt {
-  std::unique_ptr<Expr> condition;
-  std::unique_ptr<Stmt> thenBranch;
-  std::unique_ptr<Stmt> elseBranch; // Optional
-  IfStmt(std::unique_ptr<Expr> c, std::unique_ptr<Stmt> t,
-         std::unique_ptr<Stmt> e = nullptr)
-      : condition(std::move(c)), thenBranch(std::move(t)),
-        elseBranch(std::move(e)) {}
-  void accept(ASTVisitor &v) override;
+  static constexpr NodeKind kKind = NodeKind::IfStmt;
+  Expr *condition;
+  Stmt *thenBranch;
+  Stmt *elseBranch; // Optional
+  IfStmt(Expr *c, Stmt *t, Stmt *e = nullptr)
+      : Stmt(kKind), condition(c), thenBranch(t), elseBranch(e) {}
 };
 
 struct ArrayAccess : Expr {
-  std::string name;
-  std::unique_ptr<Expr> index;
-  ArrayAccess(std::string n, std::unique_ptr<Expr> idx)
-      : name(n), index(std::move(idx)) {}
-  void accept(ASTVisitor &v) override;
+  static constexpr NodeKind kKind = NodeKind::ArrayAccess;
+  Symbol name;
+  Expr *index;
+  ArrayAccess(Symbol n, Expr *idx) : Expr(kKind), name(n), index(idx) {}
 };
 
 struct TypedVarDecl : Stmt {
-  std::string name;
-  std::string type; // "int", "float", "string"
+  static constexpr NodeKind kKind = NodeKind::TypedVarDecl;
+  Symbol name;
+  Symbol type; // sym::Int, sym::Float or sym::String
   bool isArray;
-  std::unique_ptr<Expr> arraySize;   // Optional, for arrays
-  std::unique_ptr<Expr> initializer; // Optional
-  TypedVarDecl(std::string n, std::string t, bool isArr,
-               std::unique_ptr<Expr> size, std::unique_ptr<Expr> init)
-      : name(n), type(t), isArray(isArr), arraySize(std::move(size)),
-        initializer(std::move(init)) {}
-  void accept(ASTVisitor &v) override;
+  Expr *arraySize;   // Optional, for arrays
+  Expr *initializer; // Optional
+  TypedVarDecl(Symbol n, Symbol t, bool isArr, Expr *size, Expr *init)
+      : Stmt(kKind), name(n), type(t), isArray(isArr), arraySize(size),
+        initializer(init) {}
 };
 
 struct ReturnStmt : Stmt {
-  std::unique_ptr<Expr> value;
-  ReturnStmt(std::unique_ptr<Expr> v) : value(std::move(v)) {}
-  void accept(ASTVisitor &v) override;
+  static constexpr NodeKind kKind = NodeKind::ReturnStmt;
+  Expr *value;
+  ReturnStmt(Expr *v) : Stmt(kKind), value(v) {}
 };
 
+// Owns every other node of the tree through `arena`.
 struct Program : Node {
-  std::vector<std::unique_ptr<Node>> declarations; // Funcs or Stmts
-  void accept(ASTVisitor &v) override;
+  static constexpr NodeKind kKind = NodeKind::Program;
+  Arena arena;
+  ArenaArray<Node *> declarations; // Funcs or Stmts
+  Program() : Node(kKind) {}
 };
 
 struct UnaryExpr : Expr {
-  std::string op;
-  std::unique_ptr<Expr> operand;
-  UnaryExpr(std::string o, std::unique_ptr<Expr> expr)
-      : op(std::move(o)), operand(std::move(expr)) {}
-  void accept(ASTVisitor &v) override;
+  static constexpr NodeKind kKind = NodeKind::UnaryExpr;
+  UnaryOp op;
+  Expr *operand;
+  UnaryExpr(UnaryOp o, Expr *expr) : Expr(kKind), op(o), operand(expr) {}
 };
 
 struct ExprStmt : Stmt {
-  std::unique_ptr<Expr> expr;
-  ExprStmt(std::unique_ptr<Expr> e) : expr(std::move(e)) {}
-  void accept(ASTVisitor &v) override;
+  static constexpr NodeKind kKind = NodeKind::ExprStmt;
+  Expr *expr;
+  ExprStmt(Expr *e) : Stmt(kKind), expr(e) {}
 };
 
+// Calls `f` with `node` cast to its concrete type. Passes that do not need
+// the ASTVisitor interface switch through this directly.
+template <class F> decltype(auto) dispatch(Node &node, F &&f) {
+  switch (node.kind) {
+  case NodeKind::IntLiteral:
+    return f(static_cast<IntLiteral &>(node));
+  case NodeKind::FloatLiteral:
+    return f(static_cast<FloatLiteral &>(node));
+  case NodeKind::StringLiteral:
+    return f(static_cast<StringLiteral &>(node));
+  case NodeKind::Variable:
+    return f(static_cast<Variable &>(node));
+  case NodeKind::BinaryExpr:
+    return f(static_cast<BinaryExpr &>(node));
+  case NodeKind::UnaryExpr:
+    return f(static_cast<UnaryExpr &>(node));
+  case NodeKind::CallExpr:
+    return f(static_cast<CallExpr &>(node));
+  case NodeKind::ArrayAccess:
+    return f(static_cast<ArrayAccess &>(node));
+  case NodeKind::VarDecl:
+    return f(static_cast<VarDecl &>(node));
+  case NodeKind::TypedVarDecl:
+    return f(static_cast<TypedVarDecl &>(node));
+  case NodeKind::AssignStmt:
+    return f(static_cast<AssignStmt &>(node));
+  case NodeKind::PrintStmt:
+    return f(static_cast<PrintStmt &>(node));
+  case NodeKind::ExprStmt:
+    return f(static_cast<ExprStmt &>(node));
+  case NodeKind::Block:
+    return f(static_cast<Block &>(node));
+  case NodeKind::IfStmt:
+    return f(static_cast<IfStmt &>(node));
+  case NodeKind::ForStmt:
+    return f(static_cast<ForStmt &>(node));
+  case NodeKind::ReturnStmt:
+    return f(static_cast<ReturnStmt &>(node));
+  case NodeKind::FuncDecl:
+    return f(static_cast<FuncDecl &>(node));
+  case NodeKind::Program:
+    break;
+  }
+  return f(static_cast<Program &>(node));
+}
+
 struct ASTVisitor {
   virtual void visit(IntLiteral &node) = 0;
   virtual void visit(FloatLiteral &node) = 0;
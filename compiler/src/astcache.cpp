@@ -0,0 +1,697 @@
+#include "astcache.hpp"
+#include "cache.hpp"
+#include "hash.hpp"
+#include "process.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <type_traits>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace tinylang {
+
+namespace {
+
+constexpr uint64_t kDefaultMaxBytes = 64ull * 1024 * 1024;
+// "TLAS" read in host byte order, so files from a host of the other byte
+// order are rejected.
+constexpr uint32_t kMagic = 0x53414c54;
+// Written in place of the kind byte for an absent child.
+constexpr uint8_t kNoNode = 0x7f;
+// Set in the kind byte when a line and column follow; most nodes have none.
+constexpr uint8_t kLocated = 0x80;
+
+struct Header {
+  uint32_t magic;
+  uint32_t version;
+  char sourceHash[64]; // hex SHA-256 of the source
+  uint64_t size;
+  uint64_t functionsOffset; // the nodes end here
+  uint64_t symbolsOffset;
+};
+
+// The function index is a count, that many (text hash, record offset)
+// entries sorted by hash, then the records. A record is the function's
+// source text, the offset of its node, its origin, and two counted lists of
+// dependencies: globals (symbol, type, defined flag) and callees (symbol,
+// argument count, return type).
+constexpr size_t kEntryBytes = 8 + 8;
+constexpr size_t kGlobalBytes = 4 + 1 + 1;
+constexpr size_t kCalleeBytes = 4 + 4 + 1;
+
+// FNV-1a: stable across builds, and only has to spread the entries out,
+// since a lookup compares the text itself.
+uint64_t textHash(std::string_view text) {
+  uint64_t h = 0xcbf29ce484222325;
+  for (unsigned char c : text)
+    h = (h ^ c) * 0x100000001b3;
+  return h;
+}
+
+// The header, if `bytes` starts with one of this version that fits them.
+bool readHeader(std::string_view bytes, Header &h) {
+  if (bytes.size() < sizeof h)
+    return false;
+  std::memcpy(&h, bytes.data(), sizeof h);
+  return h.magic == kMagic && h.version == kAstFormatVersion &&
+         h.size == bytes.size() && h.functionsOffset >= sizeof h &&
+         h.functionsOffset <= h.symbolsOffset && h.symbolsOffset <= h.size;
+}
+
+// Symbols are written as indexes into a table of names at the end of the
+// file (0 for the empty symbol), since their ids are private to a process.
+class Writer {
+public:
+  explicit Writer(std::string &out) : out(out) {}
+
+  void node(Node *n) {
+    if (!n) {
+      put(kNoNode);
+      return;
+    }
+    bool located = n->line != 0 || n->col != 0;
+    put((uint8_t)((uint8_t)n->kind | (located ? kLocated : 0)));
+    if (located) {
+      put((int32_t)n->line);
+      put((int32_t)n->col);
+    }
+    dispatch(*n, [this](auto &n) { fields(n); });
+  }
+
+  template <class T> void nodes(ArenaArray<T *> list) {
+    put((uint32_t)list.size());
+    for (T *n : list)
+      node(n);
+  }
+
+  // The program's declarations, noting where each one starts.
+  void declarations(Program &prog, std::vector<uint64_t> &offsets) {
+    put((uint32_t)prog.declarations.size());
+    for (Node *decl : prog.declarations) {
+      offsets.push_back(out.size());
+      node(decl);
+    }
+  }
+
+  void functionIndex(const std::vector<FunctionRecord> &functions,
+                     const std::vector<uint64_t> &offsets) {
+    std::vector<std::pair<uint64_t, uint64_t>> entries;
+    for (const FunctionRecord &f : functions)
+      if (!f.text.empty())
+        entries.emplace_back(textHash(f.text), 0);
+    put((uint32_t)entries.size());
+    size_t table = out.size();
+    out.resize(table + entries.size() * kEntryBytes);
+
+    auto entry = entries.begin();
+    for (size_t i = 0; i < functions.size(); ++i) {
+      const FunctionRecord &f = functions[i];
+      if (f.text.empty())
+        continue;
+      (entry++)->second = out.size();
+      text(f.text);
+      put(offsets[i]);
+      put((int32_t)f.origin.line);
+      put((int32_t)f.origin.col);
+      put((uint32_t)f.deps.globals.size());
+      for (const auto &g : f.deps.globals) {
+        symbol(g.name);
+        put((uint8_t)g.type);
+        put((uint8_t)g.isDefined);
+      }
+      put((uint32_t)f.deps.callees.size());
+      for (const auto &c : f.deps.callees) {
+        symbol(c.name);
+        put((int32_t)c.argCount);
+        put((uint8_t)c.returnType);
+      }
+    }
+    std::sort(entries.begin(), entries.end());
+    for (const auto &[hash, offset] : entries) {
+      std::memcpy(&out[table], &hash, 8);
+      std::memcpy(&out[table + 8], &offset, 8);
+      table += kEntryBytes;
+    }
+  }
+
+  void symbolTable() {
+    put((uint32_t)symbols.size());
+    for (Symbol s : symbols)
+      text(s.str());
+  }
+
+private:
+  std::string &out;
+  std::unordered_map<Symbol, uint32_t> ids;
+  std::vector<Symbol> symbols;
+
+  template <class T> void put(T value) {
+    static_assert(std::is_trivially_copyable_v<T>);
+    out.append((const char *)&value, sizeof(T));
+  }
+  void text(std::string_view s) {
+    put((uint32_t)s.size());
+    out.append(s);
+  }
+  void symbol(Symbol s) {
+    if (s.empty()) {
+      put((uint32_t)0);
+      return;
+    }
+    auto [it, added] = ids.try_emplace(s, (uint32_t)symbols.size() + 1);
+    if (added)
+      symbols.push_back(s);
+    put(it->second);
+  }
+
+  void fields(IntLiteral &n) { put((int32_t)n.value); }
+  void fields(FloatLiteral &n) { put(n.value); }
+  void fields(StringLiteral &n) { text(n.value); }
+  void fields(Variable &n) { symbol(n.name); }
+  void fields(BinaryExpr &n) {
+    put(n.op);
+    node(n.left);
+    node(n.right);
+  }
+  void fields(UnaryExpr &n) {
+    put(n.op);
+    node(n.operand);
+  }
+  void fields(CallExpr &n) {
+    symbol(n.callee);
+    nodes(n.args);
+  }
+  void fields(ArrayAccess &n) {
+    symbol(n.name);
+    node(n.index);
+  }
+  void fields(VarDecl &n) {
+    symbol(n.name);
+    node(n.initializer);
+  }
+  void fields(TypedVarDecl &n) {
+    symbol(n.name);
+    symbol(n.type);
+    put((uint8_t)n.isArray);
+    node(n.arraySize);
+    node(n.initializer);
+  }
+  void fields(AssignStmt &n) {
+    symbol(n.name);
+    node(n.index);
+    node(n.value);
+  }
+  void fields(PrintStmt &n) {
+    node(n.expr);
+    put((uint8_t)n.newLine);
+  }
+  void fields(ExprStmt &n) { node(n.expr); }
+  void fields(Block &n) { nodes(n.statements); }
+  void fields(IfStmt &n) {
+    node(n.condition);
+    node(n.thenBranch);
+    node(n.elseBranch);
+  }
+  void fields(ForStmt &n) {
+    node(n.init);
+    node(n.condition);
+    node(n.update);
+    node(n.body);
+  }
+  void fields(ReturnStmt &n) { node(n.value); }
+  void fields(FuncDecl &n) {
+    symbol(n.name);
+    put((uint32_t)n.params.size());
+    for (auto &[type, name] : n.params) {
+      symbol(type);
+      symbol(name);
+    }
+    symbol(n.returnType);
+    node(n.body);
+  }
+  void fields(Program &) {}
+};
+
+struct Malformed {};
+
+// Decodes what Writer produced, checking every length and offset against
+// the buffer and every child against the type of the field it fills. Nodes
+// go into `arena`, which may be null for reading anything else.
+class Reader {
+public:
+  Reader(std::string_view data, Arena *arena,
+         const std::vector<Symbol> &symbols)
+      : begin(data.data()), pos(data.data()), end(data.data() + data.size()),
+        arena(arena), symbols(symbols) {}
+
+  bool atEnd() const { return pos == end; }
+  size_t offset() const { return pos - begin; }
+
+  // Moves locations read from here on from a tree that started at `from`
+  // to one starting at `to`. Only the first line's columns shift.
+  void relocate(SourceLocation from, SourceLocation to) {
+    firstLine = from.line;
+    lineShift = to.line - from.line;
+    colShift = to.col - from.col;
+  }
+
+  void need(size_t bytes) {
+    if ((size_t)(end - pos) < bytes)
+      throw Malformed();
+  }
+  void skip(size_t bytes) {
+    need(bytes);
+    pos += bytes;
+  }
+  template <class T> T get() {
+    need(sizeof(T));
+    T value;
+    std::memcpy(&value, pos, sizeof(T));
+    pos += sizeof(T);
+    return value;
+  }
+  // An element count, each element taking at least `minBytes`.
+  uint32_t count(size_t minBytes) {
+    uint32_t n = get<uint32_t>();
+    need(n * minBytes);
+    return n;
+  }
+  std::string_view bytes(size_t n) {
+    need(n);
+    std::string_view s(pos, n);
+    pos += n;
+    return s;
+  }
+  std::string_view text() { return bytes(get<uint32_t>()); }
+  Symbol symbol() {
+    uint32_t id = get<uint32_t>();
+    if (id > symbols.size())
+      throw Malformed();
+    return id ? symbols[id - 1] : Symbol();
+  }
+  Type type() {
+    uint8_t v = get<uint8_t>();
+    if (v > (uint8_t)Type::Unknown)
+      throw Malformed();
+    return (Type)v;
+  }
+
+  template <class T> T *child() {
+    Node *n = node();
+    if (n && !fits<T>(n->kind))
+      throw Malformed();
+    return static_cast<T *>(n);
+  }
+
+  template <class T> ArenaArray<T *> children() {
+    uint32_t n = count(1);
+    if (n == 0)
+      return {};
+    auto **items = (T **)arena->allocate(n * sizeof(T *), alignof(T *));
+    for (uint32_t i = 0; i < n; ++i)
+      items[i] = child<T>();
+    return {items, n};
+  }
+
+private:
+  const char *begin;
+  const char *pos;
+  const char *end;
+  Arena *arena;
+  const std::vector<Symbol> &symbols;
+  int firstLine = 0;
+  int lineShift = 0;
+  int colShift = 0;
+
+  template <class T> T op(T last) {
+    uint8_t v = get<uint8_t>();
+    if (v > (uint8_t)last)
+      throw Malformed();
+    return (T)v;
+  }
+
+  template <class T> static bool fits(NodeKind k) {
+    if constexpr (std::is_same_v<T, Expr>)
+      return k <= NodeKind::ArrayAccess;
+    else if constexpr (std::is_same_v<T, Stmt>)
+      return k >= NodeKind::VarDecl && k <= NodeKind::ReturnStmt;
+    else if constexpr (std::is_same_v<T, Block>)
+      return k == NodeKind::Block;
+    else if constexpr (std::is_same_v<T, FuncDecl>)
+      return k == NodeKind::FuncDecl;
+    else
+      return k != NodeKind::Program;
+  }
+
+  Node *node() {
+    uint8_t tag = get<uint8_t>();
+    if (tag == kNoNode)
+      return nullptr;
+    uint8_t kind = tag & ~kLocated;
+    if (kind >= (uint8_t)NodeKind::Program)
+      throw Malformed();
+    int32_t line = 0, col = 0;
+    if (tag & kLocated) {
+      line = get<int32_t>();
+      col = get<int32_t>();
+      if (line == firstLine)
+        col += colShift;
+      line += lineShift;
+    }
+    Node *n = build((NodeKind)kind);
+    n->line = line;
+    n->col = col;
+    return n;
+  }
+
+  // Fields are read into locals first: they must be consumed in order.
+  Node *build(NodeKind kind) {
+    switch (kind) {
+    case NodeKind::IntLiteral:
+      return arena->make<IntLiteral>(get<int32_t>());
+    case NodeKind::FloatLiteral:
+      return arena->make<FloatLiteral>(get<double>());
+    case NodeKind::StringLiteral:
+      return arena->make<StringLiteral>(arena->copy(text()));
+    case NodeKind::Variable:
+      return arena->make<Variable>(symbol());
+    case NodeKind::BinaryExpr: {
+      BinaryOp o = op(BinaryOp::Ge);
+      Expr *left = child<Expr>();
+      Expr *right = child<Expr>();
+      return arena->make<BinaryExpr>(o, left, right);
+    }
+    case NodeKind::UnaryExpr: {
+      UnaryOp o = op(UnaryOp::Not);
+      return arena->make<UnaryExpr>(o, child<Expr>());
+    }
+    case NodeKind::CallExpr: {
+      Symbol callee = symbol();
+      return arena->make<CallExpr>(callee, children<Expr>());
+    }
+    case NodeKind::ArrayAccess: {
+      Symbol name = symbol();
+      return arena->make<ArrayAccess>(name, child<Expr>());
+    }
+    case NodeKind::VarDecl: {
+      Symbol name = symbol();
+      return arena->make<VarDecl>(name, child<Expr>());
+    }
+    case NodeKind::TypedVarDecl: {
+      Symbol name = symbol();
+      Symbol type = symbol();
+      bool isArray = get<uint8_t>() != 0;
+      Expr *size = child<Expr>();
+      Expr *init = child<Expr>();
+      return arena->make<TypedVarDecl>(name, type, isArray, size, init);
+    }
+    case NodeKind::AssignStmt: {
+      Symbol name = symbol();
+      Expr *index = child<Expr>();
+      Expr *value = child<Expr>();
+      return arena->make<AssignStmt>(name, value, index);
+    }
+    case NodeKind::PrintStmt: {
+      Expr *expr = child<Expr>();
+      bool newLine = get<uint8_t>() != 0;
+      return arena->make<PrintStmt>(expr, newLine);
+    }
+    case NodeKind::ExprStmt:
+      return arena->make<ExprStmt>(child<Expr>());
+    case NodeKind::Block: {
+      Block *block = arena->make<Block>();
+      block->statements = children<Stmt>();
+      return block;
+    }
+    case NodeKind::IfStmt: {
+      Expr *cond = child<Expr>();
+      Stmt *thenBranch = child<Stmt>();
+      Stmt *elseBranch = child<Stmt>();
+      return arena->make<IfStmt>(cond, thenBranch, elseBranch);
+    }
+    case NodeKind::ForStmt: {
+      Stmt *init = child<Stmt>();
+      Expr *cond = child<Expr>();
+      Stmt *update = child<Stmt>();
+      Block *body = child<Block>();
+      return arena->make<ForStmt>(init, cond, update, body);
+    }
+    case NodeKind::ReturnStmt:
+      return arena->make<ReturnStmt>(child<Expr>());
+    case NodeKind::FuncDecl: {
+      using Param = std::pair<Symbol, Symbol>;
+      Symbol name = symbol();
+      uint32_t n = count(2 * sizeof(uint32_t));
+      auto *params =
+          (Param *)arena->allocate(n * sizeof(Param), alignof(Param));
+      for (uint32_t i = 0; i < n; ++i) {
+        Symbol type = symbol();
+        new (params + i) Param(type, symbol());
+      }
+      Symbol returnType = symbol();
+      return arena->make<FuncDecl>(name, ArenaArray<Param>(params, n),
+                                  returnType, child<Block>());
+    }
+    case NodeKind::Program:
+      break;
+    }
+    throw Malformed();
+  }
+};
+
+std::vector<Symbol> readSymbols(std::string_view section) {
+  std::vector<Symbol> none;
+  Reader names(section, nullptr, none);
+  uint32_t n = names.count(sizeof(uint32_t));
+  std::vector<Symbol> symbols;
+  symbols.reserve(n);
+  for (uint32_t i = 0; i < n; ++i)
+    symbols.emplace_back(names.text());
+  if (!names.atEnd())
+    throw Malformed();
+  return symbols;
+}
+
+} // namespace
+
+std::string serializeProgram(Program &prog, std::string_view sourceHash,
+                             const std::vector<FunctionRecord> &functions) {
+  std::string out(sizeof(Header), '\0');
+  Writer writer(out);
+  std::vector<uint64_t> offsets;
+  writer.declarations(prog, offsets);
+
+  Header h{};
+  h.magic = kMagic;
+  h.version = kAstFormatVersion;
+  sourceHash.copy(h.sourceHash, sizeof h.sourceHash);
+  h.functionsOffset = out.size();
+  writer.functionIndex(functions, offsets);
+  h.symbolsOffset = out.size();
+  writer.symbolTable();
+  h.size = out.size();
+  std::memcpy(out.data(), &h, sizeof h);
+  return out;
+}
+
+std::unique_ptr<Program> deserializeProgram(std::string_view bytes,
+                                            std::string_view sourceHash) {
+  Header h;
+  if (!readHeader(bytes, h) ||
+      sourceHash != std::string_view(h.sourceHash, sizeof h.sourceHash))
+    return nullptr;
+
+  auto prog = std::make_unique<Program>();
+  try {
+    std::vector<Symbol> symbols = readSymbols(bytes.substr(h.symbolsOffset));
+    Reader reader(bytes.substr(sizeof h, h.functionsOffset - sizeof h),
+                  &prog->arena, symbols);
+    prog->declarations = reader.children<Node>();
+    if (!reader.atEnd())
+      return nullptr;
+  } catch (const Malformed &) {
+    return nullptr;
+  }
+  return prog;
+}
+
+AstSnapshot::AstSnapshot() = default;
+AstSnapshot::~AstSnapshot() = default;
+
+std::unique_ptr<AstSnapshot> AstSnapshot::open(const std::string &path) {
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return nullptr;
+  std::unique_ptr<AstSnapshot> snapshot(new AstSnapshot);
+  try {
+    snapshot->file = std::make_unique<InputView>(fd);
+  } catch (const std::runtime_error &) {
+  }
+  ::close(fd);
+  Header h;
+  if (!snapshot->file || !readHeader(snapshot->file->data(), h))
+    return nullptr;
+  std::string_view bytes = snapshot->file->data();
+  uint64_t indexBytes = h.symbolsOffset - h.functionsOffset;
+  uint32_t n = 0;
+  if (indexBytes >= 4)
+    std::memcpy(&n, bytes.data() + h.functionsOffset, 4);
+  if (indexBytes < 4 || (indexBytes - 4) / kEntryBytes < n)
+    return nullptr;
+  snapshot->bytes = bytes;
+  snapshot->table = bytes.substr(h.functionsOffset + 4, n * kEntryBytes);
+  snapshot->functionsOffset = h.functionsOffset;
+  snapshot->symbolsOffset = h.symbolsOffset;
+  return snapshot;
+}
+
+FuncDecl *AstSnapshot::function(std::string_view text, SourceLocation origin,
+                                Arena &arena, FunctionDeps &deps) {
+  uint64_t hash = textHash(text);
+  auto entryHash = [&](size_t i) {
+    uint64_t h;
+    std::memcpy(&h, table.data() + i * kEntryBytes, 8);
+    return h;
+  };
+  size_t lo = 0, hi = table.size() / kEntryBytes;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (entryHash(mid) < hash)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  for (; lo < table.size() / kEntryBytes && entryHash(lo) == hash; ++lo) {
+    uint64_t offset;
+    std::memcpy(&offset, table.data() + lo * kEntryBytes + 8, 8);
+    if (offset < functionsOffset || offset >= symbolsOffset)
+      return nullptr;
+    try {
+      if (symbols.empty())
+        symbols = readSymbols(bytes.substr(symbolsOffset));
+      Reader record(bytes.substr(offset, symbolsOffset - offset), nullptr,
+                    symbols);
+      if (record.text() != text)
+        continue;
+      uint64_t nodeOffset = record.get<uint64_t>();
+      SourceLocation from;
+      from.line = record.get<int32_t>();
+      from.col = record.get<int32_t>();
+      FunctionDeps found;
+      found.globals.resize(record.count(kGlobalBytes));
+      for (auto &g : found.globals) {
+        g.name = record.symbol();
+        g.type = record.type();
+        g.isDefined = record.get<uint8_t>() != 0;
+      }
+      found.callees.resize(record.count(kCalleeBytes));
+      for (auto &c : found.callees) {
+        c.name = record.symbol();
+        c.argCount = record.get<int32_t>();
+        c.returnType = record.type();
+      }
+      if (nodeOffset < sizeof(Header) || nodeOffset >= functionsOffset)
+        return nullptr;
+
+      Reader nodes(bytes.substr(nodeOffset, functionsOffset - nodeOffset),
+                   &arena, symbols);
+      nodes.relocate(from, origin);
+      FuncDecl *func = nodes.child<FuncDecl>();
+      if (func)
+        deps = std::move(found);
+      return func;
+    } catch (const Malformed &) {
+      return nullptr;
+    }
+  }
+  return nullptr;
+}
+
+AstCache::AstCache(std::string root, uint64_t max)
+    : dir((root.empty() ? defaultCacheDir() : root) + "/ast"),
+      maxBytes(max ? max : kDefaultMaxBytes) {
+  std::error_code ec;
+  fs::create_directories(dir, ec);
+  ready = !ec && ::access(dir.c_str(), W_OK | X_OK) == 0;
+}
+
+std::string AstCache::keyFor(std::string_view source) {
+  return sha256Hex(source);
+}
+
+std::string AstCache::entryPath(const std::string &key) const {
+  return dir + "/" + key + ".ast";
+}
+
+std::unique_ptr<Program> AstCache::load(const std::string &key) {
+  if (!ready)
+    return nullptr;
+  std::string path = entryPath(key);
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return nullptr; // miss
+  std::unique_ptr<Program> prog;
+  try {
+    InputView file(fd);
+    prog = deserializeProgram(file.data(), key);
+  } catch (const std::runtime_error &) {
+  }
+  ::close(fd);
+  // Bump recency for LRU.
+  if (prog)
+    ::utimensat(AT_FDCWD, path.c_str(), nullptr, 0);
+  return prog;
+}
+
+std::vector<std::unique_ptr<AstSnapshot>> AstCache::recent(size_t n) {
+  std::vector<std::unique_ptr<AstSnapshot>> snapshots;
+  if (!ready)
+    return snapshots;
+  std::vector<std::pair<fs::file_time_type, std::string>> entries;
+  std::error_code ec;
+  for (const auto &de : fs::directory_iterator(dir, ec)) {
+    if (de.path().extension() != ".ast")
+      continue;
+    std::error_code statEc;
+    auto mtime = de.last_write_time(statEc);
+    if (!statEc)
+      entries.emplace_back(mtime, de.path().string());
+  }
+  n = std::min(n, entries.size());
+  std::partial_sort(entries.begin(), entries.begin() + n, entries.end(),
+                    std::greater<>());
+  for (size_t i = 0; i < n; ++i)
+    if (auto s = AstSnapshot::open(entries[i].second))
+      snapshots.push_back(std::move(s));
+  return snapshots;
+}
+
+void AstCache::store(const std::string &key, Program &prog,
+                     const std::vector<FunctionRecord> &functions) {
+  if (!ready)
+    return;
+  // Unique per thread too: server workers may store the same key at once.
+  static std::atomic<unsigned> serial{0};
+  std::string tmp = dir + "/tmp." + std::to_string(::getpid()) + "." +
+                    std::to_string(serial++) + "." + key;
+  std::ofstream out(tmp, std::ios::binary);
+  out << serializeProgram(prog, key, functions);
+  out.close();
+  if (!out || ::rename(tmp.c_str(), entryPath(key).c_str()) != 0) {
+    ::unlink(tmp.c_str());
+    return;
+  }
+  evictLeastRecent(dir, ".ast", maxBytes);
+}
+
+} // namespace tinylang
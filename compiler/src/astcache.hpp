@@ -0,0 +1,97 @@
+#pragma once
+
+#include "ast.hpp"
+#include "lexer.hpp"
+#include "semantic.hpp"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace tinylang {
+
+// Bump whenever the encoding below, or the tree the front end builds for a
+// given source, changes; files of any other version are ignored.
+inline constexpr uint32_t kAstFormatVersion = 2;
+
+class InputView;
+
+// How the incremental front end found one top-level declaration: a
+// function's source text (empty for anything else), where it started, and
+// what checking the function relied on.
+struct FunctionRecord {
+  std::string_view text;
+  SourceLocation origin{};
+  FunctionDeps deps;
+};
+
+// A checked and optimized Program as one flat buffer: a fixed header (magic,
+// format version, source hash, total size, where the function index and the
+// symbol names start), the nodes in preorder, an index of the functions in
+// `functions` (parallel to the declarations, or empty), then the names of
+// the symbols they use. Every field has a fixed width and host byte order,
+// so a mapped file decodes in place in a single pass.
+std::string serializeProgram(Program &prog, std::string_view sourceHash,
+                             const std::vector<FunctionRecord> &functions = {});
+
+// Rebuilds the tree in a new Program, or returns null unless `bytes` is a
+// complete file of this version written for `sourceHash`.
+std::unique_ptr<Program> deserializeProgram(std::string_view bytes,
+                                            std::string_view sourceHash);
+
+// A mapped cache entry, for picking single functions out of it by text.
+class AstSnapshot {
+public:
+  static std::unique_ptr<AstSnapshot> open(const std::string &path);
+  ~AstSnapshot();
+
+  // Decodes the indexed function with exactly this text into `arena`, its
+  // locations moved to start at `origin`, and sets `deps` to what it relied
+  // on. Null if there is none.
+  FuncDecl *function(std::string_view text, SourceLocation origin,
+                     Arena &arena, FunctionDeps &deps);
+
+private:
+  AstSnapshot();
+
+  std::unique_ptr<InputView> file;
+  std::string_view bytes;
+  std::string_view table; // of the function index
+  uint64_t functionsOffset = 0;
+  uint64_t symbolsOffset = 0;
+  std::vector<Symbol> symbols; // read once a function is decoded
+};
+
+// On-disk cache of serialized Programs keyed by source text, so a program
+// submitted again (with different input, say) skips the lexer, parser,
+// semantic analysis and optimizer and goes straight to its backend.
+// Entries are `<root>/ast/<key>.ast`, published with an atomic rename() and
+// evicted least recently used first, like the binary cache.
+class AstCache {
+public:
+  // An empty `root` selects defaultCacheDir(); zero `maxBytes` 64 MiB.
+  explicit AstCache(std::string root = "", uint64_t maxBytes = 0);
+
+  static std::string keyFor(std::string_view source);
+
+  // The checked program stored under `key`, or null on a miss.
+  std::unique_ptr<Program> load(const std::string &key);
+
+  // The `n` most recently used entries, to reuse functions from.
+  std::vector<std::unique_ptr<AstSnapshot>> recent(size_t n);
+
+  // Serializes `prog` under `key`, then evicts entries until the cache fits
+  // its size bound. Failures are silent: the cache is an optimization only.
+  void store(const std::string &key, Program &prog,
+             const std::vector<FunctionRecord> &functions = {});
+
+private:
+  std::string dir;
+  uint64_t maxBytes;
+  bool ready = false;
+
+  std::string entryPath(const std::string &key) const;
+};
+
+} // namespace tinylang
@@ -0,0 +1,898 @@
+#include "bytecode.hpp"
+#include <climits>
+#include <cstring>
+#include <map>
+#include <unordered_map>
+
+namespace tinylang {
+
+namespace {
+
+// Static type of a value: its Kind, plus the element kind of arrays.
+struct Type {
+  Kind kind = Kind::Void;
+  Kind elem = Kind::Void;
+  auto operator<=>(const Type &) const = default;
+};
+
+bool intLike(Type t) { return t.kind == Kind::Int || t.kind == Kind::Bool; }
+
+[[noreturn]] void unsupported(const std::string &what) {
+  throw LowerError(what);
+}
+
+// A value computed into a register. Temporaries are owned by the expression
+// being lowered and go back to the free list once consumed.
+struct Operand {
+  uint16_t reg = 0;
+  Type type;
+  bool temp = false;
+};
+
+struct Label {
+  size_t target = SIZE_MAX;
+  std::vector<size_t> jumps; // instructions to patch once bound
+};
+
+struct InstanceInfo {
+  std::vector<Type> params;
+  Type result;
+  bool resultKnown = false; // false while an `auto` result is undeduced
+};
+
+class Lowerer {
+public:
+  explicit Lowerer(Program &prog) : prog(prog) {}
+
+  BcProgram run();
+
+  // Index of the instance of `fn` for these argument types, lowering it on
+  // first use.
+  size_t instance(FuncDecl &fn, std::vector<Type> args);
+  FuncDecl *function(Symbol name) {
+    auto it = funcs.find(name);
+    return it == funcs.end() ? nullptr : it->second;
+  }
+  uint16_t floatConstant(double v);
+  uint16_t stringConstant(const std::string &s);
+
+  BcProgram out;
+  std::vector<InstanceInfo> info; // parallel to out.functions
+
+private:
+  Program &prog;
+  std::unordered_map<Symbol, FuncDecl *> funcs;
+  std::map<std::pair<const FuncDecl *, std::vector<Type>>, size_t> instances;
+  std::map<uint64_t, uint16_t> floatIndex;
+  std::unordered_map<std::string, uint16_t> stringIndex;
+};
+
+class FunctionLowerer : public ASTVisitor {
+public:
+  FunctionLowerer(Lowerer &lowerer, size_t index)
+      : L(lowerer), index(index) {}
+
+  void lowerMain(Program &prog, FuncDecl *mainFn);
+  void lowerFunction(FuncDecl &decl);
+
+  void visit(IntLiteral &node) override;
+  void visit(FloatLiteral &node) override;
+  void visit(StringLiteral &node) override;
+  void visit(Variable &node) override;
+  void visit(BinaryExpr &node) override;
+  void visit(UnaryExpr &node) override;
+  void visit(CallExpr &node) override;
+  void visit(VarDecl &node) override;
+  void visit(AssignStmt &node) override;
+  void visit(PrintStmt &node) override;
+  void visit(ExprStmt &node) override;
+  void visit(Block &node) override;
+  void visit(IfStmt &node) override;
+  void visit(ForStmt &node) override;
+  void visit(FuncDecl &) override {}
+  void visit(ReturnStmt &node) override;
+  void visit(Program &) override {}
+  void visit(ArrayAccess &node) override;
+  void visit(TypedVarDecl &node) override;
+
+private:
+  struct Local {
+    Symbol name;
+    uint16_t reg;
+    Type type;
+  };
+  // Registers are only reused within a class, so a string or array register
+  // never ends up holding an int that would later be released.
+  enum RegClass : uint8_t { Scalar, String, ArrayRef };
+
+  Lowerer &L;
+  size_t index;
+  BcFunction fn;
+  bool isMain = false;
+  bool declaredResult = false;
+  std::vector<Local> locals;
+  std::vector<uint8_t> regClass;
+  std::vector<uint16_t> freeRegs[3];
+  size_t lastDef = SIZE_MAX; // instruction that produced the newest temp
+  std::unordered_map<const Expr *, Type> types;
+  Operand result;
+
+  InstanceInfo &info() { return L.info[index]; }
+
+  Operand expr(Expr &e) {
+    e.accept(*this);
+    return result;
+  }
+  void stmt(Stmt &s);
+  void endScope(size_t mark);
+  Type typeOf(Expr &e);
+  Type computeType(Expr &e);
+  Type binaryType(BinaryOp op, Type l, Type r);
+  size_t callee(CallExpr &node);
+
+  uint16_t addReg(Type t);
+  uint16_t newReg(Type t);
+  void release(const Operand &v) {
+    if (v.temp)
+      freeRegs[regClass[v.reg]].push_back(v.reg);
+  }
+  const Local &local(Symbol name);
+  void declare(Symbol name, Operand v);
+
+  size_t emit(Opcode op, uint16_t a = 0, uint16_t b = 0, uint16_t c = 0);
+  Operand def(Opcode op, Type t, uint16_t b = 0, uint16_t c = 0);
+  Operand def1(Opcode op, Type t, Operand v);
+  Operand def2(Opcode op, Type t, Operand l, Operand r);
+  Operand loadInt(int v);
+  Operand zero(Type t);
+  Operand convert(Operand v, Type to);
+  void moveInto(uint16_t dst, Operand v);
+
+  void jump(Opcode op, uint16_t a, uint16_t b, Label &l);
+  void bind(Label &l);
+  void patch(size_t at, size_t target);
+  void branch(Expr &cond, bool when, Label &target);
+
+  void finish();
+};
+
+uint16_t FunctionLowerer::addReg(Type t) {
+  if (fn.numRegs == UINT16_MAX)
+    unsupported("too many registers in '" + fn.name + "'");
+  uint16_t r = fn.numRegs++;
+  RegClass cls = Scalar;
+  if (t.kind == Kind::Str) {
+    cls = String;
+    fn.strRegs.push_back(r);
+  } else if (t.kind == Kind::Array) {
+    cls = ArrayRef;
+    fn.arrRegs.push_back(r);
+  }
+  regClass.push_back(cls);
+  return r;
+}
+
+uint16_t FunctionLowerer::newReg(Type t) {
+  auto &pool = freeRegs[t.kind == Kind::Str     ? String
+                        : t.kind == Kind::Array ? ArrayRef
+                                                : Scalar];
+  if (pool.empty())
+    return addReg(t);
+  uint16_t r = pool.back();
+  pool.pop_back();
+  return r;
+}
+
+const FunctionLowerer::Local &FunctionLowerer::local(Symbol name) {
+  for (size_t i = locals.size(); i-- > 0;)
+    if (locals[i].name == name)
+      return locals[i];
+  unsupported("'" + name.str() + "' was not declared in this scope");
+}
+
+void FunctionLowerer::declare(Symbol name, Operand v) {
+  // A temporary becomes the variable's register; anything else is copied.
+  if (!v.temp) {
+    uint16_t r = newReg(v.type);
+    moveInto(r, v);
+    v.reg = r;
+  }
+  locals.push_back({name, v.reg, v.type});
+}
+
+size_t FunctionLowerer::emit(Opcode op, uint16_t a, uint16_t b, uint16_t c) {
+  fn.code.push_back({op, 0, a, b, c});
+  lastDef = SIZE_MAX;
+  return fn.code.size() - 1;
+}
+
+Operand FunctionLowerer::def(Opcode op, Type t, uint16_t b, uint16_t c) {
+  uint16_t r = newReg(t);
+  lastDef = emit(op, r, b, c);
+  return {r, t, true};
+}
+
+Operand FunctionLowerer::def1(Opcode op, Type t, Operand v) {
+  release(v);
+  return def(op, t, v.reg);
+}
+
+Operand FunctionLowerer::def2(Opcode op, Type t, Operand l, Operand r) {
+  release(l);
+  release(r);
+  return def(op, t, l.reg, r.reg);
+}
+
+Operand FunctionLowerer::loadInt(int v) {
+  return def(Opcode::LoadInt, {Kind::Int}, (uint16_t)((uint32_t)v >> 16),
+             (uint16_t)v);
+}
+
+Operand FunctionLowerer::zero(Type t) {
+  switch (t.kind) {
+  case Kind::Float:
+    return def(Opcode::LoadFloat, t, L.floatConstant(0));
+  case Kind::Str:
+    return def(Opcode::LoadStr, t, L.stringConstant(""));
+  case Kind::Bool: {
+    Operand v = loadInt(0);
+    v.type = t;
+    return v;
+  }
+  default:
+    return loadInt(0);
+  }
+}
+
+Operand FunctionLowerer::convert(Operand v, Type to) {
+  if (v.type == to)
+    return v;
+  if (!isNumeric(v.type.kind) || !isNumeric(to.kind))
+    unsupported(std::string("cannot convert '") + cppTypeName(v.type.kind) +
+                "' to '" + cppTypeName(to.kind) + "'");
+  bool isFloat = v.type.kind == Kind::Float;
+  if (to.kind == Kind::Float)
+    return def1(Opcode::IntToFloat, to, v);
+  if (to.kind == Kind::Bool)
+    return def1(isFloat ? Opcode::FloatToBool : Opcode::IntToBool, to, v);
+  if (isFloat)
+    return def1(Opcode::FloatToInt, to, v);
+  v.type = to; // bool is already 0 or 1
+  return v;
+}
+
+void FunctionLowerer::moveInto(uint16_t dst, Operand v) {
+  if (v.reg == dst)
+    return;
+  if (v.temp && lastDef == fn.code.size() - 1 && fn.code[lastDef].a == v.reg) {
+    // Have the instruction that computed the temporary write `dst` directly.
+    fn.code[lastDef].a = dst;
+    release(v);
+    lastDef = SIZE_MAX;
+    return;
+  }
+  Opcode op = v.type.kind == Kind::Str     ? Opcode::MoveStr
+              : v.type.kind == Kind::Array ? Opcode::CopyArr
+                                           : Opcode::Move;
+  release(v);
+  emit(op, dst, v.reg);
+}
+
+bool isShortBranch(Opcode op) {
+  return op >= Opcode::BrEqI && op <= Opcode::BrGeI;
+}
+
+void FunctionLowerer::jump(Opcode op, uint16_t a, uint16_t b, Label &l) {
+  size_t at = emit(op, a, b);
+  l.jumps.push_back(at);
+  if (l.target != SIZE_MAX)
+    patch(at, l.target);
+}
+
+void FunctionLowerer::bind(Label &l) {
+  l.target = fn.code.size();
+  for (size_t at : l.jumps)
+    patch(at, l.target);
+  lastDef = SIZE_MAX;
+}
+
+void FunctionLowerer::patch(size_t at, size_t target) {
+  long off = (long)target - (long)(at + 1);
+  Instr &in = fn.code[at];
+  if (isShortBranch(in.op)) {
+    if (off < INT16_MIN || off > INT16_MAX)
+      unsupported("branch too long in '" + fn.name + "'");
+    in.c = (uint16_t)off;
+    return;
+  }
+  if (off < INT_MIN || off > INT_MAX)
+    unsupported("function '" + fn.name + "' too large");
+  in.b = (uint16_t)((uint32_t)off >> 16);
+  in.c = (uint16_t)off;
+}
+
+BinaryOp negate(BinaryOp op) {
+  switch (op) {
+  case BinaryOp::Eq:
+    return BinaryOp::Ne;
+  case BinaryOp::Ne:
+    return BinaryOp::Eq;
+  case BinaryOp::Lt:
+    return BinaryOp::Ge;
+  case BinaryOp::Le:
+    return BinaryOp::Gt;
+  case BinaryOp::Gt:
+    return BinaryOp::Le;
+  default:
+    return BinaryOp::Lt;
+  }
+}
+
+// Opcode for comparison `op` in the family starting at `eq`.
+Opcode compareOpcode(Opcode eq, BinaryOp op) {
+  return (Opcode)((int)eq + ((int)op - (int)BinaryOp::Eq));
+}
+
+void FunctionLowerer::branch(Expr &cond, bool when, Label &target) {
+  // Integer comparisons fuse into a single compare-and-branch.
+  if (auto b = as<BinaryExpr>(&cond)) {
+    BinaryOp op = b->op;
+    if (isComparison(op) && intLike(typeOf(*b->left)) &&
+        intLike(typeOf(*b->right))) {
+      Operand l = expr(*b->left);
+      Operand r = expr(*b->right);
+      release(l);
+      release(r);
+      jump(compareOpcode(Opcode::BrEqI, when ? op : negate(op)), l.reg, r.reg,
+           target);
+      return;
+    }
+  }
+  Operand v = expr(cond);
+  if (v.type.kind == Kind::Float)
+    v = def1(Opcode::FloatToBool, {Kind::Bool}, v);
+  else if (!intLike(v.type))
+    unsupported(std::string("could not convert '") +
+                cppTypeName(v.type.kind) + "' to 'bool'");
+  release(v);
+  jump(when ? Opcode::JmpIfNotZero : Opcode::JmpIfZero, v.reg, 0, target);
+}
+
+Type FunctionLowerer::binaryType(BinaryOp op, Type l, Type r) {
+  if (l.kind == Kind::Str && r.kind == Kind::Str) {
+    if (op == BinaryOp::Add)
+      return {Kind::Str};
+    if (isComparison(op))
+      return {Kind::Bool};
+    unsupported("no match for operator on '_tl_str'");
+  }
+  if (!isNumeric(l.kind) || !isNumeric(r.kind))
+    unsupported(std::string("no match for operator (operand types are '") +
+                cppTypeName(l.kind) + "' and '" + cppTypeName(r.kind) + "')");
+  if (isComparison(op))
+    return {Kind::Bool};
+  bool isFloat = l.kind == Kind::Float || r.kind == Kind::Float;
+  if (isFloat && op == BinaryOp::Mod)
+    unsupported("invalid operands to binary 'operator%'");
+  return {isFloat ? Kind::Float : Kind::Int};
+}
+
+Type FunctionLowerer::typeOf(Expr &e) {
+  // Each expression has one type per instance; caching keeps nested
+  // expressions from being typed once per enclosing level.
+  auto it = types.find(&e);
+  if (it != types.end())
+    return it->second;
+  Type t = computeType(e);
+  types.emplace(&e, t);
+  return t;
+}
+
+Type FunctionLowerer::computeType(Expr &e) {
+  if (as<IntLiteral>(&e))
+    return {Kind::Int};
+  if (as<FloatLiteral>(&e))
+    return {Kind::Float};
+  if (as<StringLiteral>(&e))
+    return {Kind::Str};
+  if (auto v = as<Variable>(&e))
+    return local(v->name).type;
+  if (auto a = as<ArrayAccess>(&e)) {
+    Type t = local(a->name).type;
+    if (t.kind != Kind::Array)
+      unsupported("no match for 'operator[]'");
+    return {t.elem};
+  }
+  if (auto b = as<BinaryExpr>(&e))
+    return binaryType(b->op, typeOf(*b->left), typeOf(*b->right));
+  if (auto u = as<UnaryExpr>(&e)) {
+    Type t = typeOf(*u->operand);
+    if (!isNumeric(t.kind))
+      unsupported("no match for unary operator");
+    if (u->op == UnaryOp::Not)
+      return {Kind::Bool};
+    return {t.kind == Kind::Float ? Kind::Float : Kind::Int};
+  }
+  if (auto c = as<CallExpr>(&e)) {
+    if (c->callee == sym::Input || c->callee == sym::Substr)
+      return {Kind::Str};
+    if (c->callee == sym::Len || c->callee == sym::Int)
+      return {Kind::Int};
+    if (c->callee == sym::Float)
+      return {Kind::Float};
+    return L.info[callee(*c)].result;
+  }
+  unsupported("unknown expression");
+}
+
+// The instance a user-function call resolves to.
+size_t FunctionLowerer::callee(CallExpr &node) {
+  FuncDecl *f = L.function(node.callee);
+  if (!f)
+    unsupported("'" + node.callee.str() + "' was not declared in this scope");
+  std::vector<Type> args;
+  for (auto &a : node.args)
+    args.push_back(typeOf(*a));
+  size_t idx = L.instance(*f, std::move(args));
+  if (!L.info[idx].resultKnown)
+    unsupported("'" + node.callee.str() +
+                "' used before its return type is deduced");
+  return idx;
+}
+
+void FunctionLowerer::visit(IntLiteral &node) { result = loadInt(node.value); }
+
+void FunctionLowerer::visit(FloatLiteral &node) {
+  result = def(Opcode::LoadFloat, {Kind::Float},
+               L.floatConstant(floatLiteralValue(node.value)));
+}
+
+void FunctionLowerer::visit(StringLiteral &node) {
+  std::string s;
+  if (!decodeLiteral(node.value, s))
+    unsupported("invalid string literal");
+  result = def(Opcode::LoadStr, {Kind::Str}, L.stringConstant(s));
+}
+
+void FunctionLowerer::visit(Variable &node) {
+  const Local &v = local(node.name);
+  result = {v.reg, v.type, false};
+}
+
+void FunctionLowerer::visit(ArrayAccess &node) {
+  Operand idx = convert(expr(*node.index), {Kind::Int});
+  Local arr = local(node.name);
+  if (arr.type.kind != Kind::Array)
+    unsupported("no match for 'operator[]'");
+  release(idx);
+  result = def(arr.type.elem == Kind::Str ? Opcode::GetArrStr : Opcode::GetArr,
+               {arr.type.elem}, arr.reg, idx.reg);
+}
+
+void FunctionLowerer::visit(BinaryExpr &node) {
+  BinaryOp op = node.op;
+  Type lt = typeOf(*node.left), rt = typeOf(*node.right);
+  Type t = binaryType(op, lt, rt);
+
+  // String operators are overloaded functions, whose arguments g++
+  // evaluates right to left.
+  Operand l, r;
+  if (lt.kind == Kind::Str || rt.kind == Kind::Str) {
+    r = expr(*node.right);
+    l = expr(*node.left);
+  } else if (auto k = as<IntLiteral>(node.right);
+             k && intLike(lt) && (op == BinaryOp::Add || op == BinaryOp::Sub) &&
+             k->value >= -INT16_MAX && k->value <= INT16_MAX) {
+    l = convert(expr(*node.left), {Kind::Int});
+    int v = op == BinaryOp::Add ? k->value : -k->value;
+    release(l);
+    result = def(Opcode::AddIK, t, l.reg, (uint16_t)(int16_t)v);
+    return;
+  } else {
+    l = expr(*node.left);
+    r = expr(*node.right);
+  }
+
+  if (lt.kind == Kind::Str) {
+    result = def2(op == BinaryOp::Add ? Opcode::Concat
+                                : compareOpcode(Opcode::EqS, op),
+                  t, l, r);
+    return;
+  }
+  if (lt.kind == Kind::Float || rt.kind == Kind::Float) {
+    l = convert(l, {Kind::Float});
+    r = convert(r, {Kind::Float});
+    static const Opcode arith[] = {Opcode::AddF, Opcode::SubF, Opcode::MulF,
+                                   Opcode::DivF};
+    result = def2(isComparison(op) ? compareOpcode(Opcode::EqF, op)
+                                   : arith[(int)op],
+                  t, l, r);
+    return;
+  }
+  l = convert(l, {Kind::Int});
+  r = convert(r, {Kind::Int});
+  static const Opcode arith[] = {Opcode::AddI, Opcode::SubI, Opcode::MulI,
+                                 Opcode::DivI, Opcode::ModI};
+  result = def2(isComparison(op) ? compareOpcode(Opcode::EqI, op)
+                                 : arith[(int)op],
+                t, l, r);
+}
+
+void FunctionLowerer::visit(UnaryExpr &node) {
+  Operand v = expr(*node.operand);
+  if (!isNumeric(v.type.kind))
+    unsupported(std::string("no match for 'operator") + spelling(node.op) +
+                "' on '" + cppTypeName(v.type.kind) + "'");
+  bool isFloat = v.type.kind == Kind::Float;
+  if (node.op == UnaryOp::Not)
+    result = def1(isFloat ? Opcode::NotF : Opcode::NotI, {Kind::Bool}, v);
+  else
+    result = def1(isFloat ? Opcode::NegF : Opcode::NegI,
+                  {isFloat ? Kind::Float : Kind::Int}, v);
+}
+
+void FunctionLowerer::visit(CallExpr &node) {
+  Symbol name = node.callee;
+  size_t argc = node.args.size();
+  auto arity = [&](size_t n) {
+    if (argc != n)
+      unsupported("wrong number of arguments to '" + name.str() + "'");
+  };
+
+  if (name == sym::Input) {
+    arity(0);
+    result = def(Opcode::Input, {Kind::Str});
+    return;
+  }
+  if (name == sym::Len) {
+    arity(1);
+    Operand s = expr(*node.args[0]);
+    if (s.type.kind != Kind::Str)
+      unsupported("len() of non-string");
+    result = def1(Opcode::Len, {Kind::Int}, s);
+    return;
+  }
+  if (name == sym::Substr) {
+    // start and len go in consecutive registers; arguments are evaluated
+    // right to left, as g++ does.
+    arity(3);
+    uint16_t range = addReg({Kind::Int});
+    addReg({Kind::Int});
+    moveInto(range + 1, convert(expr(*node.args[2]), {Kind::Int}));
+    moveInto(range, convert(expr(*node.args[1]), {Kind::Int}));
+    Operand s = expr(*node.args[0]);
+    if (s.type.kind != Kind::Str)
+      unsupported("substr() of non-string");
+    release(s);
+    release({range, {Kind::Int}, true});
+    release({(uint16_t)(range + 1), {Kind::Int}, true});
+    result = def(Opcode::Substr, {Kind::Str}, s.reg, range);
+    return;
+  }
+  if (name == sym::Int || name == sym::Float) {
+    arity(1);
+    Operand v = expr(*node.args[0]);
+    bool toInt = name == sym::Int;
+    if (v.type.kind == Kind::Str)
+      result = def1(toInt ? Opcode::StrToInt : Opcode::StrToFloat,
+                    {toInt ? Kind::Int : Kind::Float}, v);
+    else
+      result = convert(v, {toInt ? Kind::Int : Kind::Float});
+    return;
+  }
+
+  size_t idx = callee(node);
+  if (idx > UINT16_MAX)
+    unsupported("too many function instances");
+  std::vector<Type> params = L.info[idx].params;
+  Type ret = L.info[idx].result;
+
+  // Arguments are built in consecutive registers, right to left, and handed
+  // over to the callee's frame.
+  uint16_t base = fn.numRegs;
+  for (Type p : params)
+    addReg(p);
+  for (size_t i = argc; i-- > 0;)
+    moveInto((uint16_t)(base + i), convert(expr(*node.args[i]), params[i]));
+  for (size_t i = 0; i < argc; ++i)
+    release({(uint16_t)(base + i), params[i], true});
+
+  if (ret.kind == Kind::Void) {
+    emit(Opcode::Call, 0, (uint16_t)idx, base);
+    result = {0, ret, false};
+    return;
+  }
+  result = def(Opcode::Call, ret, (uint16_t)idx, base);
+}
+
+void FunctionLowerer::endScope(size_t mark) {
+  for (size_t i = mark; i < locals.size(); ++i)
+    release({locals[i].reg, locals[i].type, true});
+  locals.resize(mark);
+}
+
+void FunctionLowerer::stmt(Stmt &s) {
+  size_t mark = locals.size();
+  s.accept(*this);
+  endScope(mark);
+}
+
+void FunctionLowerer::visit(Block &node) {
+  size_t mark = locals.size();
+  for (auto &s : node.statements)
+    s->accept(*this);
+  endScope(mark);
+}
+
+void FunctionLowerer::visit(VarDecl &node) {
+  Operand v = expr(*node.initializer);
+  if (v.type.kind == Kind::Void)
+    unsupported("variable '" + node.name.str() + "' declared void");
+  declare(node.name, v);
+}
+
+void FunctionLowerer::visit(TypedVarDecl &node) {
+  Kind k = Kind::Int;
+  kindFromTypeName(node.type, k);
+  if (k == Kind::Void)
+    unsupported("variable '" + node.name.str() + "' declared void");
+  if (node.isArray) {
+    // Codegen ignores array initializers.
+    Operand n = node.arraySize ? convert(expr(*node.arraySize), {Kind::Int})
+                               : loadInt(0);
+    release(n);
+    Operand arr = def(Opcode::NewArr, {Kind::Array, k}, n.reg);
+    fn.code.back().x = (uint8_t)k;
+    declare(node.name, arr);
+    return;
+  }
+  declare(node.name, node.initializer
+                         ? convert(expr(*node.initializer), {k})
+                         : zero({k}));
+}
+
+void FunctionLowerer::visit(AssignStmt &node) {
+  // C++17 sequences the right-hand side before the target.
+  Operand v = expr(*node.value);
+  if (node.index) {
+    Operand idx = convert(expr(*node.index), {Kind::Int});
+    Local arr = local(node.name);
+    if (arr.type.kind != Kind::Array)
+      unsupported("no match for 'operator[]'");
+    v = convert(v, {arr.type.elem});
+    release(v);
+    release(idx);
+    emit(arr.type.elem == Kind::Str ? Opcode::SetArrStr : Opcode::SetArr,
+         arr.reg, idx.reg, v.reg);
+    return;
+  }
+  Local target = local(node.name);
+  if (target.type.kind == Kind::Array && v.type != target.type)
+    unsupported("cannot convert array");
+  moveInto(target.reg, convert(v, target.type));
+}
+
+void FunctionLowerer::visit(PrintStmt &node) {
+  Operand v = expr(*node.expr);
+  release(v);
+  switch (v.type.kind) {
+  case Kind::Int:
+    emit(Opcode::PrintInt, v.reg);
+    break;
+  case Kind::Bool:
+    emit(Opcode::PrintBool, v.reg);
+    break;
+  case Kind::Float:
+    emit(Opcode::PrintFloat, v.reg);
+    break;
+  case Kind::Str:
+    emit(Opcode::PrintStr, v.reg);
+    break;
+  default:
+    unsupported("no matching function for call to '_tl_print'");
+  }
+  if (node.newLine)
+    emit(Opcode::EndLine);
+}
+
+void FunctionLowerer::visit(ExprStmt &node) { release(expr(*node.expr)); }
+
+void FunctionLowerer::visit(IfStmt &node) {
+  Label otherwise, end;
+  branch(*node.condition, false, otherwise);
+  stmt(*node.thenBranch);
+  if (node.elseBranch) {
+    jump(Opcode::Jmp, 0, 0, end);
+    bind(otherwise);
+    stmt(*node.elseBranch);
+    bind(end);
+  } else {
+    bind(otherwise);
+  }
+}
+
+void FunctionLowerer::visit(ForStmt &node) {
+  size_t mark = locals.size();
+  if (auto v = as<VarDecl>(node.init)) {
+    // Codegen declares for-loop variables as int.
+    declare(v->name, v->initializer
+                         ? convert(expr(*v->initializer), {Kind::Int})
+                         : loadInt(0));
+  } else if (node.init) {
+    node.init->accept(*this);
+  }
+
+  // The condition is tested at the bottom, so each iteration takes one jump.
+  Label top, check;
+  jump(Opcode::Jmp, 0, 0, check);
+  bind(top);
+  stmt(*node.body);
+  if (node.update)
+    stmt(*node.update);
+  bind(check);
+  if (node.condition)
+    branch(*node.condition, true, top);
+  else
+    jump(Opcode::Jmp, 0, 0, top);
+  endScope(mark);
+}
+
+void FunctionLowerer::visit(ReturnStmt &node) {
+  // A bare `return;` is emitted as `return 0;`.
+  Operand v = node.value ? expr(*node.value) : loadInt(0);
+  if (isMain) {
+    v = convert(v, {Kind::Int});
+  } else if (declaredResult) {
+    if (info().result.kind == Kind::Void)
+      unsupported("return-statement with a value, in function returning "
+                  "'void'");
+    v = convert(v, info().result);
+  } else if (!info().resultKnown) {
+    // `auto` deduces the return type from the first return statement.
+    if (v.type.kind == Kind::Void)
+      unsupported("'" + fn.name + "' returns void");
+    info().result = v.type;
+    info().resultKnown = true;
+    fn.result = v.type.kind;
+  } else if (v.type != info().result) {
+    unsupported("inconsistent deduction for auto return type of '" +
+                fn.name + "'");
+  }
+  release(v);
+  emit(Opcode::Ret, v.reg);
+}
+
+// Falling off the end: main returns 0, void functions return, and others
+// return a zero value (undefined behaviour in the generated C++).
+void FunctionLowerer::finish() {
+  if (!info().resultKnown) {
+    info().resultKnown = true; // `auto` without a return: void
+    fn.result = Kind::Void;
+  }
+  if (info().result.kind == Kind::Void) {
+    emit(Opcode::RetVoid);
+  } else if (info().result.kind == Kind::Array) {
+    Operand n = loadInt(0);
+    release(n);
+    Operand arr = def(Opcode::NewArr, info().result, n.reg);
+    fn.code.back().x = (uint8_t)info().result.elem;
+    emit(Opcode::Ret, arr.reg);
+  } else {
+    emit(Opcode::Ret, zero(info().result).reg);
+  }
+  L.out.functions[index] = std::move(fn);
+}
+
+void FunctionLowerer::lowerMain(Program &prog, FuncDecl *mainFn) {
+  fn.name = "main";
+  fn.result = Kind::Int;
+  isMain = true;
+  if (mainFn) {
+    // main is always emitted as `int main()`; global statements are dropped.
+    if (!mainFn->params.empty())
+      unsupported("'main' takes no parameters");
+    stmt(*mainFn->body);
+  } else {
+    for (auto &d : prog.declarations)
+      if (!as<FuncDecl>(d))
+        static_cast<Stmt &>(*d).accept(*this);
+  }
+  finish();
+}
+
+void FunctionLowerer::lowerFunction(FuncDecl &decl) {
+  fn.name = decl.name.str();
+  std::vector<Type> params = info().params;
+  for (size_t i = 0; i < params.size(); ++i)
+    locals.push_back({decl.params[i].second, addReg(params[i]), params[i]});
+  fn.numParams = (uint16_t)params.size();
+  if (!decl.returnType.empty()) {
+    Kind k;
+    if (!kindFromTypeName(decl.returnType, k))
+      unsupported("'" + decl.returnType.str() + "' does not name a type");
+    declaredResult = true;
+    fn.result = k;
+  }
+  stmt(*decl.body);
+  finish();
+}
+
+size_t Lowerer::instance(FuncDecl &fn, std::vector<Type> args) {
+  if (args.size() != fn.params.size())
+    unsupported("wrong number of arguments to function '" + fn.name.str() +
+                "'");
+  for (size_t i = 0; i < args.size(); ++i) {
+    Symbol declared = fn.params[i].first;
+    Kind k;
+    if (!declared.empty() && kindFromTypeName(declared, k))
+      args[i] = {k};
+    if (args[i].kind == Kind::Void)
+      unsupported("invalid use of void expression");
+  }
+  auto key = std::make_pair(&fn, args);
+  auto it = instances.find(key);
+  if (it != instances.end())
+    return it->second;
+
+  size_t idx = out.functions.size();
+  if (out.functions.size() > UINT16_MAX)
+    unsupported("too many function instances");
+  instances.emplace(key, idx);
+  out.functions.emplace_back();
+  InstanceInfo inf;
+  inf.params = std::move(args);
+  Kind k;
+  if (!fn.returnType.empty() && kindFromTypeName(fn.returnType, k)) {
+    inf.result = {k};
+    inf.resultKnown = true;
+  }
+  info.push_back(std::move(inf));
+  FunctionLowerer(*this, idx).lowerFunction(fn);
+  return idx;
+}
+
+uint16_t Lowerer::floatConstant(double v) {
+  uint64_t bits;
+  std::memcpy(&bits, &v, sizeof bits);
+  auto it = floatIndex.find(bits);
+  if (it != floatIndex.end())
+    return it->second;
+  if (out.floats.size() > UINT16_MAX)
+    unsupported("too many float constants");
+  out.floats.push_back(v);
+  return floatIndex[bits] = (uint16_t)(out.floats.size() - 1);
+}
+
+uint16_t Lowerer::stringConstant(const std::string &s) {
+  auto it = stringIndex.find(s);
+  if (it != stringIndex.end())
+    return it->second;
+  if (out.strings.size() > UINT16_MAX)
+    unsupported("too many string constants");
+  out.strings.push_back(s);
+  return stringIndex[s] = (uint16_t)(out.strings.size() - 1);
+}
+
+BcProgram Lowerer::run() {
+  FuncDecl *mainFn = nullptr;
+  for (auto &d : prog.declarations) {
+    if (auto f = as<FuncDecl>(d)) {
+      funcs[f->name] = f;
+      if (f->name == sym::Main)
+        mainFn = f;
+    }
+  }
+  out.functions.emplace_back();
+  InstanceInfo mainInfo;
+  mainInfo.result = {Kind::Int};
+  mainInfo.resultKnown = true;
+  info.push_back(mainInfo);
+  FunctionLowerer(*this, 0).lowerMain(prog, mainFn);
+  return std::move(out);
+}
+
+} // namespace
+
+BcProgram lower(Program &prog) { return Lowerer(prog).run(); }
+
+} // namespace tinylang
@@ -0,0 +1,143 @@
+#pragma once
+
+#include "ast.hpp"
+#include "execution.hpp"
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace tinylang {
+
+// The program uses something lower() does not handle (e.g. an `auto`
+// function called recursively before its return type is known). Callers fall
+// back to the tree-walking interpreter, which accepts every checked program.
+class LowerError : public std::runtime_error {
+public:
+  using std::runtime_error::runtime_error;
+};
+
+// Register-based bytecode. Registers are untyped 8-byte slots; every
+// instruction knows the type it reads and writes, so ints and floats stay
+// unboxed. `a`, `b` and `c` name registers unless noted otherwise:
+//   imm  32-bit immediate packed into b:c
+//   k    constant pool index (in b)
+//   off  jump offset relative to the next instruction: b:c, or (int16)c for
+//        the fused compare-and-branch forms
+// String registers own a reference and array registers own their array;
+// instructions that overwrite one release the previous value.
+#define TINYLANG_OPCODES(X)                                                    \
+  X(LoadInt)     /* a = imm */                                                 \
+  X(LoadFloat)   /* a = floats[k] */                                           \
+  X(LoadStr)     /* a = strings[k] */                                          \
+  X(Move)        /* a = b (int, bool or float) */                              \
+  X(MoveStr)     /* a = b */                                                   \
+  X(CopyArr)     /* a = deep copy of b */                                      \
+  X(AddI)        /* a = b + c, wrapping */                                     \
+  X(AddIK)       /* a = b + (int16)c */                                        \
+  X(SubI)                                                                      \
+  X(MulI)                                                                      \
+  X(DivI)        /* traps (SIGFPE) on c == 0 or INT_MIN / -1 */                \
+  X(ModI)                                                                      \
+  X(NegI)        /* a = -b */                                                  \
+  X(NotI)        /* a = !b */                                                  \
+  X(AddF)                                                                      \
+  X(SubF)                                                                      \
+  X(MulF)                                                                      \
+  X(DivF)                                                                      \
+  X(NegF)                                                                      \
+  X(NotF)                                                                      \
+  X(EqI)         /* a = b == c (bool) */                                       \
+  X(NeI)                                                                       \
+  X(LtI)                                                                       \
+  X(LeI)                                                                       \
+  X(GtI)                                                                       \
+  X(GeI)                                                                       \
+  X(EqF)                                                                       \
+  X(NeF)                                                                       \
+  X(LtF)                                                                       \
+  X(LeF)                                                                       \
+  X(GtF)                                                                       \
+  X(GeF)                                                                       \
+  X(EqS)                                                                       \
+  X(NeS)                                                                       \
+  X(LtS)                                                                       \
+  X(LeS)                                                                       \
+  X(GtS)                                                                       \
+  X(GeS)                                                                       \
+  X(Concat)      /* a = b + c (strings) */                                     \
+  X(IntToFloat)  /* a = (double)b */                                           \
+  X(FloatToInt)  /* a = (int)b */                                              \
+  X(IntToBool)   /* a = b != 0 */                                              \
+  X(FloatToBool) /* a = b != 0.0 */                                            \
+  X(StrToInt)    /* a = int(b) */                                              \
+  X(StrToFloat)  /* a = float(b) */                                            \
+  X(Len)         /* a = len(b) */                                              \
+  X(Substr)      /* a = substr(b, c, c+1) */                                   \
+  X(Input)       /* a = input() */                                             \
+  X(NewArr)      /* a = new array of b elements of kind `x` */                 \
+  X(GetArr)      /* a = b[c] (scalar elements) */                              \
+  X(GetArrStr)   /* a = b[c] */                                                \
+  X(SetArr)      /* a[b] = c (scalar elements) */                              \
+  X(SetArrStr)   /* a[b] = c */                                                \
+  X(Jmp)         /* ip += off */                                               \
+  X(JmpIfZero)   /* if a == 0: ip += off (int or bool) */                      \
+  X(JmpIfNotZero)                                                              \
+  X(BrEqI)       /* if a == b: ip += off (ints) */                             \
+  X(BrNeI)                                                                     \
+  X(BrLtI)                                                                     \
+  X(BrLeI)                                                                     \
+  X(BrGtI)                                                                     \
+  X(BrGeI)                                                                     \
+  X(PrintInt)    /* print(a) */                                                \
+  X(PrintFloat)                                                                \
+  X(PrintBool)                                                                 \
+  X(PrintStr)                                                                  \
+  X(EndLine)     /* println's newline and flush */                             \
+  X(Call)        /* a = functions[b](c, c+1, ...) */                           \
+  X(Ret)         /* return a */                                                \
+  X(RetVoid)
+
+enum class Opcode : uint8_t {
+#define TINYLANG_OPCODE_ENUM(name) name,
+  TINYLANG_OPCODES(TINYLANG_OPCODE_ENUM)
+#undef TINYLANG_OPCODE_ENUM
+};
+
+struct Instr {
+  Opcode op;
+  uint8_t x; // element Kind for NewArr
+  uint16_t a;
+  uint16_t b;
+  uint16_t c;
+
+  int32_t imm() const { return (int32_t)(((uint32_t)b << 16) | c); }
+  int16_t shortC() const { return (int16_t)c; }
+};
+static_assert(sizeof(Instr) == 8, "instructions are 8 bytes");
+
+// One monomorphic instance of a TinyLang function: `auto` parameters are
+// specialized for the argument types at each distinct call signature.
+struct BcFunction {
+  std::string name;
+  std::vector<Instr> code;
+  uint16_t numRegs = 0;
+  uint16_t numParams = 0; // in registers 0..numParams-1
+  Kind result = Kind::Void;
+  // Registers holding strings / arrays, released when the frame exits.
+  std::vector<uint16_t> strRegs;
+  std::vector<uint16_t> arrRegs;
+};
+
+struct BcProgram {
+  std::vector<BcFunction> functions; // functions[0] is main
+  std::vector<double> floats;
+  std::vector<std::string> strings;
+};
+
+// Lowers a program that passed semantic analysis and checkDeclarations().
+// Types are resolved statically, following the C++ codegen emits. Throws
+// LowerError for programs outside the supported subset.
+BcProgram lower(Program &prog);
+
+} // namespace tinylang
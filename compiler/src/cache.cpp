@@ -0,0 +1,201 @@
+#include "cache.hpp"
+#include "hash.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <fcntl.h>
+#include <filesystem>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace tinylang {
+
+static const uint64_t kDefaultMaxBytes = 256ull * 1024 * 1024;
+// Temp files left behind by a crashed writer are reclaimed after this long.
+static const auto kStaleTempAge = std::chrono::hours(1);
+
+std::string defaultCacheDir() {
+  if (const char *env = std::getenv("TINYLANG_CACHE_DIR"); env && *env)
+    return env;
+  if (const char *xdg = std::getenv("XDG_CACHE_HOME"); xdg && *xdg)
+    return std::string(xdg) + "/tinylang";
+  if (const char *home = std::getenv("HOME"); home && *home)
+    return std::string(home) + "/.cache/tinylang";
+  return "/tmp/tinylang-cache";
+}
+
+static uint64_t defaultMaxBytes() {
+  if (const char *env = std::getenv("TINYLANG_CACHE_MAX_MB"); env && *env) {
+    char *end = nullptr;
+    unsigned long long mb = std::strtoull(env, &end, 10);
+    if (end && *end == '\0')
+      return mb * 1024 * 1024;
+  }
+  return kDefaultMaxBytes;
+}
+
+// Holds an flock() on the cache lock file for the lifetime of the object.
+class LockGuard {
+public:
+  LockGuard(const std::string &path, int op) {
+    fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd >= 0 && ::flock(fd, op) != 0) {
+      ::close(fd);
+      fd = -1;
+    }
+  }
+  ~LockGuard() {
+    if (fd >= 0)
+      ::close(fd); // releases the lock
+  }
+  bool locked() const { return fd >= 0; }
+
+private:
+  int fd = -1;
+};
+
+void evictLeastRecent(const std::string &dir, const std::string &extension,
+                      uint64_t maxBytes) {
+  LockGuard lock(dir + "/cache.lock", LOCK_EX);
+  if (!lock.locked())
+    return;
+
+  struct Entry {
+    std::string path;
+    uint64_t size;
+    fs::file_time_type mtime;
+  };
+  std::vector<Entry> entries;
+  uint64_t total = 0;
+  auto now = fs::file_time_type::clock::now();
+
+  std::error_code ec;
+  for (const auto &de : fs::directory_iterator(dir, ec)) {
+    std::error_code statEc;
+    const std::string name = de.path().filename().string();
+    auto mtime = de.last_write_time(statEc);
+    if (statEc)
+      continue;
+    if (name.rfind("tmp.", 0) == 0) {
+      if (now - mtime > kStaleTempAge)
+        fs::remove(de.path(), statEc);
+      continue;
+    }
+    if (de.path().extension() != extension)
+      continue;
+    uint64_t size = de.file_size(statEc);
+    if (statEc)
+      continue;
+    entries.push_back({de.path().string(), size, mtime});
+    total += size;
+  }
+  if (total <= maxBytes)
+    return;
+
+  std::sort(entries.begin(), entries.end(),
+            [](const Entry &a, const Entry &b) { return a.mtime < b.mtime; });
+  for (const auto &e : entries) {
+    if (total <= maxBytes)
+      break;
+    if (::unlink(e.path.c_str()) == 0 || errno == ENOENT)
+      total -= e.size;
+  }
+}
+
+BinaryCache::BinaryCache(std::string d, uint64_t max)
+    : dir(d.empty() ? defaultCacheDir() : std::move(d)),
+      maxBytes(max ? max : defaultMaxBytes()) {
+  init();
+}
+
+void BinaryCache::init() {
+  std::error_code ec;
+  fs::create_directories(dir, ec);
+  ready = !ec && ::access(dir.c_str(), W_OK | X_OK) == 0;
+}
+
+std::string BinaryCache::makeKey(const std::string &cppCode,
+                                 const std::string &compileFlags,
+                                 const std::string &runtimeVersion) {
+  // Length-prefix each component so that distinct inputs can never
+  // concatenate to the same byte stream.
+  Sha256 h;
+  for (const std::string *part : {&runtimeVersion, &compileFlags, &cppCode}) {
+    h.update(std::to_string(part->size()));
+    h.update(":");
+    h.update(*part);
+  }
+  return h.hexDigest();
+}
+
+std::string BinaryCache::entryPath(const std::string &key) const {
+  return dir + "/" + key + ".exe";
+}
+
+bool BinaryCache::fetch(const std::string &key, const std::string &destPath) {
+  if (!ready)
+    return false;
+  std::string src = entryPath(key);
+  std::string staged = destPath + ".cache-tmp";
+
+  ::unlink(staged.c_str());
+  if (::link(src.c_str(), staged.c_str()) != 0) {
+    if (errno != EXDEV && errno != EPERM)
+      return false; // ENOENT: miss
+    // Different filesystem: fall back to a copy.
+    std::error_code ec;
+    fs::copy_file(src, staged, fs::copy_options::overwrite_existing, ec);
+    if (ec) {
+      ::unlink(staged.c_str());
+      return false;
+    }
+    ::chmod(staged.c_str(), 0755);
+  }
+  if (::rename(staged.c_str(), destPath.c_str()) != 0) {
+    ::unlink(staged.c_str());
+    return false;
+  }
+
+  // Bump recency for LRU. A concurrent eviction may already have unlinked the
+  // name; our link/copy keeps the binary alive regardless.
+  ::utimensat(AT_FDCWD, src.c_str(), nullptr, 0);
+  return true;
+}
+
+void BinaryCache::store(const std::string &key, const std::string &exePath) {
+  if (!ready)
+    return;
+
+  // The pid alone is not enough: two daemon workers can store one key
+  // concurrently.
+  static std::atomic<unsigned> serial{0};
+  std::string tmp = dir + "/tmp." + std::to_string(::getpid()) + "." +
+                    std::to_string(serial++) + "." + key;
+  std::error_code ec;
+  fs::copy_file(exePath, tmp, fs::copy_options::overwrite_existing, ec);
+  if (ec) {
+    ::unlink(tmp.c_str());
+    return;
+  }
+  ::chmod(tmp.c_str(), 0755);
+  // Atomic publish; if another process raced us with the same key the
+  // contents are identical, so whichever rename lands last is fine.
+  if (::rename(tmp.c_str(), entryPath(key).c_str()) != 0) {
+    ::unlink(tmp.c_str());
+    return;
+  }
+  evict();
+}
+
+void BinaryCache::evict() {
+  if (ready)
+    evictLeastRecent(dir, ".exe", maxBytes);
+}
+
+} // namespace tinylang
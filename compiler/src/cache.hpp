@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace tinylang {
+
+// Root directory for on-disk compiler caches: $TINYLANG_CACHE_DIR, else
+// $XDG_CACHE_HOME/tinylang, ~/.cache/tinylang or /tmp/tinylang-cache.
+std::string defaultCacheDir();
+
+// Deletes the least recently modified files named `*<extension>` in `dir`
+// until they total at most `maxBytes`, along with temp files (`tmp.*`) a
+// crashed writer left behind. Runs under an exclusive flock() on
+// `dir/cache.lock`.
+void evictLeastRecent(const std::string &dir, const std::string &extension,
+                      uint64_t maxBytes);
+
+// On-disk cache of finished executables, keyed by a content hash of the
+// generated C++ plus everything else that influences the binary (compiler
+// flags, runtime version). Entries are immutable files named `<key>.exe`.
+//
+// Several driver processes may share one cache directory:
+//  - entries are published with an atomic rename(), so readers never see a
+//    partially written binary;
+//  - a hit hard-links the entry to the caller's path, so a concurrent
+//    eviction cannot delete a binary that is about to be executed;
+//  - eviction runs under an exclusive flock() on `cache.lock`.
+// Recency for the LRU policy is the entry's mtime, refreshed on every hit.
+class BinaryCache {
+public:
+  // An empty `dir` / zero `maxBytes` selects the defaults: defaultCacheDir()
+  // and TINYLANG_CACHE_MAX_MB (else 256 MiB).
+  explicit BinaryCache(std::string dir = "", uint64_t maxBytes = 0);
+
+  static std::string makeKey(const std::string &cppCode,
+                             const std::string &compileFlags,
+                             const std::string &runtimeVersion);
+
+  // Places the cached binary for `key` at `destPath`. Returns false on a miss
+  // (or if the cache is unusable), in which case `destPath` is untouched.
+  bool fetch(const std::string &key, const std::string &destPath);
+
+  // Copies the freshly built binary at `exePath` into the cache and then
+  // evicts least-recently-used entries until the cache fits its size bound.
+  // Failures are silent: the cache is an optimization only.
+  void store(const std::string &key, const std::string &exePath);
+
+  void evict();
+
+  const std::string &directory() const { return dir; }
+  bool usable() const { return ready; }
+
+private:
+  std::string dir;
+  uint64_t maxBytes;
+  bool ready = false;
+
+  std::string entryPath(const std::string &key) const;
+  void init();
+};
+
+} // namespace tinylang
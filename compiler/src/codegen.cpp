@@ -2,29 +2,21 @@
 
 namespace tinylang {
 
-std::string Codegen::generate(Program &prog) {
-  out.str("");
-  out << "#include <iostream>\n";
-  out << "#include <string>\n";
-  out << "#include <vector>\n";
-  out << "#include <algorithm>\n\n";
-
-  // Runtime Helpers
-  out << "std::string _tl_input() { std::string s; std::cin >> s; "
-         "return s; }\n";
-  out << "int _tl_len(const std::string& s) { return (int)s.length(); }\n";
-  out << "std::string _tl_substr(const std::string& s, int start, int len) { "
-         "return s.substr(start, len); }\n";
-  out << "int _tl_to_int(const std::string& s) { try { return std::stoi(s); } "
-         "catch (...) { return 0; } }\n";
-  out << "int _tl_to_int(int i) { return i; }\n";
-  out << "int _tl_to_int(double d) { return (int)d; }\n";
-
-  out << "double _tl_to_float(const std::string& s) { try { return "
-         "std::stod(s); } "
-         "catch (...) { return 0.0; } }\n";
-  out << "double _tl_to_float(int i) { return (double)i; }\n";
-  out << "double _tl_to_float(double d) { return d; }\n\n";
+std::string Codegen::prelude() {
+  // Everything a program needs is declared by the runtime header; the
+  // helpers themselves are linked from libtinylang-runtime.a.
+  return std::string("#ifndef TINYLANG_PRELUDE_HPP\n"
+                     "#define TINYLANG_PRELUDE_HPP\n"
+                     "#include \"") +
+         kRuntimeHeader + "\"\n#endif\n";
+}
+
+std::string Codegen::generate(Program &prog, bool inlinePrelude) {
+  out.clear();
+  if (inlinePrelude)
+    out += prelude() + "\n";
+  else
+    out += std::string("#include \"") + kPreludeHeader + "\"\n\n";
 
   // We need to declare all functions first (forward declarations)
   // But we will just emit everything in order and assume topological sort or
@@ -32,20 +24,22 @@ std::string Codegen::generate(Program &prog) {
   // prototypes? Simplest: `int main() { ... }` but we allow functions. So let's
   // emit them.
 
-  prog.accept(*this);
-  return out.str();
+  visit(prog);
+  return std::move(out);
 }
 
-void Codegen::indent() {
-  for (int i = 0; i < indentLevel; ++i)
-    out << "  ";
-}
+void Codegen::indent() { out.append(2 * indentLevel, ' '); }
 
-void Codegen::emit(const std::string &str) { out << str; }
+void Codegen::emit(std::string_view str) { out += str; }
 
 void Codegen::emitLine(const std::string &str) {
   indent();
-  out << str << "\n";
+  out += str;
+  out += '\n';
+}
+
+void Codegen::visit(Node &node) {
+  dispatch(node, [this](auto &n) { visit(n); });
 }
 
 void Codegen::visit(IntLiteral &node) { emit(std::to_string(node.value)); }
@@ -53,24 +47,24 @@ void Codegen::visit(IntLiteral &node) { emit(std::to_string(node.value)); }
 void Codegen::visit(FloatLiteral &node) { emit(std::to_string(node.value)); }
 
 void Codegen::visit(StringLiteral &node) {
-  emit("\"" + node.value +
-       "\""); // Simple escaping needed? Assuming no quotes in string for now
+  emit("_tl_str(\"" + std::string(node.value) +
+       "\")"); // Simple escaping needed? Assuming no quotes in string for now
 }
 
-void Codegen::visit(Variable &node) { emit(node.name); }
+void Codegen::visit(Variable &node) { emit(node.name.str()); }
 
 void Codegen::visit(IfStmt &node) {
   emit("if (");
-  node.condition->accept(*this);
+  visit(*node.condition);
   emitLine(") {");
   indentLevel++;
-  node.thenBranch->accept(*this);
+  visit(*node.thenBranch);
   indentLevel--;
   emitLine("}");
   if (node.elseBranch) {
     emitLine("else {");
     indentLevel++;
-    node.elseBranch->accept(*this);
+    visit(*node.elseBranch);
     indentLevel--;
     emitLine("}");
   }
@@ -80,30 +74,30 @@ void Codegen::visit(TypedVarDecl &node) {
   indent();
   // Map types
   std::string cppType = "int";
-  if (node.type == "float")
+  if (node.type == sym::Float)
     cppType = "double";
-  else if (node.type == "string")
-    cppType = "std::string";
+  else if (node.type == sym::String)
+    cppType = "_tl_str";
 
   if (node.isArray) {
-    // std::vector<Type> name; or name(size);
-    emit("std::vector<" + cppType + "> " + node.name);
+    // _tl_arr<Type> name; or name(size);
+    emit("_tl_arr<" + cppType + "> " + node.name.str());
     if (node.arraySize) {
       emit("(");
-      node.arraySize->accept(*this);
+      visit(*node.arraySize);
       emit(")");
     }
   } else {
-    emit(cppType + " " + node.name);
+    emit(cppType + " " + node.name.str());
     if (node.initializer) {
       emit(" = ");
-      node.initializer->accept(*this);
+      visit(*node.initializer);
     } else {
       // Default init options?
       // For now, C++ default init (0 for globals, random for locals? No,
       // primitives undefined). But we act like C++. "int x;" -> "int x;" If
       // strict safety requested, emit "= 0;"? Let's safe-init strings always.
-      if (cppType == "std::string") {
+      if (cppType == "_tl_str") {
       } // default ctor is empty
       else
         emit(" = 0"); // Strict safety default?
@@ -113,30 +107,25 @@ void Codegen::visit(TypedVarDecl &node) {
 
   // Safety flag
   indent();
-  emitLine("bool " + node.name +
+  emitLine("bool " + node.name.str() +
            "_init = " + (node.initializer ? "true" : "false") + ";");
 }
 
 void Codegen::visit(AssignStmt &node) {
   indent();
-  emit(node.name);
+  emit(node.name.str());
   if (node.index) {
     emit("[");
-    // Bounds Check Logic (if simplified)
-    // Using vector::at() provides checks but throws std::out_of_range
-    // (crashes). Spec asks for "Runtime error". Use unchecked [] for C
-    // compatibility or .at() for safety? Let's use `[` but we can inject a
-    // check before using `_tl_check_bounds`. However, here we just emit index
-    // expression.
-    node.index->accept(*this);
+    // _tl_arr::operator[] bounds-checks and reports a runtime error.
+    visit(*node.index);
     emit("]");
   }
   emit(" = ");
-  node.value->accept(*this);
+  visit(*node.value);
   emit(";\n");
 
   indent();
-  emitLine(node.name + "_init = true;");
+  emitLine(node.name.str() + "_init = true;");
 }
 
 void Codegen::visit(ArrayAccess &node) {
@@ -148,43 +137,46 @@ void Codegen::visit(ArrayAccess &node) {
   // expression unless we use comma op or helper.
   // "(_tl_check_init(name_init), name[index])"
 
-  emit(node.name);
+  emit(node.name.str());
   emit("[");
-  node.index->accept(*this);
+  visit(*node.index);
   emit("]");
 }
 
 void Codegen::visit(BinaryExpr &node) {
   emit("(");
-  node.left->accept(*this);
-  emit(" " + node.op + " ");
-  node.right->accept(*this);
+  visit(*node.left);
+  emit(" ");
+  emit(spelling(node.op));
+  emit(" ");
+  visit(*node.right);
   emit(")");
 }
 
 void Codegen::visit(UnaryExpr &node) {
-  emit("(" + node.op);
-  node.operand->accept(*this);
+  emit("(");
+  emit(spelling(node.op));
+  visit(*node.operand);
   emit(")");
 }
 
 void Codegen::visit(CallExpr &node) {
-  if (node.callee == "input") {
+  if (node.callee == sym::Input) {
     emit("_tl_input()");
     return;
   }
-  if (node.callee == "len") {
+  if (node.callee == sym::Len) {
     emit("_tl_len(");
     if (!node.args.empty())
-      node.args[0]->accept(*this);
+      visit(*node.args[0]);
     emit(")");
     return;
   }
-  if (node.callee == "substr") {
+  if (node.callee == sym::Substr) {
     emit("_tl_substr(");
     // arguments...
     for (size_t i = 0; i < node.args.size(); ++i) {
-      node.args[i]->accept(*this);
+      visit(*node.args[i]);
       if (i < node.args.size() - 1)
         emit(", ");
     }
@@ -193,24 +185,24 @@ void Codegen::visit(CallExpr &node) {
   }
 
   // Casting built-ins
-  if (node.callee == "int") {
+  if (node.callee == sym::Int) {
     emit("_tl_to_int(");
     if (!node.args.empty())
-      node.args[0]->accept(*this);
+      visit(*node.args[0]);
     emit(")");
     return;
   }
-  if (node.callee == "float") {
+  if (node.callee == sym::Float) {
     emit("_tl_to_float(");
     if (!node.args.empty())
-      node.args[0]->accept(*this);
+      visit(*node.args[0]);
     emit(")");
     return;
   }
 
-  emit(node.callee + "(");
+  emit(node.callee.str() + "(");
   for (size_t i = 0; i < node.args.size(); ++i) {
-    node.args[i]->accept(*this);
+    visit(*node.args[i]);
     if (i < node.args.size() - 1)
       emit(", ");
   }
@@ -219,10 +211,10 @@ void Codegen::visit(CallExpr &node) {
 
 void Codegen::visit(VarDecl &node) {
   indent();
-  emit("auto " + node.name);
+  emit("auto " + node.name.str());
   if (node.initializer) {
     emit(" = ");
-    node.initializer->accept(*this);
+    visit(*node.initializer);
   } else {
     emit(" = 0"); // Default? Issue: auto requires init.
     // We should enforce initializer in parser or here.
@@ -257,16 +249,16 @@ void Codegen::visit(ForStmt &node) {
 
   // Scope: init is usually VarDecl or AssignStmt.
   if (node.init) {
-    if (auto v = dynamic_cast<VarDecl *>(node.init.get())) {
-      emit("int " + v->name + " = ");
+    if (auto v = as<VarDecl>(node.init)) {
+      emit("int " + v->name.str() + " = ");
       if (v->initializer)
-        v->initializer->accept(*this);
+        visit(*v->initializer);
       else
         emit("0");
       emit("; ");
-    } else if (auto a = dynamic_cast<AssignStmt *>(node.init.get())) {
-      emit(a->name + " = ");
-      a->value->accept(*this);
+    } else if (auto a = as<AssignStmt>(node.init)) {
+      emit(a->name.str() + " = ");
+      visit(*a->value);
       emit("; ");
     }
   } else {
@@ -274,60 +266,59 @@ void Codegen::visit(ForStmt &node) {
   }
 
   if (node.condition) {
-    node.condition->accept(*this);
+    visit(*node.condition);
   }
   emit("; ");
 
   if (node.update) {
-    if (auto a = dynamic_cast<AssignStmt *>(node.update.get())) {
-      emit(a->name + " = ");
-      a->value->accept(*this);
+    if (auto a = as<AssignStmt>(node.update)) {
+      emit(a->name.str() + " = ");
+      visit(*a->value);
     }
     // what if it's expression stmt?
   }
 
   emit(")\n");
-  node.body->accept(*this);
+  visit(*node.body);
 }
 
 void Codegen::visit(FuncDecl &node) {
   // Use explicit return type if provided, otherwise auto. Main is always int.
   std::string retType;
-  if (node.name == "main") {
+  if (node.name == sym::Main) {
     retType = "int";
+  } else if (node.returnType == sym::String) {
+    retType = "_tl_str";
+  } else if (node.returnType == sym::Float) {
+    retType = "double";
   } else if (!node.returnType.empty()) {
-    retType = node.returnType;
-    if (retType == "string")
-      retType = "std::string";
-    if (retType == "float")
-      retType = "double";
+    retType = node.returnType.str();
   } else {
     retType = "auto";
   }
 
-  emitLine(retType + " " + node.name + "(" + ([&]() {
+  emitLine(retType + " " + node.name.str() + "(" + ([&]() {
              std::string s;
              for (size_t i = 0; i < node.params.size(); ++i) {
-               std::string type = node.params[i].first;
-               std::string name = node.params[i].second;
-
-               if (type.empty()) {
+               auto [symType, name] = node.params[i];
+               std::string type;
+               if (symType.empty())
                  type = "auto";
-               } else {
-                 if (type == "string")
-                   type = "std::string";
-                 if (type == "float")
-                   type = "double";
-               }
-
-               s += type + " " + name;
+               else if (symType == sym::String)
+                 type = "_tl_str";
+               else if (symType == sym::Float)
+                 type = "double";
+               else
+                 type = symType.str();
+
+               s += type + " " + name.str();
                if (i < node.params.size() - 1)
                  s += ", ";
              }
              return s;
            })() +
            ")");
-  node.body->accept(*this);
+  visit(*node.body);
   emitLine("");
 }
 
@@ -335,7 +326,7 @@ void Codegen::visit(ReturnStmt &node) {
   indent();
   emit("return ");
   if (node.value) {
-    node.value->accept(*this);
+    visit(*node.value);
   } else {
     emit("0"); // Default return
   }
@@ -344,18 +335,14 @@ void Codegen::visit(ReturnStmt &node) {
 
 void Codegen::visit(PrintStmt &node) {
   indent();
-  emit("std::cout << ");
-  node.expr->accept(*this);
-  if (node.newLine) {
-    emit(" << std::endl;\n");
-  } else {
-    emit(";\n");
-  }
+  emit(node.newLine ? "_tl_println(" : "_tl_print(");
+  visit(*node.expr);
+  emit(");\n");
 }
 
 void Codegen::visit(ExprStmt &node) {
   indent();
-  node.expr->accept(*this);
+  visit(*node.expr);
   emit(";\n");
 }
 
@@ -363,7 +350,7 @@ void Codegen::visit(Block &node) {
   emitLine("{");
   indentLevel++;
   for (auto &stmt : node.statements) {
-    stmt->accept(*this);
+    visit(*stmt);
   }
   indentLevel--;
   indent();
@@ -377,18 +364,18 @@ void Codegen::visit(Program &node) {
   std::vector<Stmt *> globalStmts;
 
   for (auto &d : node.declarations) {
-    if (auto f = dynamic_cast<FuncDecl *>(d.get())) {
+    if (auto f = as<FuncDecl>(d)) {
       funcs.push_back(f);
-      if (f->name == "main")
+      if (f->name == sym::Main)
         hasMain = true;
-    } else if (auto s = dynamic_cast<Stmt *>(d.get())) {
-      globalStmts.push_back(s);
+    } else {
+      globalStmts.push_back(static_cast<Stmt *>(d));
     }
   }
 
   // Emit functions
   for (auto f : funcs) {
-    f->accept(*this);
+    visit(*f);
   }
 
   // Emit main if not present (script mode)
@@ -396,7 +383,7 @@ void Codegen::visit(Program &node) {
     emitLine("int main() {");
     indentLevel++;
     for (auto s : globalStmts) {
-      s->accept(*this);
+      visit(*s);
     }
     emitLine("return 0;");
     indentLevel--;
@@ -1,40 +1,59 @@
 #pragma once
 
 #include "ast.hpp"
-#include <sstream>
+#include <string>
+#include <string_view>
 
 namespace tinylang {
 
-class Codegen : public ASTVisitor {
+// Bumped whenever the runtime ABI or the code Codegen::generate emits against
+// it changes, so that cached binaries built for an older runtime are not
+// reused.
+inline constexpr const char *kRuntimeVersion = "3";
+
+class Codegen {
 public:
-  std::string generate(Program &prog);
-
-  void visit(IntLiteral &node) override;
-  void visit(FloatLiteral &node) override;
-  void visit(StringLiteral &node) override;
-  void visit(ArrayAccess &node) override;
-  void visit(TypedVarDecl &node) override;
-  void visit(Variable &node) override;
-  void visit(BinaryExpr &node) override;
-  void visit(UnaryExpr &node) override;
-  void visit(CallExpr &node) override;
-  void visit(VarDecl &node) override;
-  void visit(AssignStmt &node) override;
-  void visit(PrintStmt &node) override;
-  void visit(ExprStmt &node) override;
-  void visit(Block &node) override;
-  void visit(IfStmt &node) override;
-  void visit(ForStmt &node) override;
-  void visit(FuncDecl &node) override;
-  void visit(ReturnStmt &node) override;
-  void visit(Program &node) override;
+  // Header name generated code includes when the prelude is not inlined.
+  static constexpr const char *kPreludeHeader = "tinylang_prelude.hpp";
+  // Declarations of the tinylang-runtime library (runtime/tinylang_rt.h).
+  static constexpr const char *kRuntimeHeader = "tinylang_rt.h";
+
+  // The declarations every program needs: the `_tl_*` runtime wrappers.
+  static std::string prelude();
+
+  // With `inlinePrelude` false the output starts with
+  // `#include "tinylang_prelude.hpp"`, which the caller must make resolvable
+  // (see PrecompiledPrelude).
+  std::string generate(Program &prog, bool inlinePrelude = true);
 
 private:
-  std::stringstream out;
+  // One overload per node kind; visit(Node &) switches to the right one.
+  void visit(Node &node);
+  void visit(IntLiteral &node);
+  void visit(FloatLiteral &node);
+  void visit(StringLiteral &node);
+  void visit(ArrayAccess &node);
+  void visit(TypedVarDecl &node);
+  void visit(Variable &node);
+  void visit(BinaryExpr &node);
+  void visit(UnaryExpr &node);
+  void visit(CallExpr &node);
+  void visit(VarDecl &node);
+  void visit(AssignStmt &node);
+  void visit(PrintStmt &node);
+  void visit(ExprStmt &node);
+  void visit(Block &node);
+  void visit(IfStmt &node);
+  void visit(ForStmt &node);
+  void visit(FuncDecl &node);
+  void visit(ReturnStmt &node);
+  void visit(Program &node);
+
+  std::string out;
   int indentLevel = 0;
 
   void indent();
-  void emit(const std::string &str);
+  void emit(std::string_view str);
   void emitLine(const std::string &str);
 };
 
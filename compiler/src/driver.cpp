@@ -1,14 +1,15 @@
-#include "codegen.hpp"
-#include "lexer.hpp"
-#include "optimizer.hpp"
-#include "parser.hpp"
-#include "semantic.hpp"
-#include <algorithm>
-#include <array>
-#include <chrono>
-#include <cstdio>
+#include "astcache.hpp"
+#include "cache.hpp"
+#include "judge.hpp"
+#include "json.hpp"
+#include "pipeline.hpp"
+#include "prelude.hpp"
+#include "server.hpp"
+#include <cerrno>
+#include <climits>
 #include <cstdlib>
-#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
 #include <fstream>
 #include <iostream>
 #include <memory>
@@ -16,59 +17,69 @@
 
 using namespace tinylang;
 
-void printJson(bool success, const std::string &stdout_str,
-               const std::string &stderr_str, int exit_code, long time_ms,
-               const std::string &error_phase = "",
-               const std::string &error_msg = "", int line = 0, int col = 0) {
-  std::cout << "{\n";
-  std::cout << "  \"success\": " << (success ? "true" : "false") << ",\n";
-  if (!success) {
-    std::cout << "  \"compile_errors\": [ { \"phase\": \"" << error_phase
-              << "\", \"message\": \"" << error_msg << "\", \"line\": " << line
-              << ", \"col\": " << col << " } ],\n";
-  } else {
-    std::cout << "  \"compile_errors\": [],\n";
-  }
-  // Escape JSON strings manually or use minimal escaping
-  auto escape = [](const std::string &s) {
-    std::string res;
-    for (char c : s) {
-      if (c == '"')
-        res += "\\\"";
-      else if (c == '\\')
-        res += "\\\\";
-      else if (c == '\n')
-        res += "\\n";
-      else if (c == '\r')
-        res += "\\r";
-      else if (c == '\t')
-        res += "\\t";
-      else
-        res += c;
-    }
-    return res;
-  };
+void printJson(const RunResult &r) {
+  writeJson(std::cout, r);
+  std::cout << std::endl;
+}
 
-  std::cout << "  \"stdout\": \"" << escape(stdout_str) << "\",\n";
-  std::cout << "  \"stderr\": \"" << escape(stderr_str) << "\",\n";
-  std::cout << "  \"exit_code\": " << exit_code << ",\n";
-  std::cout << "  \"time_ms\": " << time_ms << "\n";
-  std::cout << "}" << std::endl;
+int usage() {
+  std::cerr << "Usage: tinylang-compiler --run --file <path> "
+               "[--stdin <input>]\n"
+               "       [--stdin-file <path> | --stdin-fd <n>]\n"
+               "       [--interpret | --vm | --jit | --tiered] "
+               "[--output <exe>]\n"
+               "       [--no-cache] [--no-ast-cache] [--pch] "
+               "[--cache-dir <dir>] [--phases]\n"
+               "       [--output-limit <bytes>] [--time-limit <ms>]\n"
+               "       tinylang-compiler --file <path> --judge <manifest> "
+               "[--workers <n>]\n"
+               "       tinylang-compiler --serve [--socket <path>] "
+               "[--workers <n>] [--no-cache] [--pch]\n"
+               "       [--cache-dir <dir>]"
+            << std::endl;
+  return 1;
 }
 
-std::string exec(const char *cmd, std::string input = "") {
-  // This is raw exec, but for the assignment we specifically need to capture
-  // output. Using simple popen is easier for reading output. Writing input to
-  // popen is harder (bidirectional). Let's use temporary files for stdin/stdout
-  // to keep it robust and simple in C++.
-  return ""; // Unused helper
+// Upper bound for --workers, each of which is a thread.
+constexpr long long kMaxWorkers = 1024;
+
+// Parses all of `text` as a decimal integer in [min, max].
+bool parseNumber(const char *text, long long min, long long max,
+                 long long &out) {
+  errno = 0;
+  char *end;
+  long long v = std::strtoll(text, &end, 10);
+  if (end == text || *end || errno == ERANGE || v < min || v > max)
+    return false;
+  out = v;
+  return true;
 }
 
 int main(int argc, char **argv) {
   std::string filePath;
   std::string stdinContent;
+  std::string stdinFile;
+  int stdinFd = -1;
+  std::string cacheDir;
+  std::string outputPath = "/tmp/tinylang_run";
+  std::string socketPath;
+  std::string manifestPath;
   bool run = false;
-
+  Backend backend = Backend::Compile;
+  bool useCache = true;
+  bool useAstCache = true;
+  bool usePch = false;
+  bool serveMode = false;
+  bool phases = false;
+  size_t outputLimit = kDefaultOutputLimit;
+  long long timeLimitMs = 0;
+  int workers = 0;
+
+  auto invalid = [](const char *flag, const char *value) {
+    std::cerr << "Invalid " << flag << ": " << value << std::endl;
+    return usage();
+  };
+  long long number;
   for (int i = 1; i < argc; ++i) {
     if (std::string(argv[i]) == "--run")
       run = true;
@@ -76,138 +87,133 @@ int main(int argc, char **argv) {
       filePath = argv[++i];
     else if (std::string(argv[i]) == "--stdin" && i + 1 < argc)
       stdinContent = argv[++i];
+    else if (std::string(argv[i]) == "--stdin-file" && i + 1 < argc)
+      stdinFile = argv[++i];
+    else if (std::string(argv[i]) == "--stdin-fd" && i + 1 < argc) {
+      if (!parseNumber(argv[++i], 0, INT_MAX, number))
+        return invalid("--stdin-fd", argv[i]);
+      stdinFd = (int)number;
+    } else if (std::string(argv[i]) == "--interpret")
+      backend = Backend::Interpret;
+    else if (std::string(argv[i]) == "--vm")
+      backend = Backend::Vm;
+    else if (std::string(argv[i]) == "--jit")
+      backend = Backend::Jit;
+    else if (std::string(argv[i]) == "--tiered")
+      backend = Backend::Tiered;
+    else if (std::string(argv[i]) == "--output-limit" && i + 1 < argc) {
+      if (!parseNumber(argv[++i], 0, LLONG_MAX, number))
+        return invalid("--output-limit", argv[i]);
+      outputLimit = (size_t)number;
+    } else if (std::string(argv[i]) == "--time-limit" && i + 1 < argc) {
+      if (!parseNumber(argv[++i], 1, LONG_MAX, timeLimitMs))
+        return invalid("--time-limit", argv[i]);
+    } else if (std::string(argv[i]) == "--phases")
+      phases = true;
+    else if (std::string(argv[i]) == "--no-cache")
+      useCache = false;
+    else if (std::string(argv[i]) == "--no-ast-cache")
+      useAstCache = false;
+    else if (std::string(argv[i]) == "--pch")
+      usePch = true;
+    else if (std::string(argv[i]) == "--no-pch")
+      usePch = false;
+    else if (std::string(argv[i]) == "--cache-dir" && i + 1 < argc)
+      cacheDir = argv[++i];
+    else if (std::string(argv[i]) == "--output" && i + 1 < argc)
+      outputPath = argv[++i];
+    else if (std::string(argv[i]) == "--serve")
+      serveMode = true;
+    else if (std::string(argv[i]) == "--socket" && i + 1 < argc)
+      socketPath = argv[++i];
+    else if (std::string(argv[i]) == "--judge" && i + 1 < argc)
+      manifestPath = argv[++i];
+    else if (std::string(argv[i]) == "--workers" && i + 1 < argc) {
+      if (!parseNumber(argv[++i], 1, kMaxWorkers, number))
+        return invalid("--workers", argv[i]);
+      workers = (int)number;
+    }
   }
 
-  if (filePath.empty()) {
-    std::cerr
-        << "Usage: tinylang-compiler --run --file <path> [--stdin <input>]"
-        << std::endl;
-    return 1;
+  std::unique_ptr<BinaryCache> cache;
+  if (useCache)
+    cache = std::make_unique<BinaryCache>(cacheDir);
+  std::unique_ptr<AstCache> astCache;
+  if (useCache && useAstCache)
+    astCache = std::make_unique<AstCache>(cacheDir);
+  std::unique_ptr<PrecompiledPrelude> prelude;
+  if (usePch)
+    prelude = std::make_unique<PrecompiledPrelude>(cacheDir, cxxCommand());
+
+  if (serveMode) {
+    ServeOptions opts;
+    opts.socketPath = socketPath;
+    opts.workers = workers;
+    opts.cache = cache.get();
+    opts.astCache = astCache.get();
+    opts.prelude = prelude.get();
+    return serve(opts);
   }
 
-  // Read source
-  std::ifstream f(filePath);
-  if (!f) {
-    printJson(false, "", "", 1, 0, "file", "Could not open file: " + filePath);
+  if (filePath.empty())
+    return usage();
+
+  // The source is mapped by the pipeline rather than read here.
+  int sourceFd = ::open(filePath.c_str(), O_RDONLY | O_CLOEXEC);
+  if (sourceFd < 0) {
+    printJson(failure("file", "Could not open file: " + filePath));
     return 0;
   }
-  std::stringstream buffer;
-  buffer << f.rdbuf();
-  std::string source = buffer.str();
-
-  auto start = std::chrono::high_resolution_clock::now();
-
-  try {
-    // 1. Lexer
-    Lexer lexer(source);
-    auto tokens = lexer.tokenize();
-
-    // Check for lexer errors
-    for (const auto &t : tokens) {
-      if (t.type == TokenType::Error) {
-        printJson(false, "", "", 1, 0, "lexer",
-                  "Unexpected character: " + t.text, t.line, t.col);
-        return 0;
-      }
-    }
-
-    // 2. Parser
-    Parser parser(std::move(tokens));
-    auto prog = parser.parse();
-
-    // 3. Semantic
-    SemanticAnalyzer semantic;
-    semantic.analyze(*prog);
-
-    // 4. Optimizer
-    Optimizer optimizer;
-    optimizer.optimize(*prog);
 
-    // 5. Codegen
-    Codegen codegen;
-    std::string cppCode = codegen.generate(*prog);
-
-    // Write to tmp
-    std::string tmpCpp = "/tmp/tinylang_gen.cpp";
-    std::ofstream out(tmpCpp);
-    out << cppCode;
-    out.close();
-
-    // Compile with g++
-    std::string exePath = "/tmp/tinylang_run";
-    std::string compileCmd = "g++ -O2 -std=c++20 -o " + exePath + " " + tmpCpp +
-                             " 2>&1"; // capture gcc stderr
-
-    // Execute compilation
-    FILE *pipe = popen(compileCmd.c_str(), "r");
-    if (!pipe)
-      throw std::runtime_error("popen failed");
-    char buf[128];
-    std::string compileOutput;
-    while (fgets(buf, 128, pipe) != NULL)
-      compileOutput += buf;
-    int ret = pclose(pipe);
-
-    if (ret != 0) {
-      // Compilation failed (C++ error, likely codegen bug or unhandled case)
-      printJson(false, "", compileOutput, ret, 0, "codegen",
-                "C++ Compilation failed: " + compileOutput);
+  RunRequest req;
+  req.sourceFd = sourceFd;
+  req.cache = cache.get();
+  req.astCache = astCache.get();
+  req.prelude = prelude.get();
+  req.phases = phases;
+  req.outputLimit = outputLimit;
+  req.timeLimitMs = (long)timeLimitMs;
+
+  if (!manifestPath.empty()) {
+    // One line per case as it finishes, then the report.
+    std::vector<JudgeCase> cases;
+    try {
+      std::ifstream m(manifestPath);
+      if (!m)
+        throw std::runtime_error("Could not open file: " + manifestPath);
+      std::stringstream text;
+      text << m.rdbuf();
+      cases = parseJudgeManifest(
+          text.str(),
+          std::filesystem::path(manifestPath).parent_path().string());
+    } catch (const std::exception &e) {
+      printJson(failure("manifest", e.what()));
       return 0;
     }
+    JudgeReport report = judge(req, cases, workers, [](const CaseVerdict &v) {
+      writeJson(std::cout, v);
+      std::cout << std::endl;
+    });
+    writeJson(std::cout, report);
+    std::cout << std::endl;
+    return 0;
+  }
 
-    if (run) {
-      // Execute the binary
-      // Write stdin to tmp file to pipe it safely
-      std::string tmpStdin = "/tmp/tinylang_stdin.txt";
-      std::ofstream val(tmpStdin);
-      val << stdinContent;
-      val.close();
-
-      std::string cmd = exePath + " < " + tmpStdin;
-      // Use popen again?
-      // To capture both stdout and stderr, we use shell redirection
-      cmd += " > /tmp/tinylang_out.txt 2> /tmp/tinylang_err.txt";
-
-      auto runStart = std::chrono::high_resolution_clock::now();
-      int runRet = system(cmd.c_str());
-      auto runEnd = std::chrono::high_resolution_clock::now();
-      auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(runEnd -
-                                                                      runStart)
-                    .count();
-
-      // Read back output
-      std::ifstream info("/tmp/tinylang_out.txt");
-      std::stringstream oss;
-      oss << info.rdbuf();
-      std::ifstream errf("/tmp/tinylang_err.txt");
-      std::stringstream ess;
-      ess << errf.rdbuf();
-
-      int exitCode = WEXITSTATUS(runRet);
-      std::string errStr = ess.str();
-
-      if (exitCode != 0) {
-        // Runtime error
-        std::string msg = errStr.empty() ? "Program exited with code " +
-                                               std::to_string(exitCode)
-                                         : errStr;
-        printJson(false, oss.str(), errStr, exitCode, ms, "runtime", msg);
-      } else {
-        printJson(true, oss.str(), errStr, 0, ms);
-      }
-
-    } else {
-      // Just compiled
-      printJson(true, "", "", 0, 0);
+  if (!stdinFile.empty()) {
+    // Handed to the program as is; never read into memory when it runs as
+    // a binary.
+    stdinFd = ::open(stdinFile.c_str(), O_RDONLY | O_CLOEXEC);
+    if (stdinFd < 0) {
+      printJson(failure("file", "Could not open file: " + stdinFile));
+      return 0;
     }
-
-  } catch (const ParseError &e) {
-    printJson(false, "", "", 1, 0, "parser", e.what(), e.line, e.col);
-  } catch (const SemanticError &e) {
-    printJson(false, "", "", 1, 0, "semantic", e.what(), e.line, e.col);
-  } catch (const std::exception &e) {
-    printJson(false, "", "", 1, 0, "unknown", e.what());
   }
+  req.stdinContent = stdinContent;
+  req.stdinFd = stdinFd;
+  req.run = run;
+  req.backend = backend;
+  req.outputPath = outputPath;
+  printJson(runPipeline(req));
 
   return 0;
-}
\ No newline at end of file
+}
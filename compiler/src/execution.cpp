@@ -0,0 +1,457 @@
+#include "execution.hpp"
+#include "interpreter.hpp"
+#include <cctype>
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <unordered_map>
+#include <sys/wait.h>
+#include <vector>
+
+namespace tinylang {
+
+// Size of the runtime library's stdout buffer (tinylang_rt.cpp).
+static constexpr size_t kOutBufBytes = 1 << 16;
+
+const char *cppTypeName(Kind k) {
+  switch (k) {
+  case Kind::Void:
+    return "void";
+  case Kind::Bool:
+    return "bool";
+  case Kind::Int:
+    return "int";
+  case Kind::Float:
+    return "double";
+  case Kind::Str:
+    return "_tl_str";
+  case Kind::Array:
+    return "_tl_arr";
+  }
+  return "?";
+}
+
+bool kindFromTypeName(Symbol name, Kind &out) {
+  if (name == sym::Int)
+    out = Kind::Int;
+  else if (name == sym::Float)
+    out = Kind::Float;
+  else if (name == sym::String)
+    out = Kind::Str;
+  else if (name == sym::Bool)
+    out = Kind::Bool;
+  else if (name == sym::Void)
+    out = Kind::Void;
+  else
+    return false;
+  return true;
+}
+
+int truncToInt(double d) {
+  if (!(d > -2147483649.0 && d < 2147483648.0))
+    return INT_MIN;
+  return (int)d;
+}
+
+bool isBuiltin(Symbol name) {
+  return name == sym::Input || name == sym::Len || name == sym::Substr ||
+         name == sym::Int || name == sym::Float;
+}
+
+bool decodeLiteral(std::string_view raw, std::string &out) {
+  out.clear();
+  for (size_t i = 0; i < raw.size(); ++i) {
+    char c = raw[i];
+    if (c == '\n')
+      return false; // missing terminating " character
+    if (c != '\\') {
+      out += c;
+      continue;
+    }
+    if (++i == raw.size())
+      return false;
+    char e = raw[i];
+    switch (e) {
+    case 'n':
+      out += '\n';
+      break;
+    case 't':
+      out += '\t';
+      break;
+    case 'r':
+      out += '\r';
+      break;
+    case 'a':
+      out += '\a';
+      break;
+    case 'b':
+      out += '\b';
+      break;
+    case 'f':
+      out += '\f';
+      break;
+    case 'v':
+      out += '\v';
+      break;
+    case 'e':
+      out += '\x1b';
+      break;
+    case 'x': {
+      unsigned v = 0;
+      size_t j = i + 1;
+      for (; j < raw.size() && std::isxdigit((unsigned char)raw[j]); ++j) {
+        char h = (char)std::tolower((unsigned char)raw[j]);
+        v = v * 16 + (unsigned)(h <= '9' ? h - '0' : h - 'a' + 10);
+        if (v > 0xff)
+          return false; // hex escape sequence out of range
+      }
+      if (j == i + 1)
+        return false; // \x used with no following hex digits
+      out += (char)v;
+      i = j - 1;
+      break;
+    }
+    case '\n':
+      break; // line continuation
+    default:
+      if (e >= '0' && e <= '7') {
+        unsigned v = 0;
+        size_t j = i;
+        while (j < raw.size() && j < i + 3 && raw[j] >= '0' && raw[j] <= '7')
+          v = v * 8 + (unsigned)(raw[j++] - '0');
+        if (v > 0xff)
+          return false; // octal escape sequence out of range
+        out += (char)v;
+        i = j - 1;
+      } else {
+        out += e; // \\, \', \?, and unknown escapes (a g++ warning)
+      }
+    }
+  }
+  return true;
+}
+
+double floatLiteralValue(double v) {
+  return std::strtod(std::to_string(v).c_str(), nullptr);
+}
+
+int strToInt(const std::string &s) {
+  const char *p = s.c_str();
+  char *end = nullptr;
+  errno = 0;
+  long n = std::strtol(p, &end, 10);
+  if (end == p || errno == ERANGE || n < INT_MIN || n > INT_MAX)
+    return 0;
+  return (int)n;
+}
+
+double strToFloat(const std::string &s) {
+  const char *p = s.c_str();
+  char *end = nullptr;
+  errno = 0;
+  double d = std::strtod(p, &end);
+  if (end == p || errno == ERANGE)
+    return 0.0;
+  return d;
+}
+
+namespace {
+
+class DeclChecker : public ASTVisitor {
+public:
+  void visit(IntLiteral &) override {}
+  void visit(FloatLiteral &) override {}
+  void visit(StringLiteral &node) override {
+    std::string decoded;
+    if (!decodeLiteral(node.value, decoded))
+      throw InterpretError("malformed string literal", node.line, node.col);
+  }
+  void visit(Variable &node) override { use(node.name, node.line, node.col); }
+  void visit(BinaryExpr &node) override {
+    node.left->accept(*this);
+    node.right->accept(*this);
+  }
+  void visit(UnaryExpr &node) override { node.operand->accept(*this); }
+  void visit(CallExpr &node) override {
+    if (node.callee == sym::Input)
+      return; // codegen drops the arguments
+    if (!isBuiltin(node.callee)) {
+      auto it = funcIndex.find(node.callee);
+      if (it == funcIndex.end() || it->second > visible)
+        throw InterpretError("'" + node.callee.str() +
+                                 "' was not declared in this scope",
+                             node.line, node.col);
+      if (funcs[it->second]->params.size() != node.args.size())
+        throw InterpretError("wrong number of arguments to function '" +
+                                 node.callee.str() + "'",
+                             node.line, node.col);
+      if (it->second == visible && !deduced)
+        undeducedUse(node);
+      else if (it->second != visible)
+        called[it->second] = true;
+    }
+    for (auto &a : node.args)
+      a->accept(*this);
+  }
+  void visit(VarDecl &node) override {
+    if (node.initializer)
+      node.initializer->accept(*this);
+    declare(node.name);
+  }
+  void visit(AssignStmt &node) override {
+    use(node.name, node.line, node.col);
+    // Codegen follows the assignment with `<name>_init = true;`, and only
+    // typed declarations define that flag.
+    use(node.name, node.line, node.col, true);
+    if (node.index)
+      node.index->accept(*this);
+    node.value->accept(*this);
+  }
+  void visit(PrintStmt &node) override { node.expr->accept(*this); }
+  void visit(ExprStmt &node) override { node.expr->accept(*this); }
+  void visit(Block &node) override {
+    scopes.emplace_back();
+    for (auto &s : node.statements)
+      s->accept(*this);
+    scopes.pop_back();
+  }
+  void visit(IfStmt &node) override {
+    node.condition->accept(*this);
+    node.thenBranch->accept(*this);
+    if (node.elseBranch)
+      node.elseBranch->accept(*this);
+  }
+  void visit(ForStmt &node) override {
+    scopes.emplace_back();
+    if (node.init) {
+      if (as<TypedVarDecl>(node.init))
+        throw InterpretError("typed declarations are not supported in a for "
+                             "loop initializer",
+                             node.line, node.col);
+      inlineAssign(*node.init);
+    }
+    if (node.condition)
+      node.condition->accept(*this);
+    if (node.update)
+      inlineAssign(*node.update);
+    node.body->accept(*this);
+    scopes.pop_back();
+  }
+  void visit(FuncDecl &node) override {
+    deduced = !node.returnType.empty() || node.name == sym::Main;
+    scopes.assign(1, {});
+    for (const auto &p : node.params)
+      declare(p.second);
+    node.body->accept(*this);
+  }
+  void visit(ReturnStmt &node) override {
+    if (node.value)
+      node.value->accept(*this);
+    deduced = true; // g++ deduces `auto` from the first return it reaches
+  }
+  void visit(Program &node) override {
+    bool hasMain = false;
+    for (auto &d : node.declarations) {
+      if (auto f = as<FuncDecl>(d)) {
+        funcIndex[f->name] = funcs.size();
+        funcs.push_back(f);
+        hasMain |= f->name == sym::Main;
+      }
+    }
+    called.assign(funcs.size(), false);
+    undeduced.assign(funcs.size(), nullptr);
+    for (size_t i = 0; i < funcs.size(); ++i) {
+      visible = i;
+      funcs[i]->accept(*this);
+    }
+    if (!hasMain) { // otherwise codegen drops global statements
+      visible = funcs.size();
+      deduced = true;
+      scopes.assign(1, {});
+      for (auto &d : node.declarations)
+        if (!as<FuncDecl>(d))
+          d->accept(*this);
+    }
+    for (size_t i = 0; i < funcs.size(); ++i)
+      if (undeduced[i] && called[i])
+        undeducedUse(*undeduced[i]);
+  }
+  void visit(ArrayAccess &node) override {
+    use(node.name, node.line, node.col);
+    node.index->accept(*this);
+  }
+  void visit(TypedVarDecl &node) override {
+    if (node.isArray) {
+      if (node.arraySize)
+        node.arraySize->accept(*this);
+    } else if (node.initializer) {
+      node.initializer->accept(*this);
+    }
+    declare(node.name);
+    declare(node.name, true);
+  }
+
+private:
+  // A declared name, or with `flag` set its `<name>_init` companion.
+  struct Name {
+    Symbol name;
+    bool flag;
+  };
+  std::vector<std::vector<Name>> scopes;
+  std::unordered_map<Symbol, size_t> funcIndex;
+  std::vector<FuncDecl *> funcs;
+  size_t visible = 0;
+  // Whether the function being checked has a known return type yet.
+  bool deduced = true;
+  // Per function: whether another function (or script code) calls it, and
+  // a call to itself made before its `auto` return type was deduced.
+  std::vector<bool> called;
+  std::vector<CallExpr *> undeduced;
+
+  // A function with untyped parameters is a template, so g++ only objects
+  // once something instantiates it.
+  void undeducedUse(CallExpr &call) {
+    size_t f = funcIndex.at(call.callee);
+    bool generic = false;
+    for (const auto &p : funcs[f]->params)
+      generic |= p.first.empty();
+    if (generic && !called[f]) {
+      if (!undeduced[f])
+        undeduced[f] = &call;
+      return;
+    }
+    throw InterpretError("use of '" + call.callee.str() +
+                             "' before deduction of 'auto'",
+                         call.line, call.col);
+  }
+
+  // For-loop headers emit assignments without the `_init` bookkeeping.
+  void inlineAssign(Stmt &s) {
+    auto a = as<AssignStmt>(&s);
+    if (!a) {
+      s.accept(*this);
+      return;
+    }
+    use(a->name, a->line, a->col);
+    a->value->accept(*this);
+  }
+  void declare(Symbol name, bool flag = false) {
+    scopes.back().push_back({name, flag});
+  }
+  void use(Symbol name, int line, int col, bool flag = false) {
+    for (auto &scope : scopes)
+      for (auto &n : scope)
+        if (n.name == name && n.flag == flag)
+          return;
+    // The flag can also be a variable the program declared by that name.
+    if (flag) {
+      std::string spelled = name.str() + "_init";
+      for (auto &scope : scopes)
+        for (auto &n : scope)
+          if (!n.flag && n.name.str() == spelled)
+            return;
+    }
+    throw InterpretError("'" + name.str() + (flag ? "_init" : "") +
+                             "' was not declared in this scope",
+                         line, col);
+  }
+};
+
+} // namespace
+
+void checkDeclarations(Program &prog) {
+  DeclChecker checker;
+  prog.accept(checker);
+}
+
+void ProgramIO::write(const char *p, size_t n) {
+  size_t pending = out.size() - flushed;
+  if (n > kOutBufBytes - pending) {
+    flush();
+    if (n >= kOutBufBytes) {
+      out.append(p, n);
+      flush();
+      return;
+    }
+  }
+  out.append(p, n);
+}
+
+void ProgramIO::writeInt(int v) {
+  char buf[16];
+  int n = std::snprintf(buf, sizeof(buf), "%d", v);
+  write(buf, (size_t)n);
+}
+
+void ProgramIO::writeFloat(double v) {
+  char buf[64];
+  int n = std::snprintf(buf, sizeof(buf), "%g", v);
+  write(buf, (size_t)n);
+}
+
+std::string ProgramIO::readWord() {
+  // Skip whitespace, read a word, consume one delimiter.
+  auto space = [](char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' ||
+           c == '\f';
+  };
+  flush();
+  while (inPos < in.size() && space(in[inPos]))
+    ++inPos;
+  size_t start = inPos;
+  while (inPos < in.size() && !space(in[inPos]))
+    ++inPos;
+  std::string word(in.substr(start, inPos - start));
+  if (inPos < in.size())
+    ++inPos;
+  return word;
+}
+
+std::string ProgramIO::substr(std::string_view s, int start, int len) {
+  long size = (long)s.size();
+  if (start < 0 || start > size)
+    runtimeError("substr start " + std::to_string(start) +
+                 " out of range for string of length " + std::to_string(size));
+  long take = size - start;
+  if (len >= 0 && len < take)
+    take = len;
+  return std::string(s.substr(start, take));
+}
+
+void ProgramIO::runtimeError(const std::string &msg) {
+  flush();
+  err += "Runtime error: " + msg + "\n";
+  throw ProgramExit{W_EXITCODE(1, 0)};
+}
+
+void ProgramIO::indexError(long index, long size) {
+  runtimeError("array index " + std::to_string(index) +
+               " out of bounds for array of size " + std::to_string(size));
+}
+
+void ProgramIO::sizeError(long size) {
+  runtimeError("invalid array size " + std::to_string(size));
+}
+
+void ProgramIO::die(int sig) {
+  // Whatever the runtime had not yet written dies with the process.
+  out.resize(flushed);
+  throw ProgramExit{W_EXITCODE(0, sig)};
+}
+
+void ProgramIO::exit(int status) {
+  flush(); // the runtime's static destructor
+  throw ProgramExit{W_EXITCODE(status & 0xff, 0)};
+}
+
+void ProgramIO::finish(int waitStatus, ProcessResult &res) {
+  out.resize(flushed);
+  res.started = true;
+  res.waitStatus = waitStatus;
+  res.out = std::move(out);
+  res.err = std::move(err);
+  res.truncated = truncated;
+}
+
+} // namespace tinylang
@@ -0,0 +1,162 @@
+#pragma once
+
+#include "ast.hpp"
+#include "phases.hpp"
+#include "process.hpp"
+#include <atomic>
+#include <string>
+#include <string_view>
+
+// Pieces shared by the in-process backends (interpreter.cpp, vm.cpp), which
+// must behave exactly like the generated C++ linked against the runtime
+// library.
+
+namespace tinylang {
+
+// C++ type of a value in the generated program: bool, int, double, _tl_str or
+// _tl_arr<T>.
+enum class Kind : unsigned char { Void, Bool, Int, Float, Str, Array };
+
+const char *cppTypeName(Kind k);
+// TinyLang type names as spelled in declarations ("int", "float", ...).
+bool kindFromTypeName(Symbol name, Kind &out);
+inline bool isNumeric(Kind k) {
+  return k == Kind::Bool || k == Kind::Int || k == Kind::Float;
+}
+
+// (int)d as x86-64 computes it (cvttsd2si): out-of-range and NaN give INT_MIN.
+int truncToInt(double d);
+// The value of a float literal once codegen has printed it with
+// std::to_string (six decimals).
+double floatLiteralValue(double v);
+// Decodes the escapes g++ would apply to the literal codegen emits verbatim
+// between double quotes. Returns false where g++ rejects the literal.
+bool decodeLiteral(std::string_view raw, std::string &out);
+// tlrt_str_to_int / tlrt_str_to_float.
+int strToInt(const std::string &s);
+double strToFloat(const std::string &s);
+
+// input, len, substr, int and float.
+bool isBuiltin(Symbol name);
+
+template <typename T> bool compare(BinaryOp op, T a, T b) {
+  switch (op) {
+  case BinaryOp::Eq:
+    return a == b;
+  case BinaryOp::Ne:
+    return a != b;
+  case BinaryOp::Lt:
+    return a < b;
+  case BinaryOp::Le:
+    return a <= b;
+  case BinaryOp::Gt:
+    return a > b;
+  default:
+    return a >= b;
+  }
+}
+
+// Rejects, with InterpretError, the name-resolution errors g++ would report
+// for the generated C++: functions only see their parameters and locals
+// (script-mode globals become locals of main), a function can only call
+// itself or functions defined above it since no prototypes are emitted, an
+// `auto` function can only call itself once a return has fixed its type, and
+// assignments need the `_init` flag only typed declarations define.
+void checkDeclarations(Program &prog);
+
+// Thrown to unwind a backend when the program ends early: a runtime error, a
+// simulated fatal signal, or `return` from main.
+struct ProgramExit {
+  int waitStatus;
+};
+
+// Thrown out of a backend whose run was abandoned at another thread's
+// request (see ProgramIO::poll).
+struct Preempted {};
+
+inline const std::atomic<bool> kNeverPreempted{false};
+
+// The program's stdin, stdout and stderr, handled the way the runtime
+// library does it, including which stdout bytes would already have been
+// written(2) when the process dies.
+class ProgramIO {
+public:
+  // Once another thread sets `preempt`, the backend stops at its next poll().
+  // Only the first `outputLimit` bytes of stdout are kept (0: all).
+  explicit ProgramIO(std::string_view stdinData,
+                     const std::atomic<bool> *preempt = nullptr,
+                     size_t outputLimit = 0)
+      : in(stdinData), preempt(preempt ? preempt : &kNeverPreempted),
+        outputLimit(outputLimit) {}
+
+  // Called by the backends on every call and loop iteration.
+  void poll() const {
+    if (preempt->load(std::memory_order_relaxed))
+      throw Preempted();
+  }
+  const std::atomic<bool> *preemptFlag() const { return preempt; }
+
+  void write(const char *p, size_t n);
+  void writeInt(int v);
+  void writeFloat(double v);
+  void writeBool(bool v) { write(v ? "1" : "0", 1); }
+  // println's trailing newline, which also flushes.
+  void endLine() {
+    write("\n", 1);
+    flush();
+  }
+  // Reads the next whitespace-delimited word, like tlrt_input().
+  std::string readWord();
+
+  // tlrt_str_substr, including its range check.
+  std::string substr(std::string_view s, int start, int len);
+
+  // Print "Runtime error: ..." and exit with status 1.
+  [[noreturn]] void runtimeError(const std::string &msg);
+  [[noreturn]] void indexError(long index, long size);
+  [[noreturn]] void sizeError(long size);
+  // Terminate as if killed by `sig`.
+  [[noreturn]] void die(int sig);
+  // Normal exit with `status` (main's return value).
+  [[noreturn]] void exit(int status);
+
+  // Fills in the process result once a ProgramExit has been caught.
+  void finish(int waitStatus, ProcessResult &res);
+
+private:
+  std::string_view in;
+  size_t inPos = 0;
+  std::string out;
+  size_t flushed = 0; // bytes of `out` the native runtime has written(2)
+  std::string err;
+  const std::atomic<bool> *preempt;
+  size_t outputLimit;
+  bool truncated = false;
+
+  // Bytes past the limit are dropped as they are written(2), so `out` never
+  // holds more than the limit plus one buffer.
+  void flush() {
+    if (outputLimit && out.size() > outputLimit) {
+      out.resize(outputLimit);
+      truncated = true;
+    }
+    flushed = out.size();
+  }
+};
+
+// Heap one in-process run may allocate (see HeapLimit).
+constexpr size_t kHeapLimitBytes = size_t(1) << 30;
+
+// Runs `f`; a failed allocation ends the program with the runtime library's
+// "out of memory" error instead of escaping the backend.
+template <class F>
+void reportOutOfMemory(ProgramIO &io, HeapLimit &heap, F &&f) {
+  try {
+    f();
+  } catch (const std::bad_alloc &) {
+    heap.lift();
+    io.runtimeError("out of memory");
+  }
+}
+
+} // namespace tinylang
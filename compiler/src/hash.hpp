@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace tinylang {
+
+// Incremental SHA-256. Used wherever a content hash must be collision
+// resistant (e.g. the compiled-binary cache key).
+class Sha256 {
+public:
+  Sha256();
+  void update(std::string_view data);
+  // Finalizes the digest and returns it as 64 lowercase hex characters.
+  std::string hexDigest();
+
+private:
+  uint32_t state[8];
+  uint8_t block[64];
+  uint64_t totalBytes = 0;
+  size_t blockLen = 0;
+
+  void compress(const uint8_t *chunk);
+};
+
+std::string sha256Hex(std::string_view data);
+
+} // namespace tinylang
@@ -0,0 +1,162 @@
+#include "incremental.hpp"
+#include "lexer.hpp"
+#include "optimizer.hpp"
+#include "parser.hpp"
+#include "semantic.hpp"
+#include <stdexcept>
+
+namespace tinylang {
+
+// How many of the most recent cache entries are searched for functions.
+static constexpr size_t kSnapshots = 3;
+
+namespace {
+
+// A run of top-level source text: one function, or the global statements
+// between two functions.
+struct Chunk {
+  std::string_view text;
+  SourceLocation origin;
+  bool isFunction;
+};
+
+// Cuts `source` at top-level `func` keywords and at the brace closing each
+// function. False if it does not lex or its braces do not balance.
+bool split(std::string_view source, std::vector<Chunk> &chunks) {
+  Lexer lexer(source);
+  lexer.skipInterning();
+  int depth = 0;
+  bool open = false;
+  uint32_t begin = 0, end = 0;
+  auto close = [&] {
+    if (open)
+      chunks.back().text = source.substr(begin, end - begin);
+    open = false;
+  };
+  for (Token t = lexer.next(); t.type != TokenType::EndOfFile;
+       t = lexer.next()) {
+    if (t.type == TokenType::Error)
+      return false;
+    bool startsFunction = depth == 0 && t.type == TokenType::Func;
+    if (startsFunction)
+      close();
+    if (!open) {
+      chunks.push_back({{}, lexer.locate(t), startsFunction});
+      begin = t.offset;
+      open = true;
+    }
+    end = t.offset + t.length;
+    if (t.type == TokenType::LBrace) {
+      ++depth;
+    } else if (t.type == TokenType::RBrace) {
+      if (depth-- == 0)
+        return false;
+      if (depth == 0 && chunks.back().isFunction)
+        close();
+    }
+  }
+  close();
+  return depth == 0;
+}
+
+// Parses one chunk into `arena`.
+std::vector<Node *> parseChunk(const Chunk &chunk, Arena &arena) {
+  Lexer lexer(chunk.text, chunk.origin);
+  Parser parser(lexer);
+  std::vector<Node *> decls = parser.parseDeclarations(arena);
+  if (chunk.isFunction && (decls.size() != 1 || !as<FuncDecl>(decls[0])))
+    throw std::runtime_error("function chunk does not parse alone");
+  return decls;
+}
+
+} // namespace
+
+std::unique_ptr<Program>
+incrementalFrontEnd(std::string_view source, AstCache &cache,
+                    std::vector<FunctionRecord> &functions,
+                    std::vector<PhaseStat> *phases) {
+  auto prog = std::make_unique<Program>();
+  std::vector<Chunk> chunks;
+  // Per declaration: the chunk it came from, and whether it was decoded
+  // already checked and optimized.
+  std::vector<size_t> from;
+  std::vector<bool> reused;
+  functions.clear();
+
+  bool parsed = measurePhase(phases, "parser", [&] {
+    if (!split(source, chunks))
+      return false;
+    std::vector<std::unique_ptr<AstSnapshot>> snapshots;
+    bool searched = false;
+    std::vector<Node *> decls;
+    try {
+      for (size_t i = 0; i < chunks.size(); ++i) {
+        const Chunk &chunk = chunks[i];
+        FunctionRecord record;
+        FuncDecl *found = nullptr;
+        if (chunk.isFunction) {
+          record.text = chunk.text;
+          record.origin = chunk.origin;
+          if (!searched) {
+            snapshots = cache.recent(kSnapshots);
+            searched = true;
+          }
+          for (auto &snapshot : snapshots) {
+            found = snapshot->function(chunk.text, chunk.origin,
+                                       prog->arena, record.deps);
+            if (found)
+              break;
+          }
+        }
+        std::vector<Node *> parts;
+        if (found)
+          parts.push_back(found);
+        else
+          parts = parseChunk(chunk, prog->arena);
+        for (Node *decl : parts) {
+          decls.push_back(decl);
+          from.push_back(i);
+          reused.push_back(found != nullptr);
+          functions.push_back(record);
+        }
+      }
+    } catch (const std::exception &) {
+      return false; // LexError, ParseError
+    }
+    prog->declarations = prog->arena.copy(decls.data(), decls.size());
+    return true;
+  });
+  if (!parsed)
+    return nullptr;
+
+  // A reused function is only valid if everything it relied on still
+  // holds; otherwise it is parsed again, since the decoded tree has been
+  // optimized already.
+  SemanticAnalyzer semantic;
+  measurePhase(phases, "semantic", [&] {
+    semantic.declareFunctions(*prog);
+    for (size_t i = 0; i < prog->declarations.size(); ++i) {
+      FunctionRecord &record = functions[i];
+      if (reused[i]) {
+        if (semantic.holds(record.deps))
+          continue;
+        prog->declarations[i] = parseChunk(chunks[from[i]], prog->arena)[0];
+        reused[i] = false;
+        record.deps = {};
+      }
+      bool isFunction = !record.text.empty();
+      semantic.check(*prog->declarations[i],
+                     isFunction ? &record.deps : nullptr);
+    }
+  });
+
+  Optimizer optimizer;
+  measurePhase(phases, "optimizer", [&] {
+    for (size_t i = 0; i < prog->declarations.size(); ++i)
+      if (!reused[i])
+        optimizer.optimize(*prog->declarations[i]);
+  });
+  return prog;
+}
+
+} // namespace tinylang
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "astcache.hpp"
+#include "phases.hpp"
+#include <memory>
+#include <string_view>
+#include <vector>
+
+namespace tinylang {
+
+// The front end for a source the AST cache has not seen whole, reusing the
+// functions it has seen. The source is cut at top-level `func` keywords; a
+// function whose exact text is indexed in one of the most recent cache
+// entries is decoded from there instead of being parsed, and is neither
+// checked nor optimized again unless a global or a function signature it
+// relied on differs in this program. Global statements are always handled
+// afresh.
+//
+// Fills `functions` (one record per declaration) for AstCache::store().
+// Returns null when the source does not lex or parse piecewise; the caller
+// then runs the whole-program front end, which reports the error. Semantic
+// errors are thrown as usual.
+std::unique_ptr<Program>
+incrementalFrontEnd(std::string_view source, AstCache &cache,
+                    std::vector<FunctionRecord> &functions,
+                    std::vector<PhaseStat> *phases);
+
+} // namespace tinylang
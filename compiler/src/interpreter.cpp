@@ -0,0 +1,754 @@
+#include "interpreter.hpp"
+#include "execution.hpp"
+#include "vmstate.hpp"
+#include <chrono>
+#include <climits>
+#include <exception>
+#include <map>
+#include <memory>
+#include <pthread.h>
+#include <signal.h>
+#include <unordered_map>
+#include <vector>
+
+namespace tinylang {
+
+namespace {
+
+// The interpreter runs on its own thread so deep TinyLang recursion has room.
+// Its call depth is capped at what the stack holds (with a generous per-call
+// allowance); past that we report the SIGSEGV of a native stack overflow. The
+// native limit depends on frame sizes (and g++ may turn the recursion into a
+// loop), so this is only an approximation.
+constexpr size_t kStackBytes = size_t(1) << 30;
+constexpr size_t kMinStackBytes = size_t(8) << 20;
+constexpr size_t kStackBytesPerCall = 4096;
+
+struct Value;
+
+// The elements of an array, unboxed so that an array takes about the memory
+// the compiled program's _tl_arr<elem> does: ints and bools in `ints`,
+// floats in `floats`, strings as StrObj references (nullptr is "").
+struct ArrayData {
+  Kind elem;
+  std::vector<int> ints;
+  std::vector<double> floats;
+  std::vector<StrObj *> strs;
+
+  ArrayData(Kind elem, int n) : elem(elem) {
+    if (elem == Kind::Float)
+      floats.assign(n, 0.0);
+    else if (elem == Kind::Str)
+      strs.assign(n, nullptr);
+    else
+      ints.assign(n, 0);
+  }
+  ArrayData(const ArrayData &o)
+      : elem(o.elem), ints(o.ints), floats(o.floats), strs(o.strs) {
+    for (StrObj *s : strs)
+      retain(s);
+  }
+  ArrayData &operator=(const ArrayData &) = delete;
+  ~ArrayData() {
+    for (StrObj *s : strs)
+      release(s);
+  }
+
+  size_t size() const {
+    return elem == Kind::Float ? floats.size()
+           : elem == Kind::Str ? strs.size()
+                               : ints.size();
+  }
+  Value get(size_t i) const;
+  // `v` must already have the element kind.
+  void set(size_t i, const Value &v);
+};
+
+// Owns an array's elements; copies are deep, like _tl_arr's.
+class ArrayRef {
+public:
+  ArrayRef() = default;
+  ArrayRef(Kind elem, int n) : p(std::make_unique<ArrayData>(elem, n)) {}
+  ArrayRef(const ArrayRef &o)
+      : p(o.p ? std::make_unique<ArrayData>(*o.p) : nullptr) {}
+  ArrayRef(ArrayRef &&) = default;
+  ArrayRef &operator=(const ArrayRef &o) {
+    if (this != &o)
+      p = o.p ? std::make_unique<ArrayData>(*o.p) : nullptr;
+    return *this;
+  }
+  ArrayRef &operator=(ArrayRef &&) = default;
+
+  ArrayData *operator->() const { return p.get(); }
+
+private:
+  std::unique_ptr<ArrayData> p;
+};
+
+// C++ type of a value in the generated program: bool, int, double, _tl_str or
+// _tl_arr<elem>.
+struct Value {
+  Kind kind = Kind::Void;
+  Kind elem = Kind::Void;
+  int i = 0; // Int and Bool
+  double f = 0;
+  std::string s;
+  ArrayRef items; // Array
+
+  static Value ofInt(int v) {
+    Value r;
+    r.kind = Kind::Int;
+    r.i = v;
+    return r;
+  }
+  static Value ofBool(bool v) {
+    Value r;
+    r.kind = Kind::Bool;
+    r.i = v;
+    return r;
+  }
+  static Value ofFloat(double v) {
+    Value r;
+    r.kind = Kind::Float;
+    r.f = v;
+    return r;
+  }
+  static Value ofStr(std::string v) {
+    Value r;
+    r.kind = Kind::Str;
+    r.s = std::move(v);
+    return r;
+  }
+};
+
+Value ArrayData::get(size_t i) const {
+  switch (elem) {
+  case Kind::Float:
+    return Value::ofFloat(floats[i]);
+  case Kind::Str:
+    return Value::ofStr(std::string(view(strs[i])));
+  case Kind::Bool:
+    return Value::ofBool(ints[i]);
+  default:
+    return Value::ofInt(ints[i]);
+  }
+}
+
+void ArrayData::set(size_t i, const Value &v) {
+  if (elem == Kind::Float) {
+    floats[i] = v.f;
+  } else if (elem == Kind::Str) {
+    StrObj *s = makeStr(v.s);
+    release(strs[i]);
+    strs[i] = s;
+  } else {
+    ints[i] = v.i;
+  }
+}
+
+class Interpreter : public ASTVisitor {
+public:
+  Interpreter(std::string_view stdinData, const std::atomic<bool> *preempt,
+              size_t outputLimit, int maxDepth)
+      : heap(kHeapLimitBytes), io(stdinData, preempt, outputLimit),
+        maxDepth(maxDepth) {}
+
+  ProcessResult run(Program &prog);
+
+  void visit(IntLiteral &node) override;
+  void visit(FloatLiteral &node) override;
+  void visit(StringLiteral &node) override;
+  void visit(Variable &node) override;
+  void visit(BinaryExpr &node) override;
+  void visit(UnaryExpr &node) override;
+  void visit(CallExpr &node) override;
+  void visit(VarDecl &node) override;
+  void visit(AssignStmt &node) override;
+  void visit(PrintStmt &node) override;
+  void visit(ExprStmt &node) override;
+  void visit(Block &node) override;
+  void visit(IfStmt &node) override;
+  void visit(ForStmt &node) override;
+  void visit(FuncDecl &node) override;
+  void visit(ReturnStmt &node) override;
+  void visit(Program &node) override;
+  void visit(ArrayAccess &node) override;
+  void visit(TypedVarDecl &node) override;
+
+private:
+  struct Slot {
+    Symbol name;
+    Value value;
+  };
+
+  HeapLimit heap; // first, so that it outlives everything it counts
+  ProgramIO io;
+  int maxDepth;
+
+  std::unordered_map<Symbol, FuncDecl *> funcs;
+  // Result kind of each `auto` function, learned from its first return; used
+  // only to pick the operand evaluation order in binaryOrder().
+  std::map<const FuncDecl *, Kind> autoResults;
+
+  std::vector<Slot> vars;
+  size_t frameBase = 0;
+  int depth = 0;
+
+  Value result;       // value of the last expression visited
+  bool returning = false;
+  Value returnValue;
+
+  Value eval(Expr &e) {
+    e.accept(*this);
+    return std::move(result);
+  }
+  void exec(Stmt &s) { s.accept(*this); }
+  void execBody(Block &body);
+
+  Value &lookup(Symbol name, const Node &at);
+  void declare(Symbol name, Value v) {
+    vars.push_back({name, std::move(v)});
+  }
+
+  Value convert(Value v, Kind to, Kind elem, const Node &at);
+  Value callFunction(FuncDecl &fn, std::vector<Value> args, const Node &at);
+  bool truthy(const Value &v, const Node &at);
+  int toIndex(const Value &v, const Node &at);
+  bool rightToLeft(Expr &left, Expr &right);
+  bool isStringExpr(Expr &e);
+};
+
+[[noreturn]] void rejected(const std::string &msg, const Node &at) {
+  throw InterpretError(msg, at.line, at.col);
+}
+
+Value &Interpreter::lookup(Symbol name, const Node &at) {
+  for (size_t i = vars.size(); i > frameBase; --i)
+    if (vars[i - 1].name == name)
+      return vars[i - 1].value;
+  rejected("'" + name.str() + "' was not declared in this scope", at);
+}
+
+Value Interpreter::convert(Value v, Kind to, Kind elem, const Node &at) {
+  if (to == Kind::Array) {
+    if (v.kind != Kind::Array || v.elem != elem)
+      rejected(std::string("cannot convert '") + cppTypeName(v.kind) +
+                   "' to '_tl_arr'",
+               at);
+    return v;
+  }
+  if (v.kind == to)
+    return v;
+  if (!isNumeric(v.kind) || !isNumeric(to))
+    rejected(std::string("cannot convert '") + cppTypeName(v.kind) + "' to '" +
+                 cppTypeName(to) + "'",
+             at);
+  if (to == Kind::Float)
+    return Value::ofFloat(v.kind == Kind::Float ? v.f : (double)v.i);
+  if (to == Kind::Bool)
+    return Value::ofBool(v.kind == Kind::Float ? v.f != 0 : v.i != 0);
+  return Value::ofInt(v.kind == Kind::Float ? truncToInt(v.f) : v.i);
+}
+
+bool Interpreter::truthy(const Value &v, const Node &at) {
+  if (v.kind == Kind::Float)
+    return v.f != 0;
+  if (v.kind == Kind::Int || v.kind == Kind::Bool)
+    return v.i != 0;
+  rejected(std::string("could not convert '") + cppTypeName(v.kind) +
+               "' to 'bool'",
+           at);
+}
+
+int Interpreter::toIndex(const Value &v, const Node &at) {
+  return convert(v, Kind::Int, Kind::Void, at).i;
+}
+
+bool Interpreter::isStringExpr(Expr &e) {
+  if (as<StringLiteral>(&e))
+    return true;
+  if (auto v = as<Variable>(&e)) {
+    for (size_t i = vars.size(); i > frameBase; --i)
+      if (vars[i - 1].name == v->name)
+        return vars[i - 1].value.kind == Kind::Str;
+    return false;
+  }
+  if (auto a = as<ArrayAccess>(&e)) {
+    for (size_t i = vars.size(); i > frameBase; --i)
+      if (vars[i - 1].name == a->name)
+        return vars[i - 1].value.elem == Kind::Str;
+    return false;
+  }
+  if (auto b = as<BinaryExpr>(&e))
+    return b->op == BinaryOp::Add &&
+           (isStringExpr(*b->left) || isStringExpr(*b->right));
+  if (auto c = as<CallExpr>(&e)) {
+    if (c->callee == sym::Input || c->callee == sym::Substr)
+      return true;
+    if (isBuiltin(c->callee))
+      return false;
+    auto it = funcs.find(c->callee);
+    if (it == funcs.end())
+      return false;
+    if (!it->second->returnType.empty())
+      return it->second->returnType == sym::String;
+    auto res = autoResults.find(it->second);
+    return res != autoResults.end() && res->second == Kind::Str;
+  }
+  return false;
+}
+
+bool Interpreter::rightToLeft(Expr &left, Expr &right) {
+  // Built-in operators on numbers evaluate left to right. String operands
+  // make the operator a call to an overloaded function, whose arguments g++
+  // evaluates right to left.
+  return isStringExpr(left) || isStringExpr(right);
+}
+
+void Interpreter::visit(IntLiteral &node) { result = Value::ofInt(node.value); }
+
+void Interpreter::visit(FloatLiteral &node) {
+  // Codegen prints the literal with std::to_string (six decimals).
+  result = Value::ofFloat(floatLiteralValue(node.value));
+}
+
+void Interpreter::visit(StringLiteral &node) {
+  std::string s;
+  decodeLiteral(node.value, s); // validated by checkDeclarations()
+  result = Value::ofStr(std::move(s));
+}
+
+void Interpreter::visit(Variable &node) { result = lookup(node.name, node); }
+
+void Interpreter::visit(ArrayAccess &node) {
+  Value idx = eval(*node.index);
+  Value &arr = lookup(node.name, node);
+  if (arr.kind != Kind::Array)
+    rejected(std::string("no match for 'operator[]' on '") +
+                 cppTypeName(arr.kind) + "'",
+             node);
+  int i = toIndex(idx, node);
+  if ((unsigned)i >= arr.items->size())
+    io.indexError(i, (long)arr.items->size());
+  result = arr.items->get(i);
+}
+
+void Interpreter::visit(BinaryExpr &node) {
+  Value l, r;
+  if (rightToLeft(*node.left, *node.right)) {
+    r = eval(*node.right);
+    l = eval(*node.left);
+  } else {
+    l = eval(*node.left);
+    r = eval(*node.right);
+  }
+  BinaryOp op = node.op;
+
+  if (l.kind == Kind::Str && r.kind == Kind::Str) {
+    if (op == BinaryOp::Add)
+      result = Value::ofStr(l.s + r.s);
+    else if (isComparison(op))
+      result = Value::ofBool(compare(op, l.s.compare(r.s), 0));
+    else
+      rejected(std::string("no match for 'operator") + spelling(node.op) +
+                   "' on '_tl_str'",
+               node);
+    return;
+  }
+  if (!isNumeric(l.kind) || !isNumeric(r.kind))
+    rejected(std::string("no match for 'operator") + spelling(node.op) +
+                 "' (operand types are '" + cppTypeName(l.kind) + "' and '" +
+                 cppTypeName(r.kind) + "')",
+             node);
+
+  if (l.kind == Kind::Float || r.kind == Kind::Float) {
+    double a = l.kind == Kind::Float ? l.f : l.i;
+    double b = r.kind == Kind::Float ? r.f : r.i;
+    switch (op) {
+    case BinaryOp::Add:
+      result = Value::ofFloat(a + b);
+      return;
+    case BinaryOp::Sub:
+      result = Value::ofFloat(a - b);
+      return;
+    case BinaryOp::Mul:
+      result = Value::ofFloat(a * b);
+      return;
+    case BinaryOp::Div:
+      result = Value::ofFloat(a / b);
+      return;
+    default:
+      if (!isComparison(op))
+        rejected(std::string("invalid operands of types '") +
+                     cppTypeName(l.kind) + "' and '" + cppTypeName(r.kind) +
+                     "' to binary 'operator" + spelling(node.op) + "'",
+                 node);
+      result = Value::ofBool(compare(op, a, b));
+      return;
+    }
+  }
+
+  // int arithmetic wraps, as it does in practice for the native binary.
+  int a = l.i, b = r.i;
+  unsigned ua = (unsigned)a, ub = (unsigned)b;
+  switch (op) {
+  case BinaryOp::Add:
+    result = Value::ofInt((int)(ua + ub));
+    return;
+  case BinaryOp::Sub:
+    result = Value::ofInt((int)(ua - ub));
+    return;
+  case BinaryOp::Mul:
+    result = Value::ofInt((int)(ua * ub));
+    return;
+  case BinaryOp::Div:
+  case BinaryOp::Mod:
+    if (b == 0 || (a == INT_MIN && b == -1))
+      io.die(SIGFPE); // idiv traps
+    result = Value::ofInt(op == BinaryOp::Div ? a / b : a % b);
+    return;
+  default:
+    result = Value::ofBool(compare(op, a, b));
+  }
+}
+
+void Interpreter::visit(UnaryExpr &node) {
+  Value v = eval(*node.operand);
+  if (node.op == UnaryOp::Not) {
+    result = Value::ofBool(!truthy(v, node));
+    return;
+  }
+  if (v.kind == Kind::Float)
+    result = Value::ofFloat(-v.f);
+  else if (v.kind == Kind::Int || v.kind == Kind::Bool)
+    result = Value::ofInt((int)(0u - (unsigned)v.i));
+  else
+    rejected(std::string("no match for 'operator-' on '") +
+                 cppTypeName(v.kind) + "'",
+             node);
+}
+
+void Interpreter::visit(CallExpr &node) {
+  if (node.callee == sym::Input) {
+    result = Value::ofStr(io.readWord());
+    return;
+  }
+
+  // Arguments are evaluated right to left, as g++ does.
+  std::vector<Value> args(node.args.size());
+  for (size_t i = node.args.size(); i-- > 0;)
+    args[i] = eval(*node.args[i]);
+
+  if (node.callee == sym::Len) {
+    result = Value::ofInt(
+        (int)convert(std::move(args[0]), Kind::Str, Kind::Void, node).s.size());
+    return;
+  }
+  if (node.callee == sym::Substr) {
+    std::string s =
+        convert(std::move(args[0]), Kind::Str, Kind::Void, node).s;
+    int start = toIndex(args[1], node);
+    int len = toIndex(args[2], node);
+    result = Value::ofStr(io.substr(s, start, len));
+    return;
+  }
+  if (node.callee == sym::Int || node.callee == sym::Float) {
+    Value &v = args[0];
+    bool toInt = node.callee == sym::Int;
+    if (v.kind == Kind::Str) {
+      result = toInt ? Value::ofInt(strToInt(v.s))
+                     : Value::ofFloat(strToFloat(v.s));
+      return;
+    }
+    result = convert(std::move(v), toInt ? Kind::Int : Kind::Float,
+                     Kind::Void, node);
+    return;
+  }
+
+  auto it = funcs.find(node.callee);
+  if (it == funcs.end())
+    rejected("'" + node.callee.str() + "' was not declared in this scope",
+             node);
+  result = callFunction(*it->second, std::move(args), node);
+}
+
+Value Interpreter::callFunction(FuncDecl &fn, std::vector<Value> args,
+                                const Node &at) {
+  if (args.size() != fn.params.size())
+    rejected("wrong number of arguments to function '" + fn.name.str() + "'",
+             at);
+  Kind ret = Kind::Void;
+  bool autoRet = fn.returnType.empty();
+  if (!autoRet && !kindFromTypeName(fn.returnType, ret))
+    rejected("'" + fn.returnType.str() + "' does not name a type", fn);
+  if (++depth > maxDepth)
+    io.die(SIGSEGV); // the native stack would have overflowed
+  io.poll();
+
+  size_t savedBase = frameBase;
+  size_t mark = vars.size();
+  frameBase = mark;
+  for (size_t i = 0; i < args.size(); ++i) {
+    const auto &param = fn.params[i];
+    Kind k;
+    if (!param.first.empty() && kindFromTypeName(param.first, k))
+      args[i] = convert(std::move(args[i]), k, Kind::Void, fn);
+    declare(param.second, std::move(args[i]));
+  }
+
+  execBody(*fn.body);
+  bool returned = returning;
+  Value v = std::move(returnValue);
+  returning = false;
+  returnValue = Value();
+  vars.erase(vars.begin() + mark, vars.end());
+  frameBase = savedBase;
+  --depth;
+
+  if (autoRet) {
+    // `auto` deduces from the first return; falling off the end means void.
+    if (returned)
+      autoResults.emplace(&fn, v.kind);
+    return returned ? v : Value();
+  }
+  if (ret == Kind::Void) {
+    if (returned)
+      rejected("return-statement with a value, in function returning 'void'",
+               fn);
+    return Value();
+  }
+  if (!returned)
+    return convert(Value::ofInt(0), ret, Kind::Void, fn);
+  return convert(std::move(v), ret, Kind::Void, fn);
+}
+
+void Interpreter::execBody(Block &body) {
+  size_t mark = vars.size();
+  for (auto &stmt : body.statements) {
+    exec(*stmt);
+    if (returning)
+      break;
+  }
+  vars.erase(vars.begin() + mark, vars.end());
+}
+
+void Interpreter::visit(VarDecl &node) {
+  Value v = eval(*node.initializer);
+  if (v.kind == Kind::Void)
+    rejected("variable '" + node.name.str() + "' declared void", node);
+  declare(node.name, std::move(v));
+}
+
+void Interpreter::visit(TypedVarDecl &node) {
+  Kind k = Kind::Int;
+  kindFromTypeName(node.type, k);
+  if (node.isArray) {
+    // Codegen ignores array initializers.
+    Value arr;
+    arr.kind = Kind::Array;
+    arr.elem = k;
+    int n = 0;
+    if (node.arraySize) {
+      n = toIndex(eval(*node.arraySize), node);
+      if (n < 0)
+        io.sizeError(n);
+      if (k == Kind::Void) // value-initializing the elements fails
+        convert(Value::ofInt(0), k, Kind::Void, node);
+    }
+    arr.items = ArrayRef(k, n);
+    declare(node.name, std::move(arr));
+    return;
+  }
+  Value v;
+  if (node.initializer)
+    v = convert(eval(*node.initializer), k, Kind::Void, node);
+  else
+    v = k == Kind::Str ? Value::ofStr("")
+                       : convert(Value::ofInt(0), k, Kind::Void, node);
+  declare(node.name, std::move(v));
+}
+
+void Interpreter::visit(AssignStmt &node) {
+  // C++17 sequences the right-hand side before the target.
+  Value v = eval(*node.value);
+  if (node.index) {
+    Value idx = eval(*node.index);
+    Value &arr = lookup(node.name, node);
+    if (arr.kind != Kind::Array)
+      rejected(std::string("no match for 'operator[]' on '") +
+                   cppTypeName(arr.kind) + "'",
+               node);
+    v = convert(std::move(v), arr.elem, Kind::Void, node);
+    int i = toIndex(idx, node);
+    if ((unsigned)i >= arr.items->size())
+      io.indexError(i, (long)arr.items->size());
+    arr.items->set(i, v);
+    return;
+  }
+  Value &target = lookup(node.name, node);
+  target = convert(std::move(v), target.kind, target.elem, node);
+}
+
+void Interpreter::visit(PrintStmt &node) {
+  Value v = eval(*node.expr);
+  switch (v.kind) {
+  case Kind::Int:
+    io.writeInt(v.i);
+    break;
+  case Kind::Bool:
+    io.writeBool(v.i);
+    break;
+  case Kind::Float:
+    io.writeFloat(v.f);
+    break;
+  case Kind::Str:
+    io.write(v.s.data(), v.s.size());
+    break;
+  default:
+    rejected(std::string("no matching function for call to '_tl_print(") +
+                 cppTypeName(v.kind) + ")'",
+             node);
+  }
+  if (node.newLine)
+    io.endLine();
+}
+
+void Interpreter::visit(ExprStmt &node) { eval(*node.expr); }
+
+void Interpreter::visit(Block &node) { execBody(node); }
+
+void Interpreter::visit(IfStmt &node) {
+  if (truthy(eval(*node.condition), node))
+    exec(*node.thenBranch);
+  else if (node.elseBranch)
+    exec(*node.elseBranch);
+}
+
+void Interpreter::visit(ForStmt &node) {
+  size_t mark = vars.size();
+  if (auto v = as<VarDecl>(node.init)) {
+    // Codegen declares for-loop variables as int.
+    Value init = v->initializer ? eval(*v->initializer) : Value::ofInt(0);
+    declare(v->name, convert(std::move(init), Kind::Int, Kind::Void, *v));
+  } else if (node.init) {
+    exec(*node.init);
+  }
+  while (!node.condition || truthy(eval(*node.condition), node)) {
+    io.poll();
+    exec(*node.body);
+    if (returning)
+      break;
+    if (node.update)
+      exec(*node.update);
+  }
+  vars.erase(vars.begin() + mark, vars.end());
+}
+
+void Interpreter::visit(FuncDecl &) {}
+
+void Interpreter::visit(ReturnStmt &node) {
+  // A bare `return;` is emitted as `return 0;`.
+  returnValue = node.value ? eval(*node.value) : Value::ofInt(0);
+  returning = true;
+}
+
+void Interpreter::visit(Program &node) {
+  FuncDecl *mainFn = nullptr;
+  for (auto &d : node.declarations) {
+    if (auto f = as<FuncDecl>(d)) {
+      funcs[f->name] = f;
+      if (f->name == sym::Main)
+        mainFn = f;
+    }
+  }
+
+  Value status;
+  if (mainFn) {
+    // main is always emitted as `int main()`; global statements are dropped.
+    if (!mainFn->params.empty())
+      rejected("'main' takes no parameters", *mainFn);
+    execBody(*mainFn->body);
+    status = returning ? returnValue : Value::ofInt(0);
+  } else {
+    for (auto &d : node.declarations) {
+      if (as<FuncDecl>(d))
+        continue;
+      exec(static_cast<Stmt &>(*d));
+      if (returning)
+        break;
+    }
+    status = returning ? returnValue : Value::ofInt(0);
+  }
+  int code = convert(std::move(status), Kind::Int, Kind::Void, node).i;
+  io.exit(code);
+}
+
+ProcessResult Interpreter::run(Program &prog) {
+  ProcessResult res;
+  try {
+    reportOutOfMemory(io, heap, [&] { prog.accept(*this); });
+  } catch (const ProgramExit &e) {
+    io.finish(e.waitStatus, res);
+  }
+  return res;
+}
+
+struct Job {
+  Program *prog;
+  std::string_view stdinData;
+  const std::atomic<bool> *preempt;
+  size_t outputLimit;
+  int maxDepth;
+  ProcessResult result;
+  std::exception_ptr error;
+};
+
+void *runJob(void *p) {
+  Job &job = *static_cast<Job *>(p);
+  try {
+    job.result = Interpreter(job.stdinData, job.preempt, job.outputLimit,
+                             job.maxDepth)
+                     .run(*job.prog);
+  } catch (...) {
+    job.error = std::current_exception();
+  }
+  return nullptr;
+}
+
+} // namespace
+
+ProcessResult interpret(Program &prog, std::string_view stdinData,
+                        const std::atomic<bool> *preempt, size_t outputLimit) {
+  checkDeclarations(prog);
+
+  auto start = std::chrono::steady_clock::now();
+  Job job{&prog, stdinData, preempt, outputLimit, 0, {}, nullptr};
+  // Take the largest stack we can get; address-space limits (RLIMIT_AS) may
+  // refuse the first choice.
+  bool ran = false;
+  for (size_t stack = kStackBytes; stack >= kMinStackBytes && !ran;
+       stack /= 2) {
+    job.maxDepth = (int)(stack / kStackBytesPerCall);
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, stack);
+    pthread_t thread;
+    if (pthread_create(&thread, &attr, runJob, &job) == 0) {
+      pthread_join(thread, nullptr);
+      ran = true;
+    }
+    pthread_attr_destroy(&attr);
+  }
+  if (!ran)
+    throw std::runtime_error("could not start interpreter thread");
+  if (job.error)
+    std::rethrow_exception(job.error);
+
+  auto end = std::chrono::steady_clock::now();
+  job.result.wallMs =
+      std::chrono::duration_cast<std::chrono::milliseconds>(end - start)
+          .count();
+  return job.result;
+}
+
+} // namespace tinylang
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "ast.hpp"
+#include "process.hpp"
+#include <atomic>
+#include <stdexcept>
+#include <string_view>
+
+namespace tinylang {
+
+// A program the compiled backend would hand to g++ only to have it rejected
+// (e.g. `%` on floats, comparing a string with a number, calling a function
+// before its definition). Reported in the "codegen" phase, like a g++ error.
+class InterpretError : public std::runtime_error {
+public:
+  int line;
+  int col;
+  InterpretError(const std::string &msg, int l = 0, int c = 0)
+      : std::runtime_error(msg), line(l), col(c) {}
+};
+
+// Executes a parsed and checked program directly, without g++.
+//
+// The result is what running the compiled binary would have produced:
+// stdout/stderr bytes, exit status (including `return` from main) and, for
+// integer division by zero or runaway recursion, the signal the native
+// program dies from. Behaviour mirrors the generated C++ and the runtime
+// library, down to operand evaluation order, `%g` float formatting and stdout
+// that was still buffered when a signal hit being lost.
+//
+// Throws InterpretError before or during execution for programs g++ would
+// not have compiled, and Preempted once `preempt` is set. Only the first
+// `outputLimit` bytes of stdout are kept (0: all).
+ProcessResult interpret(Program &prog, std::string_view stdinData,
+                        const std::atomic<bool> *preempt = nullptr,
+                        size_t outputLimit = 0);
+
+} // namespace tinylang
@@ -0,0 +1,704 @@
+#include "jit.hpp"
+#include "vmstate.hpp"
+#include <chrono>
+#include <cstddef>
+#include <cstring>
+#include <exception>
+#include <initializer_list>
+#include <signal.h>
+#include <stdexcept>
+#include <vector>
+
+#if defined(__x86_64__)
+#include <sys/mman.h>
+#endif
+
+namespace tinylang {
+
+#if defined(__x86_64__)
+
+namespace {
+
+// Generated code keeps the register base of the current frame in rbx, the
+// JitContext in r12 and the current JitFrame in r13. TinyLang calls are
+// native call/ret pairs (so return addresses are predicted) on a stack of our
+// own, sized for kMaxCallDepth 16-byte frames plus room for the helpers.
+struct JitFrame {
+  Reg *base;
+  uint32_t dest; // byte offset of the result register in the caller
+  uint32_t fn;
+};
+static_assert(sizeof(JitFrame) == 16 && offsetof(JitFrame, dest) == 8 &&
+                  offsetof(JitFrame, fn) == 12,
+              "frame layout is hard-coded in the emitter");
+
+constexpr size_t kStackBytes = 16 * kMaxCallDepth + (size_t(1) << 20);
+
+struct JitContext {
+  void *savedRsp;
+  const Reg *regsEnd;
+  const JitFrame *framesEnd;
+  const JitFrame *frames;
+  void *stackTop;
+  const std::atomic<bool> *preempt;
+  VmState *st;
+  JitFrame *top; // innermost live frame once the program has ended
+  int waitStatus;
+  std::exception_ptr *error;
+};
+static_assert(offsetof(JitContext, regsEnd) == 8 &&
+                  offsetof(JitContext, framesEnd) == 16 &&
+                  offsetof(JitContext, frames) == 24 &&
+                  offsetof(JitContext, stackTop) == 32 &&
+                  offsetof(JitContext, preempt) == 40,
+              "context layout is hard-coded in the emitter");
+
+// The native stack generated code runs on. Pages are only committed as deep
+// as the program recurses.
+class JitStack {
+public:
+  JitStack() {
+    mem = mmap(nullptr, kStackBytes, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1,
+               0);
+    if (mem == MAP_FAILED)
+      throw std::bad_alloc();
+  }
+  ~JitStack() { munmap(mem, kStackBytes); }
+  JitStack(const JitStack &) = delete;
+  JitStack &operator=(const JitStack &) = delete;
+
+  void *top() const { return static_cast<char *>(mem) + kStackBytes; }
+
+private:
+  void *mem;
+};
+
+// Called from generated code. A nonzero result means the program has ended
+// (ProgramExit, or a C++ exception stored in ctx->error) and the generated
+// code leaves through the exit stub.
+using Helper = int (*)(JitContext *ctx, Reg *R, const Instr *in,
+                       JitFrame *top);
+
+template <class F> int guarded(JitContext *ctx, JitFrame *top, F f) noexcept {
+  try {
+    reportOutOfMemory(ctx->st->io, ctx->st->heap, f);
+    return 0;
+  } catch (const ProgramExit &e) {
+    ctx->waitStatus = e.waitStatus;
+  } catch (...) {
+    *ctx->error = std::current_exception();
+  }
+  ctx->top = top;
+  return 1;
+}
+
+int jitExecute(JitContext *ctx, Reg *R, const Instr *in, JitFrame *top) {
+  return guarded(ctx, top, [&] { ctx->st->execute(*in, R); });
+}
+
+int jitExitMain(JitContext *ctx, Reg *R, const Instr *in, JitFrame *top) {
+  return guarded(ctx, top, [&] {
+    ctx->st->io.exit(in->op == Opcode::Ret ? R[in->a].i : 0);
+  });
+}
+
+int jitStackOverflow(JitContext *ctx, Reg *, const Instr *, JitFrame *top) {
+  return guarded(ctx, top, [&] { ctx->st->io.die(SIGSEGV); });
+}
+
+int jitPreempted(JitContext *ctx, Reg *, const Instr *, JitFrame *top) {
+  return guarded(ctx, top, [] { throw Preempted(); });
+}
+
+// Return from a frame that owns strings or arrays, or returns one. Stores the
+// result in the caller; the generated code then pops the frame.
+int jitReturn(JitContext *ctx, Reg *R, const Instr *in, JitFrame *top) {
+  const FunctionInfo &fn = ctx->st->fns[top->fn];
+  Reg v{};
+  if (in->op == Opcode::Ret) {
+    v = R[in->a];
+    if (fn.result == Kind::Str || fn.result == Kind::Array)
+      R[in->a].s = nullptr; // moved out of the frame
+  }
+  ctx->st->releaseFrame(fn, R);
+  Reg &dest = (top - 1)->base[top->dest / sizeof(Reg)];
+  if (fn.result == Kind::Str)
+    setStr(dest, v.s);
+  else if (fn.result == Kind::Array)
+    setArr(dest, v.arr);
+  else if (fn.result != Kind::Void)
+    dest = v;
+  return 0;
+}
+
+int32_t jumpOffset(const Instr &in) {
+  switch (in.op) {
+  case Opcode::Jmp:
+  case Opcode::JmpIfZero:
+  case Opcode::JmpIfNotZero:
+    return in.imm();
+  case Opcode::BrEqI:
+  case Opcode::BrNeI:
+  case Opcode::BrLtI:
+  case Opcode::BrLeI:
+  case Opcode::BrGtI:
+  case Opcode::BrGeI:
+    return in.shortC();
+  default:
+    return 0;
+  }
+}
+
+// x86-64 register numbers.
+enum : uint8_t { RAX, RCX, RDX, RBX };
+
+class Emitter {
+public:
+  std::vector<uint8_t> buf;
+
+  size_t pos() const { return buf.size(); }
+  void bytes(std::initializer_list<uint8_t> b) {
+    buf.insert(buf.end(), b);
+  }
+  void u32(uint32_t v) {
+    for (int i = 0; i < 4; ++i)
+      buf.push_back(uint8_t(v >> (8 * i)));
+  }
+  void u64(uint64_t v) {
+    u32(uint32_t(v));
+    u32(uint32_t(v >> 32));
+  }
+
+  // `op` (prefixes and opcode) with a ModRM operand [base + disp32], where
+  // base is rbx (a frame register) or rdx (the callee's frame).
+  void mem(std::initializer_list<uint8_t> op, uint8_t reg, uint8_t base,
+           uint32_t disp) {
+    bytes(op);
+    buf.push_back(uint8_t(0x80 | reg << 3 | base));
+    u32(disp);
+  }
+  // Same, addressing register `slot` of the current frame.
+  void slot(std::initializer_list<uint8_t> op, uint8_t reg, uint16_t r) {
+    mem(op, reg, RBX, r * sizeof(Reg));
+  }
+
+  // Placeholder for a rel8 / rel32 displacement, patched by bind*().
+  size_t rel8() {
+    buf.push_back(0);
+    return pos() - 1;
+  }
+  size_t rel32() {
+    u32(0);
+    return pos() - 4;
+  }
+  void bind8(size_t at) { bind8(at, pos()); }
+  void bind8(size_t at, size_t target) {
+    long d = long(target) - long(at + 1);
+    if (d < -128 || d > 127)
+      throw std::logic_error("jit: short branch out of range");
+    buf[at] = uint8_t(d);
+  }
+  void bind32(size_t at, size_t target) {
+    uint32_t d = uint32_t(long(target) - long(at + 4));
+    for (int i = 0; i < 4; ++i)
+      buf[at + i] = uint8_t(d >> (8 * i));
+  }
+};
+
+class Compiler {
+public:
+  explicit Compiler(const BcProgram &prog) : prog(prog) {
+    for (const auto &f : prog.functions)
+      fns.emplace_back(f);
+  }
+
+  // Returns the machine code and the offset of main's entry.
+  std::vector<uint8_t> compile(size_t &mainOffset);
+
+private:
+  const BcProgram &prog;
+  std::vector<FunctionInfo> fns;
+  Emitter e;
+  size_t exitStub = 0;
+  size_t overflowStub = 0;
+  size_t preemptStub = 0;
+  std::vector<size_t> entries;                        // per function
+  std::vector<std::pair<size_t, uint32_t>> callFixups; // rel32, function
+
+  void emitStubs();
+  void emitFunction(uint32_t index);
+  void callHelper(Helper h, const Instr *in);
+  void poll();
+  void loadI(uint8_t reg, uint16_t r) { e.slot({0x8B}, reg, r); }
+  // Ints are stored as 8 bytes (the 32-bit result zero-extended) so that the
+  // full-width loads of Move and argument passing forward from the store.
+  void storeI(uint8_t reg, uint16_t r) { e.slot({0x48, 0x89}, reg, r); }
+  void loadQ(uint8_t reg, uint16_t r) { e.slot({0x48, 0x8B}, reg, r); }
+  void storeQ(uint8_t reg, uint16_t r) { e.slot({0x48, 0x89}, reg, r); }
+  void loadSd(uint16_t r) { e.slot({0xF2, 0x0F, 0x10}, 0, r); }
+  void storeSd(uint16_t r) { e.slot({0xF2, 0x0F, 0x11}, 0, r); }
+  // movzx eax, al; mov [a], rax
+  void storeFlag(uint16_t r) {
+    e.bytes({0x0F, 0xB6, 0xC0});
+    storeI(RAX, r);
+  }
+  void emitCall(const Instr &in, const FunctionInfo &caller,
+                const FunctionInfo &callee);
+  void emitReturn(const Instr &in, uint32_t index, const FunctionInfo &fn);
+};
+
+void Compiler::emitStubs() {
+  // void entry(JitContext *ctx, Reg *base, JitFrame *frame, const void *code)
+  e.bytes({0x53, 0x55, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x41, 0x57});
+  e.bytes({0x48, 0x83, 0xEC, 0x08}); // sub rsp, 8 (16-byte alignment)
+  e.bytes({0x48, 0x89, 0x27});       // mov [rdi], rsp
+  e.bytes({0x48, 0x8B, 0x67, 0x20}); // mov rsp, [rdi + 32]
+  e.bytes({0x49, 0x89, 0xFC});       // mov r12, rdi
+  e.bytes({0x48, 0x89, 0xF3});       // mov rbx, rsi
+  e.bytes({0x49, 0x89, 0xD5});       // mov r13, rdx
+  e.bytes({0xFF, 0xD1});             // call rcx (main never returns)
+
+  exitStub = e.pos();
+  e.bytes({0x49, 0x8B, 0x24, 0x24}); // mov rsp, [r12]
+  e.bytes({0x48, 0x83, 0xC4, 0x08}); // add rsp, 8
+  e.bytes({0x41, 0x5F, 0x41, 0x5E, 0x41, 0x5D, 0x41, 0x5C, 0x5D, 0x5B, 0xC3});
+
+  overflowStub = e.pos();
+  callHelper(jitStackOverflow, nullptr);
+  preemptStub = e.pos();
+  callHelper(jitPreempted, nullptr);
+}
+
+// Function entries and loop heads check ctx->preempt.
+void Compiler::poll() {
+  e.bytes({0x49, 0x8B, 0x44, 0x24, 0x28}); // mov rax, [r12 + 40]
+  e.bytes({0x80, 0x38, 0x00, 0x0F, 0x85}); // cmp byte [rax], 0; jne
+  e.bind32(e.rel32(), preemptStub);
+}
+
+void Compiler::callHelper(Helper h, const Instr *in) {
+  e.bytes({0x4C, 0x89, 0xE7}); // mov rdi, r12
+  e.bytes({0x48, 0x89, 0xDE}); // mov rsi, rbx
+  e.bytes({0x48, 0xBA});       // mov rdx, in
+  e.u64(reinterpret_cast<uint64_t>(in));
+  e.bytes({0x4C, 0x89, 0xE9}); // mov rcx, r13
+  e.bytes({0x48, 0xB8});       // mov rax, h
+  e.u64(reinterpret_cast<uint64_t>(h));
+  e.bytes({0xFF, 0xD0, 0x85, 0xC0, 0x0F, 0x85}); // call rax; test; jnz
+  e.bind32(e.rel32(), exitStub);
+}
+
+void Compiler::emitCall(const Instr &in, const FunctionInfo &caller,
+                        const FunctionInfo &callee) {
+  uint32_t frameBytes = caller.numRegs * sizeof(Reg);
+  e.mem({0x48, 0x8D}, RDX, RBX, frameBytes); // lea rdx, [rbx + frame]
+  e.mem({0x48, 0x8D}, RAX, RDX, callee.numRegs * sizeof(Reg));
+  e.bytes({0x49, 0x3B, 0x44, 0x24, 0x08, 0x0F, 0x87}); // cmp rax, regsEnd; ja
+  e.bind32(e.rel32(), overflowStub);
+  e.bytes({0x49, 0x8D, 0x45, 0x10});                   // lea rax, [r13 + 16]
+  e.bytes({0x49, 0x3B, 0x44, 0x24, 0x10, 0x0F, 0x83}); // cmp framesEnd; jae
+  e.bind32(e.rel32(), overflowStub);
+
+  // Arguments move into the callee's parameter registers.
+  for (uint16_t i = 0; i < callee.numParams; ++i) {
+    loadQ(RAX, in.c + i);
+    e.mem({0x48, 0x89}, RAX, RDX, i * sizeof(Reg));
+  }
+  for (uint16_t r : callee.refParams) {
+    e.slot({0x48, 0xC7}, 0, in.c + r);
+    e.u32(0);
+  }
+  for (uint16_t r : callee.refLocals) {
+    e.mem({0x48, 0xC7}, 0, RDX, r * sizeof(Reg));
+    e.u32(0);
+  }
+
+  e.bytes({0x49, 0x83, 0xC5, 0x10}); // add r13, 16
+  e.bytes({0x49, 0x89, 0x55, 0x00}); // mov [r13], rdx
+  e.bytes({0x41, 0xC7, 0x45, 0x08}); // mov dword [r13 + 8], dest
+  e.u32(in.a * sizeof(Reg));
+  e.bytes({0x41, 0xC7, 0x45, 0x0C}); // mov dword [r13 + 12], fn
+  e.u32(in.b);
+  e.bytes({0x48, 0x89, 0xD3, 0xE8}); // mov rbx, rdx; call callee
+  callFixups.emplace_back(e.rel32(), in.b);
+}
+
+void Compiler::emitReturn(const Instr &in, uint32_t index,
+                          const FunctionInfo &fn) {
+  if (index == 0) {
+    e.bytes({0x4D, 0x3B, 0x6C, 0x24, 0x18, 0x75}); // cmp r13, frames; jne
+    size_t nested = e.rel8();
+    callHelper(jitExitMain, &in);
+    e.bind8(nested);
+  }
+  bool owns = !fn.strRegs.empty() || !fn.arrRegs.empty() ||
+              fn.result == Kind::Str || fn.result == Kind::Array;
+  bool value = in.op == Opcode::Ret && !owns;
+  if (owns)
+    callHelper(jitReturn, &in);
+  if (value) {
+    loadQ(RAX, in.a);
+    e.bytes({0x41, 0x8B, 0x55, 0x08}); // mov edx, [r13 + 8]
+  }
+  e.bytes({0x49, 0x83, 0xED, 0x10});   // sub r13, 16
+  e.bytes({0x49, 0x8B, 0x5D, 0x00});   // mov rbx, [r13]
+  if (value)
+    e.bytes({0x48, 0x89, 0x04, 0x13}); // mov [rbx + rdx], rax
+  e.bytes({0x48, 0x83, 0xC4, 0x08, 0xC3}); // add rsp, 8; ret
+}
+
+void Compiler::emitFunction(uint32_t index) {
+  const BcFunction &bf = prog.functions[index];
+  const FunctionInfo &info = fns[index];
+  entries[index] = e.pos();
+  e.bytes({0x48, 0x83, 0xEC, 0x08}); // sub rsp, 8 (16-byte alignment)
+  poll();
+  std::vector<size_t> offsets(bf.code.size() + 1);
+  std::vector<std::pair<size_t, size_t>> jumps; // rel32, instruction
+
+  // Targets of backward jumps are loop heads.
+  std::vector<bool> loopHead(bf.code.size() + 1);
+  for (size_t pc = 0; pc < bf.code.size(); ++pc)
+    if (int32_t off = jumpOffset(bf.code[pc]); off < 0)
+      loopHead[pc + 1 + off] = true;
+
+  for (size_t pc = 0; pc < bf.code.size(); ++pc) {
+    offsets[pc] = e.pos();
+    if (loopHead[pc])
+      poll();
+    const Instr &in = bf.code[pc];
+    auto branch = [&](std::initializer_list<uint8_t> jcc, int32_t off) {
+      e.bytes(jcc);
+      jumps.emplace_back(e.rel32(), pc + 1 + off);
+    };
+    auto intBinary = [&](std::initializer_list<uint8_t> op) {
+      loadI(RAX, in.b);
+      e.slot(op, RAX, in.c);
+      storeI(RAX, in.a);
+    };
+    auto floatBinary = [&](uint8_t op) {
+      loadSd(in.b);
+      e.slot({0xF2, 0x0F, op}, 0, in.c);
+      storeSd(in.a);
+    };
+    auto intCompare = [&](uint8_t setcc) {
+      loadI(RAX, in.b);
+      e.slot({0x3B}, RAX, in.c);
+      e.bytes({0x0F, setcc, 0xC0});
+      storeFlag(in.a);
+    };
+    // ucomisd sets CF/ZF like an unsigned compare and PF when unordered, so
+    // a/ae give false for NaN. Lt and Le swap the operands.
+    auto floatCompare = [&](uint16_t x, uint16_t y, uint8_t setcc) {
+      loadSd(x);
+      e.slot({0x66, 0x0F, 0x2E}, 0, y);
+      e.bytes({0x0F, setcc, 0xC0});
+      storeFlag(in.a);
+    };
+    auto floatEquality = [&](bool eq) {
+      e.bytes({0x0F, uint8_t(eq ? 0x94 : 0x95), 0xC0}); // sete/setne al
+      e.bytes({0x0F, uint8_t(eq ? 0x9B : 0x9A), 0xC1}); // setnp/setp cl
+      e.bytes({uint8_t(eq ? 0x20 : 0x08), 0xC8});       // and/or al, cl
+      storeFlag(in.a);
+    };
+    auto intTest = [&](uint8_t setcc) {
+      e.slot({0x83}, 7, in.b); // cmp dword [b], 0
+      e.bytes({0x00, 0x0F, setcc, 0xC0});
+      storeFlag(in.a);
+    };
+    auto floatTest = [&](bool eq) {
+      loadSd(in.b);
+      e.bytes({0x66, 0x0F, 0x57, 0xC9, 0x66, 0x0F, 0x2E, 0xC1}); // vs 0.0
+      floatEquality(eq);
+    };
+    auto slowPath = [&](size_t jcc) {
+      e.bytes({0xEB}); // jmp done
+      size_t done = e.rel8();
+      e.bind8(jcc);
+      callHelper(jitExecute, &in);
+      e.bind8(done);
+    };
+
+    switch (in.op) {
+    case Opcode::LoadInt:
+      e.slot({0x48, 0xC7}, 0, in.a);
+      e.u32(uint32_t(in.imm()));
+      break;
+    case Opcode::LoadFloat: {
+      uint64_t bits;
+      std::memcpy(&bits, &prog.floats[in.b], sizeof bits);
+      e.bytes({0x48, 0xB8});
+      e.u64(bits);
+      storeQ(RAX, in.a);
+      break;
+    }
+    case Opcode::Move:
+      loadQ(RAX, in.b);
+      storeQ(RAX, in.a);
+      break;
+
+    case Opcode::AddI:
+      intBinary({0x03});
+      break;
+    case Opcode::SubI:
+      intBinary({0x2B});
+      break;
+    case Opcode::MulI:
+      intBinary({0x0F, 0xAF});
+      break;
+    case Opcode::AddIK:
+      loadI(RAX, in.b);
+      e.bytes({0x05});
+      e.u32(uint32_t(int32_t(in.shortC())));
+      storeI(RAX, in.a);
+      break;
+    case Opcode::DivI:
+    case Opcode::ModI: {
+      // Divisors 0 and -1 take the VM's checked path.
+      loadI(RCX, in.c);
+      e.bytes({0x8D, 0x51, 0x01, 0x83, 0xFA, 0x01, 0x76}); // c + 1 <= 1u
+      size_t slow = e.rel8();
+      loadI(RAX, in.b);
+      e.bytes({0x99, 0xF7, 0xF9}); // cdq; idiv ecx
+      storeI(in.op == Opcode::DivI ? RAX : RDX, in.a);
+      slowPath(slow);
+      break;
+    }
+    case Opcode::NegI:
+      loadI(RAX, in.b);
+      e.bytes({0xF7, 0xD8});
+      storeI(RAX, in.a);
+      break;
+    case Opcode::NotI:
+      intTest(0x94);
+      break;
+
+    case Opcode::AddF:
+      floatBinary(0x58);
+      break;
+    case Opcode::SubF:
+      floatBinary(0x5C);
+      break;
+    case Opcode::MulF:
+      floatBinary(0x59);
+      break;
+    case Opcode::DivF:
+      floatBinary(0x5E);
+      break;
+    case Opcode::NegF:
+      loadQ(RAX, in.b);
+      e.bytes({0x48, 0x0F, 0xBA, 0xF8, 0x3F}); // btc rax, 63
+      storeQ(RAX, in.a);
+      break;
+    case Opcode::NotF:
+      floatTest(true);
+      break;
+
+    case Opcode::EqI:
+      intCompare(0x94);
+      break;
+    case Opcode::NeI:
+      intCompare(0x95);
+      break;
+    case Opcode::LtI:
+      intCompare(0x9C);
+      break;
+    case Opcode::LeI:
+      intCompare(0x9E);
+      break;
+    case Opcode::GtI:
+      intCompare(0x9F);
+      break;
+    case Opcode::GeI:
+      intCompare(0x9D);
+      break;
+    case Opcode::EqF:
+    case Opcode::NeF:
+      loadSd(in.b);
+      e.slot({0x66, 0x0F, 0x2E}, 0, in.c);
+      floatEquality(in.op == Opcode::EqF);
+      break;
+    case Opcode::LtF:
+      floatCompare(in.c, in.b, 0x97);
+      break;
+    case Opcode::LeF:
+      floatCompare(in.c, in.b, 0x93);
+      break;
+    case Opcode::GtF:
+      floatCompare(in.b, in.c, 0x97);
+      break;
+    case Opcode::GeF:
+      floatCompare(in.b, in.c, 0x93);
+      break;
+
+    case Opcode::IntToFloat:
+      e.bytes({0x0F, 0x57, 0xC0}); // xorps xmm0, xmm0
+      e.slot({0xF2, 0x0F, 0x2A}, 0, in.b);
+      storeSd(in.a);
+      break;
+    case Opcode::FloatToInt:
+      // Out of range and NaN give INT_MIN, as truncToInt() does.
+      e.slot({0xF2, 0x0F, 0x2C}, RAX, in.b);
+      storeI(RAX, in.a);
+      break;
+    case Opcode::IntToBool:
+      intTest(0x95);
+      break;
+    case Opcode::FloatToBool:
+      floatTest(false);
+      break;
+
+    case Opcode::GetArr: {
+      loadQ(RCX, in.b);
+      loadI(RDX, in.c);
+      e.bytes({0x3B, 0x11, 0x73}); // cmp edx, [rcx] (size); jae
+      size_t slow = e.rel8();
+      e.bytes({0x48, 0x8B, 0x44, 0xD1, 0x08}); // mov rax, [rcx + rdx*8 + 8]
+      storeQ(RAX, in.a);
+      slowPath(slow);
+      break;
+    }
+    case Opcode::SetArr: {
+      loadQ(RCX, in.a);
+      loadI(RDX, in.b);
+      e.bytes({0x3B, 0x11, 0x73});
+      size_t slow = e.rel8();
+      loadQ(RAX, in.c);
+      e.bytes({0x48, 0x89, 0x44, 0xD1, 0x08}); // mov [rcx + rdx*8 + 8], rax
+      slowPath(slow);
+      break;
+    }
+
+    case Opcode::Jmp:
+      branch({0xE9}, in.imm());
+      break;
+    case Opcode::JmpIfZero:
+    case Opcode::JmpIfNotZero:
+      e.slot({0x83}, 7, in.a);
+      e.bytes({0x00});
+      branch({0x0F, uint8_t(in.op == Opcode::JmpIfZero ? 0x84 : 0x85)},
+             in.imm());
+      break;
+    case Opcode::BrEqI:
+    case Opcode::BrNeI:
+    case Opcode::BrLtI:
+    case Opcode::BrLeI:
+    case Opcode::BrGtI:
+    case Opcode::BrGeI: {
+      static const uint8_t jcc[] = {0x84, 0x85, 0x8C, 0x8E, 0x8F, 0x8D};
+      loadI(RAX, in.a);
+      e.slot({0x3B}, RAX, in.b);
+      branch({0x0F, jcc[(int)in.op - (int)Opcode::BrEqI]}, in.shortC());
+      break;
+    }
+
+    case Opcode::Call:
+      emitCall(in, info, fns[in.b]);
+      break;
+    case Opcode::Ret:
+    case Opcode::RetVoid:
+      emitReturn(in, index, info);
+      break;
+
+    default: // strings, array allocation and I/O
+      callHelper(jitExecute, &in);
+      break;
+    }
+  }
+  offsets[bf.code.size()] = e.pos();
+  for (auto [at, target] : jumps)
+    e.bind32(at, offsets[target]);
+}
+
+std::vector<uint8_t> Compiler::compile(size_t &mainOffset) {
+  emitStubs();
+  entries.resize(prog.functions.size());
+  for (uint32_t i = 0; i < prog.functions.size(); ++i)
+    emitFunction(i);
+  for (auto [at, fn] : callFixups)
+    e.bind32(at, entries[fn]);
+  mainOffset = entries[0];
+  return std::move(e.buf);
+}
+
+} // namespace
+
+std::unique_ptr<JitProgram> JitProgram::compile(const BcProgram &prog) {
+  size_t mainOffset;
+  std::vector<uint8_t> code = Compiler(prog).compile(mainOffset);
+  void *mem = mmap(nullptr, code.size(), PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mem == MAP_FAILED)
+    return nullptr;
+  std::memcpy(mem, code.data(), code.size());
+  if (mprotect(mem, code.size(), PROT_READ | PROT_EXEC) != 0) {
+    munmap(mem, code.size());
+    return nullptr;
+  }
+  std::unique_ptr<JitProgram> jit(new JitProgram(prog));
+  jit->code = mem;
+  jit->codeSize = code.size();
+  jit->mainOffset = mainOffset;
+  return jit;
+}
+
+JitProgram::~JitProgram() {
+  if (code)
+    munmap(code, codeSize);
+}
+
+ProcessResult JitProgram::run(std::string_view stdinData,
+                              const std::atomic<bool> *preempt,
+                              size_t outputLimit) const {
+  auto start = std::chrono::steady_clock::now();
+  VmState st(prog, stdinData, preempt, outputLimit);
+  std::unique_ptr<JitFrame[]> frames(new JitFrame[kMaxCallDepth]);
+  JitStack stack;
+  std::exception_ptr error;
+  JitContext ctx{};
+  ctx.regsEnd = st.regs.get() + kRegisterSlots;
+  ctx.framesEnd = frames.get() + kMaxCallDepth;
+  ctx.frames = frames.get();
+  ctx.stackTop = stack.top();
+  ctx.preempt = st.io.preemptFlag();
+  ctx.st = &st;
+  ctx.error = &error;
+  Reg *R = st.regs.get();
+  for (uint16_t r : st.fns[0].refLocals)
+    R[r].s = nullptr;
+  frames[0] = JitFrame{R, 0, 0};
+
+  using Entry = void (*)(JitContext *, Reg *, JitFrame *, const void *);
+  auto *base = static_cast<const uint8_t *>(code);
+  reinterpret_cast<Entry>(code)(&ctx, R, frames.get(), base + mainOffset);
+
+  for (JitFrame *f = ctx.top; f >= frames.get(); --f)
+    st.releaseFrame(st.fns[f->fn], f->base);
+  if (error)
+    std::rethrow_exception(error);
+  ProcessResult res;
+  st.io.finish(ctx.waitStatus, res);
+  auto end = std::chrono::steady_clock::now();
+  res.wallMs =
+      std::chrono::duration_cast<std::chrono::milliseconds>(end - start)
+          .count();
+  return res;
+}
+
+#else
+
+std::unique_ptr<JitProgram> JitProgram::compile(const BcProgram &) {
+  return nullptr;
+}
+
+JitProgram::~JitProgram() = default;
+
+ProcessResult JitProgram::run(std::string_view,
+                              const std::atomic<bool> *) const {
+  throw std::logic_error("JitProgram::run: no native code generator");
+}
+
+#endif
+
+} // namespace tinylang
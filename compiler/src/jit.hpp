@@ -0,0 +1,39 @@
+#pragma once
+
+#include "bytecode.hpp"
+#include "process.hpp"
+#include <atomic>
+#include <memory>
+#include <string_view>
+
+namespace tinylang {
+
+// Bytecode from lower() translated to x86-64 machine code in executable
+// memory. Arithmetic, comparisons, branches, array indexing and calls run as
+// native instructions on the same register file the VM uses; strings, array
+// allocation and I/O call into the VM's implementation. Behaviour is that of
+// runBytecode().
+class JitProgram {
+public:
+  // nullptr where native code cannot be generated (not x86-64, or the system
+  // refuses executable mappings); use runBytecode() instead. `prog` must
+  // outlive the result.
+  static std::unique_ptr<JitProgram> compile(const BcProgram &prog);
+  ~JitProgram();
+
+  // Throws Preempted once `preempt` is set, checked on every call and loop
+  // iteration. Only the first `outputLimit` bytes of stdout are kept (0: all).
+  ProcessResult run(std::string_view stdinData,
+                    const std::atomic<bool> *preempt = nullptr,
+                    size_t outputLimit = 0) const;
+
+private:
+  JitProgram(const BcProgram &prog) : prog(prog) {}
+
+  const BcProgram &prog;
+  void *code = nullptr;
+  size_t codeSize = 0;
+  size_t mainOffset = 0;
+};
+
+} // namespace tinylang
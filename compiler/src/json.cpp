@@ -0,0 +1,408 @@
+#include "json.hpp"
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+namespace tinylang {
+
+class JsonParser {
+public:
+  explicit JsonParser(std::string_view text) : text(text) {}
+
+  JsonValue parseDocument() {
+    JsonValue v = value(0);
+    skipWhitespace();
+    if (pos != text.size())
+      fail("Trailing characters after JSON value");
+    return v;
+  }
+
+private:
+  static constexpr int kMaxDepth = 256;
+  std::string_view text;
+  size_t pos = 0;
+
+  [[noreturn]] void fail(const std::string &msg) { throw JsonError(msg, pos); }
+
+  void skipWhitespace() {
+    while (pos < text.size() && (text[pos] == ' ' || text[pos] == '\t' ||
+                                 text[pos] == '\n' || text[pos] == '\r'))
+      pos++;
+  }
+
+  bool consumeLiteral(std::string_view lit) {
+    if (text.substr(pos, lit.size()) == lit) {
+      pos += lit.size();
+      return true;
+    }
+    return false;
+  }
+
+  JsonValue value(int depth) {
+    if (depth > kMaxDepth)
+      fail("JSON nested too deeply");
+    skipWhitespace();
+    if (pos >= text.size())
+      fail("Unexpected end of JSON");
+
+    JsonValue v;
+    char c = text[pos];
+    if (c == '{') {
+      v.k = JsonValue::Kind::Object;
+      pos++;
+      skipWhitespace();
+      if (pos < text.size() && text[pos] == '}') {
+        pos++;
+        return v;
+      }
+      while (true) {
+        skipWhitespace();
+        if (pos >= text.size() || text[pos] != '"')
+          fail("Expected object key");
+        std::string key = string();
+        skipWhitespace();
+        if (pos >= text.size() || text[pos] != ':')
+          fail("Expected ':'");
+        pos++;
+        v.object[key] = value(depth + 1);
+        skipWhitespace();
+        if (pos < text.size() && text[pos] == ',') {
+          pos++;
+          continue;
+        }
+        if (pos < text.size() && text[pos] == '}') {
+          pos++;
+          return v;
+        }
+        fail("Expected ',' or '}'");
+      }
+    }
+    if (c == '[') {
+      v.k = JsonValue::Kind::Array;
+      pos++;
+      skipWhitespace();
+      if (pos < text.size() && text[pos] == ']') {
+        pos++;
+        return v;
+      }
+      while (true) {
+        v.array.push_back(value(depth + 1));
+        skipWhitespace();
+        if (pos < text.size() && text[pos] == ',') {
+          pos++;
+          continue;
+        }
+        if (pos < text.size() && text[pos] == ']') {
+          pos++;
+          return v;
+        }
+        fail("Expected ',' or ']'");
+      }
+    }
+    if (c == '"') {
+      v.k = JsonValue::Kind::String;
+      v.str = string();
+      return v;
+    }
+    if (consumeLiteral("true")) {
+      v.k = JsonValue::Kind::Bool;
+      v.boolean = true;
+      return v;
+    }
+    if (consumeLiteral("false")) {
+      v.k = JsonValue::Kind::Bool;
+      return v;
+    }
+    if (consumeLiteral("null"))
+      return v;
+    if (c == '-' || (c >= '0' && c <= '9')) {
+      v.k = JsonValue::Kind::Number;
+      v.number = number();
+      return v;
+    }
+    std::string msg = "Unexpected character '";
+    msg += c;
+    msg += '\'';
+    fail(msg);
+  }
+
+  double number() {
+    size_t start = pos;
+    if (text[pos] == '-')
+      pos++;
+    auto digits = [&] {
+      size_t s = pos;
+      while (pos < text.size() && text[pos] >= '0' && text[pos] <= '9')
+        pos++;
+      if (pos == s)
+        fail("Malformed number");
+    };
+    digits();
+    if (pos < text.size() && text[pos] == '.') {
+      pos++;
+      digits();
+    }
+    if (pos < text.size() && (text[pos] == 'e' || text[pos] == 'E')) {
+      pos++;
+      if (pos < text.size() && (text[pos] == '+' || text[pos] == '-'))
+        pos++;
+      digits();
+    }
+    std::string num(text.substr(start, pos - start));
+    return std::strtod(num.c_str(), nullptr);
+  }
+
+  unsigned hex4() {
+    if (pos + 4 > text.size())
+      fail("Truncated \\u escape");
+    unsigned cp = 0;
+    for (int i = 0; i < 4; ++i) {
+      char h = text[pos++];
+      cp <<= 4;
+      if (h >= '0' && h <= '9')
+        cp |= h - '0';
+      else if (h >= 'a' && h <= 'f')
+        cp |= h - 'a' + 10;
+      else if (h >= 'A' && h <= 'F')
+        cp |= h - 'A' + 10;
+      else
+        fail("Invalid \\u escape");
+    }
+    return cp;
+  }
+
+  static void appendUtf8(std::string &out, unsigned cp) {
+    if (cp < 0x80) {
+      out += (char)cp;
+    } else if (cp < 0x800) {
+      out += (char)(0xC0 | (cp >> 6));
+      out += (char)(0x80 | (cp & 0x3F));
+    } else if (cp < 0x10000) {
+      out += (char)(0xE0 | (cp >> 12));
+      out += (char)(0x80 | ((cp >> 6) & 0x3F));
+      out += (char)(0x80 | (cp & 0x3F));
+    } else {
+      out += (char)(0xF0 | (cp >> 18));
+      out += (char)(0x80 | ((cp >> 12) & 0x3F));
+      out += (char)(0x80 | ((cp >> 6) & 0x3F));
+      out += (char)(0x80 | (cp & 0x3F));
+    }
+  }
+
+  std::string string() {
+    pos++; // opening quote
+    std::string out;
+    while (true) {
+      if (pos >= text.size())
+        fail("Unterminated string");
+      char c = text[pos++];
+      if (c == '"')
+        return out;
+      if (c != '\\') {
+        out += c;
+        continue;
+      }
+      if (pos >= text.size())
+        fail("Unterminated escape");
+      char e = text[pos++];
+      switch (e) {
+      case '"':
+      case '\\':
+      case '/':
+        out += e;
+        break;
+      case 'b':
+        out += '\b';
+        break;
+      case 'f':
+        out += '\f';
+        break;
+      case 'n':
+        out += '\n';
+        break;
+      case 'r':
+        out += '\r';
+        break;
+      case 't':
+        out += '\t';
+        break;
+      case 'u': {
+        unsigned cp = hex4();
+        if (cp >= 0xD800 && cp <= 0xDBFF && consumeLiteral("\\u")) {
+          unsigned lo = hex4();
+          if (lo >= 0xDC00 && lo <= 0xDFFF)
+            cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+          else
+            fail("Invalid surrogate pair");
+        }
+        appendUtf8(out, cp);
+        break;
+      }
+      default:
+        fail("Invalid escape");
+      }
+    }
+  }
+};
+
+JsonValue JsonValue::parse(std::string_view text) {
+  return JsonParser(text).parseDocument();
+}
+
+bool JsonValue::asBool(bool fallback) const {
+  return k == Kind::Bool ? boolean : fallback;
+}
+
+double JsonValue::asNumber(double fallback) const {
+  return k == Kind::Number ? number : fallback;
+}
+
+const std::string &JsonValue::asString() const {
+  static const std::string empty;
+  return k == Kind::String ? str : empty;
+}
+
+const JsonValue &JsonValue::operator[](const std::string &key) const {
+  static const JsonValue null;
+  if (k != Kind::Object)
+    return null;
+  auto it = object.find(key);
+  return it == object.end() ? null : it->second;
+}
+
+bool JsonValue::has(const std::string &key) const {
+  return k == Kind::Object && object.count(key) > 0;
+}
+
+static std::string quoted(std::string_view s) {
+  std::string out;
+  out += '"';
+  out += jsonEscape(s);
+  out += '"';
+  return out;
+}
+
+std::string JsonValue::dump() const {
+  switch (k) {
+  case Kind::Null:
+    return "null";
+  case Kind::Bool:
+    return boolean ? "true" : "false";
+  case Kind::Number: {
+    if (!std::isfinite(number))
+      return "null";
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "%.17g", number);
+    return buf;
+  }
+  case Kind::String:
+    return quoted(str);
+  case Kind::Array: {
+    std::string s = "[";
+    for (size_t i = 0; i < array.size(); ++i) {
+      if (i)
+        s += ",";
+      s += array[i].dump();
+    }
+    return s + "]";
+  }
+  case Kind::Object: {
+    std::string s = "{";
+    bool first = true;
+    for (const auto &[key, val] : object) {
+      if (!first)
+        s += ",";
+      first = false;
+      s += quoted(key);
+      s += ':';
+      s += val.dump();
+    }
+    return s + "}";
+  }
+  }
+  return "null";
+}
+
+// Length of the well-formed UTF-8 sequence starting at s[i] (no overlong
+// forms or surrogates), or 0.
+static size_t utf8Length(std::string_view s, size_t i) {
+  auto byte = [&](size_t k) { return (unsigned char)s[i + k]; };
+  unsigned char c = byte(0);
+  size_t n;
+  unsigned char lo = 0x80, hi = 0xBF; // range of the second byte
+  if (c >= 0xC2 && c <= 0xDF)
+    n = 2;
+  else if (c >= 0xE0 && c <= 0xEF) {
+    n = 3;
+    if (c == 0xE0)
+      lo = 0xA0;
+    else if (c == 0xED)
+      hi = 0x9F;
+  } else if (c >= 0xF0 && c <= 0xF4) {
+    n = 4;
+    if (c == 0xF0)
+      lo = 0x90;
+    else if (c == 0xF4)
+      hi = 0x8F;
+  } else
+    return 0;
+  if (s.size() - i < n || byte(1) < lo || byte(1) > hi)
+    return 0;
+  for (size_t k = 2; k < n; ++k)
+    if (byte(k) < 0x80 || byte(k) > 0xBF)
+      return 0;
+  return n;
+}
+
+// Passes `s` to `out(data, size)` escaped, in runs of bytes that need no
+// escaping separated by escape sequences.
+template <class Out> static void escapeTo(std::string_view s, Out &&out) {
+  size_t run = 0, i = 0;
+  auto replace = [&](const char *esc, size_t len) {
+    out(s.data() + run, i - run);
+    out(esc, len);
+    run = ++i;
+  };
+  while (i < s.size()) {
+    unsigned char c = (unsigned char)s[i];
+    if (c >= 0x20 && c < 0x80 && c != '"' && c != '\\') {
+      ++i;
+    } else if (c >= 0x80) {
+      if (size_t n = utf8Length(s, i))
+        i += n;
+      else
+        replace("\\ufffd", 6);
+    } else if (c == '"') {
+      replace("\\\"", 2);
+    } else if (c == '\\') {
+      replace("\\\\", 2);
+    } else if (c == '\n') {
+      replace("\\n", 2);
+    } else if (c == '\r') {
+      replace("\\r", 2);
+    } else if (c == '\t') {
+      replace("\\t", 2);
+    } else {
+      char buf[8];
+      std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+      replace(buf, 6);
+    }
+  }
+  out(s.data() + run, i - run);
+}
+
+std::string jsonEscape(std::string_view s) {
+  std::string res;
+  res.reserve(s.size());
+  escapeTo(s, [&](const char *p, size_t n) { res.append(p, n); });
+  return res;
+}
+
+void writeJsonString(std::ostream &os, std::string_view s) {
+  os << '"';
+  escapeTo(s,
+           [&](const char *p, size_t n) { os.write(p, (std::streamsize)n); });
+  os << '"';
+}
+
+} // namespace tinylang
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <map>
+#include <memory>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace tinylang {
+
+class JsonError : public std::runtime_error {
+public:
+  size_t offset;
+  JsonError(const std::string &msg, size_t off)
+      : std::runtime_error(msg), offset(off) {}
+};
+
+// Minimal JSON document model, sufficient for the --serve request protocol
+// and judge manifests.
+class JsonValue {
+public:
+  enum class Kind { Null, Bool, Number, String, Array, Object };
+
+  JsonValue() = default;
+
+  static JsonValue parse(std::string_view text);
+
+  Kind kind() const { return k; }
+  bool isNull() const { return k == Kind::Null; }
+  bool isString() const { return k == Kind::String; }
+  bool isObject() const { return k == Kind::Object; }
+  bool isArray() const { return k == Kind::Array; }
+
+  // Typed accessors return `fallback` when the value has another kind.
+  bool asBool(bool fallback = false) const;
+  double asNumber(double fallback = 0) const;
+  const std::string &asString() const;
+
+  // Object member lookup; returns a Null value when absent.
+  const JsonValue &operator[](const std::string &key) const;
+  bool has(const std::string &key) const;
+  const std::vector<JsonValue> &items() const { return array; }
+
+  // Re-serializes the value compactly (used to echo request ids).
+  std::string dump() const;
+
+private:
+  Kind k = Kind::Null;
+  bool boolean = false;
+  double number = 0;
+  std::string str;
+  std::vector<JsonValue> array;
+  std::map<std::string, JsonValue> object;
+
+  friend class JsonParser;
+};
+
+// Escapes `s` for inclusion between double quotes in a JSON document. Control
+// characters become \u escapes and bytes that are not valid UTF-8 become
+// U+FFFD, so any byte string yields valid JSON.
+std::string jsonEscape(std::string_view s);
+// Writes `s` to `os` as a quoted, escaped JSON string, copying unescaped runs
+// straight through instead of building the escaped string first.
+void writeJsonString(std::ostream &os, std::string_view s);
+
+} // namespace tinylang
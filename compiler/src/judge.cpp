@@ -0,0 +1,301 @@
+#include "judge.hpp"
+#include "json.hpp"
+#include "process.hpp"
+#include "workdir.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fcntl.h>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <unistd.h>
+
+namespace tinylang {
+
+namespace {
+
+std::string readFile(const std::string &path) {
+  std::ifstream f(path, std::ios::binary);
+  if (!f)
+    throw std::runtime_error("Could not open file: " + path);
+  std::stringstream buffer;
+  buffer << f.rdbuf();
+  return buffer.str();
+}
+
+// Drops the whitespace at the end of every line and the blank lines at the
+// end of the text, passing everything else on one character at a time. Only
+// whitespace that might still turn out to be trailing is held back.
+class TrailingSpaceFilter {
+public:
+  template <class Emit> void feed(std::string_view text, Emit &&emit) {
+    for (char c : text) {
+      if (c == '\n') {
+        ++newlines;
+        blanks.clear();
+      } else if (c == ' ' || c == '\t' || c == '\r') {
+        blanks.push_back(c);
+      } else {
+        for (; newlines; --newlines)
+          emit('\n');
+        for (char b : blanks)
+          emit(b);
+        blanks.clear();
+        emit(c);
+      }
+    }
+  }
+
+private:
+  size_t newlines = 0;
+  std::string blanks; // since the last held-back newline
+};
+
+// Matches program output against the expected text as it arrives, so only
+// the expected side is ever held in memory.
+class OutputComparator {
+public:
+  explicit OutputComparator(std::string_view expected) {
+    TrailingSpaceFilter().feed(expected, [&](char c) { want.push_back(c); });
+  }
+
+  void feed(std::string_view chunk) {
+    if (!diverged)
+      filter.feed(chunk, [&](char c) {
+        if (diverged)
+          return;
+        if (pos == want.size() || want[pos] != c) {
+          diverged = true;
+          return;
+        }
+        if (c == '\n')
+          ++line;
+        ++pos;
+      });
+  }
+
+  // Empty when the output matched.
+  std::string finish() const {
+    if (diverged && pos == want.size())
+      return "extra output at line " + std::to_string(line);
+    if (diverged)
+      return "output differs at line " + std::to_string(line);
+    if (pos != want.size())
+      return "output ends early at line " +
+             std::to_string(line + (want[pos] == '\n'));
+    return "";
+  }
+
+private:
+  std::string want;
+  TrailingSpaceFilter filter;
+  size_t pos = 0; // length of the matched prefix of `want`
+  int line = 1;
+  bool diverged = false;
+};
+
+CaseVerdict runCase(const std::string &exePath, const JudgeCase &c,
+                    size_t outputLimit) {
+  std::optional<OutputComparator> cmp;
+  ProcessOptions program;
+  program.argv = {exePath};
+  int stdinFd = -1;
+  if (!c.stdinFile.empty()) {
+    stdinFd = ::open(c.stdinFile.c_str(), O_RDONLY | O_CLOEXEC);
+    if (stdinFd < 0) {
+      CaseVerdict v;
+      v.name = c.name;
+      v.verdict = "runtime_error";
+      v.message = "Could not open file: " + c.stdinFile;
+      return v;
+    }
+  }
+  program.stdinData = c.stdinContent;
+  program.stdinFd = stdinFd;
+  program.captureLimit = outputLimit;
+  program.timeLimitMs = c.timeLimitMs;
+  program.memoryLimitBytes = (size_t)c.memoryLimitMb << 20;
+  program.trackMemory = true;
+  program.countInstructions = true;
+  if (c.expected) {
+    cmp.emplace(*c.expected);
+    program.onStdout = [&](std::string_view chunk) { cmp->feed(chunk); };
+  }
+  ProcessResult ran = runProcess(program);
+  if (stdinFd >= 0)
+    ::close(stdinFd);
+
+  CaseVerdict v;
+  v.name = c.name;
+  v.exit_code = ran.exitCode();
+  v.time_ms = ran.wallMs;
+  v.memory_kb = ran.usage.peakRssKb;
+  if (ran.started)
+    v.usage = ran.usage;
+  v.stdout_str = std::move(ran.out);
+  v.stderr_str = std::move(ran.err);
+  v.truncated = ran.truncated;
+  if (!ran.started) {
+    v.verdict = "runtime_error";
+    v.message = "Could not start program: " + ran.error;
+  } else if (ran.timedOut) {
+    v.verdict = "time_limit_exceeded";
+  } else if (v.exit_code != 0) {
+    // The runtime reports exhausted memory (here: RLIMIT_AS) this way.
+    bool oom = v.stderr_str.starts_with("Runtime error: out of memory");
+    v.verdict = oom && c.memoryLimitMb ? "memory_limit_exceeded"
+                                       : "runtime_error";
+    if (ran.signaled())
+      v.message = ran.signalDescription();
+  } else if (cmp) {
+    v.message = cmp->finish();
+    v.verdict = v.message.empty() ? "accepted" : "wrong_answer";
+  } else {
+    v.verdict = "ok";
+  }
+  return v;
+}
+
+// The limits a manifest may set, with the same bounds as a daemon request:
+// at most a day, and a terabyte.
+long timeLimit(const JsonValue &obj, long fallback) {
+  double ms = obj["time_limit_ms"].asNumber((double)fallback);
+  if (!(ms >= 1 && ms <= 24 * 3600 * 1000.0)) // also rejects NaN
+    throw std::runtime_error("manifest \"time_limit_ms\" must be a positive "
+                             "number of milliseconds, at most a day");
+  return (long)ms;
+}
+
+long memoryLimit(const JsonValue &obj, long fallback) {
+  double mb = obj["memory_limit_mb"].asNumber((double)fallback);
+  if (!(mb >= 1 && mb <= 1 << 20))
+    throw std::runtime_error("manifest \"memory_limit_mb\" must be a "
+                             "positive number of MiB, at most 1048576");
+  return (long)mb;
+}
+
+} // namespace
+
+std::vector<JudgeCase> parseJudgeManifest(const std::string &json,
+                                          const std::string &baseDir) {
+  JsonValue doc = JsonValue::parse(json);
+  if (!doc.isObject() || !doc["cases"].isArray())
+    throw std::runtime_error("manifest must be an object with a \"cases\" "
+                             "array");
+  auto resolve = [&](const std::string &path) {
+    return path.starts_with("/") || baseDir.empty() ? path
+                                                    : baseDir + "/" + path;
+  };
+  JudgeCase defaults;
+  defaults.timeLimitMs = timeLimit(doc, defaults.timeLimitMs);
+  defaults.memoryLimitMb = memoryLimit(doc, defaults.memoryLimitMb);
+
+  std::vector<JudgeCase> cases;
+  for (const JsonValue &item : doc["cases"].items()) {
+    if (!item.isObject())
+      throw std::runtime_error("manifest cases must be objects");
+    JudgeCase c = defaults;
+    c.name = item["name"].isString() ? item["name"].asString()
+                                     : std::to_string(cases.size() + 1);
+    if (item.has("stdin_file")) {
+      c.stdinFile = resolve(item["stdin_file"].asString());
+      if (::access(c.stdinFile.c_str(), R_OK) != 0)
+        throw std::runtime_error("Could not open file: " + c.stdinFile);
+    } else {
+      c.stdinContent = item["stdin"].asString();
+    }
+    if (item.has("expected_file"))
+      c.expected = readFile(resolve(item["expected_file"].asString()));
+    else if (item["expected"].isString())
+      c.expected = item["expected"].asString();
+    c.timeLimitMs = timeLimit(item, c.timeLimitMs);
+    c.memoryLimitMb = memoryLimit(item, c.memoryLimitMb);
+    cases.push_back(std::move(c));
+  }
+  return cases;
+}
+
+JudgeReport judge(const RunRequest &req, const std::vector<JudgeCase> &cases,
+                  int workers,
+                  const std::function<void(const CaseVerdict &)> &onVerdict) {
+  auto start = std::chrono::steady_clock::now();
+  JudgeReport report;
+  report.cases = cases.size();
+
+  ScratchDir scratch;
+  RunRequest build = req;
+  build.run = false;
+  build.backend = Backend::Compile;
+  build.outputPath = scratch.file("prog");
+  report.build = runPipeline(build);
+  if (!report.build.success)
+    return report;
+
+  if (workers <= 0)
+    workers = (int)std::max(1u, std::thread::hardware_concurrency());
+  workers = (int)std::min<size_t>((size_t)workers, cases.size());
+
+  std::atomic<size_t> next{0};
+  std::mutex mu; // serializes onVerdict
+  std::vector<std::thread> threads;
+  for (int i = 0; i < workers; ++i)
+    threads.emplace_back([&] {
+      for (size_t k; (k = next++) < cases.size();) {
+        CaseVerdict v =
+            runCase(build.outputPath, cases[k], req.outputLimit);
+        v.index = k;
+        std::lock_guard<std::mutex> lock(mu);
+        if (v.passed())
+          ++report.passed;
+        onVerdict(v);
+      }
+    });
+  for (auto &t : threads)
+    t.join();
+
+  auto end = std::chrono::steady_clock::now();
+  report.build.time_ms =
+      std::chrono::duration_cast<std::chrono::milliseconds>(end - start)
+          .count();
+  return report;
+}
+
+void writeJson(std::ostream &os, const CaseVerdict &v) {
+  os << "{\"case\":" << v.index << ",\"name\":";
+  writeJsonString(os, v.name);
+  os << ",\"verdict\":\"" << v.verdict << "\"";
+  if (!v.message.empty()) {
+    os << ",\"message\":";
+    writeJsonString(os, v.message);
+  }
+  os << ",\"stdout\":";
+  writeJsonString(os, v.stdout_str);
+  os << ",\"stderr\":";
+  writeJsonString(os, v.stderr_str);
+  if (v.truncated)
+    os << ",\"truncated\":true";
+  os << ",\"exit_code\":" << v.exit_code << ",\"time_ms\":" << v.time_ms;
+  if (v.memory_kb >= 0)
+    os << ",\"memory_kb\":" << v.memory_kb;
+  if (v.usage) {
+    os << ",\"usage\":";
+    writeJson(os, *v.usage);
+  }
+  os << "}";
+}
+
+void writeJson(std::ostream &os, const JudgeReport &r) {
+  if (!r.build.success) {
+    writeJson(os, r.build, false);
+    return;
+  }
+  os << "{\"success\":true,\"compile_errors\":[],\"cases\":" << r.cases
+     << ",\"passed\":" << r.passed
+     << ",\"cache_hit\":" << (r.build.cache_hit ? "true" : "false")
+     << ",\"time_ms\":" << r.build.time_ms << "}";
+}
+
+} // namespace tinylang
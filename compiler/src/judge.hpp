@@ -0,0 +1,81 @@
+#pragma once
+
+#include "pipeline.hpp"
+#include <functional>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace tinylang {
+
+// One input of a judge manifest.
+struct JudgeCase {
+  std::string name;
+  std::string stdinContent;
+  // When set, stdin is this file instead of stdinContent; each run gets its
+  // own descriptor, so large inputs are never copied through the judge.
+  std::string stdinFile;
+  // What the program must print. Without it the output is reported as is.
+  std::optional<std::string> expected;
+  long timeLimitMs = 2000;
+  long memoryLimitMb = 256;
+};
+
+// Reads a manifest of the form
+//   {"time_limit_ms": 2000, "memory_limit_mb": 256,
+//    "cases": [{"name": "small", "stdin": "3\n", "expected": "6\n"},
+//              {"stdin_file": "big.in", "expected_file": "big.out",
+//               "time_limit_ms": 5000}]}
+// Top-level limits are defaults for every case; "name" defaults to the case's
+// position. Limits must be positive: at most a day and 1048576 MiB. Relative
+// *_file paths are resolved against `baseDir`. Throws JsonError for
+// malformed JSON and std::runtime_error for a bad manifest.
+std::vector<JudgeCase> parseJudgeManifest(const std::string &json,
+                                          const std::string &baseDir);
+
+struct CaseVerdict {
+  size_t index = 0;
+  std::string name;
+  // "accepted", "wrong_answer", "runtime_error", "time_limit_exceeded",
+  // "memory_limit_exceeded", or "ok" for a case without expected output
+  // that ran successfully.
+  std::string verdict;
+  // Where the output first differs, for wrong answers.
+  std::string message;
+  int exit_code = 0;
+  long time_ms = 0;
+  // Peak resident set size; -1 if it could not be measured.
+  long memory_kb = 0;
+  std::optional<ResourceUsage> usage;
+  // Only kept for cases without expected output.
+  std::string stdout_str;
+  std::string stderr_str;
+  // Output beyond RunRequest::outputLimit was dropped.
+  bool truncated = false;
+
+  bool passed() const { return verdict == "accepted" || verdict == "ok"; }
+};
+
+struct JudgeReport {
+  // The compile step; when it failed no case ran.
+  RunResult build;
+  size_t cases = 0;
+  size_t passed = 0;
+};
+
+// Compiles `req.source` once (through the cache, like runPipeline) and runs
+// the binary on every case, `workers` processes at a time (0: one per core).
+// `onVerdict` is called as each case finishes, in completion order and never
+// concurrently. Output is compared while it streams in, ignoring whitespace
+// at the ends of lines and blank lines at the end.
+JudgeReport judge(const RunRequest &req, const std::vector<JudgeCase> &cases,
+                  int workers,
+                  const std::function<void(const CaseVerdict &)> &onVerdict);
+
+// Single-line JSON objects, one per verdict followed by one for the report,
+// forming the newline-delimited stream printed by --judge.
+void writeJson(std::ostream &os, const CaseVerdict &v);
+void writeJson(std::ostream &os, const JudgeReport &r);
+
+} // namespace tinylang
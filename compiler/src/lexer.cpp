@@ -1,10 +1,78 @@
 #include "lexer.hpp"
+#include "scan.hpp"
+#include <algorithm>
 #include <cctype>
-#include <unordered_map>
+#include <array>
+#include <stdexcept>
 
 namespace tinylang {
 
-Lexer::Lexer(std::string source) : source(std::move(source)) {}
+namespace {
+
+constexpr KeywordInfo kKeywords[] = {
+    {"func", TokenType::Func},       {"let", TokenType::Let},
+    {"print", TokenType::Print},     {"println", TokenType::Println},
+    {"for", TokenType::For},         {"if", TokenType::If},
+    {"else", TokenType::Else},       {"return", TokenType::Return},
+    {"int", TokenType::Identifier},  {"float", TokenType::Identifier},
+    {"void", TokenType::Identifier}, {"string", TokenType::Identifier}};
+
+// Words are hashed on their length and first and last characters, with a
+// multiplier searched for at compile time so that no two keywords share a
+// slot. Adding a keyword that makes the search fail is a compile error.
+constexpr size_t kKeywordSlots = 32;
+
+constexpr size_t keywordHash(std::string_view w, unsigned mul) {
+  return ((unsigned char)w.front() * mul + (unsigned char)w.back() +
+          w.size()) %
+         kKeywordSlots;
+}
+
+constexpr bool keywordsCollide(unsigned mul) {
+  std::array<bool, kKeywordSlots> used{};
+  for (const KeywordInfo &k : kKeywords) {
+    size_t h = keywordHash(k.text, mul);
+    if (used[h])
+      return true;
+    used[h] = true;
+  }
+  return false;
+}
+
+constexpr unsigned findMultiplier() {
+  for (unsigned mul = 1; mul < 1024; ++mul)
+    if (!keywordsCollide(mul))
+      return mul;
+  return 0;
+}
+
+constexpr unsigned kKeywordMul = findMultiplier();
+static_assert(kKeywordMul != 0, "no perfect hash for the keyword set");
+
+// Slot -> index into kKeywords + 1, or 0 for an empty slot.
+constexpr auto kKeywordTable = [] {
+  std::array<uint8_t, kKeywordSlots> table{};
+  for (size_t i = 0; i < std::size(kKeywords); ++i)
+    table[keywordHash(kKeywords[i].text, kKeywordMul)] = (uint8_t)(i + 1);
+  return table;
+}();
+
+} // namespace
+
+const KeywordInfo *findKeyword(std::string_view word) {
+  if (word.empty())
+    return nullptr;
+  uint8_t slot = kKeywordTable[keywordHash(word, kKeywordMul)];
+  if (slot == 0 || kKeywords[slot - 1].text != word)
+    return nullptr;
+  return &kKeywords[slot - 1];
+}
+
+Lexer::Lexer(std::string_view source, SourceLocation origin)
+    : source(source), origin(origin) {
+  if (source.size() >= UINT32_MAX)
+    throw std::length_error("source file too large");
+}
 
 char Lexer::peek(int offset) const {
   if (pos + offset >= source.length())
@@ -12,17 +80,6 @@ char Lexer::peek(int offset) const {
   return source[pos + offset];
 }
 
-char Lexer::advance() {
-  char c = source[pos++];
-  if (c == '\n') {
-    line++;
-    col = 1;
-  } else {
-    col++;
-  }
-  return c;
-}
-
 bool Lexer::match(char expected) {
   if (peek() == expected) {
     advance();
@@ -32,174 +89,124 @@ bool Lexer::match(char expected) {
 }
 
 void Lexer::skipWhitespace() {
-  while (true) {
-    char c = peek();
-    if (isspace(c)) {
-      advance();
-    } else {
-      break;
-    }
-  }
+  if (pos < source.length() && isspace(source[pos]))
+    pos = skipSpace(source.data() + pos, end()) - source.data();
 }
 
-Token Lexer::makeToken(TokenType type, std::string text) {
-  // Correct tracking: token position is start, but we advanced.
-  // Simplified: we will just capture current line/col at start of token
-  // For now, let's fixup slightly in tokenize loop
-  return {type, text, line, col};
+SourceLocation Lexer::locate(const Token &t) const {
+  if (lineStarts.empty()) {
+    lineStarts.push_back(0);
+    findLineStarts(source, lineStarts);
+  }
+  auto next = std::upper_bound(lineStarts.begin(), lineStarts.end(), t.offset);
+  int line = (int)(next - lineStarts.begin());
+  int col = (int)(t.offset - next[-1]) + 1;
+  if (line == 1)
+    col += origin.col - 1;
+  return {origin.line + line - 1, col};
 }
 
 std::vector<Token> Lexer::tokenize() {
   std::vector<Token> tokens;
+  do
+    tokens.push_back(next());
+  while (tokens.back().type != TokenType::EndOfFile);
+  return tokens;
+}
 
-  while (pos < source.length()) {
+Token Lexer::next() {
+  for (;;) {
     skipWhitespace();
     if (pos >= source.length())
-      break;
-
-    int startLine = line;
-    int startCol = col;
+      return {TokenType::EndOfFile, (uint32_t)source.size(), 0, Symbol()};
 
+    size_t start = pos;
     char c = advance();
 
-    // Lambda to easily push token with correct start pos
-    auto push = [&](TokenType type, std::string text) {
-      tokens.push_back({type, text, startLine, startCol});
+    // The token spanning everything consumed since `start`.
+    auto token = [&](TokenType type) -> Token {
+      return {type, (uint32_t)start, (uint32_t)(pos - start), Symbol()};
     };
 
     if (isdigit(c)) {
-      std::string numStr;
-      numStr += c;
       bool isFloat = false;
       while (isdigit(peek()))
-        numStr += advance();
+        advance();
       if (peek() == '.') {
         isFloat = true;
-        numStr += advance(); // consume dot
+        advance(); // consume dot
         while (isdigit(peek()))
-          numStr += advance();
+          advance();
       }
-      if (isFloat)
-        push(TokenType::Float, numStr);
-      else
-        push(TokenType::Number, numStr);
-      continue;
+      return token(isFloat ? TokenType::Float : TokenType::Number);
     }
 
     if (c == '"') {
-      // String literal
-      std::string val;
-      while (peek() != '"' && peek() != '\0') {
-        val += advance();
-      }
+      // String literal; the token is its contents, without the quotes.
+      pos = findStringEnd(source.data() + pos, end()) - source.data();
+      Token t{TokenType::StringLiteral, (uint32_t)start + 1,
+              (uint32_t)(pos - start - 1), Symbol()};
       if (peek() == '"')
         advance(); // closing quote
-      push(TokenType::StringLiteral, val);
-      continue;
+      return t;
     }
 
     if (isalpha(c) || c == '_') {
-      std::string idStr;
-      idStr += c;
-      while (isalnum(peek()) || peek() == '_')
-        idStr += advance();
-
-      static const std::unordered_map<std::string, TokenType> keywords = {
-          {"func", TokenType::Func},   {"let", TokenType::Let},
-          {"print", TokenType::Print}, {"println", TokenType::Println},
-          {"for", TokenType::For},     {"if", TokenType::If},
-          {"else", TokenType::Else},   {"return", TokenType::Return}};
-
-      if (keywords.count(idStr)) {
-        push(keywords.at(idStr), idStr);
-      } else {
-        push(TokenType::Identifier, idStr);
-      }
-      continue;
+      pos = skipIdentifier(source.data() + pos, end()) - source.data();
+      const KeywordInfo *kw = findKeyword(source.substr(start, pos - start));
+      if (kw && kw->type != TokenType::Identifier)
+        return token(kw->type);
+      Token t = token(TokenType::Identifier);
+      if (interning)
+        t.symbol = Symbol(text(t));
+      return t;
     }
 
     switch (c) {
     case '(':
-      push(TokenType::LParen, "(");
-      break;
+      return token(TokenType::LParen);
     case ')':
-      push(TokenType::RParen, ")");
-      break;
+      return token(TokenType::RParen);
     case '{':
-      push(TokenType::LBrace, "{");
-      break;
+      return token(TokenType::LBrace);
     case '}':
-      push(TokenType::RBrace, "}");
-      break;
+      return token(TokenType::RBrace);
     case '[':
-      push(TokenType::LBracket, "[");
-      break;
+      return token(TokenType::LBracket);
     case ']':
-      push(TokenType::RBracket, "]");
-      break;
+      return token(TokenType::RBracket);
     case ';':
-      push(TokenType::Semicolon, ";");
-      break;
+      return token(TokenType::Semicolon);
     case ',':
-      push(TokenType::Comma, ",");
-      break;
+      return token(TokenType::Comma);
     case '+':
-      push(TokenType::Plus, "+");
-      break;
+      return token(TokenType::Plus);
     case '-':
-      if (match('>'))
-        push(TokenType::Arrow, "->");
-      else
-        push(TokenType::Minus, "-");
-      break;
+      return token(match('>') ? TokenType::Arrow : TokenType::Minus);
     case '*':
-      push(TokenType::Star, "*");
-      break;
+      return token(TokenType::Star);
     case '/':
       if (match('/')) {
         // Comment: skip until end of line
-        while (peek() != '\n' && peek() != '\0')
-          advance();
-      } else {
-        push(TokenType::Slash, "/");
+        pos = findLineEnd(source.data() + pos, end()) - source.data();
+        continue;
       }
-      break;
+      return token(TokenType::Slash);
     case '%':
-      push(TokenType::Mod, "%");
-      break;
+      return token(TokenType::Mod);
     case '=':
-      if (match('='))
-        push(TokenType::Equals, "==");
-      else
-        push(TokenType::Assign, "=");
-      break;
+      return token(match('=') ? TokenType::Equals : TokenType::Assign);
     case '!':
-      if (match('='))
-        push(TokenType::NotEquals, "!=");
-      else
-        push(TokenType::Not, "!");
-      break;
+      return token(match('=') ? TokenType::NotEquals : TokenType::Not);
     case '<':
-      if (match('='))
-        push(TokenType::LessEq, "<=");
-      else
-        push(TokenType::Less, "<");
-      break;
+      return token(match('=') ? TokenType::LessEq : TokenType::Less);
     case '>':
-      if (match('='))
-        push(TokenType::GreaterEq, ">=");
-      else
-        push(TokenType::Greater, ">");
-      break;
+      return token(match('=') ? TokenType::GreaterEq : TokenType::Greater);
     default:
       // Unknown character
-      push(TokenType::Error, std::string(1, c));
-      break;
+      return token(TokenType::Error);
     }
   }
-
-  tokens.push_back({TokenType::EndOfFile, "", line, col});
-  return tokens;
 }
 
 std::string tokenTypeToString(TokenType type) {
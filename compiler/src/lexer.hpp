@@ -1,7 +1,10 @@
 #pragma once
 
-#include <iostream>
+#include "symbol.hpp"
+#include <cstdint>
+#include <stdexcept>
 #include <string>
+#include <string_view>
 #include <vector>
 
 namespace tinylang {
@@ -50,34 +53,78 @@ enum class TokenType {
   Error
 };
 
+// A token is a slice of the source; Lexer::text() and Lexer::locate() turn
+// it back into characters and a position. Identifiers are interned as they
+// are scanned.
 struct Token {
   TokenType type;
-  std::string text;
+  uint32_t offset;
+  uint32_t length;
+  Symbol symbol; // Identifier tokens only
+};
+
+struct SourceLocation {
+  int line;
+  int col;
+};
+
+// An Error token, reported when the parser reaches it.
+class LexError : public std::runtime_error {
+public:
   int line;
   int col;
+  LexError(const std::string &msg, int l, int c)
+      : std::runtime_error(msg), line(l), col(c) {}
 };
 
+// Scans a source it does not own; the text must outlive the lexer and every
+// token it produced.
 class Lexer {
 public:
-  explicit Lexer(std::string source);
+  // `origin` is where `source` starts when it was cut out of a larger file;
+  // locate() reports positions in that file.
+  explicit Lexer(std::string_view source, SourceLocation origin = {1, 1});
+  // The next token; EndOfFile once the source is exhausted, and on every
+  // call after that.
+  Token next();
+  // All tokens up to and including EndOfFile.
   std::vector<Token> tokenize();
 
+  std::string_view text(const Token &t) const {
+    return source.substr(t.offset, t.length);
+  }
+  // 1-based line and column of a token. The line table is built on first
+  // use, so error-free runs that never ask pay nothing for it.
+  SourceLocation locate(const Token &t) const;
+  // Leaves Identifier tokens without a symbol, for scans that only look at
+  // token kinds.
+  void skipInterning() { interning = false; }
+
 private:
-  std::string source;
+  std::string_view source;
+  SourceLocation origin;
+  bool interning = true;
   size_t pos = 0;
-  int line = 1;
-  int col = 1;
+  mutable std::vector<uint32_t> lineStarts;
 
   char peek(int offset = 0) const;
-  char advance();
+  char advance() { return source[pos++]; }
+  const char *end() const { return source.data() + source.size(); }
   bool match(char expected);
   void skipWhitespace();
+};
 
-  Token makeToken(TokenType type, std::string text);
-  Token number();
-  Token identifier();
+// A reserved word. The type names are not keywords to the grammar (`int(x)`
+// is a call) and lex as identifiers, but are looked up the same way.
+struct KeywordInfo {
+  std::string_view text;
+  TokenType type; // Identifier for type names
 };
 
+// The keyword or type name spelled by `word`, or nullptr. A perfect hash
+// built at compile time: one table probe and one comparison.
+const KeywordInfo *findKeyword(std::string_view word);
+
 std::string tokenTypeToString(TokenType type);
 
 } // namespace tinylang
@@ -5,10 +5,15 @@ namespace tinylang {
 
 // Helper to check if Expr is a Number
 static IntLiteral *asNumber(Expr *expr) {
-  return dynamic_cast<IntLiteral *>(expr);
+  return as<IntLiteral>(expr);
 }
 
-void Optimizer::optimize(Program &prog) { prog.accept(*this); }
+void Optimizer::optimize(Program &prog) { visit(prog); }
+void Optimizer::optimize(Node &decl) { visit(decl); }
+
+void Optimizer::visit(Node &node) {
+  dispatch(node, [this](auto &n) { visit(n); });
+}
 
 void Optimizer::visit(IntLiteral &node) {}
 void Optimizer::visit(FloatLiteral &node) {}
@@ -18,28 +23,28 @@ void Optimizer::visit(TypedVarDecl &node) {}
 void Optimizer::visit(Variable &node) {}
 
 void Optimizer::visit(BinaryExpr &node) {
-  node.left->accept(*this);
-  node.right->accept(*this);
+  visit(*node.left);
+  visit(*node.right);
 
   // Constant Folding
-  auto l = asNumber(node.left.get());
-  auto r = asNumber(node.right.get());
+  auto l = asNumber(node.left);
+  auto r = asNumber(node.right);
 
   if (l && r) {
     // Fold!
     int res = 0;
-    if (node.op == "+")
+    if (node.op == BinaryOp::Add)
       res = l->value + r->value;
-    else if (node.op == "-")
+    else if (node.op == BinaryOp::Sub)
       res = l->value - r->value;
-    else if (node.op == "*")
+    else if (node.op == BinaryOp::Mul)
       res = l->value * r->value;
-    else if (node.op == "/") {
+    else if (node.op == BinaryOp::Div) {
       if (r->value != 0)
         res = l->value / r->value;
       else
         return;
-    } else if (node.op == "%") {
+    } else if (node.op == BinaryOp::Mod) {
       if (r->value != 0)
         res = l->value % r->value;
       else
@@ -122,45 +127,45 @@ void Optimizer::visit(BinaryExpr &node) {
   }
 }
 
-void Optimizer::visit(UnaryExpr &node) { node.operand->accept(*this); }
+void Optimizer::visit(UnaryExpr &node) { visit(*node.operand); }
 void Optimizer::visit(CallExpr &node) {
   for (auto &a : node.args)
-    a->accept(*this);
+    visit(*a);
 }
 void Optimizer::visit(VarDecl &node) {
   if (node.initializer)
-    node.initializer->accept(*this);
+    visit(*node.initializer);
 }
-void Optimizer::visit(AssignStmt &node) { node.value->accept(*this); }
-void Optimizer::visit(PrintStmt &node) { node.expr->accept(*this); }
-void Optimizer::visit(ExprStmt &node) { node.expr->accept(*this); }
+void Optimizer::visit(AssignStmt &node) { visit(*node.value); }
+void Optimizer::visit(PrintStmt &node) { visit(*node.expr); }
+void Optimizer::visit(ExprStmt &node) { visit(*node.expr); }
 void Optimizer::visit(Block &node) {
   for (auto &s : node.statements)
-    s->accept(*this);
+    visit(*s);
 }
 void Optimizer::visit(IfStmt &node) {
-  node.condition->accept(*this);
-  node.thenBranch->accept(*this);
+  visit(*node.condition);
+  visit(*node.thenBranch);
   if (node.elseBranch)
-    node.elseBranch->accept(*this);
+    visit(*node.elseBranch);
 }
 void Optimizer::visit(ForStmt &node) {
   if (node.init)
-    node.init->accept(*this);
+    visit(*node.init);
   if (node.condition)
-    node.condition->accept(*this);
+    visit(*node.condition);
   if (node.update)
-    node.update->accept(*this);
-  node.body->accept(*this);
+    visit(*node.update);
+  visit(*node.body);
 }
-void Optimizer::visit(FuncDecl &node) { node.body->accept(*this); }
+void Optimizer::visit(FuncDecl &node) { visit(*node.body); }
 void Optimizer::visit(ReturnStmt &node) {
   if (node.value)
-    node.value->accept(*this);
+    visit(*node.value);
 }
 void Optimizer::visit(Program &node) {
   for (auto &d : node.declarations)
-    d->accept(*this);
+    visit(*d);
 }
 
 } // namespace tinylang
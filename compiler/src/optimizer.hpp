@@ -4,29 +4,34 @@
 
 namespace tinylang {
 
-class Optimizer : public ASTVisitor {
+class Optimizer {
 public:
   void optimize(Program &prog);
+  // One top-level declaration, for the incremental front end.
+  void optimize(Node &decl);
 
-  void visit(IntLiteral &node) override;
-  void visit(FloatLiteral &node) override;
-  void visit(StringLiteral &node) override;
-  void visit(ArrayAccess &node) override;
-  void visit(TypedVarDecl &node) override;
-  void visit(Variable &node) override;
-  void visit(BinaryExpr &node) override;
-  void visit(UnaryExpr &node) override;
-  void visit(CallExpr &node) override;
-  void visit(VarDecl &node) override;
-  void visit(AssignStmt &node) override;
-  void visit(PrintStmt &node) override;
-  void visit(ExprStmt &node) override;
-  void visit(Block &node) override;
-  void visit(IfStmt &node) override;
-  void visit(ForStmt &node) override;
-  void visit(FuncDecl &node) override;
-  void visit(ReturnStmt &node) override;
-  void visit(Program &node) override;
+private:
+  // One overload per node kind; visit(Node &) switches to the right one.
+  void visit(Node &node);
+  void visit(IntLiteral &node);
+  void visit(FloatLiteral &node);
+  void visit(StringLiteral &node);
+  void visit(ArrayAccess &node);
+  void visit(TypedVarDecl &node);
+  void visit(Variable &node);
+  void visit(BinaryExpr &node);
+  void visit(UnaryExpr &node);
+  void visit(CallExpr &node);
+  void visit(VarDecl &node);
+  void visit(AssignStmt &node);
+  void visit(PrintStmt &node);
+  void visit(ExprStmt &node);
+  void visit(Block &node);
+  void visit(IfStmt &node);
+  void visit(ForStmt &node);
+  void visit(FuncDecl &node);
+  void visit(ReturnStmt &node);
+  void visit(Program &node);
 };
 
 } // namespace tinylang
@@ -1,16 +1,78 @@
 #include "parser.hpp"
+#include <array>
 
 namespace tinylang {
 
-Parser::Parser(std::vector<Token> tokens) : tokens(std::move(tokens)) {}
+Parser::Parser(Lexer &lexer) : lexer(lexer) { pull(); }
+
+namespace {
+
+struct BinaryOperator {
+  TokenType token;
+  BinaryOp op;
+  uint8_t precedence;
+};
+
+// Higher precedence binds tighter, and every binary operator is
+// left-associative. A new operator only needs a row here.
+constexpr BinaryOperator kBinaryOperators[] = {
+    {TokenType::Equals, BinaryOp::Eq, 1},
+    {TokenType::NotEquals, BinaryOp::Ne, 1},
+    {TokenType::Less, BinaryOp::Lt, 2},
+    {TokenType::LessEq, BinaryOp::Le, 2},
+    {TokenType::Greater, BinaryOp::Gt, 2},
+    {TokenType::GreaterEq, BinaryOp::Ge, 2},
+    {TokenType::Plus, BinaryOp::Add, 3},
+    {TokenType::Minus, BinaryOp::Sub, 3},
+    {TokenType::Star, BinaryOp::Mul, 4},
+    {TokenType::Slash, BinaryOp::Div, 4},
+    {TokenType::Mod, BinaryOp::Mod, 4}};
+
+// `-` and `!` bind tighter than any binary operator.
+constexpr uint8_t kPrefixPrecedence = 5;
+
+// Token type -> index into kBinaryOperators + 1, or 0 for other tokens.
+constexpr auto kBinaryTable = [] {
+  std::array<uint8_t, (size_t)TokenType::Error + 1> table{};
+  for (size_t i = 0; i < std::size(kBinaryOperators); ++i)
+    table[(size_t)kBinaryOperators[i].token] = (uint8_t)(i + 1);
+  return table;
+}();
+
+const BinaryOperator *findBinaryOperator(TokenType t) {
+  uint8_t slot = kBinaryTable[(size_t)t];
+  return slot ? &kBinaryOperators[slot - 1] : nullptr;
+}
 
-Token Parser::peek() const { return tokens[current]; }
+} // namespace
+
+template <class T> ArenaArray<T *> Parser::popNodes(size_t mark) {
+  size_t n = nodeStack.size() - mark;
+  if (n == 0)
+    return {};
+  auto **items = (T **)arena->allocate(n * sizeof(T *), alignof(T *));
+  for (size_t i = 0; i < n; ++i)
+    items[i] = static_cast<T *>(nodeStack[mark + i]);
+  nodeStack.resize(mark);
+  return {items, (uint32_t)n};
+}
 
-Token Parser::previous() const { return tokens[current - 1]; }
+// Lexes the token after the current one into its slot.
+void Parser::pull() {
+  Token t = lexer.next();
+  if (t.type == TokenType::Error) {
+    SourceLocation loc = lexer.locate(t);
+    throw LexError("Unexpected character: " + std::string(lexer.text(t)),
+                   loc.line, loc.col);
+  }
+  ring[current % kRingSize] = t;
+}
 
-Token Parser::advance() {
-  if (peek().type != TokenType::EndOfFile)
+const Token &Parser::advance() {
+  if (peek().type != TokenType::EndOfFile) {
     current++;
+    pull();
+  }
   return previous();
 }
 
@@ -28,79 +90,95 @@ bool Parser::match(TokenType type) {
   return false;
 }
 
-Token Parser::consume(TokenType type, const std::string &message) {
+const Token &Parser::consume(TokenType type, const std::string &message) {
   if (check(type))
     return advance();
-  throw ParseError(message, peek().line, peek().col);
+  throw error(message);
+}
+
+bool Parser::checkTypeName() const {
+  if (!check(TokenType::Identifier))
+    return false;
+  Symbol s = peek().symbol;
+  return s == sym::Int || s == sym::Float || s == sym::String;
+}
+
+ParseError Parser::error(const std::string &message) const {
+  SourceLocation loc = lexer.locate(peek());
+  return ParseError(message, loc.line, loc.col);
 }
 
 std::unique_ptr<Program> Parser::parse() {
   auto program = std::make_unique<Program>();
+  std::vector<Node *> decls = parseDeclarations(program->arena);
+  program->declarations = program->arena.copy(decls.data(), decls.size());
+  return program;
+}
+
+std::vector<Node *> Parser::parseDeclarations(Arena &into) {
+  arena = &into;
+  std::vector<Node *> decls;
   while (peek().type != TokenType::EndOfFile) {
     if (check(TokenType::Func)) {
-      program->declarations.push_back(functionDecl());
+      decls.push_back(functionDecl());
     } else {
       // Global statements (optional in spec but good to have)
-      try {
-        program->declarations.push_back(statement());
-      } catch (const ParseError &e) {
-        // Synchronize? For now just rethrow
-        throw;
-      }
+      decls.push_back(statement());
     }
   }
-  return program;
+  return decls;
 }
 
-std::unique_ptr<FuncDecl> Parser::functionDecl() {
+FuncDecl *Parser::functionDecl() {
   consume(TokenType::Func, "Expect 'func'");
   Token name = consume(TokenType::Identifier, "Expect function name");
   consume(TokenType::LParen, "Expect '(' after function name");
 
-  std::vector<std::pair<std::string, std::string>> params;
+  size_t paramMark = paramStack.size();
   if (!check(TokenType::RParen)) {
     do {
-      std::string type = "";
-      if (check(TokenType::Identifier)) {
-        std::string txt = peek().text;
-        if (txt == "int" || txt == "float" || txt == "string" ||
-            txt == "void") {
-          type = txt;
-          advance();
-        }
-      }
+      Symbol type;
+      if (checkTypeName() ||
+          (check(TokenType::Identifier) && peek().symbol == sym::Void))
+        type = advance().symbol;
       Token param = consume(TokenType::Identifier, "Expect parameter name");
-      params.push_back({type, param.text});
+      paramStack.emplace_back(type, param.symbol);
     } while (match(TokenType::Comma));
   }
   consume(TokenType::RParen, "Expect ')' after paremeters");
+  auto params = arena->copy(paramStack.data() + paramMark,
+                            paramStack.size() - paramMark);
+  paramStack.resize(paramMark);
 
-  std::string returnType = "";
+  Symbol returnType;
   if (match(TokenType::Arrow)) {
     if (check(TokenType::Identifier)) {
-      returnType = advance().text;
+      returnType = advance().symbol;
     }
   }
 
   auto body = block();
-  auto decl = std::make_unique<FuncDecl>(name.text, params, returnType,
-                                         std::move(body));
-  decl->line = name.line;
-  decl->col = name.col;
+  auto decl = make<FuncDecl>(name.symbol, params, returnType, body);
+  setLocation(*decl, name);
   return decl;
 }
 
-std::unique_ptr<Block> Parser::block() {
+Block *Parser::block() {
   consume(TokenType::LBrace, "Expect '{'");
-  auto node = std::make_unique<Block>();
+  if (++blockDepth > kMaxDepth)
+    throw error("Blocks nested too deeply");
+  auto node = make<Block>();
+  size_t mark = nodeStack.size();
   while (!check(TokenType::RBrace) && !check(TokenType::EndOfFile)) {
-    node->statements.push_back(statement());
+    nodeStack.push_back(statement());
   }
   consume(TokenType::RBrace, "Expect '}'");
+  node->statements = popNodes<Stmt>(mark);
+  --blockDepth;
   return node;
 }
 
-std::unique_ptr<Stmt> Parser::statement() {
+Stmt *Parser::statement() {
   if (match(TokenType::Let))
     return varDecl();
   if (match(TokenType::For))
@@ -118,20 +196,16 @@ std::unique_ptr<Stmt> Parser::statement() {
 
   // Check for Typed Declaration: type identifier ...
   // Peek to see if it looks like a type.
-  if (check(TokenType::Identifier)) {
-    std::string txt = peek().text;
-    if (txt == "int" || txt == "float" || txt == "string") {
-      return typedVarDecl();
-    }
-  }
+  if (checkTypeName())
+    return typedVarDecl();
 
   return expressionStmt();
 }
 
 Parser::ParsedType Parser::parseType() {
-  std::string base = advance().text; // int, float, string
+  Symbol base = advance().symbol; // int, float, string
   bool isArray = false;
-  std::unique_ptr<Expr> size = nullptr;
+  Expr *size = nullptr;
 
   if (match(TokenType::LBracket)) {
     isArray = true;
@@ -140,226 +214,234 @@ Parser::ParsedType Parser::parseType() {
     }
     consume(TokenType::RBracket, "Expected ']' after array size.");
   }
-  return {base, isArray, std::move(size)};
+  return {base, isArray, size};
 }
 
-std::unique_ptr<Stmt> Parser::typedVarDecl() {
+Stmt *Parser::typedVarDecl() {
   auto type = parseType();
-  std::string name =
-      consume(TokenType::Identifier, "Expected variable name.").text;
+  Symbol name =
+      consume(TokenType::Identifier, "Expected variable name.").symbol;
 
-  std::unique_ptr<Expr> init = nullptr;
+  Expr *init = nullptr;
   if (match(TokenType::Assign)) {
     init = expression();
   }
   consume(TokenType::Semicolon, "Expected ';' after declaration.");
-  return std::make_unique<TypedVarDecl>(name, type.name, type.isArray,
-                                        std::move(type.size), std::move(init));
+  return make<TypedVarDecl>(name, type.name, type.isArray, type.size, init);
 }
 
-std::unique_ptr<Stmt> Parser::varDecl() {
+Stmt *Parser::varDecl() {
   Token name = consume(TokenType::Identifier, "Expect variable name");
   consume(TokenType::Assign, "Expect '='");
   auto init = expression();
   consume(TokenType::Semicolon, "Expect ';'");
-  return std::make_unique<VarDecl>(name.text, std::move(init));
+  return make<VarDecl>(name.symbol, init);
 }
 
-std::unique_ptr<Stmt> Parser::forStmt() {
+Stmt *Parser::forStmt() {
   consume(TokenType::LParen, "Expect '(' after 'for'");
 
-  std::unique_ptr<Stmt> init = nullptr;
+  Stmt *init = nullptr;
   if (!match(TokenType::Semicolon)) {
     if (match(TokenType::Let)) {
       init = varDecl();
-    } else if (check(TokenType::Identifier) &&
-               (peek().text == "int" || peek().text == "float" ||
-                peek().text == "string")) {
+    } else if (checkTypeName()) {
       init = typedVarDecl();
     } else {
       Token id =
           consume(TokenType::Identifier, "Expect identifier in for-init");
       consume(TokenType::Assign, "Expect '='");
       auto val = expression();
-      init = std::make_unique<AssignStmt>(id.text, std::move(val));
+      init = make<AssignStmt>(id.symbol, val);
       consume(TokenType::Semicolon, "Expect ';'");
     }
   }
 
-  std::unique_ptr<Expr> cond = nullptr;
+  Expr *cond = nullptr;
   if (!check(TokenType::Semicolon)) {
     cond = expression();
   }
   consume(TokenType::Semicolon, "Expect ';'");
 
-  std::unique_ptr<Stmt> update = nullptr;
+  Stmt *update = nullptr;
   if (!check(TokenType::RParen)) {
     Token id =
         consume(TokenType::Identifier, "Expect identifier in for-update");
     consume(TokenType::Assign, "Expect '='");
     auto val = expression();
-    update = std::make_unique<AssignStmt>(id.text, std::move(val));
+    update = make<AssignStmt>(id.symbol, val);
   }
   consume(TokenType::RParen, "Expect ')'");
 
   auto body = block();
-  return std::make_unique<ForStmt>(std::move(init), std::move(cond),
-                                   std::move(update), std::move(body));
+  return make<ForStmt>(init, cond, update, body);
 }
 
-std::unique_ptr<Stmt> Parser::ifStmt() {
+Stmt *Parser::ifStmt() {
   consume(TokenType::LParen, "Expect '('");
   auto cond = expression();
   consume(TokenType::RParen, "Expect ')'");
   auto thenBranch = block();
-  std::unique_ptr<Block> elseBranch = nullptr;
+  Block *elseBranch = nullptr;
   if (match(TokenType::Else)) {
     elseBranch = block();
   }
-  return std::make_unique<IfStmt>(std::move(cond), std::move(thenBranch),
-                                  std::move(elseBranch));
+  return make<IfStmt>(cond, thenBranch, elseBranch);
 }
 
-std::unique_ptr<Stmt> Parser::returnStmt() {
-  std::unique_ptr<Expr> val = nullptr;
+Stmt *Parser::returnStmt() {
+  Expr *val = nullptr;
   if (!check(TokenType::Semicolon)) {
     val = expression();
   }
   consume(TokenType::Semicolon, "Expect ';'");
-  return std::make_unique<ReturnStmt>(std::move(val));
+  return make<ReturnStmt>(val);
 }
 
-std::unique_ptr<Stmt> Parser::expressionStmt() {
+Stmt *Parser::expressionStmt() {
   auto expr = expression();
 
   if (match(TokenType::Assign)) {
-    if (auto varNode = dynamic_cast<Variable *>(expr.get())) {
+    if (auto varNode = as<Variable>(expr)) {
       auto val = expression();
       consume(TokenType::Semicolon, "Expect ';'");
-      return std::make_unique<AssignStmt>(varNode->name, std::move(val));
+      return make<AssignStmt>(varNode->name, val);
     }
-    if (auto arrNode = dynamic_cast<ArrayAccess *>(expr.get())) {
+    if (auto arrNode = as<ArrayAccess>(expr)) {
       auto val = expression();
       consume(TokenType::Semicolon, "Expect ';'");
-      return std::make_unique<AssignStmt>(arrNode->name, std::move(val),
-                                          std::move(arrNode->index));
+      return make<AssignStmt>(arrNode->name, val, arrNode->index);
     }
-    throw ParseError("Invalid assignment target.", peek().line, peek().col);
+    throw error("Invalid assignment target.");
   }
 
   consume(TokenType::Semicolon, "Expect ';'");
-  return std::make_unique<ExprStmt>(std::move(expr));
+  return make<ExprStmt>(expr);
 }
 
-std::unique_ptr<Expr> Parser::primary() {
-  if (match(TokenType::Number)) {
-    return std::make_unique<IntLiteral>(std::stoi(previous().text));
-  }
-  if (match(TokenType::Float)) {
-    return std::make_unique<FloatLiteral>(std::stod(previous().text));
-  }
-  if (match(TokenType::StringLiteral)) {
-    return std::make_unique<StringLiteral>(previous().text);
-  }
-  if (match(TokenType::Identifier)) {
-    Token idToken = previous();
-    std::string name = idToken.text;
-
-    if (match(TokenType::LBracket)) {
-      auto index = expression();
-      consume(TokenType::RBracket, "Expect ']'");
-      auto arr = std::make_unique<ArrayAccess>(name, std::move(index));
-      arr->line = idToken.line;
-      arr->col = idToken.col;
-      return arr;
-    }
-
-    if (match(TokenType::LParen)) {
-      std::vector<std::unique_ptr<Expr>> args;
-      if (!check(TokenType::RParen)) {
-        do {
-          args.push_back(expression());
-        } while (match(TokenType::Comma));
-      }
-      consume(TokenType::RParen, "Expect ')'");
-      auto call = std::make_unique<CallExpr>(name, std::move(args));
-      call->line = idToken.line;
-      call->col = idToken.col;
-      return call;
-    }
-    auto var = std::make_unique<Variable>(name);
-    var->line = idToken.line;
-    var->col = idToken.col;
-    return var;
-  }
-  if (match(TokenType::LParen)) {
-    auto expr = expression();
-    consume(TokenType::RParen, "Expect ')'");
-    return expr;
-  }
-
-  throw ParseError("Expect expression", peek().line, peek().col);
-}
-
-std::unique_ptr<Stmt> Parser::printStmt(bool newLine) {
+Stmt *Parser::printStmt(bool newLine) {
   consume(TokenType::LParen, "Expect '('");
   auto expr = expression();
   consume(TokenType::RParen, "Expect ')'");
   consume(TokenType::Semicolon, "Expect ';'");
-  return std::make_unique<PrintStmt>(std::move(expr), newLine);
+  return make<PrintStmt>(expr, newLine);
 }
 
-std::unique_ptr<Expr> Parser::expression() { return equality(); }
+// Operator precedence parsing over explicit stacks, so neither long
+// operator chains nor deeply nested brackets grow the call stack. Operands
+// go on nodeStack; operators and open brackets wait on `pending` until a
+// weaker operator or a closing token reduces them.
+Expr *Parser::expression() {
+  size_t base = pending.size();
+  for (;;) {
+    // An operand, after any prefix operators and opening brackets.
+    if (match(TokenType::Not) || match(TokenType::Minus)) {
+      UnaryOp op =
+          previous().type == TokenType::Not ? UnaryOp::Not : UnaryOp::Neg;
+      pending.push_back({Pending::Prefix, kPrefixPrecedence, (uint8_t)op});
+      continue;
+    }
+    if (match(TokenType::LParen)) {
+      pending.push_back({Pending::Group});
+      continue;
+    }
+    if (match(TokenType::Identifier)) {
+      Token name = previous();
+      if (match(TokenType::LBracket)) {
+        pending.push_back({Pending::Index, 0, 0, 0, name});
+        continue;
+      }
+      if (match(TokenType::LParen)) {
+        pending.push_back({Pending::Call, 0, 0, nodeStack.size(), name});
+        if (!check(TokenType::RParen))
+          continue;
+      } else {
+        auto var = make<Variable>(name.symbol);
+        setLocation(*var, name);
+        pushExpr(var, 1);
+      }
+    } else {
+      pushExpr(literal(), 1);
+    }
 
-std::unique_ptr<Expr> Parser::equality() {
-  auto expr = comparison();
-  while (match(TokenType::Equals) || match(TokenType::NotEquals)) {
-    std::string op = previous().text;
-    auto right = comparison();
-    expr = std::make_unique<BinaryExpr>(op, std::move(expr), std::move(right));
+    // The operators and closing brackets that follow it.
+    for (;;) {
+      if (const BinaryOperator *bin = findBinaryOperator(peek().type)) {
+        reduce(base, bin->precedence);
+        advance();
+        pending.push_back(
+            {Pending::Binary, bin->precedence, (uint8_t)bin->op});
+        break;
+      }
+      reduce(base, 0);
+      uint32_t depth = 0;
+      if (pending.size() == base)
+        return popExpr(depth);
+
+      Pending open = pending.back();
+      if (open.kind == Pending::Call && match(TokenType::Comma))
+        break;
+      pending.pop_back();
+      if (open.kind == Pending::Group) {
+        consume(TokenType::RParen, "Expect ')'");
+      } else if (open.kind == Pending::Index) {
+        consume(TokenType::RBracket, "Expect ']'");
+        auto arr = make<ArrayAccess>(open.name.symbol, popExpr(depth));
+        setLocation(*arr, open.name);
+        pushExpr(arr, depth + 1);
+      } else {
+        consume(TokenType::RParen, "Expect ')'");
+        size_t args = nodeStack.size() - open.mark;
+        auto first = operandDepths.end() - args;
+        depth = args ? *std::max_element(first, operandDepths.end()) : 0;
+        operandDepths.erase(first, operandDepths.end());
+        auto call =
+            make<CallExpr>(open.name.symbol, popNodes<Expr>(open.mark));
+        setLocation(*call, open.name);
+        pushExpr(call, depth + 1);
+      }
+    }
   }
-  return expr;
 }
 
-std::unique_ptr<Expr> Parser::comparison() {
-  auto expr = term();
-  while (match(TokenType::Less) || match(TokenType::LessEq) ||
-         match(TokenType::Greater) || match(TokenType::GreaterEq)) {
-    std::string op = previous().text;
-    auto right = term();
-    expr = std::make_unique<BinaryExpr>(op, std::move(expr), std::move(right));
-  }
-  return expr;
+void Parser::pushExpr(Expr *expr, uint32_t depth) {
+  if (depth + blockDepth > kMaxDepth)
+    throw error("Expression nested too deeply");
+  nodeStack.push_back(expr);
+  operandDepths.push_back(depth);
 }
 
-std::unique_ptr<Expr> Parser::term() {
-  auto expr = factor();
-  while (match(TokenType::Plus) || match(TokenType::Minus)) {
-    std::string op = previous().text;
-    auto right = factor();
-    expr = std::make_unique<BinaryExpr>(op, std::move(expr), std::move(right));
+// Applies the operators above `base` that bind at least as tightly as
+// `precedence`, stopping at an open bracket.
+void Parser::reduce(size_t base, int precedence) {
+  while (pending.size() > base) {
+    const Pending &top = pending.back();
+    uint32_t depth = 0;
+    if (top.kind == Pending::Binary && top.precedence >= precedence) {
+      Expr *right = popExpr(depth);
+      Expr *left = popExpr(depth);
+      pushExpr(make<BinaryExpr>((BinaryOp)top.op, left, right), depth + 1);
+    } else if (top.kind == Pending::Prefix && top.precedence >= precedence) {
+      Expr *operand = popExpr(depth);
+      pushExpr(make<UnaryExpr>((UnaryOp)top.op, operand), depth + 1);
+    } else {
+      return;
+    }
+    pending.pop_back();
   }
-  return expr;
 }
 
-std::unique_ptr<Expr> Parser::factor() {
-  auto expr = unary();
-  while (match(TokenType::Star) || match(TokenType::Slash) ||
-         match(TokenType::Mod)) {
-    std::string op = previous().text;
-    auto right = unary();
-    expr = std::make_unique<BinaryExpr>(op, std::move(expr), std::move(right));
+Expr *Parser::literal() {
+  if (match(TokenType::Number)) {
+    return make<IntLiteral>(std::stoi(std::string(text(previous()))));
   }
-  return expr;
-}
-
-std::unique_ptr<Expr> Parser::unary() {
-  if (match(TokenType::Not) || match(TokenType::Minus)) {
-    std::string op = previous().text;
-    auto right = unary();
-    return std::make_unique<UnaryExpr>(op, std::move(right));
+  if (match(TokenType::Float)) {
+    return make<FloatLiteral>(std::stod(std::string(text(previous()))));
+  }
+  if (match(TokenType::StringLiteral)) {
+    return make<StringLiteral>(arena->copy(text(previous())));
   }
-  return primary();
+  throw error("Expect expression");
 }
 
 } // namespace tinylang
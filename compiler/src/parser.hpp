@@ -2,8 +2,10 @@
 
 #include "ast.hpp"
 #include "lexer.hpp"
+#include <algorithm>
 #include <memory>
 #include <stdexcept>
+#include <utility>
 #include <vector>
 
 namespace tinylang {
@@ -18,46 +20,105 @@ public:
 
 class Parser {
 public:
-  explicit Parser(std::vector<Token> tokens);
+  // Tokens are pulled from `lexer` as the parse reaches them; it must
+  // outlive the parser. parse() throws LexError at the first Error token.
+  explicit Parser(Lexer &lexer);
   std::unique_ptr<Program> parse();
+  // The top-level declarations of a fragment of a program, allocated in
+  // `arena`; for the incremental front end.
+  std::vector<Node *> parseDeclarations(Arena &arena);
 
 private:
-  std::vector<Token> tokens;
-  size_t current = 0;
+  // Only the current and the previous token are ever looked at, so a few
+  // slots suffice and the token stream is never held in memory.
+  static constexpr size_t kRingSize = 4;
 
-  Token peek() const;
-  Token previous() const;
-  Token advance();
+  Lexer &lexer;
+  Token ring[kRingSize];
+  size_t current = 0; // index of the current token in the whole stream
+
+  // Nodes go into the arena of the program being parsed. Child lists are
+  // gathered on these stacks and copied into it once complete, so nested
+  // lists share the scratch space.
+  Arena *arena = nullptr;
+  std::vector<Node *> nodeStack;
+  std::vector<std::pair<Symbol, Symbol>> paramStack;
+
+  template <class T, class... Args> T *make(Args &&...args) {
+    return arena->make<T>(std::forward<Args>(args)...);
+  }
+  // Moves the nodes pushed since `mark` into the arena.
+  template <class T> ArenaArray<T *> popNodes(size_t mark);
+
+  const Token &peek() const { return ring[current % kRingSize]; }
+  const Token &previous() const { return ring[(current - 1) % kRingSize]; }
+  void pull();
+  const Token &advance();
   bool check(TokenType type) const;
   bool match(TokenType type);
-  Token consume(TokenType type, const std::string &message);
-
-  std::unique_ptr<FuncDecl> functionDecl();
-  std::unique_ptr<Stmt> statement();
-  std::unique_ptr<Stmt> varDecl();
-  std::unique_ptr<Stmt> typedVarDecl();
-  std::unique_ptr<Stmt> ifStmt();
-  std::unique_ptr<Stmt> forStmt();
-  std::unique_ptr<Stmt> printStmt(bool newLine = false);
-  std::unique_ptr<Stmt> returnStmt();
-  std::unique_ptr<Block> block();
-  std::unique_ptr<Stmt> expressionStmt();
+  const Token &consume(TokenType type, const std::string &message);
+  std::string_view text(const Token &t) const { return lexer.text(t); }
+  // Whether the next token names one of the builtin types.
+  bool checkTypeName() const;
+  ParseError error(const std::string &message) const;
+  template <class Node> void setLocation(Node &node, const Token &t) const {
+    SourceLocation loc = lexer.locate(t);
+    node.line = loc.line;
+    node.col = loc.col;
+  }
+
+  FuncDecl *functionDecl();
+  Stmt *statement();
+  Stmt *varDecl();
+  Stmt *typedVarDecl();
+  Stmt *ifStmt();
+  Stmt *forStmt();
+  Stmt *printStmt(bool newLine = false);
+  Stmt *returnStmt();
+  Block *block();
+  Stmt *expressionStmt();
 
   // Type parsing
   struct ParsedType {
-    std::string name;
+    Symbol name;
     bool isArray;
-    std::unique_ptr<Expr> size;
+    Expr *size;
   };
   ParsedType parseType();
 
-  std::unique_ptr<Expr> expression();
-  std::unique_ptr<Expr> equality();
-  std::unique_ptr<Expr> comparison();
-  std::unique_ptr<Expr> term();
-  std::unique_ptr<Expr> factor();
-  std::unique_ptr<Expr> unary();
-  std::unique_ptr<Expr> primary();
+  // Expressions are parsed without recursion: operators and open brackets
+  // wait on `pending` while their operands collect on `nodeStack`.
+  struct Pending {
+    enum Kind : uint8_t { Binary, Prefix, Group, Call, Index };
+    Kind kind;
+    uint8_t precedence = 0; // Binary and Prefix only
+    uint8_t op = 0;         // the BinaryOp or UnaryOp
+    size_t mark = 0;        // where a Call's arguments start on nodeStack
+    Token name{};           // the callee or array of a Call or Index
+  };
+  std::vector<Pending> pending;
+
+  // Every later pass walks the tree recursively, so the parser bounds its
+  // depth: blocks open around the current statement plus the height of the
+  // expression being built. `operandDepths` holds the height of each
+  // operand on top of nodeStack.
+  static constexpr uint32_t kMaxDepth = 10000;
+  uint32_t blockDepth = 0;
+  std::vector<uint32_t> operandDepths;
+
+  void pushExpr(Expr *expr, uint32_t depth);
+  // Pops the top operand, raising `depth` to its height.
+  Expr *popExpr(uint32_t &depth) {
+    depth = std::max(depth, operandDepths.back());
+    operandDepths.pop_back();
+    auto *expr = static_cast<Expr *>(nodeStack.back());
+    nodeStack.pop_back();
+    return expr;
+  }
+  void reduce(size_t base, int precedence);
+
+  Expr *expression();
+  Expr *literal();
 };
 
 } // namespace tinylang
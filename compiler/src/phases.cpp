@@ -0,0 +1,82 @@
+#include "phases.hpp"
+#include <algorithm>
+#include <cstdlib>
+#include <malloc.h>
+#include <new>
+
+namespace tinylang {
+
+constinit thread_local HeapCounter *heapCounter = nullptr;
+
+// What was counted in `inner` is also part of the enclosing counter.
+static void merge(HeapCounter *outer, const HeapCounter &inner) {
+  if (outer) {
+    outer->peak = std::max(outer->peak, outer->current + inner.peak);
+    outer->current += inner.current;
+  }
+}
+
+PhaseTimer::PhaseTimer(std::vector<PhaseStat> *out, const char *name)
+    : out(out), name(name) {
+  if (!out)
+    return;
+  outer = heapCounter;
+  heapCounter = &counter;
+  start = std::chrono::steady_clock::now();
+}
+
+PhaseTimer::~PhaseTimer() {
+  if (!out)
+    return;
+  auto end = std::chrono::steady_clock::now();
+  heapCounter = outer;
+  merge(outer, counter);
+  PhaseStat s;
+  s.name = name;
+  s.ms = std::chrono::duration<double, std::milli>(end - start).count();
+  s.peakKb = childPeakKb ? *childPeakKb : (long)(counter.peak >> 10);
+  out->push_back(std::move(s));
+}
+
+HeapLimit::HeapLimit(size_t bytes) : outer(heapCounter) {
+  counter.limit = (long long)bytes;
+  heapCounter = &counter;
+}
+
+HeapLimit::~HeapLimit() {
+  heapCounter = outer;
+  merge(outer, counter);
+}
+
+} // namespace tinylang
+
+// Counting replacements for the global allocation functions; the array and
+// nothrow forms forward to these.
+void *operator new(std::size_t n) {
+  if (n == 0)
+    n = 1;
+  void *p;
+  while (!(p = std::malloc(n))) {
+    std::new_handler handler = std::get_new_handler();
+    if (!handler)
+      throw std::bad_alloc();
+    handler();
+  }
+  if (tinylang::heapCounter) {
+    try {
+      tinylang::noteAlloc(malloc_usable_size(p));
+    } catch (const std::bad_alloc &) {
+      std::free(p);
+      throw;
+    }
+  }
+  return p;
+}
+
+void operator delete(void *p) noexcept {
+  if (p && tinylang::heapCounter)
+    tinylang::noteFree(malloc_usable_size(p));
+  std::free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept { ::operator delete(p); }
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <new>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace tinylang {
+
+// Wall time and peak memory of one pipeline stage, as reported by --phases.
+struct PhaseStat {
+  std::string name;
+  double ms = 0;
+  // Heap growth for stages that run in-process; peak resident set size for
+  // stages that run in a child process; -1 if that was not measured.
+  long peakKb = 0;
+};
+
+// Bytes allocated and freed by this thread while a phase is measured.
+struct HeapCounter {
+  long long current = 0;
+  long long peak = 0;
+  // Allocations that would take `current` past this fail; 0: no limit.
+  long long limit = 0;
+};
+extern constinit thread_local HeapCounter *heapCounter;
+
+// Heap memory obtained through operator new is counted automatically; code
+// that calls malloc() directly reports it here. Both are a single
+// thread-local test when nothing is being measured. Under a HeapLimit,
+// noteAlloc() throws std::bad_alloc instead of exceeding it, so call it
+// before handing the memory out.
+inline void noteAlloc(size_t bytes) {
+  if (HeapCounter *c = heapCounter) {
+    if (c->limit && c->current + (long long)bytes > c->limit)
+      throw std::bad_alloc();
+    c->current += (long long)bytes;
+    if (c->current > c->peak)
+      c->peak = c->current;
+  }
+}
+inline void noteFree(size_t bytes) {
+  if (HeapCounter *c = heapCounter)
+    c->current -= (long long)bytes;
+}
+
+// Appends the stage covering its lifetime to `*out`; does nothing when `out`
+// is null. Heap growth is measured on the constructing thread.
+class PhaseTimer {
+public:
+  PhaseTimer(std::vector<PhaseStat> *out, const char *name);
+  ~PhaseTimer();
+  PhaseTimer(const PhaseTimer &) = delete;
+  PhaseTimer &operator=(const PhaseTimer &) = delete;
+
+  // For a stage spent in a child process: report its peak instead (-1:
+  // unknown).
+  void setPeakKb(long kb) { childPeakKb = kb; }
+
+private:
+  std::vector<PhaseStat> *out;
+  const char *name;
+  std::chrono::steady_clock::time_point start;
+  HeapCounter counter;
+  HeapCounter *outer = nullptr;
+  std::optional<long> childPeakKb;
+};
+
+// Caps what this thread may allocate while it is alive, so that a program
+// run in-process fails with std::bad_alloc long before the host runs out of
+// memory. The usage still counts towards an enclosing PhaseTimer.
+class HeapLimit {
+public:
+  explicit HeapLimit(size_t bytes);
+  ~HeapLimit();
+  HeapLimit(const HeapLimit &) = delete;
+  HeapLimit &operator=(const HeapLimit &) = delete;
+
+  // Let the remaining allocations through, e.g. to report the failure.
+  void lift() { counter.limit = 0; }
+
+private:
+  HeapCounter counter;
+  HeapCounter *outer;
+};
+
+// Runs `f` as stage `name`, returning its result.
+template <class F>
+decltype(auto) measurePhase(std::vector<PhaseStat> *out, const char *name,
+                            F &&f) {
+  PhaseTimer timer(out, name);
+  return f();
+}
+
+} // namespace tinylang
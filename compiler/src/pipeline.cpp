@@ -0,0 +1,668 @@
+#include "pipeline.hpp"
+#include "astcache.hpp"
+#include "cache.hpp"
+#include "codegen.hpp"
+#include "execution.hpp"
+#include "hash.hpp"
+#include "incremental.hpp"
+#include "interpreter.hpp"
+#include "jit.hpp"
+#include "json.hpp"
+#include "lexer.hpp"
+#include "optimizer.hpp"
+#include "parser.hpp"
+#include "phases.hpp"
+#include "prelude.hpp"
+#include "process.hpp"
+#include "semantic.hpp"
+#include "vm.hpp"
+#include "workdir.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <signal.h>
+#include <sstream>
+#include <thread>
+#include <unistd.h>
+
+namespace tinylang {
+
+RunResult failure(const std::string &phase, const std::string &msg, int line,
+                  int col) {
+  RunResult r;
+  r.success = false;
+  r.exit_code = 1;
+  r.error_phase = phase;
+  r.error_msg = msg;
+  r.line = line;
+  r.col = col;
+  return r;
+}
+
+void writeJson(std::ostream &os, const RunResult &r, bool pretty,
+               const std::string &idJson) {
+  const char *nl = pretty ? "\n" : "";
+  const char *ind = pretty ? "  " : "";
+  const char *sep = pretty ? ": " : ":";
+
+  os << "{" << nl;
+  if (!idJson.empty())
+    os << ind << "\"id\"" << sep << idJson << "," << nl;
+  os << ind << "\"success\"" << sep << (r.success ? "true" : "false") << ","
+     << nl;
+  if (!r.success) {
+    os << ind << "\"compile_errors\"" << sep << "[ { \"phase\": ";
+    writeJsonString(os, r.error_phase);
+    os << ", \"message\": ";
+    writeJsonString(os, r.error_msg);
+    os << ", \"line\": " << r.line << ", \"col\": " << r.col << " } ],"
+       << nl;
+  } else {
+    os << ind << "\"compile_errors\"" << sep << "[]," << nl;
+  }
+  os << ind << "\"stdout\"" << sep;
+  writeJsonString(os, r.stdout_str);
+  os << "," << nl << ind << "\"stderr\"" << sep;
+  writeJsonString(os, r.stderr_str);
+  os << "," << nl;
+  if (r.truncated)
+    os << ind << "\"truncated\"" << sep << "true," << nl;
+  os << ind << "\"exit_code\"" << sep << r.exit_code << "," << nl;
+  os << ind << "\"cache_hit\"" << sep << (r.cache_hit ? "true" : "false")
+     << "," << nl;
+  if (!r.tier.empty())
+    os << ind << "\"tier\"" << sep << "\"" << r.tier << "\"," << nl;
+  if (r.usage) {
+    os << ind << "\"usage\"" << sep;
+    writeJson(os, *r.usage);
+    os << "," << nl;
+  }
+  if (!r.phases.empty()) {
+    const char *comma = pretty ? ", " : ",";
+    os << ind << "\"phases\"" << sep << "{";
+    for (size_t i = 0; i < r.phases.size(); ++i) {
+      const PhaseStat &p = r.phases[i];
+      char ms[32];
+      std::snprintf(ms, sizeof(ms), "%.3f", p.ms);
+      os << (i ? comma : "") << "\"" << p.name << "\"" << sep << "{\"ms\""
+         << sep << ms;
+      if (p.peakKb >= 0)
+        os << comma << "\"peak_kb\"" << sep << p.peakKb;
+      os << "}";
+    }
+    os << "}," << nl;
+  }
+  os << ind << "\"time_ms\"" << sep << r.time_ms << nl;
+  os << "}";
+}
+
+void writeJson(std::ostream &os, const ResourceUsage &u) {
+  char cpu[64];
+  std::snprintf(cpu, sizeof(cpu), "\"user_ms\":%.3f,\"sys_ms\":%.3f",
+                u.userMs, u.sysMs);
+  os << "{" << cpu;
+  if (u.peakRssKb >= 0)
+    os << ",\"peak_rss_kb\":" << u.peakRssKb;
+  os << ",\"minor_faults\":" << u.minorFaults
+     << ",\"major_faults\":" << u.majorFaults
+     << ",\"voluntary_switches\":" << u.voluntarySwitches
+     << ",\"involuntary_switches\":" << u.involuntarySwitches;
+  if (u.instructions >= 0)
+    os << ",\"instructions\":" << u.instructions;
+  os << "}";
+}
+
+#ifndef TINYLANG_RUNTIME_INCLUDE_DIR
+#define TINYLANG_RUNTIME_INCLUDE_DIR "runtime"
+#endif
+#ifndef TINYLANG_RUNTIME_LIBRARY
+#define TINYLANG_RUNTIME_LIBRARY "libtinylang-runtime.a"
+#endif
+
+const RuntimeLocation &runtimeLocation() {
+  static const RuntimeLocation loc = [] {
+    if (const char *env = std::getenv("TINYLANG_RUNTIME_DIR"); env && *env)
+      return RuntimeLocation{env, std::string(env) + "/libtinylang-runtime.a"};
+    return RuntimeLocation{TINYLANG_RUNTIME_INCLUDE_DIR,
+                           TINYLANG_RUNTIME_LIBRARY};
+  }();
+  return loc;
+}
+
+// The contents of `path`, or nothing if it cannot be read.
+static std::string fileContents(const std::string &path) {
+  std::ifstream f(path, std::ios::binary);
+  std::stringstream buffer;
+  buffer << f.rdbuf();
+  return buffer.str();
+}
+
+const std::string &runtimeFingerprint() {
+  static const std::string fingerprint = [] {
+    const RuntimeLocation &loc = runtimeLocation();
+    ProcessOptions gxx;
+    gxx.argv = {"g++", "--version"};
+    ProcessResult version = runProcess(gxx);
+    return std::string(kRuntimeVersion) + " " +
+           sha256Hex(fileContents(loc.includeDir + "/" +
+                                  Codegen::kRuntimeHeader)) +
+           " " + sha256Hex(fileContents(loc.library)) + " " +
+           sha256Hex(version.out);
+  }();
+  return fingerprint;
+}
+
+std::vector<std::string> cxxCommand() {
+  return {"g++", "-O2", "-std=c++20", "-I" + runtimeLocation().includeDir};
+}
+
+// Turns the outcome of running a program (natively or interpreted) into the
+// result reported to the client.
+static RunResult programResult(ProcessResult &ran) {
+  int exitCode = ran.exitCode();
+  RunResult r;
+  if (ran.timedOut) {
+    r = failure("runtime", "Time limit exceeded");
+  } else if (exitCode != 0) {
+    // Runtime error
+    std::string msg = !ran.err.empty() ? ran.err
+                      : ran.signaled() ? ran.signalDescription()
+                                       : "Program exited with code " +
+                                             std::to_string(exitCode);
+    r = failure("runtime", msg);
+  }
+  r.stdout_str = std::move(ran.out);
+  r.stderr_str = std::move(ran.err);
+  r.truncated = ran.truncated;
+  r.exit_code = exitCode;
+  r.time_ms = ran.wallMs;
+  return r;
+}
+
+// The program's stdin, produced once for whichever engines need it.
+class ProgramInput {
+public:
+  explicit ProgramInput(const RunRequest &req) : req(req) {}
+
+  // All of stdin, for the in-process engines.
+  std::string_view bytes() {
+    if (req.stdinFd < 0)
+      return req.stdinContent;
+    if (!view)
+      view.emplace(req.stdinFd);
+    return view->data();
+  }
+
+  // Hands stdin to a child: the descriptor itself unless bytes() had to
+  // drain it.
+  void feed(ProcessOptions &program) {
+    if (req.stdinFd >= 0 && (!view || view->mapped()))
+      program.stdinFd = req.stdinFd;
+    else
+      program.stdinData = bytes();
+  }
+
+private:
+  const RunRequest &req;
+  std::optional<InputView> view;
+};
+
+static ProcessResult runEngine(Program &prog, const RunRequest &req,
+                               std::string_view input,
+                               const std::atomic<bool> *preempt,
+                               std::string &tier) {
+  if (req.backend == Backend::Interpret) {
+    tier = "interpreter";
+    return interpret(prog, input, preempt, req.outputLimit);
+  }
+  checkDeclarations(prog);
+  BcProgram code;
+  try {
+    code = lower(prog);
+  } catch (const LowerError &) {
+    // Outside the statically typed subset: the interpreter gives the same
+    // results, only slower.
+    tier = "interpreter";
+    return interpret(prog, input, preempt, req.outputLimit);
+  }
+  if (req.backend != Backend::Vm)
+    if (auto jit = JitProgram::compile(code)) {
+      tier = "jit";
+      return jit->run(input, preempt, req.outputLimit);
+    }
+  tier = "vm";
+  return runBytecode(code, input, preempt, req.outputLimit);
+}
+
+// Sets `flag` once `ms` milliseconds have passed, unless destroyed first.
+// Does nothing for 0.
+class Watchdog {
+public:
+  Watchdog(std::atomic<bool> &flag, long ms) {
+    if (ms <= 0)
+      return;
+    thread = std::thread([this, &flag, ms] {
+      std::unique_lock<std::mutex> lock(mu);
+      if (!cv.wait_for(lock, std::chrono::milliseconds(ms),
+                       [this] { return done; })) {
+        fired = true;
+        flag = true;
+      }
+    });
+  }
+  ~Watchdog() {
+    {
+      std::lock_guard<std::mutex> lock(mu);
+      done = true;
+    }
+    cv.notify_one();
+    if (thread.joinable())
+      thread.join();
+  }
+  Watchdog(const Watchdog &) = delete;
+  Watchdog &operator=(const Watchdog &) = delete;
+
+  bool expired() const { return fired; }
+
+private:
+  std::mutex mu;
+  std::condition_variable cv;
+  bool done = false;
+  std::atomic<bool> fired{false};
+  std::thread thread;
+};
+
+// Runs the program on an in-process engine, which stops at its next call or
+// loop iteration once `preempt` is set. Past req.timeLimitMs that happens
+// here, and the run ends like a native one killed for its time limit;
+// otherwise Preempted is passed on.
+static ProcessResult runInProcess(Program &prog, const RunRequest &req,
+                                  std::string_view input,
+                                  std::atomic<bool> &preempt,
+                                  std::string &tier) {
+  auto start = std::chrono::steady_clock::now();
+  {
+    Watchdog deadline(preempt, req.timeLimitMs);
+    try {
+      return runEngine(prog, req, input, &preempt, tier);
+    } catch (const Preempted &) {
+      if (!deadline.expired())
+        throw;
+    }
+  }
+  ProcessResult res;
+  res.started = true;
+  res.timedOut = true;
+  res.waitStatus = SIGKILL;
+  res.wallMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+                   std::chrono::steady_clock::now() - start)
+                   .count();
+  return res;
+}
+
+static std::string cacheKeyFor(const std::string &cppCode) {
+  std::string flags;
+  for (const auto &a : cxxCommand())
+    flags += a + " ";
+  return BinaryCache::makeKey(cppCode, flags, runtimeFingerprint());
+}
+
+// Compiles `cppCode` with g++ into `exePath` and stores the binary in the
+// cache under `cacheKey`. Returns a failure result when g++ rejects the code.
+static RunResult buildBinary(const RunRequest &req, const std::string &cppCode,
+                             const std::string &cacheKey,
+                             const ScratchDir &scratch,
+                             const std::string &exePath,
+                             std::vector<PhaseStat> *phases,
+                             int cancelFd = -1) {
+  std::vector<std::string> compileArgs = cxxCommand();
+  if (req.prelude) {
+    // Fall back to a plain copy of the header next to the source if the
+    // shared prelude directory is unusable.
+    std::string includeDir = req.prelude->ensure();
+    if (includeDir.empty()) {
+      includeDir = scratch.path();
+      std::ofstream hdr(scratch.file(Codegen::kPreludeHeader));
+      hdr << Codegen::prelude();
+    }
+    compileArgs.push_back("-Winvalid-pch");
+    compileArgs.push_back("-I" + includeDir);
+  }
+  auto runGxx = [&](ProcessOptions &gxx, const char *phase) {
+    gxx.mergeStderr = true; // capture gcc diagnostics
+    gxx.cancelFd = cancelFd;
+    PhaseTimer timer(phases, phase);
+    ProcessResult done = runProcess(gxx);
+    if (!done.started)
+      throw std::runtime_error("Could not run g++: " + done.error);
+    timer.setPeakKb(done.usage.peakRssKb);
+    return done;
+  };
+  // Compile with g++, streaming the generated source over its stdin. Only
+  // when phases are being timed does linking get an invocation of its own.
+  std::string objPath = scratch.file("prog.o");
+  ProcessOptions gxx;
+  gxx.argv = compileArgs;
+  for (const char *a : {"-x", "c++", "-"})
+    gxx.argv.push_back(a);
+  if (phases) {
+    for (const char *a : {"-c", "-o"})
+      gxx.argv.push_back(a);
+    gxx.argv.push_back(objPath);
+  } else {
+    for (const char *a : {"-x", "none", "-o"})
+      gxx.argv.push_back(a);
+    gxx.argv.push_back(exePath);
+    gxx.argv.push_back(runtimeLocation().library);
+  }
+  gxx.stdinData = cppCode;
+  ProcessResult compiled = runGxx(gxx, "cxx_compile");
+  if (req.prelude && PrecompiledPrelude::rejectedIn(compiled.out))
+    req.prelude->invalidate(); // stale .gch: rebuild on the next compile
+  if (phases && compiled.exitCode() == 0) {
+    ProcessOptions ld;
+    ld.argv = {cxxCommand()[0], objPath, "-o", exePath,
+               runtimeLocation().library};
+    compiled = runGxx(ld, "link");
+  }
+  const std::string &compileOutput = compiled.out;
+  int ret = compiled.exitCode();
+  if (ret != 0) {
+    // Compilation failed (C++ error, likely codegen bug or unhandled case)
+    RunResult r =
+        failure("codegen", "C++ Compilation failed: " + compileOutput);
+    r.stderr_str = compileOutput;
+    r.exit_code = ret;
+    return r;
+  }
+
+  if (req.cache)
+    req.cache->store(cacheKey, exePath);
+  return RunResult();
+}
+
+static RunResult runBinary(const std::string &exePath, const RunRequest &req,
+                           ProgramInput &input,
+                           std::vector<PhaseStat> *phases, long timeLimitMs) {
+  ProcessOptions program;
+  program.argv = {exePath};
+  input.feed(program);
+  program.captureLimit = req.outputLimit;
+  program.timeLimitMs = timeLimitMs;
+  program.memoryLimitBytes = req.memoryLimitBytes;
+  program.trackMemory = true;
+  program.countInstructions = true;
+  PhaseTimer timer(phases, "run");
+  ProcessResult ran = runProcess(program);
+  timer.setPeakKb(ran.usage.peakRssKb);
+  if (!ran.started)
+    return failure("runtime", "Could not start program: " + ran.error);
+  RunResult r = programResult(ran);
+  r.usage = ran.usage;
+  r.tier = "native";
+  return r;
+}
+
+// g++ building the program on its own thread, for runTiered(); sets `built`
+// once the binary is ready. Destroying it kills a compile that is still
+// running.
+class BackgroundBuild {
+public:
+  BackgroundBuild(std::function<bool(int cancelFd)> build,
+                  std::atomic<bool> &built)
+      : built(built) {
+    if (::pipe2(cancelPipe, O_CLOEXEC) != 0)
+      throw std::runtime_error("pipe: " + std::string(std::strerror(errno)));
+    thread = std::thread([this, build = std::move(build)] {
+      try {
+        if (build(cancelPipe[0]))
+          this->built = true;
+      } catch (const std::exception &) {
+        // No g++: the program just stays on the in-process tier.
+      }
+    });
+  }
+  ~BackgroundBuild() {
+    if (thread.joinable()) {
+      [[maybe_unused]] ssize_t n = ::write(cancelPipe[1], "x", 1);
+      thread.join();
+    }
+    ::close(cancelPipe[0]);
+    ::close(cancelPipe[1]);
+  }
+  BackgroundBuild(const BackgroundBuild &) = delete;
+  BackgroundBuild &operator=(const BackgroundBuild &) = delete;
+
+  void wait() { thread.join(); }
+
+private:
+  int cancelPipe[2];
+  std::atomic<bool> &built;
+  std::thread thread;
+};
+
+// Starts the program in-process right away while g++ builds it in the
+// background. If the binary is ready before the program has finished, the
+// in-process run is abandoned at its next call or loop iteration and the
+// binary runs instead. In-process tiers deliver their output only at the end
+// and get all of stdin up front, so the restart is never observable. A
+// program that finishes first cancels g++.
+static RunResult runTiered(Program &prog, const RunRequest &req,
+                           std::vector<PhaseStat> *phases) {
+  auto start = std::chrono::steady_clock::now();
+  std::string cppCode = measurePhase(phases, "codegen", [&] {
+    return Codegen().generate(prog, req.prelude == nullptr);
+  });
+  ScratchDir scratch;
+  std::string exePath = scratch.file("prog");
+  std::string cacheKey = req.cache ? cacheKeyFor(cppCode) : "";
+
+  RunResult r;
+  ProgramInput input(req);
+  if (req.cache && req.cache->fetch(cacheKey, exePath)) {
+    r = runBinary(exePath, req, input, phases, req.timeLimitMs);
+    r.cache_hit = true;
+  } else {
+    // g++'s phases are recorded on the build thread and merged once it has
+    // been joined.
+    std::vector<PhaseStat> buildPhases;
+    {
+      // Set by the build once the binary is ready, or by the deadline.
+      std::atomic<bool> preempt{false};
+      BackgroundBuild build(
+          [&](int cancelFd) {
+            return buildBinary(req, cppCode, cacheKey, scratch, exePath,
+                               phases ? &buildPhases : nullptr, cancelFd)
+                .success;
+          },
+          preempt);
+      // Both tiers count as one "run", timed until the program finishes.
+      PhaseTimer timer(phases, "run");
+      try {
+        std::string tier;
+        ProcessResult ran =
+            runInProcess(prog, req, input.bytes(), preempt, tier);
+        r = programResult(ran);
+        r.tier = tier;
+      } catch (const Preempted &) {
+        build.wait();
+        // The binary gets what is left of the time limit.
+        long limit = req.timeLimitMs;
+        if (limit > 0) {
+          auto spent = std::chrono::duration_cast<std::chrono::milliseconds>(
+              std::chrono::steady_clock::now() - start);
+          limit = std::max(1L, limit - (long)spent.count());
+        }
+        r = runBinary(exePath, req, input, nullptr, limit);
+      }
+    }
+    if (phases)
+      phases->insert(phases->end(), buildPhases.begin(), buildPhases.end());
+  }
+  auto end = std::chrono::steady_clock::now();
+  r.time_ms =
+      std::chrono::duration_cast<std::chrono::milliseconds>(end - start)
+          .count();
+  return r;
+}
+
+// Lexes, parses, checks and optimizes `source`.
+static std::unique_ptr<Program> frontEnd(std::string_view source,
+                                         std::vector<PhaseStat> *phases) {
+  // 1./2. Lexer and parser, interleaved: the parser pulls each token as it
+  // reaches it.
+  Lexer lexer(source);
+  auto prog = measurePhase(phases, "parser", [&] {
+    Parser parser(lexer);
+    return parser.parse();
+  });
+
+  // 3. Semantic
+  SemanticAnalyzer semantic;
+  measurePhase(phases, "semantic", [&] { semantic.analyze(*prog); });
+
+  // 4. Optimizer
+  Optimizer optimizer;
+  measurePhase(phases, "optimizer", [&] { optimizer.optimize(*prog); });
+  return prog;
+}
+
+static RunResult compileAndRun(const RunRequest &req,
+                               std::vector<PhaseStat> *phases) {
+  // Tokens point into the source, so a mapped file stays mapped until the
+  // program has been parsed.
+  std::optional<InputView> mapped;
+  std::string_view source = req.source;
+  if (req.sourceFd >= 0)
+    source = mapped.emplace(req.sourceFd).data();
+
+  // The checked tree from an earlier run of the same source, if any. Only
+  // programs that passed the front end are ever stored.
+  std::unique_ptr<Program> prog;
+  std::string astKey;
+  if (req.astCache) {
+    prog = measurePhase(phases, "ast_cache", [&] {
+      astKey = AstCache::keyFor(source);
+      return req.astCache->load(astKey);
+    });
+  }
+  if (!prog && req.astCache) {
+    // Unchanged functions come from earlier entries; the phases are only
+    // reported if the piecewise front end got through.
+    std::vector<FunctionRecord> functions;
+    std::vector<PhaseStat> steps;
+    prog = incrementalFrontEnd(source, *req.astCache, functions,
+                               phases ? &steps : nullptr);
+    if (prog && phases)
+      phases->insert(phases->end(), steps.begin(), steps.end());
+    if (!prog) {
+      prog = frontEnd(source, phases);
+      functions.clear();
+    }
+    req.astCache->store(astKey, *prog, functions);
+  }
+  if (!prog)
+    prog = frontEnd(source, phases);
+
+  if (req.backend == Backend::Tiered && req.run)
+    return runTiered(*prog, req, phases);
+  if (req.backend != Backend::Compile && req.backend != Backend::Tiered) {
+    // Nothing to build: execute the checked AST in-process.
+    if (!req.run)
+      return RunResult();
+    std::string tier;
+    ProgramInput input(req);
+    std::atomic<bool> preempt{false};
+    ProcessResult ran = measurePhase(phases, "run", [&] {
+      return runInProcess(*prog, req, input.bytes(), preempt, tier);
+    });
+    RunResult r = programResult(ran);
+    r.tier = tier;
+    return r;
+  }
+
+  // 5. Codegen
+  Codegen codegen;
+  std::string cppCode = measurePhase(phases, "codegen", [&] {
+    return codegen.generate(*prog, req.prelude == nullptr);
+  });
+
+  // Everything below lives in a private directory removed on return.
+  ScratchDir scratch;
+  std::string exePath = scratch.file("prog");
+
+  // 6. Reuse a previously built binary for identical generated code.
+  std::string cacheKey;
+  bool cacheHit = false;
+  if (req.cache) {
+    cacheKey = cacheKeyFor(cppCode);
+    cacheHit = req.cache->fetch(cacheKey, exePath);
+  }
+
+  if (!cacheHit) {
+    RunResult built =
+        buildBinary(req, cppCode, cacheKey, scratch, exePath, phases);
+    if (!built.success)
+      return built;
+  }
+
+  if (!req.run) {
+    // Just compiled: keep the binary for the user to run by hand.
+    if (!req.outputPath.empty()) {
+      std::error_code ec;
+      std::filesystem::copy_file(
+          exePath, req.outputPath,
+          std::filesystem::copy_options::overwrite_existing, ec);
+      if (ec)
+        return failure("file", "Could not write executable to " +
+                                   req.outputPath + ": " + ec.message());
+    }
+    RunResult r;
+    r.cache_hit = cacheHit;
+    return r;
+  }
+
+  // Execute the binary
+  ProgramInput input(req);
+  RunResult r = runBinary(exePath, req, input, phases, req.timeLimitMs);
+  r.cache_hit = cacheHit;
+  return r;
+}
+
+static RunResult checkedRun(const RunRequest &req,
+                           std::vector<PhaseStat> *phases) {
+  try {
+    return compileAndRun(req, phases);
+  } catch (const LexError &e) {
+    return failure("lexer", e.what(), e.line, e.col);
+  } catch (const ParseError &e) {
+    return failure("parser", e.what(), e.line, e.col);
+  } catch (const SemanticError &e) {
+    return failure("semantic", e.what(), e.line, e.col);
+  } catch (const InterpretError &e) {
+    return failure("codegen", e.what(), e.line, e.col);
+  } catch (const std::exception &e) {
+    return failure("unknown", e.what());
+  }
+}
+
+RunResult runPipeline(const RunRequest &req) {
+  SymbolScope symbols;
+  std::vector<PhaseStat> phases;
+  RunResult r = checkedRun(req, req.phases ? &phases : nullptr);
+  r.phases = std::move(phases);
+  return r;
+}
+
+} // namespace tinylang
@@ -0,0 +1,128 @@
+#pragma once
+
+#include "phases.hpp"
+#include "process.hpp"
+#include <optional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace tinylang {
+
+class AstCache;
+class BinaryCache;
+class PrecompiledPrelude;
+
+// Where generated programs find tinylang_rt.h and libtinylang-runtime.a.
+// $TINYLANG_RUNTIME_DIR (holding both files) overrides the build-tree paths
+// baked in at compile time.
+struct RuntimeLocation {
+  std::string includeDir;
+  std::string library;
+};
+const RuntimeLocation &runtimeLocation();
+
+// Identifies what a built program depends on besides its own C++ source:
+// kRuntimeVersion, the contents of tinylang_rt.h and libtinylang-runtime.a,
+// and the `g++ --version` banner. Computed on first use.
+const std::string &runtimeFingerprint();
+
+// g++ argv (without inputs/outputs) used for generated programs and their
+// precompiled prelude: optimization, language level and runtime include path.
+std::vector<std::string> cxxCommand();
+
+// How a checked program is executed. The in-process backends skip codegen
+// and g++ but produce the same observable output as the compiled binary.
+enum class Backend {
+  Compile,   // generate C++, build it with g++ and run the binary
+  Interpret, // walk the AST
+  Vm,        // lower to register bytecode and run it; programs outside the
+             // subset lower() handles fall back to Interpret
+  Jit,       // lower to bytecode and translate it to native code in memory;
+             // falls back to Vm where no code generator is available
+  Tiered,    // start on Jit while g++ builds the binary in the background;
+             // switch to the binary if it is ready before the program ends
+};
+
+constexpr size_t kDefaultOutputLimit = size_t(16) << 20;
+
+// One compile (and optional run) of a TinyLang program.
+struct RunRequest {
+  std::string source;
+  // Read the source from this descriptor instead; a regular file is mapped
+  // and lexed in place.
+  int sourceFd = -1;
+  std::string stdinContent;
+  // Read the program's stdin from this descriptor instead of stdinContent.
+  // A binary inherits it directly; in-process engines map it when it is a
+  // regular file and read it into memory otherwise.
+  int stdinFd = -1;
+  bool run = true;
+  // With an in-process backend and `run` false only the front end runs.
+  Backend backend = Backend::Compile;
+  // Where to leave the executable when `run` is false. Empty: discard it.
+  std::string outputPath;
+  // Shared binary cache, or nullptr to always invoke g++.
+  BinaryCache *cache = nullptr;
+  // Checked programs from earlier requests, or nullptr to always run the
+  // front end.
+  AstCache *astCache = nullptr;
+  // Precompiled runtime prelude, or nullptr to paste the prelude into every
+  // generated program.
+  PrecompiledPrelude *prelude = nullptr;
+  // How much of the program's stdout and of its stderr is kept; the rest is
+  // discarded as it arrives and RunResult::truncated is set. 0: unlimited.
+  size_t outputLimit = kDefaultOutputLimit;
+  // Wall-clock limit on the program's run; past it the program is killed and
+  // a runtime error is reported. 0: unlimited.
+  long timeLimitMs = 0;
+  // Address-space limit (RLIMIT_AS) on the compiled program. 0: unlimited.
+  size_t memoryLimitBytes = 0;
+  // Report wall time and peak memory per stage in RunResult::phases. When
+  // set, g++ compiles and links in two separate invocations.
+  bool phases = false;
+};
+
+struct RunResult {
+  bool success = true;
+  std::string stdout_str;
+  std::string stderr_str;
+  // Output beyond RunRequest::outputLimit was dropped.
+  bool truncated = false;
+  int exit_code = 0;
+  long time_ms = 0;
+  std::string error_phase;
+  std::string error_msg;
+  int line = 0;
+  int col = 0;
+  bool cache_hit = false;
+  // Which engine produced the output: "native", "jit", "vm" or
+  // "interpreter". Empty when nothing ran.
+  std::string tier;
+  // What the program consumed, when it ran as a native binary.
+  std::optional<ResourceUsage> usage;
+  // Stages in the order they finished, with RunRequest::phases.
+  std::vector<PhaseStat> phases;
+};
+
+RunResult failure(const std::string &phase, const std::string &msg,
+                  int line = 0, int col = 0);
+
+// Runs lexer -> parser -> semantic -> optimizer -> codegen -> g++ (-> run),
+// or lexer -> parser -> semantic -> optimizer -> interpreter / VM / JIT, or
+// both at once for Backend::Tiered. With an AstCache, a source seen before
+// skips straight from the cached tree to codegen or the in-process backend.
+// Never throws; every failure is reported through the result. Safe to call
+// from several threads at once.
+RunResult runPipeline(const RunRequest &req);
+
+// Writes the result object consumed by the server. `pretty` selects the
+// multi-line layout used by the CLI; otherwise the object is emitted on a
+// single line, as required by the --serve protocol. A non-empty `idJson` (a
+// serialized JSON value) is echoed back as the "id" member.
+void writeJson(std::ostream &os, const RunResult &r, bool pretty = true,
+               const std::string &idJson = "");
+// The "usage" member's value, on one line.
+void writeJson(std::ostream &os, const ResourceUsage &u);
+
+} // namespace tinylang
@@ -0,0 +1,106 @@
+#include "prelude.hpp"
+#include "cache.hpp"
+#include "codegen.hpp"
+#include "hash.hpp"
+#include "pipeline.hpp"
+#include "process.hpp"
+#include <cstdio>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <sys/file.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+namespace tinylang {
+
+PrecompiledPrelude::PrecompiledPrelude(std::string root,
+                                       std::vector<std::string> compileCommand)
+    : command(std::move(compileCommand)) {
+  if (root.empty())
+    root = defaultCacheDir();
+  std::string flags;
+  for (const auto &a : command)
+    flags += a + " ";
+  // The prelude includes tinylang_rt.h, whose contents the .gch captures.
+  std::string key = sha256Hex(flags + "\n" + runtimeFingerprint() + "\n" +
+                              Codegen::prelude());
+  dir = root + "/pch/" + key.substr(0, 16);
+}
+
+static bool writeAtomically(const std::string &path,
+                            const std::string &content) {
+  std::string tmp = path + ".tmp." + std::to_string(::getpid());
+  {
+    std::ofstream out(tmp, std::ios::binary);
+    out << content;
+    if (!out)
+      return false;
+  }
+  if (::rename(tmp.c_str(), path.c_str()) != 0) {
+    ::unlink(tmp.c_str());
+    return false;
+  }
+  return true;
+}
+
+std::string PrecompiledPrelude::ensure() {
+  std::lock_guard<std::mutex> lock(mu);
+  if (checked)
+    return headerReady ? dir : "";
+  checked = true;
+
+  std::error_code ec;
+  fs::create_directories(dir, ec);
+  std::string header = dir + "/" + Codegen::kPreludeHeader;
+  headerReady = fs::exists(header, ec) ||
+                writeAtomically(header, Codegen::prelude());
+  if (!headerReady)
+    return "";
+
+  if (!fs::exists(header + ".gch", ec))
+    build(); // on failure g++ just parses the plain header
+  return dir;
+}
+
+bool PrecompiledPrelude::build() {
+  // Serialize builders across processes; whoever gets the lock second finds
+  // the finished .gch and returns.
+  int lockFd = ::open((dir + "/.lock").c_str(), O_RDWR | O_CREAT | O_CLOEXEC,
+                      0644);
+  if (lockFd < 0)
+    return false;
+  ::flock(lockFd, LOCK_EX);
+
+  std::string header = dir + "/" + Codegen::kPreludeHeader;
+  std::string gch = header + ".gch";
+  bool ok = fs::exists(gch);
+  if (!ok) {
+    std::string tmp = gch + ".tmp." + std::to_string(::getpid());
+    ProcessOptions gxx;
+    gxx.argv = command;
+    for (const std::string &a : {std::string("-x"), std::string("c++-header"),
+                                 header, std::string("-o"), tmp})
+      gxx.argv.push_back(a);
+    gxx.mergeStderr = true;
+    ok = runProcess(gxx).ok() && ::rename(tmp.c_str(), gch.c_str()) == 0;
+    if (!ok)
+      ::unlink(tmp.c_str());
+  }
+
+  ::close(lockFd);
+  return ok;
+}
+
+void PrecompiledPrelude::invalidate() {
+  std::lock_guard<std::mutex> lock(mu);
+  ::unlink((dir + "/" + Codegen::kPreludeHeader + ".gch").c_str());
+  checked = false;
+}
+
+bool PrecompiledPrelude::rejectedIn(const std::string &compilerOutput) {
+  return compilerOutput.find("[-Winvalid-pch]") != std::string::npos;
+}
+
+} // namespace tinylang
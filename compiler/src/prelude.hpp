@@ -0,0 +1,47 @@
+#pragma once
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace tinylang {
+
+// Maintains a precompiled header for Codegen::prelude() so g++ does not
+// re-parse <iostream> and friends for every program.
+//
+// The header and its .gch live in `<root>/pch/<hash>/`, where the hash covers
+// the prelude text, the compile flags and the runtime (runtimeFingerprint()),
+// so a changed prelude, flag set or tinylang_rt.h simply gets a new
+// directory. The .gch is built on first use (guarded by an
+// flock so concurrent drivers build it once) and published atomically.
+// If the PCH cannot be built, or g++ later reports it as unusable (e.g. after
+// a compiler upgrade), compiles still succeed from the plain header and the
+// stale .gch is discarded so the next ensure() rebuilds it.
+class PrecompiledPrelude {
+public:
+  // An empty `root` selects defaultCacheDir(); `compileCommand` is the g++
+  // argv the prelude will be included under (see cxxCommand()).
+  PrecompiledPrelude(std::string root, std::vector<std::string> compileCommand);
+
+  // Returns a directory containing the prelude header (and, when possible,
+  // its .gch) suitable for `-I`, or an empty string if even the header could
+  // not be written. Thread-safe; only the first call does any work.
+  std::string ensure();
+
+  // Call when g++ output shows the .gch was rejected.
+  void invalidate();
+
+  // True if `compilerOutput` contains g++'s -Winvalid-pch diagnostic.
+  static bool rejectedIn(const std::string &compilerOutput);
+
+private:
+  std::string dir;
+  std::vector<std::string> command;
+  std::mutex mu;
+  bool checked = false;
+  bool headerReady = false;
+
+  bool build();
+};
+
+} // namespace tinylang
@@ -0,0 +1,451 @@
+#include "process.hpp"
+#include "tinylang_spawn.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/perf_event.h>
+#include <optional>
+#include <poll.h>
+#include <spawn.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char **environ;
+
+namespace tinylang {
+
+int ProcessResult::exitCode() const {
+  if (WIFSIGNALED(waitStatus))
+    return 128 + WTERMSIG(waitStatus);
+  return WEXITSTATUS(waitStatus);
+}
+
+bool ProcessResult::signaled() const { return WIFSIGNALED(waitStatus); }
+
+std::string ProcessResult::signalDescription() const {
+  int sig = WTERMSIG(waitStatus);
+  return "Program terminated by signal " + std::to_string(sig) + " (" +
+         strsignal(sig) + ")";
+}
+
+namespace {
+
+// Owns a file descriptor.
+struct Fd {
+  int fd = -1;
+  Fd() = default;
+  Fd(const Fd &) = delete;
+  Fd &operator=(const Fd &) = delete;
+  ~Fd() { reset(); }
+  void reset() {
+    if (fd >= 0)
+      ::close(fd);
+    fd = -1;
+  }
+};
+
+bool makePipe(Fd &readEnd, Fd &writeEnd) {
+  int fds[2];
+  if (::pipe2(fds, O_CLOEXEC) != 0)
+    return false;
+  readEnd.fd = fds[0];
+  writeEnd.fd = fds[1];
+  return true;
+}
+
+// The kernel's high-water mark of the process's resident set (VmHWM), in
+// KiB; 0 once it has exited.
+long peakRss(pid_t pid) {
+  std::string path = "/proc/" + std::to_string(pid) + "/status";
+  Fd f;
+  f.fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (f.fd < 0)
+    return 0;
+  char buf[4096];
+  ssize_t n = ::read(f.fd, buf, sizeof(buf) - 1);
+  if (n <= 0)
+    return 0;
+  buf[n] = '\0';
+  const char *hwm = std::strstr(buf, "VmHWM:");
+  return hwm ? std::atol(hwm + 6) : 0;
+}
+
+// Counts the user-space instructions of the children this thread spawns. The
+// counter is inherited by each child but only switched on by its exec, and a
+// child's count is added to this one when it exits, so neither the spawning
+// thread nor the time before exec is included.
+class InstructionCounter {
+public:
+  InstructionCounter() {
+    perf_event_attr attr{};
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+    attr.disabled = 1;
+    attr.enable_on_exec = 1;
+    attr.inherit = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    counter.fd = (int)::syscall(SYS_perf_event_open, &attr, 0, -1, -1,
+                                PERF_FLAG_FD_CLOEXEC);
+  }
+
+  // -1 when perf events are unavailable or not permitted.
+  long long read() const {
+    uint64_t n;
+    if (counter.fd < 0 || ::read(counter.fd, &n, sizeof(n)) != sizeof(n))
+      return -1;
+    return (long long)n;
+  }
+
+private:
+  Fd counter;
+};
+
+double toMs(const timeval &tv) { return tv.tv_sec * 1e3 + tv.tv_usec / 1e3; }
+
+// posix_spawn cannot set resource limits, and setting one after it returns
+// leaves the program running unlimited for a while. So a child with a memory
+// limit is forked and applies it itself before exec. Only async-signal-safe
+// calls may run in the child. Returns 0 or the errno of the failed step.
+int forkWithLimit(pid_t &pid, char *const argv[], int stdinFd, int stdoutFd,
+                  int stderrFd, int reportFd, bool newGroup,
+                  size_t memoryLimitBytes) {
+  Fd failR, failW; // carries the child's errno if exec fails
+  if (!makePipe(failR, failW))
+    return errno;
+  pid = ::fork();
+  if (pid < 0)
+    return errno;
+  if (pid == 0) {
+    ::dup2(stdinFd, STDIN_FILENO);
+    ::dup2(stdoutFd, STDOUT_FILENO);
+    ::dup2(stderrFd, STDERR_FILENO);
+    if (reportFd >= 0)
+      ::dup2(reportFd, TINYLANG_SPAWN_REPORT_FD);
+    if (newGroup)
+      ::setpgid(0, 0);
+    struct sigaction dfl {};
+    dfl.sa_handler = SIG_DFL;
+    ::sigaction(SIGPIPE, &dfl, nullptr);
+    rlimit lim{memoryLimitBytes, memoryLimitBytes};
+    if (::setrlimit(RLIMIT_AS, &lim) == 0)
+      ::execvp(argv[0], argv);
+    int err = errno;
+    ssize_t ignored = ::write(failW.fd, &err, sizeof(err));
+    (void)ignored;
+    ::_exit(127);
+  }
+  if (newGroup)
+    ::setpgid(pid, pid); // also here, in case we signal it first
+  failW.reset();
+  int err = 0;
+  ssize_t n;
+  while ((n = ::read(failR.fd, &err, sizeof(err))) < 0 && errno == EINTR) {
+  }
+  if (n != (ssize_t)sizeof(err))
+    return 0; // closed by a successful exec
+  ::waitpid(pid, nullptr, 0);
+  return err;
+}
+
+#ifndef TINYLANG_SPAWN_HELPER
+#define TINYLANG_SPAWN_HELPER "tinylang-spawn"
+#endif
+
+// tinylang-spawn (see tinylang_spawn.h); $TINYLANG_SPAWN_HELPER overrides the
+// build-tree path. Empty if it cannot be executed.
+const std::string &spawnHelper() {
+  static const std::string path = [] {
+    const char *env = std::getenv("TINYLANG_SPAWN_HELPER");
+    std::string p = env && *env ? env : TINYLANG_SPAWN_HELPER;
+    return ::access(p.c_str(), X_OK) == 0 ? p : std::string();
+  }();
+  return path;
+}
+
+bool readFull(int fd, void *p, size_t n) {
+  char *c = static_cast<char *>(p);
+  while (n > 0) {
+    ssize_t r = ::read(fd, c, n);
+    if (r < 0 && errno == EINTR)
+      continue;
+    if (r <= 0)
+      return false;
+    c += r;
+    n -= (size_t)r;
+  }
+  return true;
+}
+
+} // namespace
+
+InputView::InputView(int fd) {
+  struct stat st;
+  if (::fstat(fd, &st) != 0)
+    throw std::runtime_error(std::string("read: ") + std::strerror(errno));
+  if (S_ISREG(st.st_mode)) {
+    off_t pos = ::lseek(fd, 0, SEEK_CUR);
+    if (pos < 0 || pos >= st.st_size)
+      return; // nothing left to read
+    void *p =
+        ::mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p != MAP_FAILED) {
+      map = p;
+      mapBytes = (size_t)st.st_size;
+      view = std::string_view((const char *)p + pos, mapBytes - (size_t)pos);
+      return;
+    }
+  }
+  char buf[65536];
+  for (;;) {
+    ssize_t n = ::read(fd, buf, sizeof(buf));
+    if (n > 0)
+      buffer.append(buf, (size_t)n);
+    else if (n == 0)
+      break;
+    else if (errno != EINTR)
+      throw std::runtime_error(std::string("read: ") + std::strerror(errno));
+  }
+  view = buffer;
+}
+
+InputView::~InputView() {
+  if (map)
+    ::munmap(map, mapBytes);
+}
+
+ProcessResult runProcess(const ProcessOptions &opts) {
+  // Writing stdin to a child that exits early must fail with EPIPE rather
+  // than kill us.
+  static const bool sigpipeIgnored = [] {
+    std::signal(SIGPIPE, SIG_IGN);
+    return true;
+  }();
+  (void)sigpipeIgnored;
+
+  ProcessResult res;
+  Fd inR, inW, outR, outW, errR, errW;
+  bool pipeStdin = opts.stdinFd < 0;
+  if ((pipeStdin && !makePipe(inR, inW)) || !makePipe(outR, outW) ||
+      (!opts.mergeStderr && !makePipe(errR, errW))) {
+    res.error = std::string("pipe: ") + std::strerror(errno);
+    return res;
+  }
+
+  // With trackMemory the program runs under tinylang-spawn, whose report
+  // arrives on reportR. dup2() onto the same descriptor would leave it
+  // close-on-exec, so the write end is kept off that number.
+  bool viaHelper = opts.trackMemory && !spawnHelper().empty();
+  Fd reportR, reportW;
+  if (viaHelper) {
+    if (!makePipe(reportR, reportW)) {
+      res.error = std::string("pipe: ") + std::strerror(errno);
+      return res;
+    }
+    if (reportW.fd == TINYLANG_SPAWN_REPORT_FD) {
+      int moved = ::fcntl(reportW.fd, F_DUPFD_CLOEXEC,
+                          TINYLANG_SPAWN_REPORT_FD + 1);
+      reportW.reset();
+      reportW.fd = moved;
+    }
+  }
+
+  int childIn = pipeStdin ? inR.fd : opts.stdinFd;
+  int childErr = opts.mergeStderr ? outW.fd : errW.fd;
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_adddup2(&actions, childIn, STDIN_FILENO);
+  posix_spawn_file_actions_adddup2(&actions, outW.fd, STDOUT_FILENO);
+  posix_spawn_file_actions_adddup2(&actions, childErr, STDERR_FILENO);
+  if (viaHelper)
+    posix_spawn_file_actions_adddup2(&actions, reportW.fd,
+                                     TINYLANG_SPAWN_REPORT_FD);
+
+  // The child gets default signal dispositions (in particular SIGPIPE).
+  posix_spawnattr_t attr;
+  posix_spawnattr_init(&attr);
+  sigset_t defaults;
+  sigemptyset(&defaults);
+  sigaddset(&defaults, SIGPIPE);
+  posix_spawnattr_setsigdefault(&attr, &defaults);
+  short flags = POSIX_SPAWN_SETSIGDEF;
+  if (opts.cancelFd >= 0)
+    flags |= POSIX_SPAWN_SETPGROUP; // process group = the child's pid
+  posix_spawnattr_setflags(&attr, flags);
+
+  std::vector<char *> argv;
+  if (viaHelper) {
+    argv.push_back(const_cast<char *>(spawnHelper().c_str()));
+    argv.push_back(const_cast<char *>(opts.countInstructions ? "1" : "0"));
+  }
+  for (const auto &a : opts.argv)
+    argv.push_back(const_cast<char *>(a.c_str()));
+  argv.push_back(nullptr);
+
+  std::optional<InstructionCounter> instructions;
+  if (opts.countInstructions && !viaHelper)
+    instructions.emplace();
+
+  auto start = std::chrono::steady_clock::now();
+  pid_t pid;
+  int rc;
+  if (opts.memoryLimitBytes)
+    rc = forkWithLimit(pid, argv.data(), childIn, outW.fd, childErr,
+                       viaHelper ? reportW.fd : -1, opts.cancelFd >= 0,
+                       opts.memoryLimitBytes);
+  else
+    rc = posix_spawnp(&pid, argv[0], &actions, &attr, argv.data(), environ);
+  posix_spawn_file_actions_destroy(&actions);
+  posix_spawnattr_destroy(&attr);
+  if (rc != 0) {
+    res.error = opts.argv[0] + ": " + std::strerror(rc);
+    return res;
+  }
+  res.started = true;
+  auto deadline = start + std::chrono::milliseconds(opts.timeLimitMs);
+
+  // Our copies of the child's ends must go, or we never see EOF.
+  inR.reset();
+  outW.reset();
+  errW.reset();
+  reportW.reset();
+
+  // The program itself: the helper's child, announced as soon as it forks.
+  pid_t program = pid;
+  if (viaHelper) {
+    pid_t announced = 0;
+    bool got = readFull(reportR.fd, &announced, sizeof(announced));
+    program = got && announced > 0 ? announced : 0;
+  }
+
+  size_t written = 0;
+  if (pipeStdin && !opts.stdinData.empty())
+    ::fcntl(inW.fd, F_SETFL, O_NONBLOCK);
+  else
+    inW.reset();
+
+  char buf[65536];
+  bool cancelled = false;
+  while (inW.fd >= 0 || outR.fd >= 0 || errR.fd >= 0) {
+    pollfd fds[4];
+    int n = 0;
+    if (inW.fd >= 0)
+      fds[n++] = {inW.fd, POLLOUT, 0};
+    if (outR.fd >= 0)
+      fds[n++] = {outR.fd, POLLIN, 0};
+    if (errR.fd >= 0)
+      fds[n++] = {errR.fd, POLLIN, 0};
+    if (opts.cancelFd >= 0 && !cancelled)
+      fds[n++] = {opts.cancelFd, POLLIN, 0};
+    int timeout = opts.trackMemory ? 10 : -1;
+    if (opts.timeLimitMs > 0 && !res.timedOut) {
+      auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+          deadline - std::chrono::steady_clock::now());
+      int untilDeadline = left.count() > 0 ? (int)left.count() + 1 : 0;
+      if (timeout < 0 || untilDeadline < timeout)
+        timeout = untilDeadline;
+    }
+    int ready = ::poll(fds, n, timeout);
+    if (opts.trackMemory && program > 0)
+      res.usage.peakRssKb = std::max(res.usage.peakRssKb, peakRss(program));
+    if (ready == 0) {
+      if (opts.timeLimitMs > 0 && !res.timedOut &&
+          std::chrono::steady_clock::now() >= deadline) {
+        ::kill(program > 0 ? program : pid, SIGKILL);
+        res.timedOut = true;
+      }
+      continue;
+    }
+    if (ready < 0) {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+    for (int i = 0; i < n; ++i) {
+      if (!fds[i].revents)
+        continue;
+      if (fds[i].fd == opts.cancelFd) {
+        ::kill(-pid, SIGKILL);
+        cancelled = true;
+        continue;
+      }
+      if (fds[i].fd == inW.fd) {
+        ssize_t w = ::write(inW.fd, opts.stdinData.data() + written,
+                            opts.stdinData.size() - written);
+        if (w > 0)
+          written += (size_t)w;
+        if ((w < 0 && errno != EAGAIN && errno != EINTR) ||
+            written == opts.stdinData.size())
+          inW.reset(); // done, or the child closed its stdin (EPIPE)
+        continue;
+      }
+      bool isOut = fds[i].fd == outR.fd;
+      Fd &src = isOut ? outR : errR;
+      ssize_t r = ::read(src.fd, buf, sizeof(buf));
+      if (r > 0 && isOut && opts.onStdout)
+        opts.onStdout(std::string_view(buf, (size_t)r));
+      else if (r > 0) {
+        std::string &dst = isOut ? res.out : res.err;
+        size_t keep = (size_t)r;
+        if (opts.captureLimit && keep > opts.captureLimit - dst.size()) {
+          keep = opts.captureLimit - dst.size();
+          res.truncated = true;
+        }
+        dst.append(buf, keep);
+      }
+      else if (r == 0 || (errno != EINTR && errno != EAGAIN))
+        src.reset();
+    }
+  }
+
+  rusage usage{};
+  while (::wait4(pid, &res.waitStatus, 0, &usage) < 0 && errno == EINTR) {
+  }
+  auto end = std::chrono::steady_clock::now();
+  tinylang_spawn_report report;
+  bool reported =
+      viaHelper && readFull(reportR.fd, &report, sizeof(report));
+  if (reported && report.error) {
+    res.started = false;
+    res.error = opts.argv[0] + ": " + std::strerror(report.error);
+    return res;
+  }
+  if (reported) {
+    res.waitStatus = report.status;
+    usage = report.usage;
+  }
+  // Sampling misses growth after the last sample. Without the helper the
+  // rusage figure starts out at our own peak, so it only counts above it,
+  // and a child that exits before the first sample is left unknown.
+  if (!opts.trackMemory || reported ||
+      usage.ru_maxrss > peakRss(::getpid()))
+    res.usage.peakRssKb = std::max(res.usage.peakRssKb, usage.ru_maxrss);
+  if (opts.trackMemory && res.usage.peakRssKb == 0)
+    res.usage.peakRssKb = -1;
+  res.usage.userMs = toMs(usage.ru_utime);
+  res.usage.sysMs = toMs(usage.ru_stime);
+  res.usage.minorFaults = usage.ru_minflt;
+  res.usage.majorFaults = usage.ru_majflt;
+  res.usage.voluntarySwitches = usage.ru_nvcsw;
+  res.usage.involuntarySwitches = usage.ru_nivcsw;
+  if (reported)
+    res.usage.instructions = report.instructions;
+  else if (instructions)
+    res.usage.instructions = instructions->read();
+  res.wallMs =
+      std::chrono::duration_cast<std::chrono::milliseconds>(end - start)
+          .count();
+  return res;
+}
+
+} // namespace tinylang
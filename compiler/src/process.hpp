@@ -0,0 +1,107 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace tinylang {
+
+struct ProcessOptions {
+  // argv[0] is looked up on PATH.
+  std::vector<std::string> argv;
+  // Written to the child's stdin, which is then closed.
+  std::string_view stdinData;
+  // When set, the child reads stdin from this descriptor directly (sharing
+  // its file offset) and stdinData is ignored.
+  int stdinFd = -1;
+  // Send stderr into the stdout capture (like `2>&1`).
+  bool mergeStderr = false;
+  // When this descriptor becomes readable the child and everything it has
+  // spawned (it runs in its own process group) are killed with SIGKILL.
+  int cancelFd = -1;
+  // Wall-clock limit; the child is killed with SIGKILL once it is exceeded.
+  // 0: unlimited.
+  long timeLimitMs = 0;
+  // Address-space limit (RLIMIT_AS) applied to the child. 0: unlimited.
+  size_t memoryLimitBytes = 0;
+  // Measure the child's own peak memory; see ResourceUsage::peakRssKb.
+  bool trackMemory = false;
+  // Fill in ResourceUsage::instructions.
+  bool countInstructions = false;
+  // Keep at most this many bytes each of stdout and stderr; the rest is read
+  // and discarded. 0: unlimited.
+  size_t captureLimit = 0;
+  // When set, stdout is handed over chunk by chunk as it arrives instead of
+  // being collected in ProcessResult::out.
+  std::function<void(std::string_view)> onStdout;
+};
+
+// What the child consumed, from wait4().
+struct ResourceUsage {
+  double userMs = 0;
+  double sysMs = 0;
+  // Peak resident set size in KiB. With trackMemory it is the child's own,
+  // or -1 when it could not be measured (see tinylang_spawn.h). Otherwise it
+  // covers the child's descendants too, but is never below this process's
+  // peak: Linux carries that over into a spawned child.
+  long peakRssKb = 0;
+  long minorFaults = 0;
+  long majorFaults = 0;
+  long voluntarySwitches = 0;
+  long involuntarySwitches = 0;
+  // Instructions retired in user space from exec on, with countInstructions
+  // where the kernel grants a hardware counter; otherwise -1.
+  long long instructions = -1;
+};
+
+struct ProcessResult {
+  // False if the child could not be started; see `error`.
+  bool started = false;
+  std::string error;
+  int waitStatus = 0;
+  std::string out;
+  std::string err;
+  long wallMs = 0;
+  // Set when the child was killed for exceeding timeLimitMs.
+  bool timedOut = false;
+  // Set when output was dropped because of captureLimit.
+  bool truncated = false;
+  ResourceUsage usage;
+
+  bool ok() const { return started && exitCode() == 0; }
+  // Shell convention: 128 + signal number when killed by a signal.
+  int exitCode() const;
+  bool signaled() const;
+  // e.g. "Program terminated by signal 8 (Floating point exception)".
+  std::string signalDescription() const;
+};
+
+// Everything a descriptor has left to read, as one view. Regular files are
+// mapped without copying or moving the file offset; anything else (pipes,
+// terminals) is read into memory. Throws std::runtime_error on I/O errors.
+class InputView {
+public:
+  explicit InputView(int fd);
+  ~InputView();
+  InputView(const InputView &) = delete;
+  InputView &operator=(const InputView &) = delete;
+
+  std::string_view data() const { return view; }
+  // False if the descriptor was consumed to fill the buffer.
+  bool mapped() const { return map != nullptr; }
+
+private:
+  void *map = nullptr;
+  size_t mapBytes = 0;
+  std::string buffer;
+  std::string_view view;
+};
+
+// Spawns the child directly (posix_spawn, no /bin/sh), feeds stdin and drains
+// stdout/stderr concurrently through pipes with poll(), then reaps it.
+// Thread-safe: all descriptors are close-on-exec, so concurrent spawns from
+// other threads never inherit each other's pipes.
+ProcessResult runProcess(const ProcessOptions &opts);
+
+} // namespace tinylang
@@ -0,0 +1,253 @@
+#include "scan.hpp"
+#include <algorithm>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+namespace tinylang {
+
+namespace {
+
+// The same classes as the <cctype> functions in the "C" locale.
+bool stopsSpace(char c) { return c != ' ' && (unsigned char)(c - '\t') > 4; }
+bool stopsIdentifier(char c) {
+  return c != '_' && (unsigned char)(c - '0') > 9 &&
+         (unsigned char)((c | 0x20) - 'a') > 25;
+}
+bool stopsString(char c) { return c == '"' || c == '\0'; }
+bool stopsLine(char c) { return c == '\n' || c == '\0'; }
+
+template <bool (*Stop)(char)>
+const char *scanScalar(const char *p, const char *end) {
+  while (p < end && !Stop(*p))
+    ++p;
+  return p;
+}
+
+void lineStartsScalar(std::string_view text, size_t i,
+                      std::vector<uint32_t> &out) {
+  for (; i < text.size(); ++i)
+    if (text[i] == '\n')
+      out.push_back((uint32_t)i + 1);
+}
+
+#if defined(__x86_64__)
+
+// Bit i of each mask is set where byte i stops the scan. A byte b is in the
+// range [lo, lo + n] exactly when min(b - lo, n) == b - lo, unsigned.
+
+unsigned spaceStops16(__m128i v) {
+  __m128i d = _mm_sub_epi8(v, _mm_set1_epi8('\t'));
+  __m128i in =
+      _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')),
+                   _mm_cmpeq_epi8(_mm_min_epu8(d, _mm_set1_epi8(4)), d));
+  return ~_mm_movemask_epi8(in) & 0xffff;
+}
+
+unsigned identifierStops16(__m128i v) {
+  __m128i digit = _mm_sub_epi8(v, _mm_set1_epi8('0'));
+  __m128i alpha = _mm_sub_epi8(_mm_or_si128(v, _mm_set1_epi8(0x20)),
+                               _mm_set1_epi8('a'));
+  __m128i in = _mm_or_si128(
+      _mm_or_si128(
+          _mm_cmpeq_epi8(_mm_min_epu8(digit, _mm_set1_epi8(9)), digit),
+          _mm_cmpeq_epi8(_mm_min_epu8(alpha, _mm_set1_epi8(25)), alpha)),
+      _mm_cmpeq_epi8(v, _mm_set1_epi8('_')));
+  return ~_mm_movemask_epi8(in) & 0xffff;
+}
+
+unsigned stringStops16(__m128i v) {
+  return _mm_movemask_epi8(_mm_or_si128(
+      _mm_cmpeq_epi8(v, _mm_set1_epi8('"')),
+      _mm_cmpeq_epi8(v, _mm_setzero_si128())));
+}
+
+unsigned lineStops16(__m128i v) {
+  return _mm_movemask_epi8(_mm_or_si128(
+      _mm_cmpeq_epi8(v, _mm_set1_epi8('\n')),
+      _mm_cmpeq_epi8(v, _mm_setzero_si128())));
+}
+
+template <unsigned (*Stops)(__m128i), bool (*Stop)(char)>
+const char *scanSse2(const char *p, const char *end) {
+  for (; end - p >= 16; p += 16)
+    if (unsigned m = Stops(_mm_loadu_si128((const __m128i *)p)))
+      return p + __builtin_ctz(m);
+  return scanScalar<Stop>(p, end);
+}
+
+void lineStartsSse2(std::string_view text, std::vector<uint32_t> &out) {
+  const __m128i nl = _mm_set1_epi8('\n');
+  size_t i = 0;
+  for (; i + 16 <= text.size(); i += 16) {
+    unsigned m = _mm_movemask_epi8(_mm_cmpeq_epi8(
+        _mm_loadu_si128((const __m128i *)(text.data() + i)), nl));
+    for (; m; m &= m - 1)
+      out.push_back((uint32_t)(i + __builtin_ctz(m)) + 1);
+  }
+  lineStartsScalar(text, i, out);
+}
+
+#define AVX2 __attribute__((target("avx2")))
+
+AVX2 unsigned spaceStops32(__m256i v) {
+  __m256i d = _mm256_sub_epi8(v, _mm256_set1_epi8('\t'));
+  __m256i in = _mm256_or_si256(
+      _mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')),
+      _mm256_cmpeq_epi8(_mm256_min_epu8(d, _mm256_set1_epi8(4)), d));
+  return ~(unsigned)_mm256_movemask_epi8(in);
+}
+
+AVX2 unsigned identifierStops32(__m256i v) {
+  __m256i digit = _mm256_sub_epi8(v, _mm256_set1_epi8('0'));
+  __m256i alpha = _mm256_sub_epi8(
+      _mm256_or_si256(v, _mm256_set1_epi8(0x20)), _mm256_set1_epi8('a'));
+  __m256i in = _mm256_or_si256(
+      _mm256_or_si256(
+          _mm256_cmpeq_epi8(_mm256_min_epu8(digit, _mm256_set1_epi8(9)),
+                            digit),
+          _mm256_cmpeq_epi8(_mm256_min_epu8(alpha, _mm256_set1_epi8(25)),
+                            alpha)),
+      _mm256_cmpeq_epi8(v, _mm256_set1_epi8('_')));
+  return ~(unsigned)_mm256_movemask_epi8(in);
+}
+
+AVX2 unsigned stringStops32(__m256i v) {
+  return _mm256_movemask_epi8(_mm256_or_si256(
+      _mm256_cmpeq_epi8(v, _mm256_set1_epi8('"')),
+      _mm256_cmpeq_epi8(v, _mm256_setzero_si256())));
+}
+
+AVX2 unsigned lineStops32(__m256i v) {
+  return _mm256_movemask_epi8(_mm256_or_si256(
+      _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')),
+      _mm256_cmpeq_epi8(v, _mm256_setzero_si256())));
+}
+
+// Most runs are short, so the first 16 bytes are tried with SSE2 before
+// paying for a 32-byte load.
+template <unsigned (*Stops)(__m256i), unsigned (*Stops16)(__m128i),
+          bool (*Stop)(char)>
+AVX2 const char *scanAvx2(const char *p, const char *end) {
+  if (end - p >= 16) {
+    if (unsigned m = Stops16(_mm_loadu_si128((const __m128i *)p)))
+      return p + __builtin_ctz(m);
+    p += 16;
+  }
+  for (; end - p >= 32; p += 32)
+    if (unsigned m = Stops(_mm256_loadu_si256((const __m256i *)p)))
+      return p + __builtin_ctz(m);
+  return scanSse2<Stops16, Stop>(p, end);
+}
+
+AVX2 void lineStartsAvx2(std::string_view text, std::vector<uint32_t> &out) {
+  const __m256i nl = _mm256_set1_epi8('\n');
+  size_t i = 0;
+  for (; i + 32 <= text.size(); i += 32) {
+    unsigned m = _mm256_movemask_epi8(_mm256_cmpeq_epi8(
+        _mm256_loadu_si256((const __m256i *)(text.data() + i)), nl));
+    for (; m; m &= m - 1)
+      out.push_back((uint32_t)(i + __builtin_ctz(m)) + 1);
+  }
+  lineStartsScalar(text, i, out);
+}
+
+#undef AVX2
+
+#endif // __x86_64__
+
+struct ScanOps {
+  const char *(*space)(const char *, const char *);
+  const char *(*identifier)(const char *, const char *);
+  const char *(*stringEnd)(const char *, const char *);
+  const char *(*lineEnd)(const char *, const char *);
+  void (*lineStarts)(std::string_view, std::vector<uint32_t> &);
+};
+
+const ScanOps kScalar = {
+    scanScalar<stopsSpace>, scanScalar<stopsIdentifier>,
+    scanScalar<stopsString>, scanScalar<stopsLine>,
+    [](std::string_view text, std::vector<uint32_t> &out) {
+      lineStartsScalar(text, 0, out);
+    }};
+
+#if defined(__x86_64__)
+const ScanOps kSse2 = {scanSse2<spaceStops16, stopsSpace>,
+                       scanSse2<identifierStops16, stopsIdentifier>,
+                       scanSse2<stringStops16, stopsString>,
+                       scanSse2<lineStops16, stopsLine>, lineStartsSse2};
+const ScanOps kAvx2 = {
+    scanAvx2<spaceStops32, spaceStops16, stopsSpace>,
+    scanAvx2<identifierStops32, identifierStops16, stopsIdentifier>,
+    scanAvx2<stringStops32, stringStops16, stopsString>,
+    scanAvx2<lineStops32, lineStops16, stopsLine>, lineStartsAvx2};
+#endif
+
+const ScanOps &opsFor(ScanIsa isa) {
+#if defined(__x86_64__)
+  if (isa == ScanIsa::Avx2)
+    return kAvx2;
+  if (isa == ScanIsa::Sse2)
+    return kSse2;
+#endif
+  (void)isa;
+  return kScalar;
+}
+
+ScanIsa current = detectScanIsa();
+const ScanOps *ops = &opsFor(current);
+
+} // namespace
+
+ScanIsa detectScanIsa() {
+#if defined(__x86_64__)
+  __builtin_cpu_init(); // may run before constructors that would do it
+  if (__builtin_cpu_supports("avx2"))
+    return ScanIsa::Avx2;
+  return ScanIsa::Sse2; // part of x86-64
+#else
+  return ScanIsa::Scalar;
+#endif
+}
+
+ScanIsa scanIsa() { return current; }
+
+void useScanIsa(ScanIsa isa) {
+  current = std::min(isa, detectScanIsa());
+  ops = &opsFor(current);
+}
+
+const char *scanIsaName(ScanIsa isa) {
+  switch (isa) {
+  case ScanIsa::Scalar:
+    return "scalar";
+  case ScanIsa::Sse2:
+    return "sse2";
+  case ScanIsa::Avx2:
+    return "avx2";
+  }
+  return "?";
+}
+
+const char *skipSpace(const char *p, const char *end) {
+  return ops->space(p, end);
+}
+
+const char *skipIdentifier(const char *p, const char *end) {
+  return ops->identifier(p, end);
+}
+
+const char *findStringEnd(const char *p, const char *end) {
+  return ops->stringEnd(p, end);
+}
+
+const char *findLineEnd(const char *p, const char *end) {
+  return ops->lineEnd(p, end);
+}
+
+void findLineStarts(std::string_view text, std::vector<uint32_t> &out) {
+  ops->lineStarts(text, out);
+}
+
+} // namespace tinylang
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+namespace tinylang {
+
+// Character-class scans used by the lexer, in SSE2 and AVX2 versions picked
+// at startup from what the CPU supports, with a portable fallback. Each
+// returns the first position in [p, end) that stops the scan, or `end`.
+enum class ScanIsa { Scalar, Sse2, Avx2 };
+
+ScanIsa detectScanIsa();
+// The version currently in use; detectScanIsa() unless overridden.
+ScanIsa scanIsa();
+// Switches every scan to `isa` (clamped to what the CPU supports), so
+// benchmarks can compare them. Not safe while other threads are lexing.
+void useScanIsa(ScanIsa isa);
+const char *scanIsaName(ScanIsa isa);
+
+// Stops at the first character that isspace() rejects.
+const char *skipSpace(const char *p, const char *end);
+// Stops at the first character that is not a letter, digit or '_'.
+const char *skipIdentifier(const char *p, const char *end);
+// Stops at the first '"' or NUL.
+const char *findStringEnd(const char *p, const char *end);
+// Stops at the first '\n' or NUL.
+const char *findLineEnd(const char *p, const char *end);
+// Appends the offset just past every '\n' in `text`.
+void findLineStarts(std::string_view text, std::vector<uint32_t> &out);
+
+} // namespace tinylang
@@ -1,52 +1,85 @@
 #include "semantic.hpp"
+#include <algorithm>
 #include <iostream>
 
 namespace tinylang {
 
 void SemanticAnalyzer::analyze(Program &prog) {
-  // Global scope
-  enterScope();
   // Built-ins?
   // functions["print"] = 1; // Actually print is a statement in our grammar,
   // but let's handle it if it were a function But print is a Stmt, so it won't
   // appear in CallExpr unless we parse it as such, but we parse it as
   // PrintStmt.
 
-  prog.accept(*this);
-  exitScope();
+  visit(prog);
+}
+
+void SemanticAnalyzer::check(Node &decl, FunctionDeps *deps) {
+  recording = deps;
+  visit(decl);
+  recording = nullptr;
+}
+
+bool SemanticAnalyzer::holds(const FunctionDeps &deps) const {
+  const auto &globals = scopes.front();
+  for (const auto &g : deps.globals) {
+    auto it = globals.find(g.name);
+    if (it == globals.end() || it->second.type != g.type ||
+        it->second.isDefined != g.isDefined)
+      return false;
+  }
+  for (const auto &c : deps.callees) {
+    auto it = functions.find(c.name);
+    if (it == functions.end() || it->second.argCount != c.argCount ||
+        it->second.returnType != c.returnType)
+      return false;
+  }
+  return true;
 }
 
 void SemanticAnalyzer::enterScope() { scopes.push_back({}); }
 
 void SemanticAnalyzer::exitScope() { scopes.pop_back(); }
 
-void SemanticAnalyzer::declare(const std::string &name, Type type) {
+void SemanticAnalyzer::declare(Symbol name, Type type) {
   if (scopes.empty())
     return;
   auto &scope = scopes.back();
   if (scope.find(name) != scope.end()) {
-    throw SemanticError("Variable '" + name +
+    throw SemanticError("Variable '" + name.str() +
                         "' already declared in this scope.");
   }
   scope[name] = {false, type};
 }
 
-void SemanticAnalyzer::define(const std::string &name) {
+void SemanticAnalyzer::define(Symbol name) {
   if (scopes.empty())
     return;
   auto &scope = scopes.back();
   scope[name].isDefined = true;
 }
 
-SymbolInfo *SemanticAnalyzer::resolve(const std::string &name) {
+SymbolInfo *SemanticAnalyzer::resolve(Symbol name) {
   for (auto it = scopes.rbegin(); it != scopes.rend(); ++it) {
-    if (it->find(name) != it->end()) {
-      return &(*it)[name];
+    auto found = it->find(name);
+    if (found == it->end())
+      continue;
+    if (recording && it + 1 == scopes.rend()) {
+      const SymbolInfo &info = found->second;
+      auto &globals = recording->globals;
+      if (std::none_of(globals.begin(), globals.end(),
+                       [&](const auto &g) { return g.name == name; }))
+        globals.push_back({name, info.type, info.isDefined});
     }
+    return &found->second;
   }
   return nullptr;
 }
 
+void SemanticAnalyzer::visit(Node &node) {
+  dispatch(node, [this](auto &n) { visit(n); });
+}
+
 void SemanticAnalyzer::visit(IntLiteral &node) { lastType = Type::Int; }
 void SemanticAnalyzer::visit(FloatLiteral &node) { lastType = Type::Float; }
 void SemanticAnalyzer::visit(StringLiteral &node) { lastType = Type::String; }
@@ -54,20 +87,21 @@ void SemanticAnalyzer::visit(StringLiteral &node) { lastType = Type::String; }
 void SemanticAnalyzer::visit(Variable &node) {
   auto info = resolve(node.name);
   if (!info) {
-    throw SemanticError("Undefined variable '" + node.name + "'", node.line,
-                        node.col);
+    throw SemanticError("Undefined variable '" + node.name.str() + "'",
+                        node.line, node.col);
   }
   lastType = info->type;
 }
 
 void SemanticAnalyzer::visit(BinaryExpr &node) {
-  node.left->accept(*this);
+  visit(*node.left);
   Type leftType = lastType;
-  node.right->accept(*this);
+  visit(*node.right);
   Type rightType = lastType;
 
   // Type checking and inference
-  if (leftType == Type::String && rightType == Type::String && node.op == "+") {
+  if (leftType == Type::String && rightType == Type::String &&
+      node.op == BinaryOp::Add) {
     lastType = Type::String;
     return;
   }
@@ -84,8 +118,7 @@ void SemanticAnalyzer::visit(BinaryExpr &node) {
   }
 
   // Comparison operators return Int (boolean)
-  if (node.op == "==" || node.op == "!=" || node.op == "<" || node.op == ">" ||
-      node.op == "<=" || node.op == ">=") {
+  if (isComparison(node.op)) {
     lastType = Type::Int;
     return; // Valid for all types if equal?Strings? Yes.
   }
@@ -94,67 +127,75 @@ void SemanticAnalyzer::visit(BinaryExpr &node) {
 }
 
 void SemanticAnalyzer::visit(UnaryExpr &node) {
-  node.operand->accept(*this);
+  visit(*node.operand);
   // lastType remains same? ! is int. - is same type.
-  if (node.op == "!")
+  if (node.op == UnaryOp::Not)
     lastType = Type::Int;
 }
 
 void SemanticAnalyzer::visit(CallExpr &node) {
   // Built-in functions checks
-  if (node.callee == "input") {
+  if (node.callee == sym::Input) {
     lastType = Type::String;
     return;
   }
-  if (node.callee == "len") {
+  if (node.callee == sym::Len) {
     if (node.args.size() != 1)
       throw SemanticError("len() expects 1 argument", node.line, node.col);
-    node.args[0]->accept(*this);
+    visit(*node.args[0]);
     if (lastType != Type::String)
       throw SemanticError("len() expects string", node.line, node.col);
     lastType = Type::Int;
     return;
   }
 
-  if (node.callee == "int") {
+  if (node.callee == sym::Int) {
     if (node.args.size() != 1)
       throw SemanticError("int() expects 1 argument", node.line, node.col);
-    node.args[0]->accept(*this);
+    visit(*node.args[0]);
     lastType = Type::Int;
     return;
   }
 
-  if (node.callee == "float") {
+  if (node.callee == sym::Float) {
     if (node.args.size() != 1)
       throw SemanticError("float() expects 1 argument", node.line, node.col);
-    node.args[0]->accept(*this);
+    visit(*node.args[0]);
     lastType = Type::Float;
     return;
   }
 
-  if (node.callee == "substr") {
+  if (node.callee == sym::Substr) {
     if (node.args.size() != 3)
       throw SemanticError("substr() expects 3 arguments", node.line, node.col);
     for (auto &arg : node.args)
-      arg->accept(*this);
+      visit(*arg);
     lastType = Type::String;
     return;
   }
 
   for (auto &arg : node.args) {
-    arg->accept(*this);
+    visit(*arg);
   }
 
-  if (functions.find(node.callee) == functions.end()) {
-    throw SemanticError("Undefined function '" + node.callee + "'", node.line,
-                        node.col);
+  auto fn = functions.find(node.callee);
+  if (fn == functions.end()) {
+    throw SemanticError("Undefined function '" + node.callee.str() + "'",
+                        node.line, node.col);
+  }
+  if (recording) {
+    auto &callees = recording->callees;
+    if (std::none_of(callees.begin(), callees.end(),
+                     [&](const auto &c) { return c.name == node.callee; }))
+      callees.push_back(
+          {node.callee, fn->second.argCount, fn->second.returnType});
   }
   // We don't track function return types in AST yet (spec didn't add return
   // types to syntax). So we assume generic int? Or void? or 'auto'? For
   // specific requirement "seamless integration", we should assume functions
   // return something. Let's assume Unknown or Int for now to avoid breaking
   // existing `factorial` which returns Int.
-  lastType = functions[node.callee].returnType;
+  lastType = fn->second.returnType;
 
   // Default user functions return Int/unknown for now?
   if (lastType == Type::Unknown)
@@ -164,7 +205,7 @@ void SemanticAnalyzer::visit(CallExpr &node) {
 void SemanticAnalyzer::visit(VarDecl &node) {
   // Analyze init to find type
   if (node.initializer) {
-    node.initializer->accept(*this);
+    visit(*node.initializer);
   } else {
     lastType = Type::Int; // Default?
   }
@@ -175,14 +216,14 @@ void SemanticAnalyzer::visit(VarDecl &node) {
 
 void SemanticAnalyzer::visit(TypedVarDecl &node) {
   if (node.initializer) {
-    node.initializer->accept(*this);
+    visit(*node.initializer);
     // Type check logic...
   }
   // Track type
   Type t = Type::Int;
-  if (node.type == "float")
+  if (node.type == sym::Float)
     t = Type::Float;
-  else if (node.type == "string")
+  else if (node.type == sym::String)
     t = Type::String;
   // Map Array?
   // We need a better type system in semantic, but for now just map base types.
@@ -206,7 +247,7 @@ void SemanticAnalyzer::visit(TypedVarDecl &node) {
   }
 
   if (node.arraySize) {
-    node.arraySize->accept(*this);
+    visit(*node.arraySize);
     if (lastType != Type::Int)
       throw SemanticError("Array size must be integer.", node.line, node.col);
   }
@@ -215,17 +256,17 @@ void SemanticAnalyzer::visit(TypedVarDecl &node) {
 void SemanticAnalyzer::visit(ArrayAccess &node) {
   auto info = resolve(node.name);
   if (!info)
-    throw SemanticError("Undefined array '" + node.name + "'", node.line,
-                        node.col);
+    throw SemanticError("Undefined array '" + node.name.str() + "'",
+                        node.line, node.col);
 
   if (!info->isDefined) {
     // Warning? Or Error? User asked for "Undefined behavior" or warning.
     // We can print warning to stderr?
     std::cerr << "Warning: Possible read of uninitialized variable '"
-              << node.name << "'\n";
+              << node.name.str() << "'\n";
   }
 
-  node.index->accept(*this);
+  visit(*node.index);
   if (lastType != Type::Int)
     throw SemanticError("Array index must be integer.", node.line, node.col);
 
@@ -235,10 +276,11 @@ void SemanticAnalyzer::visit(ArrayAccess &node) {
 void SemanticAnalyzer::visit(AssignStmt &node) {
   auto info = resolve(node.name);
   if (!info) {
-    throw SemanticError("Assignment to undefined variable '" + node.name + "'",
+    throw SemanticError("Assignment to undefined variable '" +
+                            node.name.str() + "'",
                         node.line, node.col);
   }
-  node.value->accept(*this);
+  visit(*node.value);
   // Check assignable? info->type vs lastType?
   // TinyLang is dynamic or static with inference?
   // "let x = ..." implies inference on declaration.
@@ -250,46 +292,46 @@ void SemanticAnalyzer::visit(AssignStmt &node) {
   }
   // Check index if array assign
   if (node.index) {
-    node.index->accept(*this);
+    visit(*node.index);
     if (lastType != Type::Int)
       throw SemanticError("Array index must be integer.", node.line, node.col);
   }
 
-  node.value->accept(*this);
+  visit(*node.value);
   // Logic for type matching...
 
   define(node.name); // Mark initialized
 }
 
-void SemanticAnalyzer::visit(PrintStmt &node) { node.expr->accept(*this); }
+void SemanticAnalyzer::visit(PrintStmt &node) { visit(*node.expr); }
 
-void SemanticAnalyzer::visit(ExprStmt &node) { node.expr->accept(*this); }
+void SemanticAnalyzer::visit(ExprStmt &node) { visit(*node.expr); }
 
 void SemanticAnalyzer::visit(Block &node) {
   enterScope();
   for (auto &stmt : node.statements) {
-    stmt->accept(*this);
+    visit(*stmt);
   }
   exitScope();
 }
 
 void SemanticAnalyzer::visit(IfStmt &node) {
-  node.condition->accept(*this);
-  node.thenBranch->accept(*this);
+  visit(*node.condition);
+  visit(*node.thenBranch);
   if (node.elseBranch) {
-    node.elseBranch->accept(*this);
+    visit(*node.elseBranch);
   }
 }
 
 void SemanticAnalyzer::visit(ForStmt &node) {
   enterScope(); // For loop creates a scope for init variable
   if (node.init)
-    node.init->accept(*this);
+    visit(*node.init);
   if (node.condition)
-    node.condition->accept(*this);
+    visit(*node.condition);
   if (node.update)
-    node.update->accept(*this);
-  node.body->accept(*this);
+    visit(*node.update);
+  visit(*node.body);
   exitScope();
 }
 
@@ -300,21 +342,21 @@ void SemanticAnalyzer::visit(FuncDecl &node) {
   enterScope();
   for (const auto &param : node.params) {
     Type pType = Type::Int; // Default
-    if (param.first == "float")
+    if (param.first == sym::Float)
       pType = Type::Float;
-    if (param.first == "string")
+    if (param.first == sym::String)
       pType = Type::String;
 
     declare(param.second, pType);
     define(param.second);
   }
-  node.body->accept(*this);
+  visit(*node.body);
   exitScope();
 }
 
 void SemanticAnalyzer::visit(ReturnStmt &node) {
   if (node.value) {
-    node.value->accept(*this);
+    visit(*node.value);
   }
 }
 
@@ -329,22 +371,29 @@ void SemanticAnalyzer::visit(Program &node) {
   // Let's do two passes over top-level: 1. Collect functions. 2. Analyze
   // bodies.
 
-  // Pass 1: Collect function signatures
+  declareFunctions(node);
+
+  // Pass 2: Analyze bodies (and global stmts)
   for (const auto &decl : node.declarations) {
-    if (auto func = dynamic_cast<FuncDecl *>(decl.get())) {
+    check(*decl);
+  }
+}
+
+void SemanticAnalyzer::declareFunctions(Program &prog) {
+  // Global scope
+  enterScope();
+
+  // Pass 1: Collect function signatures
+  for (const auto &decl : prog.declarations) {
+    if (auto func = as<FuncDecl>(decl)) {
       if (functions.find(func->name) != functions.end()) {
-        throw SemanticError("Function '" + func->name + "' redefined.",
+        throw SemanticError("Function '" + func->name.str() + "' redefined.",
                             func->line, func->col);
       }
       functions[func->name] = {(int)func->params.size(),
                                Type::Int}; // Assume Int return
     }
   }
-
-  // Pass 2: Analyze bodies (and global stmts)
-  for (const auto &decl : node.declarations) {
-    decl->accept(*this);
-  }
 }
 
 } // namespace tinylang
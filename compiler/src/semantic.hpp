@@ -1,8 +1,9 @@
 #pragma once
 
 #include "ast.hpp"
-#include <map>
+#include <stdexcept>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 namespace tinylang {
@@ -22,47 +23,77 @@ struct SymbolInfo {
   Type type;
 };
 
-class SemanticAnalyzer : public ASTVisitor {
+// What checking a function relied on from outside it: the globals its body
+// refers to and the signatures of the functions it calls. A function whose
+// text and dependencies are unchanged checks the same way again.
+struct FunctionDeps {
+  struct Global {
+    Symbol name;
+    Type type;
+    bool isDefined;
+  };
+  struct Callee {
+    Symbol name;
+    int argCount;
+    Type returnType;
+  };
+  std::vector<Global> globals;
+  std::vector<Callee> callees;
+};
+
+class SemanticAnalyzer {
 public:
   void analyze(Program &prog);
 
-  void visit(IntLiteral &node) override;
-  void visit(FloatLiteral &node) override;
-  void visit(StringLiteral &node) override;
-  void visit(ArrayAccess &node) override;
-  void visit(TypedVarDecl &node) override;
-  void visit(Variable &node) override;
-  // ... others same ...
-  void visit(BinaryExpr &node) override;
-  void visit(UnaryExpr &node) override;
-  void visit(CallExpr &node) override;
-  void visit(VarDecl &node) override;
-  void visit(AssignStmt &node) override;
-  void visit(PrintStmt &node) override;
-  void visit(ExprStmt &node) override;
-  void visit(Block &node) override;
-  void visit(IfStmt &node) override;
-  void visit(ForStmt &node) override;
-  void visit(FuncDecl &node) override;
-  void visit(ReturnStmt &node) override;
-  void visit(Program &node) override;
+  // analyze() in steps, for the incremental front end: collect the function
+  // signatures, then check the top-level declarations in order. With `deps`,
+  // check() records what a function relied on.
+  void declareFunctions(Program &prog);
+  void check(Node &decl, FunctionDeps *deps = nullptr);
+  // Whether a function that relied on `deps` would check the same way at
+  // this point of the program.
+  bool holds(const FunctionDeps &deps) const;
 
 private:
-  std::vector<std::map<std::string, SymbolInfo>> scopes;
+  // One overload per node kind; visit(Node &) switches to the right one.
+  void visit(Node &node);
+  void visit(IntLiteral &node);
+  void visit(FloatLiteral &node);
+  void visit(StringLiteral &node);
+  void visit(ArrayAccess &node);
+  void visit(TypedVarDecl &node);
+  void visit(Variable &node);
+  void visit(BinaryExpr &node);
+  void visit(UnaryExpr &node);
+  void visit(CallExpr &node);
+  void visit(VarDecl &node);
+  void visit(AssignStmt &node);
+  void visit(PrintStmt &node);
+  void visit(ExprStmt &node);
+  void visit(Block &node);
+  void visit(IfStmt &node);
+  void visit(ForStmt &node);
+  void visit(FuncDecl &node);
+  void visit(ReturnStmt &node);
+  void visit(Program &node);
+
+  std::vector<std::unordered_map<Symbol, SymbolInfo>> scopes;
   struct FuncInfo {
     int argCount;
     Type returnType;
   };
-  std::map<std::string, FuncInfo> functions;
+  std::unordered_map<Symbol, FuncInfo> functions;
 
   // Helper to store last expression type for type checking
   Type lastType = Type::Unknown;
+  // Set while check() records a function's dependencies.
+  FunctionDeps *recording = nullptr;
 
   void enterScope();
   void exitScope();
-  void declare(const std::string &name, Type type);
-  void define(const std::string &name);
-  SymbolInfo *resolve(const std::string &name);
+  void declare(Symbol name, Type type);
+  void define(Symbol name);
+  SymbolInfo *resolve(Symbol name);
 };
 
 } // namespace tinylang
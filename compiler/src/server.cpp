@@ -0,0 +1,321 @@
+#include "server.hpp"
+#include "json.hpp"
+#include "pipeline.hpp"
+#include <cerrno>
+#include <condition_variable>
+#include <csignal>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace tinylang {
+
+namespace {
+
+// Upper bounds on the per-request limits: a day, and a terabyte.
+constexpr double kMaxTimeLimitMs = 24 * 3600 * 1000.0;
+constexpr double kMaxMemoryLimitMb = 1 << 20;
+
+// Fixed-size pool of threads draining a FIFO of jobs.
+class WorkerPool {
+public:
+  explicit WorkerPool(int n) {
+    for (int i = 0; i < n; ++i)
+      threads.emplace_back([this] { loop(); });
+  }
+
+  ~WorkerPool() {
+    {
+      std::lock_guard<std::mutex> lock(mu);
+      stopping = true;
+    }
+    cv.notify_all();
+    for (auto &t : threads)
+      t.join();
+  }
+
+  // False, without queueing the job, when kMaxQueuedRequests are waiting.
+  bool submit(std::function<void()> job) {
+    {
+      std::lock_guard<std::mutex> lock(mu);
+      if (jobs.size() >= kMaxQueuedRequests)
+        return false;
+      jobs.push_back(std::move(job));
+    }
+    cv.notify_one();
+    return true;
+  }
+
+private:
+  std::vector<std::thread> threads;
+  std::deque<std::function<void()>> jobs;
+  std::mutex mu;
+  std::condition_variable cv;
+  bool stopping = false;
+
+  void loop() {
+    while (true) {
+      std::function<void()> job;
+      {
+        std::unique_lock<std::mutex> lock(mu);
+        cv.wait(lock, [this] { return stopping || !jobs.empty(); });
+        // Finish queued work before exiting so no request goes unanswered.
+        if (jobs.empty())
+          return;
+        job = std::move(jobs.front());
+        jobs.pop_front();
+      }
+      job();
+    }
+  }
+};
+
+// One client stream. Responses from concurrent workers are serialized by the
+// write mutex; the fd is closed once the reader and all of its in-flight
+// requests have released their references.
+class Connection {
+public:
+  Connection(int in, int out, bool owned) : inFd(in), outFd(out), owned(owned) {}
+  ~Connection() {
+    if (owned)
+      ::close(inFd);
+  }
+
+  // Sets `tooLong` instead of filling `line` for a line longer than
+  // kMaxRequestBytes, whose bytes are discarded as they arrive.
+  bool readLine(std::string &line, bool &tooLong) {
+    tooLong = false;
+    while (true) {
+      size_t nl = buffer.find('\n', scanned);
+      if (nl != std::string::npos) {
+        tooLong = skipping || nl > kMaxRequestBytes;
+        if (!tooLong)
+          line.assign(buffer, 0, nl);
+        buffer.erase(0, nl + 1);
+        scanned = 0;
+        skipping = false;
+        return true;
+      }
+      if (buffer.size() > kMaxRequestBytes) {
+        buffer.clear();
+        skipping = true;
+      }
+      scanned = buffer.size();
+      char chunk[65536];
+      ssize_t n = ::read(inFd, chunk, sizeof(chunk));
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0) {
+        // Treat an unterminated final line as a request too.
+        if (skipping) {
+          skipping = false;
+          tooLong = true;
+          return true;
+        }
+        if (buffer.empty())
+          return false;
+        line.swap(buffer);
+        buffer.clear();
+        scanned = 0;
+        return true;
+      }
+      buffer.append(chunk, (size_t)n);
+    }
+  }
+
+  void writeLine(const std::string &line) {
+    std::lock_guard<std::mutex> lock(writeMu);
+    const char *p = line.data();
+    size_t left = line.size();
+    while (left > 0) {
+      ssize_t n = ::write(outFd, p, left);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        return; // client went away; drop the response
+      p += n;
+      left -= (size_t)n;
+    }
+  }
+
+private:
+  int inFd;
+  int outFd;
+  bool owned;
+  std::string buffer;
+  size_t scanned = 0;
+  bool skipping = false; // inside a line that is too long
+  std::mutex writeMu;
+};
+
+// The response to a request turned away without being run, echoing its id
+// when `line` holds one.
+std::string rejection(const std::string &msg, const std::string &line = "") {
+  std::string idJson = "null";
+  try {
+    JsonValue req = JsonValue::parse(line);
+    if (req.has("id"))
+      idJson = req["id"].dump();
+  } catch (const JsonError &) {
+  }
+  std::ostringstream os;
+  writeJson(os, failure("request", msg), false, idJson);
+  os << '\n';
+  return os.str();
+}
+
+std::string handleRequest(const std::string &line, const ServeOptions &opts) {
+  std::string idJson = "null";
+  RunResult result;
+  try {
+    JsonValue req = JsonValue::parse(line);
+    if (req.has("id"))
+      idJson = req["id"].dump();
+    const JsonValue &options = req["options"];
+    double outputLimit =
+        options["output_limit"].asNumber((double)kDefaultOutputLimit);
+    double timeLimit =
+        options["time_limit_ms"].asNumber((double)opts.timeLimitMs);
+    double memoryLimit =
+        options["memory_limit_mb"].asNumber((double)opts.memoryLimitMb);
+    if (!req.isObject() || !req["source"].isString()) {
+      result = failure("request", "Request must be an object with a string "
+                                  "\"source\" member");
+    } else if (!(outputLimit >= 0 && outputLimit < 0x1p64)) {
+      // Also rejects NaN and infinity, which strtod() can produce.
+      result = failure("request", "\"output_limit\" must be a non-negative "
+                                  "number of bytes");
+    } else if (!(timeLimit >= 1 && timeLimit <= kMaxTimeLimitMs)) {
+      result = failure("request", "\"time_limit_ms\" must be a positive "
+                                  "number of milliseconds, at most a day");
+    } else if (!(memoryLimit >= 1 && memoryLimit <= kMaxMemoryLimitMb)) {
+      result = failure("request", "\"memory_limit_mb\" must be a positive "
+                                  "number of MiB, at most 1048576");
+    } else {
+      RunRequest run;
+      run.source = req["source"].asString();
+      run.stdinContent = req["stdin"].asString();
+      run.run = options["run"].asBool(true);
+      if (options["tiered"].asBool(false))
+        run.backend = Backend::Tiered;
+      else if (options["jit"].asBool(false))
+        run.backend = Backend::Jit;
+      else if (options["vm"].asBool(false))
+        run.backend = Backend::Vm;
+      else if (options["interpret"].asBool(false))
+        run.backend = Backend::Interpret;
+      bool cache = options["cache"].asBool(true);
+      run.cache = cache ? opts.cache : nullptr;
+      run.astCache = cache ? opts.astCache : nullptr;
+      run.phases = options["phases"].asBool(false);
+      run.outputLimit = (size_t)outputLimit;
+      run.timeLimitMs = (long)timeLimit;
+      run.memoryLimitBytes = (size_t)memoryLimit << 20;
+      run.prelude = opts.prelude;
+      result = runPipeline(run);
+    }
+  } catch (const JsonError &e) {
+    result = failure("request", std::string("Malformed JSON: ") + e.what(), 1,
+                     (int)e.offset + 1);
+  }
+
+  std::ostringstream os;
+  writeJson(os, result, false, idJson);
+  os << '\n';
+  return os.str();
+}
+
+void serveConnection(std::shared_ptr<Connection> conn, WorkerPool &pool,
+                     const ServeOptions &opts) {
+  std::string line;
+  bool tooLong;
+  while (conn->readLine(line, tooLong)) {
+    if (tooLong) {
+      conn->writeLine(rejection("Request exceeds " +
+                                std::to_string(kMaxRequestBytes) + " bytes"));
+      continue;
+    }
+    if (line.find_first_not_of(" \t\r") == std::string::npos)
+      continue;
+    bool queued = pool.submit([conn, line, opts] {
+      conn->writeLine(handleRequest(line, opts));
+    });
+    if (!queued)
+      conn->writeLine(rejection("Server busy: " +
+                                std::to_string(kMaxQueuedRequests) +
+                                " requests are already waiting",
+                                line));
+  }
+}
+
+} // namespace
+
+int serve(const ServeOptions &opts) {
+  // A client disconnecting mid-response must not kill the daemon.
+  std::signal(SIGPIPE, SIG_IGN);
+
+  int workers = opts.workers > 0 ? opts.workers
+                                 : (int)std::thread::hardware_concurrency();
+  if (workers <= 0)
+    workers = 1;
+
+  if (opts.socketPath.empty()) {
+    WorkerPool pool(workers);
+    auto conn = std::make_shared<Connection>(STDIN_FILENO, STDOUT_FILENO,
+                                             false);
+    serveConnection(std::move(conn), pool, opts);
+    return 0; // ~WorkerPool drains the remaining requests
+  }
+
+  sockaddr_un addr{};
+  addr.sun_family = AF_UNIX;
+  if (opts.socketPath.size() >= sizeof(addr.sun_path)) {
+    std::cerr << "Socket path too long: " << opts.socketPath << std::endl;
+    return 1;
+  }
+  std::strcpy(addr.sun_path, opts.socketPath.c_str());
+
+  int listenFd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (listenFd < 0) {
+    std::cerr << "socket: " << std::strerror(errno) << std::endl;
+    return 1;
+  }
+  ::unlink(opts.socketPath.c_str());
+  if (::bind(listenFd, (sockaddr *)&addr, sizeof(addr)) != 0 ||
+      ::listen(listenFd, 64) != 0) {
+    std::cerr << "Could not listen on " << opts.socketPath << ": "
+              << std::strerror(errno) << std::endl;
+    ::close(listenFd);
+    return 1;
+  }
+
+  // Connection threads are detached and may outlive this frame, so the pool
+  // is deliberately never destroyed in socket mode.
+  WorkerPool &pool = *new WorkerPool(workers);
+  while (true) {
+    int fd = ::accept4(listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+    if (fd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED)
+        continue;
+      std::cerr << "accept: " << std::strerror(errno) << std::endl;
+      break;
+    }
+    auto conn = std::make_shared<Connection>(fd, fd, true);
+    std::thread([conn, &pool, opts] {
+      serveConnection(conn, pool, opts);
+    }).detach();
+  }
+  ::close(listenFd);
+  return 1;
+}
+
+} // namespace tinylang
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+namespace tinylang {
+
+class AstCache;
+class BinaryCache;
+class PrecompiledPrelude;
+
+constexpr size_t kMaxRequestBytes = size_t(64) << 20;
+constexpr size_t kMaxQueuedRequests = 1024;
+
+struct ServeOptions {
+  // Listen on this Unix domain socket; empty means serve stdin/stdout.
+  std::string socketPath;
+  // Worker threads compiling/running requests; 0 picks the core count.
+  int workers = 0;
+  BinaryCache *cache = nullptr;
+  AstCache *astCache = nullptr;
+  PrecompiledPrelude *prelude = nullptr;
+  // Limits on running a program when the request sets none.
+  long timeLimitMs = 5000;
+  long memoryLimitMb = 256;
+};
+
+// Long-lived compiler daemon speaking newline-delimited JSON.
+//
+// Each request is one line:
+//   {"id": <any>, "source": "...", "stdin": "...",
+//    "options": {"run": true, "cache": true, "interpret": false,
+//                "vm": false, "jit": false, "tiered": false,
+//                "phases": false, "output_limit": 16777216,
+//                "time_limit_ms": 5000, "memory_limit_mb": 256}}
+// and is answered by one line carrying the same object `writeJson` produces
+// for the CLI, plus the echoed "id". Requests are processed concurrently by a
+// worker pool, so responses may arrive out of order; clients match them by id.
+// Lines longer than kMaxRequestBytes, and requests arriving while
+// kMaxQueuedRequests are waiting for a worker, are answered with a "request"
+// error without being run.
+//
+// Returns the process exit code: serving stdin ends at EOF once in-flight
+// requests have been answered; socket mode runs until killed.
+int serve(const ServeOptions &opts);
+
+} // namespace tinylang
@@ -0,0 +1,119 @@
+#include "symbol.hpp"
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace tinylang {
+
+// Names live in fixed-size chunks that never move, so str() can read them
+// without a lock: a thread only holds ids whose names were stored before
+// intern() handed them out.
+class SymbolTable {
+public:
+  SymbolTable() { addPredefined(); }
+
+  uint32_t intern(std::string_view name) {
+    {
+      std::shared_lock lock(mu);
+      auto it = index.find(name);
+      if (it != index.end())
+        return it->second;
+    }
+    std::unique_lock lock(mu);
+    auto it = index.find(name);
+    if (it != index.end())
+      return it->second;
+    return add(name);
+  }
+
+  const std::string &name(uint32_t id) const {
+    return chunks[id / kChunkSize].load(std::memory_order_acquire)
+        [id % kChunkSize];
+  }
+
+  uint32_t size() {
+    std::shared_lock lock(mu);
+    return count;
+  }
+
+private:
+  static constexpr uint32_t kChunkSize = 4096;
+  static constexpr uint32_t kMaxChunks = 4096;
+
+  void addPredefined() {
+    for (const char *name : {"", "input", "len", "substr", "int", "float",
+                             "string", "void", "bool", "main"})
+      add(name);
+  }
+
+  // Called with `mu` held exclusively (or from the constructor).
+  uint32_t add(std::string_view name) {
+    uint32_t id = count;
+    uint32_t c = id / kChunkSize;
+    if (c == kMaxChunks)
+      throw std::length_error("too many distinct identifiers");
+    std::string *chunk = chunks[c].load(std::memory_order_relaxed);
+    if (!chunk) {
+      owned[c] = std::make_unique<std::string[]>(kChunkSize);
+      chunk = owned[c].get();
+      chunks[c].store(chunk, std::memory_order_release);
+    }
+    chunk[id % kChunkSize] = name;
+    index.emplace(chunk[id % kChunkSize], id);
+    ++count;
+    return id;
+  }
+
+  std::shared_mutex mu;
+  std::unordered_map<std::string_view, uint32_t> index;
+  uint32_t count = 0;
+  std::atomic<std::string *> chunks[kMaxChunks] = {};
+  std::unique_ptr<std::string[]> owned[kMaxChunks];
+};
+
+namespace {
+
+// Past this many names, new scopes start a fresh table.
+constexpr uint32_t kReclaimAbove = 1 << 20;
+
+// The table new scopes join. Each scope keeps its own alive, so an old one
+// is freed as soon as the last compilation using it ends.
+std::mutex generationMu;
+std::shared_ptr<SymbolTable> generation;
+
+// The table of the innermost scope on this thread.
+thread_local SymbolTable *current = nullptr;
+
+// For symbols made outside any scope, e.g. by a benchmark driving the lexer
+// directly. Never reclaimed.
+SymbolTable &unscoped() {
+  static SymbolTable t;
+  return t;
+}
+
+SymbolTable &table() { return current ? *current : unscoped(); }
+
+} // namespace
+
+Symbol::Symbol(std::string_view name) : index(table().intern(name)) {}
+
+const std::string &Symbol::str() const { return table().name(index); }
+
+SymbolScope::SymbolScope() : outer(current) {
+  if (outer)
+    return; // nested: symbols pass between the scopes, so keep the table
+  {
+    std::lock_guard lock(generationMu);
+    if (!generation || generation->size() > kReclaimAbove)
+      generation = std::make_shared<SymbolTable>();
+    pinned = generation;
+  }
+  current = pinned.get();
+}
+
+SymbolScope::~SymbolScope() { current = outer; }
+
+} // namespace tinylang
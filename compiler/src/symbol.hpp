@@ -0,0 +1,75 @@
+#pragma once
+
+#include <compare>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+
+namespace tinylang {
+
+// An interned identifier. Every spelling maps to one id while the table
+// lives, so symbols compare and hash as integers; the lexer interns each
+// identifier once and later phases never touch its characters again except
+// to print it. Tables are shared between threads; see SymbolScope for how
+// they are reclaimed.
+class Symbol {
+public:
+  // The empty name.
+  constexpr Symbol() = default;
+  explicit Symbol(std::string_view name);
+
+  uint32_t id() const { return index; }
+  bool empty() const { return index == 0; }
+  const std::string &str() const;
+
+  bool operator==(const Symbol &) const = default;
+  auto operator<=>(const Symbol &) const = default;
+
+  // Only for the predefined symbols below.
+  static constexpr Symbol predefined(uint32_t id) { return Symbol(id, 0); }
+
+private:
+  constexpr Symbol(uint32_t id, int) : index(id) {}
+  uint32_t index = 0;
+};
+
+class SymbolTable;
+
+// Marks a compilation that holds symbols, on the constructing thread. Each
+// outermost scope joins the current table and keeps it alive until it ends;
+// once that table has grown past a bound, later scopes start a fresh one
+// and the old one is freed with the last scope using it, so no compilation
+// ever waits for another. Symbols must not be kept past the scope they were
+// made in, nor handed to another thread's scope.
+class SymbolScope {
+public:
+  SymbolScope();
+  ~SymbolScope();
+  SymbolScope(const SymbolScope &) = delete;
+  SymbolScope &operator=(const SymbolScope &) = delete;
+
+private:
+  std::shared_ptr<SymbolTable> pinned;
+  SymbolTable *outer;
+};
+
+// Names the compiler itself refers to, interned at startup in this order.
+namespace sym {
+inline constexpr Symbol Input = Symbol::predefined(1);
+inline constexpr Symbol Len = Symbol::predefined(2);
+inline constexpr Symbol Substr = Symbol::predefined(3);
+inline constexpr Symbol Int = Symbol::predefined(4);
+inline constexpr Symbol Float = Symbol::predefined(5);
+inline constexpr Symbol String = Symbol::predefined(6);
+inline constexpr Symbol Void = Symbol::predefined(7);
+inline constexpr Symbol Bool = Symbol::predefined(8);
+inline constexpr Symbol Main = Symbol::predefined(9);
+} // namespace sym
+
+} // namespace tinylang
+
+template <> struct std::hash<tinylang::Symbol> {
+  size_t operator()(tinylang::Symbol s) const noexcept { return s.id(); }
+};
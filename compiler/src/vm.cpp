@@ -0,0 +1,310 @@
+#include "vm.hpp"
+#include "vmstate.hpp"
+#include <chrono>
+#include <climits>
+#include <signal.h>
+
+namespace tinylang {
+
+namespace {
+
+struct Frame {
+  const FunctionInfo *fn;
+  Reg *base;
+  const Instr *resume; // while this frame is calling another
+  uint16_t dest;       // caller register receiving the result
+};
+
+class Vm {
+public:
+  Vm(const BcProgram &prog, std::string_view stdinData,
+     const std::atomic<bool> *preempt, size_t outputLimit)
+      : st(prog, stdinData, preempt, outputLimit) {}
+
+  ProcessResult run();
+
+private:
+  VmState st;
+  std::unique_ptr<Frame[]> frames{new Frame[kMaxCallDepth]};
+  Frame *top = nullptr; // innermost live frame
+
+  [[noreturn]] void execute();
+  void releaseFrames() {
+    for (Frame *f = top; f >= frames.get(); --f)
+      st.releaseFrame(*f->fn, f->base);
+  }
+};
+
+ProcessResult Vm::run() {
+  ProcessResult res;
+  try {
+    reportOutOfMemory(st.io, st.heap, [&] { execute(); });
+  } catch (const ProgramExit &e) {
+    releaseFrames();
+    st.io.finish(e.waitStatus, res);
+  } catch (const Preempted &) {
+    releaseFrames();
+    throw;
+  }
+  return res;
+}
+
+void Vm::execute() {
+  static const void *const labels[] = {
+#define TINYLANG_OPCODE_LABEL(name) &&op_##name,
+      TINYLANG_OPCODES(TINYLANG_OPCODE_LABEL)
+#undef TINYLANG_OPCODE_LABEL
+  };
+
+  ProgramIO &io = st.io;
+  const double *floats = st.floats;
+  Frame *fp = frames.get();
+  const FunctionInfo *fn = &st.fns[0];
+  Reg *R = st.regs.get();
+  const Reg *regsEnd = R + kRegisterSlots;
+  const Frame *framesEnd = fp + kMaxCallDepth;
+  fp->fn = fn;
+  fp->base = R;
+  for (uint16_t r : fn->refLocals)
+    R[r].s = nullptr;
+  top = fp;
+
+  const Instr *ip = fn->code;
+  Instr in;
+#define DISPATCH()                                                             \
+  do {                                                                         \
+    in = *ip++;                                                                \
+    goto *labels[(uint8_t)in.op];                                              \
+  } while (0)
+#define INT_BINARY(name, expr)                                                 \
+  op_##name : {                                                                \
+    unsigned x = (unsigned)R[in.b].i, y = (unsigned)R[in.c].i;                 \
+    R[in.a].i = (int)(expr);                                                   \
+    DISPATCH();                                                                \
+  }
+#define BINARY(name, field, op)                                                \
+  op_##name : R[in.a].field = R[in.b].field op R[in.c].field;                  \
+  DISPATCH();
+#define COMPARE(name, field, op)                                               \
+  op_##name : R[in.a].i = R[in.b].field op R[in.c].field;                      \
+  DISPATCH();
+#define BRANCH(name, op)                                                       \
+  op_##name : if (R[in.a].i op R[in.b].i) JUMP(in.shortC());                   \
+  DISPATCH();
+  // Loops poll for preemption on their back edge.
+#define JUMP(off)                                                              \
+  do {                                                                         \
+    int off_ = (off);                                                          \
+    ip += off_;                                                                \
+    if (off_ < 0)                                                              \
+      io.poll();                                                               \
+  } while (0)
+
+  DISPATCH();
+
+  // Strings, array storage and I/O.
+op_LoadStr:
+op_MoveStr:
+op_CopyArr:
+op_EqS:
+op_NeS:
+op_LtS:
+op_LeS:
+op_GtS:
+op_GeS:
+op_Concat:
+op_StrToInt:
+op_StrToFloat:
+op_Len:
+op_Substr:
+op_Input:
+op_NewArr:
+op_GetArrStr:
+op_SetArrStr:
+op_PrintInt:
+op_PrintFloat:
+op_PrintBool:
+op_PrintStr:
+op_EndLine:
+  st.execute(in, R);
+  DISPATCH();
+
+op_LoadInt:
+  R[in.a].i = in.imm();
+  DISPATCH();
+op_LoadFloat:
+  R[in.a].f = floats[in.b];
+  DISPATCH();
+op_Move:
+  R[in.a] = R[in.b];
+  DISPATCH();
+
+  // int arithmetic wraps, as it does in practice for the native binary.
+  INT_BINARY(AddI, x + y)
+  INT_BINARY(SubI, x - y)
+  INT_BINARY(MulI, x * y)
+op_AddIK:
+  R[in.a].i = (int)((unsigned)R[in.b].i + (unsigned)in.shortC());
+  DISPATCH();
+op_DivI:
+op_ModI: {
+  int x = R[in.b].i, y = R[in.c].i;
+  if (y == 0 || (x == INT_MIN && y == -1))
+    io.die(SIGFPE); // idiv traps
+  R[in.a].i = in.op == Opcode::DivI ? x / y : x % y;
+  DISPATCH();
+}
+op_NegI:
+  R[in.a].i = (int)(0u - (unsigned)R[in.b].i);
+  DISPATCH();
+op_NotI:
+  R[in.a].i = R[in.b].i == 0;
+  DISPATCH();
+
+  BINARY(AddF, f, +)
+  BINARY(SubF, f, -)
+  BINARY(MulF, f, *)
+  BINARY(DivF, f, /)
+op_NegF:
+  R[in.a].f = -R[in.b].f;
+  DISPATCH();
+op_NotF:
+  R[in.a].i = R[in.b].f == 0;
+  DISPATCH();
+
+  COMPARE(EqI, i, ==)
+  COMPARE(NeI, i, !=)
+  COMPARE(LtI, i, <)
+  COMPARE(LeI, i, <=)
+  COMPARE(GtI, i, >)
+  COMPARE(GeI, i, >=)
+  COMPARE(EqF, f, ==)
+  COMPARE(NeF, f, !=)
+  COMPARE(LtF, f, <)
+  COMPARE(LeF, f, <=)
+  COMPARE(GtF, f, >)
+  COMPARE(GeF, f, >=)
+
+op_IntToFloat:
+  R[in.a].f = R[in.b].i;
+  DISPATCH();
+op_FloatToInt:
+  R[in.a].i = truncToInt(R[in.b].f);
+  DISPATCH();
+op_IntToBool:
+  R[in.a].i = R[in.b].i != 0;
+  DISPATCH();
+op_FloatToBool:
+  R[in.a].i = R[in.b].f != 0;
+  DISPATCH();
+
+op_GetArr: {
+  ArrObj *a = R[in.b].arr;
+  int i = R[in.c].i;
+  if ((unsigned)i >= (unsigned)a->size)
+    io.indexError(i, a->size);
+  R[in.a] = a->items()[i];
+  DISPATCH();
+}
+op_SetArr: {
+  ArrObj *a = R[in.a].arr;
+  int i = R[in.b].i;
+  if ((unsigned)i >= (unsigned)a->size)
+    io.indexError(i, a->size);
+  a->items()[i] = R[in.c];
+  DISPATCH();
+}
+
+op_Jmp:
+  JUMP(in.imm());
+  DISPATCH();
+op_JmpIfZero:
+  if (R[in.a].i == 0)
+    JUMP(in.imm());
+  DISPATCH();
+op_JmpIfNotZero:
+  if (R[in.a].i != 0)
+    JUMP(in.imm());
+  DISPATCH();
+  BRANCH(BrEqI, ==)
+  BRANCH(BrNeI, !=)
+  BRANCH(BrLtI, <)
+  BRANCH(BrLeI, <=)
+  BRANCH(BrGtI, >)
+  BRANCH(BrGeI, >=)
+
+op_Call: {
+  const FunctionInfo *callee = &st.fns[in.b];
+  Reg *nb = R + fn->numRegs;
+  if (fp + 1 == framesEnd || nb + callee->numRegs > regsEnd)
+    io.die(SIGSEGV); // the native stack would have overflowed
+  io.poll();
+  // Arguments move into the callee's parameter registers.
+  Reg *args = R + in.c;
+  for (unsigned i = 0; i < callee->numParams; ++i)
+    nb[i] = args[i];
+  for (uint16_t r : callee->refParams)
+    args[r].s = nullptr;
+  for (uint16_t r : callee->refLocals)
+    nb[r].s = nullptr;
+  fp->resume = ip;
+  ++fp;
+  fp->fn = callee;
+  fp->base = nb;
+  fp->dest = in.a;
+  top = fp;
+  fn = callee;
+  R = nb;
+  ip = callee->code;
+  DISPATCH();
+}
+op_Ret:
+op_RetVoid: {
+  Reg v{};
+  Kind kind = fn->result;
+  if (in.op == Opcode::Ret) {
+    v = R[in.a];
+    if (kind == Kind::Str || kind == Kind::Array)
+      R[in.a].s = nullptr; // moved out of the frame
+  }
+  if (fp == frames.get())
+    io.exit(v.i); // run() releases main's registers
+  st.releaseFrame(*fn, R);
+  uint16_t dest = fp->dest;
+  --fp;
+  top = fp;
+  fn = fp->fn;
+  R = fp->base;
+  ip = fp->resume;
+  if (kind == Kind::Str)
+    setStr(R[dest], v.s);
+  else if (kind == Kind::Array)
+    setArr(R[dest], v.arr);
+  else if (kind != Kind::Void)
+    R[dest] = v;
+  DISPATCH();
+}
+
+#undef DISPATCH
+#undef INT_BINARY
+#undef BINARY
+#undef COMPARE
+#undef BRANCH
+#undef JUMP
+}
+
+} // namespace
+
+ProcessResult runBytecode(const BcProgram &prog, std::string_view stdinData,
+                          const std::atomic<bool> *preempt,
+                          size_t outputLimit) {
+  auto start = std::chrono::steady_clock::now();
+  ProcessResult res = Vm(prog, stdinData, preempt, outputLimit).run();
+  auto end = std::chrono::steady_clock::now();
+  res.wallMs =
+      std::chrono::duration_cast<std::chrono::milliseconds>(end - start)
+          .count();
+  return res;
+}
+
+} // namespace tinylang
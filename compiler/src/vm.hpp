@@ -0,0 +1,18 @@
+#pragma once
+
+#include "bytecode.hpp"
+#include "process.hpp"
+#include <atomic>
+#include <string_view>
+
+namespace tinylang {
+
+// Executes bytecode produced by lower(), with the same observable behaviour
+// as interpret() (see interpreter.hpp): stdout/stderr bytes, exit status,
+// runtime errors and simulated fatal signals. Throws Preempted once `preempt`
+// is set. Only the first `outputLimit` bytes of stdout are kept (0: all).
+ProcessResult runBytecode(const BcProgram &prog, std::string_view stdinData,
+                          const std::atomic<bool> *preempt = nullptr,
+                          size_t outputLimit = 0);
+
+} // namespace tinylang
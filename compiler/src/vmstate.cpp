@@ -0,0 +1,194 @@
+#include "vmstate.hpp"
+#include <climits>
+#include <signal.h>
+#include <stdexcept>
+#include <string>
+
+namespace tinylang {
+
+ArrObj *newArr(int n, Kind elem) {
+  size_t bytes = sizeof(ArrObj) + n * sizeof(Reg);
+  noteAlloc(bytes);
+  // All-zero bytes are 0, 0.0, false and the empty string.
+  auto *a = static_cast<ArrObj *>(std::calloc(1, bytes));
+  if (!a) {
+    noteFree(bytes);
+    throw std::bad_alloc();
+  }
+  a->size = n;
+  a->elem = elem;
+  return a;
+}
+
+ArrObj *copyArr(ArrObj *src) {
+  size_t bytes = sizeof(ArrObj) + src->size * sizeof(Reg);
+  noteAlloc(bytes);
+  auto *a = static_cast<ArrObj *>(std::malloc(bytes));
+  if (!a) {
+    noteFree(bytes);
+    throw std::bad_alloc();
+  }
+  std::memcpy(a, src, bytes);
+  if (a->elem == Kind::Str)
+    for (int i = 0; i < a->size; ++i)
+      retain(a->items()[i].s);
+  return a;
+}
+
+void freeArr(ArrObj *a) {
+  if (!a)
+    return;
+  if (a->elem == Kind::Str)
+    for (int i = 0; i < a->size; ++i)
+      release(a->items()[i].s);
+  noteFree(sizeof(ArrObj) + a->size * sizeof(Reg));
+  std::free(a);
+}
+
+FunctionInfo::FunctionInfo(const BcFunction &f)
+    : code(f.code.data()), numRegs(f.numRegs), numParams(f.numParams),
+      result(f.result), strRegs(f.strRegs), arrRegs(f.arrRegs) {
+  for (auto list : {&f.strRegs, &f.arrRegs})
+    for (uint16_t r : *list)
+      (r < f.numParams ? refParams : refLocals).push_back(r);
+}
+
+VmState::VmState(const BcProgram &prog, std::string_view stdinData,
+                 const std::atomic<bool> *preempt, size_t outputLimit)
+    : io(stdinData, preempt, outputLimit), floats(prog.floats.data()) {
+  for (const auto &f : prog.functions)
+    fns.emplace_back(f);
+  for (const auto &s : prog.strings)
+    strings.push_back(makeStr(s));
+}
+
+VmState::~VmState() {
+  for (StrObj *s : strings)
+    release(s);
+}
+
+void VmState::releaseFrame(const FunctionInfo &fn, Reg *base) {
+  for (uint16_t r : fn.strRegs)
+    release(base[r].s);
+  for (uint16_t r : fn.arrRegs)
+    freeArr(base[r].arr);
+}
+
+static void checkIndex(ProgramIO &io, ArrObj *a, int i) {
+  if ((unsigned)i >= (unsigned)a->size)
+    io.indexError(i, a->size);
+}
+
+void VmState::execute(const Instr &in, Reg *R) {
+  switch (in.op) {
+  case Opcode::LoadStr:
+    retain(strings[in.b]);
+    setStr(R[in.a], strings[in.b]);
+    return;
+  case Opcode::MoveStr:
+    retain(R[in.b].s);
+    setStr(R[in.a], R[in.b].s);
+    return;
+  case Opcode::CopyArr:
+    setArr(R[in.a], copyArr(R[in.b].arr));
+    return;
+  case Opcode::DivI:
+  case Opcode::ModI: {
+    int x = R[in.b].i, y = R[in.c].i;
+    if (y == 0 || (x == INT_MIN && y == -1))
+      io.die(SIGFPE); // idiv traps
+    R[in.a].i = in.op == Opcode::DivI ? x / y : x % y;
+    return;
+  }
+  case Opcode::EqS:
+  case Opcode::NeS:
+  case Opcode::LtS:
+  case Opcode::LeS:
+  case Opcode::GtS:
+  case Opcode::GeS:
+    R[in.a].i =
+        compare((BinaryOp)((int)BinaryOp::Eq + ((int)in.op - (int)Opcode::EqS)),
+                view(R[in.b].s).compare(view(R[in.c].s)), 0);
+    return;
+  case Opcode::Concat: {
+    StrObj *x = R[in.b].s, *y = R[in.c].s, *s;
+    if (!y) {
+      s = x;
+      retain(s);
+    } else if (!x) {
+      s = y;
+      retain(s);
+    } else {
+      s = newStr(x->size + y->size);
+      std::memcpy(s->data(), x->data(), x->size);
+      std::memcpy(s->data() + x->size, y->data(), y->size);
+    }
+    setStr(R[in.a], s);
+    return;
+  }
+  case Opcode::StrToInt:
+    R[in.a].i = strToInt(std::string(view(R[in.b].s)));
+    return;
+  case Opcode::StrToFloat:
+    R[in.a].f = strToFloat(std::string(view(R[in.b].s)));
+    return;
+  case Opcode::Len:
+    R[in.a].i = (int)view(R[in.b].s).size();
+    return;
+  case Opcode::Substr:
+    setStr(R[in.a],
+           makeStr(io.substr(view(R[in.b].s), R[in.c].i, R[in.c + 1].i)));
+    return;
+  case Opcode::Input:
+    setStr(R[in.a], makeStr(io.readWord()));
+    return;
+  case Opcode::NewArr: {
+    int n = R[in.b].i;
+    if (n < 0)
+      io.sizeError(n);
+    setArr(R[in.a], newArr(n, (Kind)in.x));
+    return;
+  }
+  case Opcode::GetArr:
+    checkIndex(io, R[in.b].arr, R[in.c].i);
+    R[in.a] = R[in.b].arr->items()[R[in.c].i];
+    return;
+  case Opcode::GetArrStr: {
+    checkIndex(io, R[in.b].arr, R[in.c].i);
+    StrObj *s = R[in.b].arr->items()[R[in.c].i].s;
+    retain(s);
+    setStr(R[in.a], s);
+    return;
+  }
+  case Opcode::SetArr:
+    checkIndex(io, R[in.a].arr, R[in.b].i);
+    R[in.a].arr->items()[R[in.b].i] = R[in.c];
+    return;
+  case Opcode::SetArrStr:
+    checkIndex(io, R[in.a].arr, R[in.b].i);
+    retain(R[in.c].s);
+    setStr(R[in.a].arr->items()[R[in.b].i], R[in.c].s);
+    return;
+  case Opcode::PrintInt:
+    io.writeInt(R[in.a].i);
+    return;
+  case Opcode::PrintFloat:
+    io.writeFloat(R[in.a].f);
+    return;
+  case Opcode::PrintBool:
+    io.writeBool(R[in.a].i);
+    return;
+  case Opcode::PrintStr: {
+    std::string_view v = view(R[in.a].s);
+    io.write(v.data(), v.size());
+    return;
+  }
+  case Opcode::EndLine:
+    io.endLine();
+    return;
+  default:
+    throw std::logic_error("VmState::execute: unexpected opcode");
+  }
+}
+
+} // namespace tinylang
@@ -0,0 +1,137 @@
+#pragma once
+
+#include "bytecode.hpp"
+#include "execution.hpp"
+#include "phases.hpp"
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <string_view>
+#include <vector>
+
+// Value representation and per-run state shared by the bytecode backends
+// (vm.cpp and jit.cpp). The interpreter keeps string array elements as
+// StrObj too.
+
+namespace tinylang {
+
+// Registers are preallocated once per run; pages are only touched as deep as
+// the program recurses. The call depth limit matches the interpreter's (see
+// interpreter.cpp) and reports SIGSEGV like a native stack overflow.
+constexpr size_t kRegisterSlots = size_t(1) << 22;
+constexpr size_t kMaxCallDepth = size_t(1) << 18;
+
+// Reference-counted immutable string, as in the runtime library. nullptr is
+// the empty string.
+struct StrObj {
+  long refs;
+  size_t size;
+  char *data() { return reinterpret_cast<char *>(this + 1); }
+};
+
+inline StrObj *newStr(size_t n) {
+  noteAlloc(sizeof(StrObj) + n);
+  auto *s = static_cast<StrObj *>(std::malloc(sizeof(StrObj) + n));
+  if (!s) {
+    noteFree(sizeof(StrObj) + n);
+    throw std::bad_alloc();
+  }
+  s->refs = 1;
+  s->size = n;
+  return s;
+}
+
+inline StrObj *makeStr(std::string_view v) {
+  if (v.empty())
+    return nullptr;
+  StrObj *s = newStr(v.size());
+  std::memcpy(s->data(), v.data(), v.size());
+  return s;
+}
+
+inline std::string_view view(StrObj *s) {
+  return s ? std::string_view(s->data(), s->size) : std::string_view();
+}
+inline void retain(StrObj *s) {
+  if (s)
+    ++s->refs;
+}
+inline void release(StrObj *s) {
+  if (s && --s->refs == 0) {
+    noteFree(sizeof(StrObj) + s->size);
+    std::free(s);
+  }
+}
+
+struct ArrObj;
+
+union Reg {
+  int i; // int and bool
+  double f;
+  StrObj *s;
+  ArrObj *arr;
+};
+
+// Uniquely owned by one register; copies are deep. The JIT relies on `size`
+// being at offset 0 and the items following the header.
+struct ArrObj {
+  int size;
+  Kind elem;
+  Reg *items() { return reinterpret_cast<Reg *>(this + 1); }
+};
+static_assert(sizeof(ArrObj) == 8, "array items start 8 bytes in");
+
+ArrObj *newArr(int n, Kind elem);
+ArrObj *copyArr(ArrObj *src);
+void freeArr(ArrObj *a);
+
+inline void setStr(Reg &r, StrObj *s) {
+  StrObj *old = r.s;
+  r.s = s;
+  release(old);
+}
+
+inline void setArr(Reg &r, ArrObj *a) {
+  ArrObj *old = r.arr;
+  r.arr = a;
+  freeArr(old);
+}
+
+// BcFunction with the register lists the call sequence needs.
+struct FunctionInfo {
+  explicit FunctionInfo(const BcFunction &f);
+
+  const Instr *code;
+  uint16_t numRegs;
+  uint16_t numParams;
+  Kind result;
+  std::vector<uint16_t> strRegs;
+  std::vector<uint16_t> arrRegs;
+  std::vector<uint16_t> refParams; // handed over by the caller
+  std::vector<uint16_t> refLocals; // cleared on entry
+};
+
+class VmState {
+public:
+  VmState(const BcProgram &prog, std::string_view stdinData,
+          const std::atomic<bool> *preempt, size_t outputLimit);
+  ~VmState();
+  VmState(const VmState &) = delete;
+  VmState &operator=(const VmState &) = delete;
+
+  // Executes one of the instructions that allocate, do I/O or can fail:
+  // string and array operations, printing, and the error paths of division
+  // and indexing. Throws ProgramExit when the program ends.
+  void execute(const Instr &in, Reg *R);
+  void releaseFrame(const FunctionInfo &fn, Reg *base);
+
+  HeapLimit heap{kHeapLimitBytes}; // first, so that it outlives the rest
+  ProgramIO io;
+  std::vector<FunctionInfo> fns;
+  const double *floats;
+  std::vector<StrObj *> strings;
+  std::unique_ptr<Reg[]> regs{new Reg[kRegisterSlots]};
+};
+
+} // namespace tinylang
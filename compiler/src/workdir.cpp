@@ -0,0 +1,78 @@
+#include "workdir.hpp"
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <mutex>
+#include <stdexcept>
+#include <sys/statvfs.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+namespace tinylang {
+
+static const char *kPrefix = "tinylang.";
+// A scratch directory untouched for this long belongs to a driver that died
+// without cleaning up. Nothing a live driver does takes that long between
+// writes: the source and binary are written when a run starts.
+static constexpr std::chrono::hours kOrphanAge{1};
+
+static bool usableBase(const std::string &base) {
+  struct statvfs st;
+  if (::statvfs(base.c_str(), &st) != 0)
+    return false;
+  // The compiled program is executed from the scratch directory.
+  if (st.f_flag & ST_NOEXEC)
+    return false;
+  return ::access(base.c_str(), W_OK | X_OK) == 0;
+}
+
+static std::string chooseBase() {
+  static const std::string base = [] {
+    if (usableBase("/dev/shm"))
+      return std::string("/dev/shm");
+    if (const char *env = std::getenv("TMPDIR"); env && *env && usableBase(env))
+      return std::string(env);
+    return std::string("/tmp");
+  }();
+  return base;
+}
+
+// Removes scratch directories left behind by driver processes that died.
+// Their pids cannot tell: a driver in another PID namespace may share the
+// directory, and pids are reused, so only the age of a directory counts.
+static void sweepOrphans(const std::string &base) {
+  std::string own = kPrefix + std::to_string(::getpid()) + ".";
+  auto cutoff = fs::file_time_type::clock::now() - kOrphanAge;
+  std::error_code ec;
+  for (const auto &de : fs::directory_iterator(base, ec)) {
+    std::string name = de.path().filename().string();
+    if (name.rfind(kPrefix, 0) != 0 || name.rfind(own, 0) == 0)
+      continue;
+    std::error_code timeEc;
+    auto mtime = fs::last_write_time(de.path(), timeEc);
+    if (!timeEc && mtime < cutoff && de.is_directory(timeEc)) {
+      std::error_code rmEc;
+      fs::remove_all(de.path(), rmEc);
+    }
+  }
+}
+
+ScratchDir::ScratchDir() {
+  std::string base = chooseBase();
+  static std::once_flag swept;
+  std::call_once(swept, sweepOrphans, base);
+
+  std::string tmpl =
+      base + "/" + kPrefix + std::to_string(::getpid()) + ".XXXXXX";
+  if (!::mkdtemp(tmpl.data()))
+    throw std::runtime_error("Could not create scratch directory in " + base);
+  dir = tmpl;
+}
+
+ScratchDir::~ScratchDir() {
+  std::error_code ec;
+  fs::remove_all(dir, ec);
+}
+
+} // namespace tinylang
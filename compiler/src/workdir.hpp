@@ -0,0 +1,31 @@
+#pragma once
+
+#include <string>
+
+namespace tinylang {
+
+// A private scratch directory for one compile/run, removed with everything in
+// it when the object is destroyed. Concurrent driver invocations each get
+// their own directory, so generated sources, binaries and captured output can
+// never collide.
+//
+// The directory is created on tmpfs (/dev/shm) when that is writable and not
+// mounted noexec, otherwise under $TMPDIR or /tmp. Directories are named
+// `tinylang.<pid>.XXXXXX`. Ones left behind by a process that died without
+// cleaning up (e.g. killed by a timeout) are swept when a process creates its
+// first scratch directory, once they have not been modified for an hour.
+class ScratchDir {
+public:
+  ScratchDir();
+  ~ScratchDir();
+  ScratchDir(const ScratchDir &) = delete;
+  ScratchDir &operator=(const ScratchDir &) = delete;
+
+  const std::string &path() const { return dir; }
+  std::string file(const std::string &name) const { return dir + "/" + name; }
+
+private:
+  std::string dir;
+};
+
+} // namespace tinylang
@@ -4,6 +4,7 @@ export interface RunResponse {
     stdout: string;
     stderr: string;
     exit_code: number;
+    cache_hit?: boolean;
     time_ms: number;
     message?: string;
 }
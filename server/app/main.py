@@ -24,13 +24,23 @@ app.add_middleware(
 class RunRequest(BaseModel):
     source: str
     stdin: str = ""
+    interpret: bool = False
+    vm: bool = False
+    jit: bool = False
+    tiered: bool = False
+    phases: bool = False
 
 class RunResponse(BaseModel):
     success: bool
     compile_errors: list = []
     stdout: str = ""
     stderr: str = ""
+    truncated: bool = False
     exit_code: int = 0
+    cache_hit: bool = False
+    tier: Optional[str] = None
+    usage: Optional[dict] = None
+    phases: Optional[dict] = None
     time_ms: int = 0
     message: Optional[str] = None
 
@@ -52,14 +62,29 @@ async def run_code(req: RunRequest):
     with tempfile.NamedTemporaryFile(mode='w', suffix='.tl', delete=False) as tmp:
         tmp.write(req.source)
         tmp_path = tmp.name
+    # Stdin goes through a file, which the program reads directly; a large
+    # input on the command line would hit the argument size limit.
+    with tempfile.NamedTemporaryFile(mode='w', suffix='.in', delete=False) as tmp:
+        tmp.write(req.stdin)
+        stdin_path = tmp.name
 
     try:
         # Construct command
-        # tinylang-compiler --run --file <path> --stdin <stdin>
-        # We need to pass stdin content safe? 
-        # The new driver supports --stdin argument directly.
-        
-        args = [COMPILER_PATH, "--run", "--file", tmp_path, "--stdin", req.stdin]
+        # tinylang-compiler --run --file <path> --stdin-file <path> --time-limit <ms>
+        # The driver's own time limit ends in-process runs with a JSON
+        # result well before RLIMIT_CPU would kill the driver itself.
+        args = [COMPILER_PATH, "--run", "--file", tmp_path,
+                "--stdin-file", stdin_path, "--time-limit", "2000"]
+        if req.tiered:
+            args.append("--tiered")
+        elif req.jit:
+            args.append("--jit")
+        elif req.vm:
+            args.append("--vm")
+        elif req.interpret:
+            args.append("--interpret")
+        if req.phases:
+            args.append("--phases")
         
         # Determine if we can use set_limits (Unix only)
         preexec = None
@@ -109,6 +134,8 @@ async def run_code(req: RunRequest):
     finally:
         if os.path.exists(tmp_path):
             os.remove(tmp_path)
+        if os.path.exists(stdin_path):
+            os.remove(stdin_path)
 
 @app.get("/health")
 def health():